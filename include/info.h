@@ -45,6 +45,11 @@ const char HTTP_INFO[] PROGMEM = R"rawliteral(
         <dt>RSSI</dt>
         <dd>%MY_RSSI% dBm</dd>
       </dl>
+      <h3>Elements</h3>
+      <hr>
+      <dl>
+        %ELEMENT_HEALTH%
+      </dl>
       <h3>About</h3>
       <hr>
       <dl>
@@ -42,18 +42,28 @@ const chart = Highcharts.chart('container', {
     },
     series: [{
         name: 'T',
-        data: (function() {        
-          var _d = %GRAPH_DATA%;
-          for (index = 0; index < _d.length; index++)
-          {
-            _d[index][0] = _d[index][0] * 1000;
-          }
-          return _d;
-        }()),
+        data: [],
         showInLegend: false
     }]
 });
 
+// The history so far, streamed by the API rather than put in the page
+(function() {
+  var xhr = new XMLHttpRequest();
+  xhr.onreadystatechange = function() {
+    if (this.readyState == 4 && this.status == 200) {
+      var _d = JSON.parse(this.responseText);
+      for (index = 0; index < _d.length; index++)
+      {
+        _d[index][0] = _d[index][0] * 1000;
+      }
+      chart.series[0].setData(_d);
+    }
+  };
+  xhr.open("GET", "/api/v1/history", true);
+  xhr.send();
+}());
+
 // window.addEventListener('load', getReadings);
 
 function plotTemperature(t) {
@@ -42,6 +42,8 @@
 
 #include <stdlib.h>
 
+#include "Max31855Frame.h"
+
 /**************************************************************************/
 /*!
     @brief  Instantiates a new Adafruit_MAX31855 class using software SPI.
@@ -84,24 +86,7 @@ bool Adafruit_MAX31855::begin(void) {
 */
 /**************************************************************************/
 double Adafruit_MAX31855::readInternal(void) {
-  uint32_t v;
-
-  v = spiread32();
-
-  // ignore bottom 4 bits - they're just thermocouple data
-  v >>= 4;
-
-  // pull the bottom 11 bits off
-  float internal = v & 0x7FF;
-  // check sign bit!
-  if (v & 0x800) {
-    // Convert to negative value by extending sign and casting to signed type.
-    int16_t tmp = 0xF800 | (v & 0x7FF);
-    internal = tmp;
-  }
-  internal *= 0.0625; // LSB = 0.0625 degrees
-  // Serial.print("\tInternal Temp: "); Serial.println(internal);
-  return internal;
+  return Max31855Frame::internal(spiread32());
 }
 
 /**************************************************************************/
@@ -112,40 +97,14 @@ double Adafruit_MAX31855::readInternal(void) {
 */
 /**************************************************************************/
 double Adafruit_MAX31855::readCelsius(void) {
-
-  int32_t v;
-
-  v = spiread32();
-
-  // Serial.print("0x"); Serial.println(v, HEX);
-
-  /*
-  float internal = (v >> 4) & 0x7FF;
-  internal *= 0.0625;
-  if ((v >> 4) & 0x800)
-    internal *= -1;
-  Serial.print("\tInternal Temp: "); Serial.println(internal);
-  */
-/* https://forums.adafruit.com/viewtopic.php?f=31&t=169135#p827564
+  // Converted even with a fault bit set, see readError()
+  /* https://forums.adafruit.com/viewtopic.php?f=31&t=169135#p827564
   if (v & 0x7) {
     // uh oh, a serious problem!
     return NAN;
   }
-*/
-  if (v & 0x80000000) {
-    // Negative value, drop the lower 18 bits and explicitly extend sign bits.
-    v = 0xFFFFC000 | ((v >> 18) & 0x00003FFF);
-  } else {
-    // Positive value, just drop the lower 18 bits.
-    v >>= 18;
-  }
-  // Serial.println(v, HEX);
-
-  double centigrade = v;
-
-  // LSB = 0.25 degrees C
-  centigrade *= 0.25;
-  return centigrade;
+  */
+  return Max31855Frame::celsius(spiread32());
 }
 
 /**************************************************************************/
@@ -155,7 +114,19 @@ double Adafruit_MAX31855::readCelsius(void) {
     @return The error state.
 */
 /**************************************************************************/
-uint8_t Adafruit_MAX31855::readError() { return spiread32() & 0x7; }
+uint8_t Adafruit_MAX31855::readError() {
+  return Max31855Frame::fault(spiread32());
+}
+
+/**************************************************************************/
+/*!
+    @brief  Read the whole frame, one conversion's thermocouple, internal
+            temperature and error bits, see Max31855Frame.
+
+    @return The raw 32 bit value read.
+*/
+/**************************************************************************/
+uint32_t Adafruit_MAX31855::readFrame(void) { return spiread32(); }
 
 /**************************************************************************/
 /*!
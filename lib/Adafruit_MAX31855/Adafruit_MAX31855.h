@@ -44,6 +44,7 @@ public:
   double readCelsius(void);
   double readFahrenheit(void);
   uint8_t readError();
+  uint32_t readFrame(void);
 
 private:
   Adafruit_SPIDevice spi_dev;
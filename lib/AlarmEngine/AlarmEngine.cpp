@@ -0,0 +1,332 @@
+#include "AlarmEngine.h"
+
+#include <algorithm>
+
+#include "Timebase.h"
+
+#define ALARM_MAGIC   0x4d524c41 // "ALRM"
+#define ALARM_VERSION 1
+
+struct AlarmDef {
+  const char *name;
+  AlarmSeverity severity;
+  bool latch;        // stays active until ack()
+  uint32_t onMs;     // condition held this long to raise
+  uint32_t offMs;    // and gone this long to clear
+  float raise;       // level() thresholds
+  float clear;
+  uint32_t repeatMs; // raised again within this is dropped
+};
+
+static const AlarmDef alarmDefs[ALARM_COUNT] = {
+    {"tc", ALARM_CRITICAL, false, 0, 10000, 0, 0, 60000},
+    {"tint", ALARM_WARNING, false, 0, 0, 60, 55, 300000},
+    {"safety", ALARM_CRITICAL, true, 0, 0, 0, 0, 0},
+    {"elements", ALARM_WARNING, false, 0, 0, 0, 0, 0},
+    {"plan", ALARM_WARNING, false, 0, 0, 0, 0, 0},
+    {"reset", ALARM_WARNING, false, 0, 0, 0, 0, 0},
+    {"budget", ALARM_INFO, false, 0, 0, 0, 0, 3600000},
+};
+
+static const char *severityNames[] = {"info", "warning", "critical"};
+
+AlarmEngine::AlarmEngine()
+{
+  memset(mState, 0, sizeof(mState));
+  memset(&mHeader, 0, sizeof(mHeader));
+  memset(mLog, 0, sizeof(mLog));
+  mHeader.magic   = ALARM_MAGIC;
+  mHeader.version = ALARM_VERSION;
+
+  mFs         = nullptr;
+  mPath       = nullptr;
+  mLock       = nullptr;
+  mQueueHead  = 0;
+  mQueueCount = 0;
+  mTokens     = ALARM_BURST;
+  mRefillMs   = 0;
+  mRaised     = 0;
+  mRepeated   = 0;
+  mDropped    = 0;
+}
+
+void AlarmEngine::begin(fs::FS *fs, const char *path)
+{
+  mFs   = fs;
+  mPath = path;
+  mLock = xSemaphoreCreateMutex();
+
+  File file = mFs->open(mPath, FILE_READ);
+  if (!file)
+    return;
+
+  Header h;
+  bool ok = file.read((uint8_t *)&h, sizeof(h)) == sizeof(h) &&
+            h.magic == ALARM_MAGIC && h.version == ALARM_VERSION &&
+            h.count <= ALARM_LOG && h.head < ALARM_LOG &&
+            file.read((uint8_t *)mLog, sizeof(mLog)) == sizeof(mLog);
+  file.close();
+
+  if (!ok) {
+    memset(mLog, 0, sizeof(mLog));
+    return;
+  }
+  mHeader = h;
+  // Stamped before SNTP synced on an earlier boot, this boot can't fix them
+  for (size_t i = 0; i < ALARM_LOG; i++) {
+    if (!Timebase::valid(mLog[i].ts))
+      mLog[i].ts = 0;
+  }
+}
+
+bool AlarmEngine::save()
+{
+  File file = mFs->open(mPath, FILE_WRITE);
+  if (!file)
+    return false;
+
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  bool ok = file.write((const uint8_t *)&mHeader, sizeof(mHeader)) ==
+                sizeof(mHeader) &&
+            file.write((const uint8_t *)mLog, sizeof(mLog)) == sizeof(mLog);
+  xSemaphoreGive(mLock);
+  file.close();
+  return ok;
+}
+
+const char *AlarmEngine::name(AlarmId id)
+{
+  return id < ALARM_COUNT ? alarmDefs[id].name : "?";
+}
+
+const char *AlarmEngine::severityName(AlarmSeverity severity)
+{
+  return severity <= ALARM_CRITICAL ? severityNames[severity] : "?";
+}
+
+AlarmId AlarmEngine::find(const char *name)
+{
+  for (uint8_t i = 0; i < ALARM_COUNT; i++) {
+    if (!strcmp(name, alarmDefs[i].name))
+      return (AlarmId)i;
+  }
+  return ALARM_COUNT;
+}
+
+// Under mQueueLock. When full a critical one pushes out the oldest that
+// isn't, anything else is dropped and false returned.
+bool AlarmEngine::queue(AlarmId id, bool raised, const char *msg)
+{
+  const AlarmDef &d = alarmDefs[id];
+
+  if (mQueueCount == ALARM_QUEUE) {
+    size_t i = 0;
+    if (d.severity == ALARM_CRITICAL) {
+      while (i < mQueueCount &&
+             mQueue[(mQueueHead + i) % ALARM_QUEUE].severity ==
+                 ALARM_CRITICAL)
+        i++;
+    }
+    mDropped++;
+    if (d.severity != ALARM_CRITICAL || i == mQueueCount)
+      return false;
+    // Its clear would go out alone
+    const AlarmRecord &gone = mQueue[(mQueueHead + i) % ALARM_QUEUE];
+    if (gone.raised)
+      mState[gone.id].queued = false;
+    for (; i > 0; i--)
+      mQueue[(mQueueHead + i) % ALARM_QUEUE] =
+          mQueue[(mQueueHead + i - 1) % ALARM_QUEUE];
+    mQueueHead = (mQueueHead + 1) % ALARM_QUEUE;
+    mQueueCount--;
+  }
+
+  AlarmRecord &r = mQueue[(mQueueHead + mQueueCount) % ALARM_QUEUE];
+  r.ts           = timebase.now();
+  r.id           = id;
+  r.severity     = d.severity;
+  r.raised       = raised;
+  r.reserved     = 0;
+  strlcpy(r.msg, msg, sizeof(r.msg));
+  mQueueCount++;
+  return true;
+}
+
+void AlarmEngine::raise(AlarmId id, uint32_t now, const char *msg)
+{
+  State &s = mState[id];
+  s.active = true;
+  s.acked  = false;
+  s.since  = timebase.now();
+
+  if (s.raisedMs && now - s.raisedMs < alarmDefs[id].repeatMs) {
+    mRepeated++;
+    s.queued = false;
+    return;
+  }
+  s.raisedMs = now ? now : 1;
+  mRaised++;
+  s.queued = queue(id, true, msg);
+}
+
+// Nobody was told about a suppressed raise, so nothing to take back either
+void AlarmEngine::clear(AlarmId id)
+{
+  State &s = mState[id];
+  s.active = false;
+  s.acked  = false;
+  if (s.queued)
+    queue(id, false, name(id));
+  s.queued = false;
+}
+
+void AlarmEngine::condition(AlarmId id, bool active, const char *msg)
+{
+  const AlarmDef &d = alarmDefs[id];
+  uint32_t now      = millis();
+
+  portENTER_CRITICAL(&mQueueLock);
+  State &s = mState[id];
+  if (active != s.cond) {
+    s.cond   = active;
+    s.condMs = now;
+  }
+  if (!s.active && s.cond && now - s.condMs >= d.onMs)
+    raise(id, now, msg);
+  else if (s.active && !s.cond && (!d.latch || s.acked) &&
+           now - s.condMs >= d.offMs)
+    clear(id);
+  portEXIT_CRITICAL(&mQueueLock);
+}
+
+void AlarmEngine::level(AlarmId id, float value, const char *msg)
+{
+  const AlarmDef &d = alarmDefs[id];
+  condition(id, value > (mState[id].active ? d.clear : d.raise), msg);
+}
+
+void AlarmEngine::event(AlarmId id, const char *msg)
+{
+  portENTER_CRITICAL(&mQueueLock);
+  raise(id, millis(), msg);
+  // Nothing will clear it
+  mState[id].active = false;
+  portEXIT_CRITICAL(&mQueueLock);
+}
+
+void AlarmEngine::ack(AlarmId id)
+{
+  portENTER_CRITICAL(&mQueueLock);
+  State &s = mState[id];
+  if (s.active && !s.cond)
+    clear(id);
+  else
+    s.acked = true;
+  portEXIT_CRITICAL(&mQueueLock);
+}
+
+void AlarmEngine::ackAll()
+{
+  for (uint8_t i = 0; i < ALARM_COUNT; i++)
+    ack((AlarmId)i);
+}
+
+int AlarmEngine::highest()
+{
+  int severity = -1;
+  for (uint8_t i = 0; i < ALARM_COUNT; i++) {
+    if (mState[i].active && alarmDefs[i].severity > severity)
+      severity = alarmDefs[i].severity;
+  }
+  return severity;
+}
+
+size_t AlarmEngine::service(AlarmSink sink)
+{
+  AlarmRecord out[ALARM_QUEUE];
+  size_t n     = 0;
+  uint32_t now = millis();
+
+  portENTER_CRITICAL(&mQueueLock);
+  uint32_t refill = (now - mRefillMs) / ALARM_RATE_MS;
+  if (refill > 0) {
+    mTokens   = std::min<uint32_t>(ALARM_BURST, mTokens + refill);
+    mRefillMs = now;
+  }
+  // Critical ones go out now, the rest in order as tokens allow, compacting
+  // whatever stays behind
+  size_t keep  = 0;
+  bool blocked = false;
+  for (size_t i = 0; i < mQueueCount; i++) {
+    const AlarmRecord &r = mQueue[(mQueueHead + i) % ALARM_QUEUE];
+    if (r.severity == ALARM_CRITICAL) {
+      out[n++] = r;
+    } else if (!blocked && mTokens > 0) {
+      mTokens--;
+      out[n++] = r;
+    } else {
+      blocked                                   = true;
+      mQueue[(mQueueHead + keep) % ALARM_QUEUE] = r;
+      keep++;
+    }
+  }
+  mQueueCount = keep;
+  portEXIT_CRITICAL(&mQueueLock);
+
+  if (n == 0)
+    return 0;
+
+  for (size_t i = 0; i < n; i++) {
+    out[i].ts = timebase.correct(out[i].ts);
+    sink(out[i]);
+  }
+
+  if (mLock == nullptr)
+    return n;
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  for (size_t i = 0; i < n; i++) {
+    mLog[mHeader.head] = out[i];
+    mHeader.head       = (mHeader.head + 1) % ALARM_LOG;
+    if (mHeader.count < ALARM_LOG)
+      mHeader.count++;
+  }
+  xSemaphoreGive(mLock);
+  save();
+  return n;
+}
+
+void AlarmEngine::toJson(JsonObject alarms, size_t last)
+{
+  JsonArray active = alarms.createNestedArray("active");
+  for (uint8_t i = 0; i < ALARM_COUNT; i++) {
+    const State &s = mState[i];
+    if (!s.active)
+      continue;
+    JsonArray row = active.createNestedArray();
+    row.add(alarmDefs[i].name);
+    row.add(severityNames[alarmDefs[i].severity]);
+    row.add(timebase.correct(s.since));
+    row.add(s.acked);
+  }
+
+  alarms["raised"]   = mRaised;
+  alarms["repeated"] = mRepeated;
+  alarms["dropped"]  = mDropped;
+
+  if (mLock == nullptr)
+    return;
+  JsonArray log = alarms.createNestedArray("log");
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  size_t n     = std::min<size_t>(last, mHeader.count);
+  size_t first = (mHeader.head + ALARM_LOG - n) % ALARM_LOG;
+  for (size_t i = 0; i < n; i++) {
+    const AlarmRecord &r = mLog[(first + i) % ALARM_LOG];
+    JsonArray row        = log.createNestedArray();
+    row.add(r.ts);
+    row.add(name((AlarmId)r.id));
+    row.add(severityNames[r.severity]);
+    row.add(r.raised);
+    row.add(r.msg);
+  }
+  xSemaphoreGive(mLock);
+}
@@ -0,0 +1,139 @@
+#ifndef __alarm_engine_h__
+#define __alarm_engine_h__
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <FS.h>
+
+/*
+ * Alarms: one place that decides what is worth telling and when.
+ *
+ * Each AlarmId has a fixed definition with its severity and how it raises:
+ *
+ *  - condition()  called with the current state as often as it is checked,
+ *                 raises once it held for onMs and clears once it was gone
+ *                 for offMs
+ *  - level()      the same for a value, raising above raise and clearing
+ *                 below clear so it doesn't flap around one threshold
+ *  - event()      one-shot, nothing to clear
+ *
+ * A latching alarm stays active after its condition went away until ack().
+ * The same alarm raised again within repeatMs is dropped, and so is its
+ * clear: only a raise that was queued gets a clear.
+ *
+ * Callers may be in timer or task context, they only queue. service() runs
+ * from the network task, hands queued raises and clears to the sink at most
+ * ALARM_BURST at once and then one per ALARM_RATE_MS, critical ones
+ * always, and appends them to a ring of ALARM_LOG in flash.
+ */
+
+#define ALARM_QUEUE   16
+#define ALARM_LOG     32
+#define ALARM_TEXT    40
+#define ALARM_BURST   4
+#define ALARM_RATE_MS 5000
+
+enum AlarmId : uint8_t {
+  ALARM_TC,       // thermocouple error
+  ALARM_TINT,     // controller too hot
+  ALARM_SAFETY,   // SafetyMonitor tripped
+  ALARM_ELEMENTS, // elements close to worn out
+  ALARM_PLAN,     // planned start missed
+  ALARM_RESET,    // restarted after a crash
+  ALARM_BUDGET,   // a hot path ran over its time budget
+  ALARM_COUNT,
+};
+
+enum AlarmSeverity : uint8_t {
+  ALARM_INFO,
+  ALARM_WARNING,
+  ALARM_CRITICAL,
+};
+
+struct AlarmRecord {
+  uint32_t ts; // epoch
+  uint8_t id;
+  uint8_t severity;
+  uint8_t raised; // 0 when it cleared
+  uint8_t reserved;
+  char msg[ALARM_TEXT];
+};
+
+typedef void (*AlarmSink)(const AlarmRecord &alarm);
+
+class AlarmEngine
+{
+  private:
+  struct State {
+    bool active;
+    bool cond;
+    bool acked;
+    bool queued;       // the raise went to the queue, so the clear will too
+    uint32_t condMs;   // millis() the condition last changed
+    uint32_t raisedMs; // millis() of the last raise, for repeatMs
+    uint32_t since;    // epoch it went active
+  };
+  struct Header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint32_t head;
+  };
+
+  fs::FS *mFs;
+  const char *mPath;
+  SemaphoreHandle_t mLock;
+  portMUX_TYPE mQueueLock = portMUX_INITIALIZER_UNLOCKED;
+
+  State mState[ALARM_COUNT];
+
+  AlarmRecord mQueue[ALARM_QUEUE];
+  size_t mQueueHead;
+  size_t mQueueCount;
+
+  uint8_t mTokens;
+  uint32_t mRefillMs;
+
+  Header mHeader;
+  AlarmRecord mLog[ALARM_LOG];
+
+  uint32_t mRaised;
+  uint32_t mRepeated;
+  uint32_t mDropped;
+
+  bool queue(AlarmId id, bool raised, const char *msg);
+  void raise(AlarmId id, uint32_t now, const char *msg);
+  void clear(AlarmId id);
+  bool save();
+
+  public:
+  AlarmEngine();
+  void begin(fs::FS *fs, const char *path);
+
+  void condition(AlarmId id, bool active, const char *msg);
+  void level(AlarmId id, float value, const char *msg);
+  void event(AlarmId id, const char *msg);
+  void ack(AlarmId id);
+  void ackAll();
+
+  bool active(AlarmId id) { return mState[id].active; }
+  // Highest severity active, -1 if none
+  int highest();
+
+  // From the network task, returns how many were delivered
+  size_t service(AlarmSink sink);
+
+  static const char *name(AlarmId id);
+  static const char *severityName(AlarmSeverity severity);
+  // ALARM_COUNT if there is no alarm by that name
+  static AlarmId find(const char *name);
+
+  uint32_t raised() { return mRaised; }
+  uint32_t repeated() { return mRepeated; }
+  uint32_t dropped() { return mDropped; }
+
+  // Active alarms and the newest last entries of the log, oldest first
+  void toJson(JsonObject alarms, size_t last = ALARM_LOG);
+};
+
+#endif
@@ -0,0 +1,128 @@
+#include "AllocWatch.h"
+
+AllocWatch allocWatch;
+
+static const char *pathNames[ALLOC_PATHS] = {"control", "telemetry"};
+
+// Zero before any constructor runs, malloc may get here that early
+AllocWatch::AllocWatch()
+{
+  memset(mSlots, 0, sizeof(mSlots));
+  memset(mCount, 0, sizeof(mCount));
+  memset(mLastCaller, 0, sizeof(mLastCaller));
+
+  mHook = nullptr;
+}
+
+const char *AllocWatch::name(AllocPath path)
+{
+  return path < ALLOC_PATHS ? pathNames[path] : "?";
+}
+
+void AllocWatch::enter(AllocPath path)
+{
+  TaskHandle_t me = xTaskGetCurrentTaskHandle();
+
+  for (uint8_t i = 0; i < ALLOC_TASKS; i++) {
+    if (mSlots[i].task == me) {
+      mSlots[i].depth++;
+      return;
+    }
+  }
+  for (uint8_t i = 0; i < ALLOC_TASKS; i++) {
+    TaskHandle_t none = nullptr;
+    if (__atomic_compare_exchange_n(&mSlots[i].task, &none, me, false,
+                                    __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+      mSlots[i].path   = path;
+      mSlots[i].depth  = 1;
+      mSlots[i].exempt = 0;
+      return;
+    }
+  }
+  // All slots taken, this scope goes unwatched
+}
+
+void AllocWatch::leave()
+{
+  TaskHandle_t me = xTaskGetCurrentTaskHandle();
+
+  for (uint8_t i = 0; i < ALLOC_TASKS; i++) {
+    if (mSlots[i].task != me)
+      continue;
+    if (--mSlots[i].depth == 0)
+      __atomic_store_n(&mSlots[i].task, nullptr, __ATOMIC_RELEASE);
+    return;
+  }
+}
+
+void AllocWatch::suspend()
+{
+  TaskHandle_t me = xTaskGetCurrentTaskHandle();
+
+  for (uint8_t i = 0; i < ALLOC_TASKS; i++) {
+    if (mSlots[i].task == me) {
+      mSlots[i].exempt++;
+      return;
+    }
+  }
+}
+
+void AllocWatch::resume()
+{
+  TaskHandle_t me = xTaskGetCurrentTaskHandle();
+
+  for (uint8_t i = 0; i < ALLOC_TASKS; i++) {
+    if (mSlots[i].task == me && mSlots[i].exempt) {
+      mSlots[i].exempt--;
+      return;
+    }
+  }
+}
+
+void AllocWatch::allocated(size_t size, void *caller)
+{
+  TaskHandle_t me = xTaskGetCurrentTaskHandle();
+  if (me == nullptr)
+    return;
+
+  for (uint8_t i = 0; i < ALLOC_TASKS; i++) {
+    Slot &s = mSlots[i];
+    if (s.task != me || s.depth == 0 || s.exempt || s.inHook)
+      continue;
+
+    mCount[s.path]++;
+    mLastCaller[s.path] = caller;
+    if (mHook) {
+      s.inHook = true;
+      mHook((AllocPath)s.path, size, caller);
+      s.inHook = false;
+    }
+    return;
+  }
+}
+
+#ifdef ALLOC_WATCH
+extern "C" {
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+void *__wrap_malloc(size_t size)
+{
+  allocWatch.allocated(size, __builtin_return_address(0));
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+  allocWatch.allocated(n * size, __builtin_return_address(0));
+  return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+  allocWatch.allocated(size, __builtin_return_address(0));
+  return __real_realloc(ptr, size);
+}
+}
+#endif
@@ -0,0 +1,88 @@
+#ifndef __alloc_watch_h__
+#define __alloc_watch_h__
+
+#include <Arduino.h>
+
+/*
+ * Counts heap allocations made inside paths that should not make any.
+ *
+ * An AllocScope marks the calling task as inside a path until it goes out
+ * of scope. Built with ALLOC_WATCH and the linker wrapping malloc, calloc
+ * and realloc (see platformio.ini), every allocation a marked task makes is
+ * counted against its path, the caller's address kept and the hook called,
+ * so a debug build can log or stop on the first one. Without ALLOC_WATCH
+ * the scopes cost a few instructions and nothing is counted.
+ *
+ * operator new and String both end up in malloc or realloc, so they are
+ * caught as well. The hook runs inside the allocator and must not allocate,
+ * allocations it makes anyway are not counted.
+ *
+ * Some library calls allocate and there is nothing to pool: the telemetry
+ * path hands its fixed buffers to AsyncEventSource::send() (a message
+ * object and a copy per client), AsyncMqttClient::publish() (a packet
+ * copy) and AsyncWebSocketClient::binary() (a shared buffer per frame).
+ * Those known allocators run inside an AllocExempt, which takes the call
+ * out of the enclosing scope, so what is counted is this code's own.
+ */
+
+#define ALLOC_TASKS 4 // tasks that can be inside a scope at the same time
+
+enum AllocPath : uint8_t {
+  ALLOC_CONTROL,   // scheduler pass on the control task
+  ALLOC_TELEMETRY, // publishing from the network task
+  ALLOC_PATHS,
+};
+
+typedef void (*AllocHook)(AllocPath path, size_t size, void *caller);
+
+class AllocWatch
+{
+  private:
+  struct Slot {
+    TaskHandle_t task;
+    uint8_t path;
+    uint8_t depth;
+    uint8_t exempt;
+    bool inHook;
+  };
+
+  Slot mSlots[ALLOC_TASKS];
+  uint32_t mCount[ALLOC_PATHS];
+  void *mLastCaller[ALLOC_PATHS];
+  AllocHook mHook;
+
+  public:
+  AllocWatch();
+
+  void enter(AllocPath path);
+  void leave();
+  // Out of the calling task's scope until resume(), nests
+  void suspend();
+  void resume();
+  // From the allocator wrappers
+  void allocated(size_t size, void *caller);
+
+  void hook(AllocHook hook) { mHook = hook; }
+  uint32_t count(AllocPath path) { return mCount[path]; }
+  void *lastCaller(AllocPath path) { return mLastCaller[path]; }
+  static const char *name(AllocPath path);
+};
+
+extern AllocWatch allocWatch;
+
+class AllocScope
+{
+  public:
+  AllocScope(AllocPath path) { allocWatch.enter(path); }
+  ~AllocScope() { allocWatch.leave(); }
+};
+
+// Around a known allocator inside an AllocScope
+class AllocExempt
+{
+  public:
+  AllocExempt() { allocWatch.suspend(); }
+  ~AllocExempt() { allocWatch.resume(); }
+};
+
+#endif
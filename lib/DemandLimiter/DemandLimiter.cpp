@@ -0,0 +1,126 @@
+#include "DemandLimiter.h"
+
+#include <algorithm>
+
+DemandLimiter::DemandLimiter()
+{
+  memset(mBuckets, 0, sizeof(mBuckets));
+  mCapW       = 0;
+  mWindowS    = DEMAND_WINDOW_S;
+  mBucket     = 0;
+  mMeterWh    = 0;
+  mHasMeter   = false;
+  mCycleStart = 0;
+  mDuty       = 1;
+  mLastAllow  = 0;
+  mWant       = false;
+  mWantMs     = 0;
+  mDeniedMs   = 0;
+  mDelayS     = 0;
+}
+
+bool DemandLimiter::configure(JsonVariantConst demand)
+{
+  float cap   = demand["cap"] | 0.0f;
+  int windowS = demand["win"] | DEMAND_WINDOW_S;
+  if (cap < 0 || windowS < DEMAND_CYCLE_S ||
+      windowS > DEMAND_BUCKETS * DEMAND_BUCKET_S)
+    return false;
+
+  mWindowS = windowS;
+  mCapW    = cap;
+  // Work the duty out again on the next allow()
+  mCycleStart = 0;
+  return true;
+}
+
+void DemandLimiter::toJson(JsonObject demand)
+{
+  demand["cap"] = mCapW;
+  demand["win"] = mWindowS;
+}
+
+void DemandLimiter::advance(uint32_t bucket)
+{
+  if (bucket == mBucket)
+    return;
+  uint32_t n = std::min<uint32_t>(bucket - mBucket, DEMAND_BUCKETS);
+  for (uint32_t i = 1; i <= n; i++)
+    mBuckets[(mBucket + i) % DEMAND_BUCKETS] = 0;
+  mBucket = bucket;
+}
+
+void DemandLimiter::account(float meterWh, uint32_t now)
+{
+  advance(now / 1000 / DEMAND_BUCKET_S);
+
+  // Same as the ledger, the first reading after boot is the baseline
+  if (!mHasMeter || meterWh < mMeterWh) {
+    mMeterWh  = meterWh;
+    mHasMeter = true;
+    return;
+  }
+  mBuckets[mBucket % DEMAND_BUCKETS] += meterWh - mMeterWh;
+  mMeterWh = meterWh;
+}
+
+// Buckets not advanced to yet are empty, so this doesn't have to write
+float DemandLimiter::usedWh(uint16_t seconds, uint32_t now)
+{
+  uint32_t bucket = now / 1000 / DEMAND_BUCKET_S;
+  uint32_t n      = (seconds + DEMAND_BUCKET_S - 1) / DEMAND_BUCKET_S;
+  n               = std::min<uint32_t>(n, DEMAND_BUCKETS);
+
+  float wh = 0;
+  for (uint32_t i = 0; i < n; i++) {
+    uint32_t id = bucket - i;
+    if (id <= mBucket && mBucket - id < DEMAND_BUCKETS)
+      wh += mBuckets[id % DEMAND_BUCKETS];
+  }
+  return wh;
+}
+
+bool DemandLimiter::allow(bool want, float elementW, uint32_t now)
+{
+  // The time since the last call went the way that call decided
+  if (mLastAllow && mWant) {
+    uint32_t inCycle = mLastAllow - mCycleStart;
+    mWantMs += now - mLastAllow;
+    if (mDuty < 1 && inCycle >= mDuty * DEMAND_CYCLE_S * 1000)
+      mDeniedMs += now - mLastAllow;
+  }
+  mLastAllow = now;
+  mWant      = want;
+
+  if (!enabled()) {
+    mDuty = 1;
+    return want;
+  }
+
+  if (mCycleStart == 0 || (now - mCycleStart) >= DEMAND_CYCLE_S * 1000UL) {
+    // What the window can still take once this cycle is in it
+    float budget = mCapW * mWindowS / 3600.0f;
+    budget -= usedWh(mWindowS - DEMAND_CYCLE_S, now);
+    float onS   = elementW > 0 ? budget / elementW * 3600.0f : 0;
+    mDuty       = std::min(1.0f, std::max(0.0f, onS / DEMAND_CYCLE_S));
+    mCycleStart = now;
+  }
+
+  return want && (now - mCycleStart) < mDuty * DEMAND_CYCLE_S * 1000;
+}
+
+float DemandLimiter::rampScale(uint32_t elapsedS)
+{
+  float scale = 1;
+  if (mWantMs > 0)
+    scale = 1 - std::min(1.0f, (float)mDeniedMs / mWantMs);
+  mDelayS += (1 - scale) * elapsedS;
+  mWantMs   = 0;
+  mDeniedMs = 0;
+  return scale;
+}
+
+float DemandLimiter::average()
+{
+  return usedWh(mWindowS, millis()) * 3600.0f / mWindowS;
+}
@@ -0,0 +1,86 @@
+#ifndef __demand_limiter_h__
+#define __demand_limiter_h__
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+/*
+ * Keeps the average power over a rolling window under a cap, for a kiln that
+ * shares its circuit.
+ *
+ * Metered energy is kept in DEMAND_BUCKET_S buckets. At the start of every
+ * DEMAND_CYCLE_S cycle the energy left in the window budget is turned into
+ * relay on time at the element power, and allow() lets the relay on for that
+ * share of the cycle only, time proportioning it.
+ *
+ * Whenever the controller wants heat and the cap says no, that time is
+ * counted. rampScale() tells rampRate() which share of the heat it asked for
+ * since the last call it got, so the setpoint ramp stretches instead of
+ * running away from the kiln, and the stretch adds up in delayS().
+ *
+ * account(), allow() and rampScale() run from the control task, as the
+ * scheduler's sample, control and ramp jobs, through KilnControl for the
+ * last two. configure() and the getters may be called from anywhere. The
+ * control path passes the time of the job it runs in, so a replay of a
+ * recording decides the same.
+ *
+ * The cycle is only evaluated when allow() runs, on the 6 s control ticks:
+ * a cycle starts on a tick and the relay goes off at the first tick past
+ * its on share, so on time is rounded up to 6 s steps.
+ *
+ * Settings live in /demand.txt: {"cap":3000,"win":900}, cap in W, 0 is off.
+ */
+
+#define DEMAND_BUCKET_S 30
+#define DEMAND_BUCKETS  60 // longest window, 30 min
+#define DEMAND_CYCLE_S  60
+#define DEMAND_WINDOW_S 900
+
+class DemandLimiter
+{
+  private:
+  float mCapW;
+  uint16_t mWindowS;
+
+  float mBuckets[DEMAND_BUCKETS]; // Wh
+  uint32_t mBucket;               // id of the newest bucket
+  float mMeterWh;
+  bool mHasMeter;
+
+  uint32_t mCycleStart;
+  float mDuty;
+  uint32_t mLastAllow;
+  bool mWant;
+  uint32_t mWantMs;
+  uint32_t mDeniedMs;
+  float mDelayS;
+
+  void advance(uint32_t bucket);
+  float usedWh(uint16_t seconds, uint32_t now);
+
+  public:
+  DemandLimiter();
+
+  bool configure(JsonVariantConst demand);
+  void toJson(JsonObject demand);
+  bool enabled() { return mCapW > 0; }
+
+  // now is millis()
+  void account(float meterWh, uint32_t now);
+  void account(float meterWh) { account(meterWh, millis()); }
+  // Whether the relay may be on now, given the controller wants it on or not
+  bool allow(bool want, float elementW, uint32_t now);
+  bool allow(bool want, float elementW)
+  {
+    return allow(want, elementW, millis());
+  }
+  // Share of the wanted heat allowed since the last call, 1 when not capped
+  float rampScale(uint32_t elapsedS);
+  void resetDelay() { mDelayS = 0; }
+
+  float average();
+  float duty() { return mDuty; }
+  float delayS() { return mDelayS; }
+};
+
+#endif
@@ -0,0 +1,231 @@
+#include "ElementHealth.h"
+
+#include <algorithm>
+
+#define HEALTH_MAGIC   0x4c54484b // "KHTL"
+#define HEALTH_VERSION 1
+
+ElementHealth::ElementHealth()
+{
+  memset(&mHeader, 0, sizeof(mHeader));
+  memset(mHistory, 0, sizeof(mHistory));
+  mHeader.magic   = HEALTH_MAGIC;
+  mHeader.version = HEALTH_VERSION;
+
+  mFs     = nullptr;
+  mPath   = nullptr;
+  mLock   = nullptr;
+  mActive = false;
+}
+
+void ElementHealth::begin(fs::FS *fs, const char *path)
+{
+  mFs   = fs;
+  mPath = path;
+  mLock = xSemaphoreCreateMutex();
+
+  File file = mFs->open(mPath, FILE_READ);
+  if (!file)
+    return;
+
+  Header h;
+  bool ok = file.read((uint8_t *)&h, sizeof(h)) == sizeof(h) &&
+            h.magic == HEALTH_MAGIC && h.version == HEALTH_VERSION &&
+            h.count <= HEALTH_HISTORY && h.head < HEALTH_HISTORY &&
+            file.read((uint8_t *)mHistory, sizeof(mHistory)) ==
+                sizeof(mHistory);
+  file.close();
+
+  if (ok)
+    mHeader = h;
+  else
+    memset(mHistory, 0, sizeof(mHistory));
+}
+
+bool ElementHealth::save()
+{
+  File file = mFs->open(mPath, FILE_WRITE);
+  if (!file)
+    return false;
+
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  bool ok = file.write((const uint8_t *)&mHeader, sizeof(mHeader)) ==
+                sizeof(mHeader) &&
+            file.write((const uint8_t *)mHistory, sizeof(mHistory)) ==
+                sizeof(mHistory);
+  xSemaphoreGive(mLock);
+  file.close();
+  return ok;
+}
+
+void ElementHealth::startFiring(uint32_t now, float targetRate)
+{
+  mActive     = true;
+  mStart      = now;
+  mTarget     = targetRate;
+  mWSum       = 0;
+  mWCount     = 0;
+  mLastMs     = 0;
+  mRampMs     = 0;
+  mRampOnMs   = 0;
+  mRampFromT  = NAN;
+  mRampFromMs = 0;
+  mRampToT    = NAN;
+  mRampToMs   = 0;
+}
+
+void ElementHealth::sample(bool relay, float elementW, float temp,
+                           bool finalRamp)
+{
+  if (!mActive)
+    return;
+
+  uint32_t now = millis();
+  uint32_t dt  = mLastMs ? now - mLastMs : 0;
+  mLastMs      = now;
+
+  if (relay && elementW > 0) {
+    mWSum += elementW;
+    mWCount++;
+  }
+
+  if (!finalRamp || isnan(temp))
+    return;
+  if (mRampFromMs == 0) {
+    mRampFromT  = temp;
+    mRampFromMs = now;
+  } else {
+    mRampMs += dt;
+    if (relay)
+      mRampOnMs += dt;
+  }
+  mRampToT  = temp;
+  mRampToMs = now;
+}
+
+bool ElementHealth::endFiring()
+{
+  if (!mActive || mLock == nullptr)
+    return false;
+  mActive = false;
+
+  if (mWCount == 0 || mRampMs < HEALTH_MIN_RAMP_S * 1000UL)
+    return false;
+
+  HealthRecord r;
+  r.ts     = mStart;
+  r.W      = mWSum / mWCount;
+  r.duty   = (float)mRampOnMs / mRampMs;
+  r.rate   = (mRampToT - mRampFromT) * 3600000.0f / (mRampToMs - mRampFromMs);
+  r.target = mTarget;
+
+  // Falling short at full power means more than W was needed, by how much
+  // the rate says, capped as a kiln that didn't climb says little
+  float shortfall = r.rate > 0 ? r.target / r.rate : 2;
+  r.need          = r.duty * r.W * std::min(2.0f, std::max(1.0f, shortfall));
+
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  mHistory[mHeader.head] = r;
+  mHeader.head           = (mHeader.head + 1) % HEALTH_HISTORY;
+  if (mHeader.count < HEALTH_HISTORY)
+    mHeader.count++;
+  if (mHeader.baseW == 0)
+    mHeader.baseW = r.W;
+  xSemaphoreGive(mLock);
+
+  save();
+  return true;
+}
+
+bool ElementHealth::last(HealthRecord &out)
+{
+  if (mHeader.count == 0)
+    return false;
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  out = mHistory[(mHeader.head + HEALTH_HISTORY - 1) % HEALTH_HISTORY];
+  xSemaphoreGive(mLock);
+  return true;
+}
+
+int ElementHealth::forecast()
+{
+  if (mLock == nullptr || mHeader.count < HEALTH_MIN_FIT)
+    return -1;
+
+  // Least squares W = a + b * firing, oldest first
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  size_t n     = mHeader.count;
+  size_t first = (mHeader.head + HEALTH_HISTORY - n) % HEALTH_HISTORY;
+  float sx     = 0;
+  float sy     = 0;
+  float sxx    = 0;
+  float sxy    = 0;
+  for (size_t i = 0; i < n; i++) {
+    float y = mHistory[(first + i) % HEALTH_HISTORY].W;
+    sx += i;
+    sy += y;
+    sxx += (float)i * i;
+    sxy += i * y;
+  }
+  float need = mHistory[(first + n - 1) % HEALTH_HISTORY].need;
+  xSemaphoreGive(mLock);
+
+  float b   = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+  float a   = (sy - b * sx) / n;
+  float now = a + b * (n - 1);
+
+  if (now <= need)
+    return 0;
+  if (b >= 0)
+    return -1;
+  return (int)((need - now) / b);
+}
+
+// Element power against the first firing recorded, negative as it ages
+float ElementHealth::driftPercent()
+{
+  HealthRecord r;
+  if (!last(r) || mHeader.baseW <= 0)
+    return 0;
+  return (r.W - mHeader.baseW) / mHeader.baseW * 100;
+}
+
+float ElementHealth::headroom()
+{
+  HealthRecord r;
+  if (!last(r) || r.W <= 0)
+    return 1;
+  return 1 - r.need / r.W;
+}
+
+void ElementHealth::toJson(JsonObject health)
+{
+  HealthRecord r;
+  health["n"] = mHeader.count;
+  if (!last(r))
+    return;
+
+  float dW       = driftPercent();
+  health["W"]    = r.W;
+  health["ohm"]  = HEALTH_MAINS_V * HEALTH_MAINS_V / r.W;
+  health["dW"]   = dW;
+  // R = V^2 / P, so it drifts the other way
+  health["dR"]   = (100 / (1 + dW / 100)) - 100;
+  health["need"] = r.need;
+  health["left"] = forecast();
+
+  JsonArray h = health.createNestedArray("h");
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  size_t first = (mHeader.head + HEALTH_HISTORY - mHeader.count) %
+                 HEALTH_HISTORY;
+  for (size_t i = 0; i < mHeader.count; i++) {
+    const HealthRecord &p = mHistory[(first + i) % HEALTH_HISTORY];
+    JsonArray row         = h.createNestedArray();
+    row.add(p.ts);
+    row.add((int)p.W);
+    row.add((int)(p.duty * 100));
+    row.add((int)p.rate);
+    row.add((int)p.need);
+  }
+  xSemaphoreGive(mLock);
+}
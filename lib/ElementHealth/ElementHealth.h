@@ -0,0 +1,96 @@
+#ifndef __element_health_h__
+#define __element_health_h__
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <FS.h>
+
+/*
+ * Element ageing across firings.
+ *
+ * While firing, sample() averages the element power PulseMeter measures
+ * while the relay is on and, during the final ramp, how much of the time the
+ * relay was on and how fast the kiln actually climbed. endFiring() turns that
+ * into one record, kept in a ring of HEALTH_HISTORY in flash:
+ *
+ *  - W     element power, resistance follows as HEALTH_MAINS_V^2 / W
+ *  - need  power the final ramp took, duty x W, scaled up by target / actual
+ *          rate when even full power fell short
+ *
+ * Kanthal loses power as it ages, so a least squares fit of W over the
+ * recorded firings tells how many more firings it takes until W drops under
+ * the last need, i.e. until segments[3][1] can no longer be held.
+ */
+
+#define HEALTH_HISTORY    16
+#define HEALTH_MAINS_V    230.0f
+#define HEALTH_MIN_RAMP_S 600 // shorter final ramps tell nothing
+#define HEALTH_MIN_FIT    3   // firings before forecasting
+
+struct HealthRecord {
+  uint32_t ts;  // firing start, epoch
+  float W;
+  float duty;   // relay on share in the final ramp
+  float rate;   // °C/h reached in the final ramp
+  float target; // °C/h asked for
+  float need;   // W
+};
+
+class ElementHealth
+{
+  private:
+  struct Header {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t count;
+    uint32_t head;
+    float baseW; // first firing ever recorded
+  };
+
+  fs::FS *mFs;
+  const char *mPath;
+  SemaphoreHandle_t mLock;
+
+  Header mHeader;
+  HealthRecord mHistory[HEALTH_HISTORY];
+
+  // Current firing
+  bool mActive;
+  uint32_t mStart;
+  float mTarget;
+  double mWSum;
+  uint32_t mWCount;
+  uint32_t mLastMs;
+  uint32_t mRampMs;
+  uint32_t mRampOnMs;
+  float mRampFromT;
+  uint32_t mRampFromMs;
+  float mRampToT;
+  uint32_t mRampToMs;
+
+  bool save();
+
+  public:
+  ElementHealth();
+  void begin(fs::FS *fs, const char *path);
+
+  void startFiring(uint32_t now, float targetRate);
+  // Every temperature reading while firing
+  void sample(bool relay, float elementW, float temp, bool finalRamp);
+  // Records the firing, true if it was long enough to tell anything
+  bool endFiring();
+
+  size_t count() { return mHeader.count; }
+  bool last(HealthRecord &out);
+  // Firings left until the elements fall short, -1 if there's no decline
+  // or not enough history yet
+  int forecast();
+  float driftPercent();
+  // Share of the element power the last final ramp left spare, 1 without a
+  // record, 0 or less when the elements no longer held it
+  float headroom();
+
+  void toJson(JsonObject health);
+};
+
+#endif
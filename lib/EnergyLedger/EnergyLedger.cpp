@@ -0,0 +1,327 @@
+#include "EnergyLedger.h"
+
+#include "Timebase.h"
+
+#define LEDGER_MAGIC   0x4c47524b // "KRGL"
+#define LEDGER_VERSION 2
+
+EnergyLedger::EnergyLedger(float price)
+{
+  memset(&mTotal, 0, sizeof(mTotal));
+  memset(&mFiring, 0, sizeof(mFiring));
+  memset(mTariff, 0, sizeof(mTariff));
+  mTariff[0].price = price;
+  mPeriods         = 1;
+  mPeriod          = -1;
+
+  mFs             = nullptr;
+  mPath           = nullptr;
+  mTmpPath        = nullptr;
+  mLock           = nullptr;
+  mMeterWh        = 0;
+  mHasMeter       = false;
+  mDirty          = false;
+  mUrgent         = false;
+  mLastCheckpoint = 0;
+  mCheckpoints    = 0;
+}
+
+void EnergyLedger::begin(fs::FS *fs, const char *path, const char *tmpPath)
+{
+  mFs      = fs;
+  mPath    = path;
+  mTmpPath = tmpPath;
+  mLock    = xSemaphoreCreateMutex();
+
+  if (!load(mPath) && load(mTmpPath)) {
+    // Interrupted between remove and rename, finish it
+    mFs->rename(mTmpPath, mPath);
+  }
+}
+
+bool EnergyLedger::load(const char *path)
+{
+  File file = mFs->open(path, FILE_READ);
+  if (!file)
+    return false;
+
+  Record r;
+  size_t n = file.read((uint8_t *)&r, sizeof(r));
+  file.close();
+  if (n < offsetof(Record, tariff) || r.magic != LEDGER_MAGIC)
+    return false;
+  // Version 1 had no table, its period sums can't be placed
+  bool v1 = r.version == 1 && r.size == offsetof(Record, tariff);
+  bool v2 = r.version == LEDGER_VERSION && r.size == sizeof(r) && n == r.size;
+  if (!v1 && !v2)
+    return false;
+
+  mTotal  = r.total;
+  mFiring = r.firing;
+  if (v1 || r.periods == 0 || r.periods > LEDGER_PERIODS) {
+    remap(nullptr, 0);
+  } else {
+    // The table in use until configure() brings the current one
+    memcpy(mTariff, r.tariff, sizeof(mTariff));
+    mPeriods = r.periods;
+  }
+  return true;
+}
+
+bool EnergyLedger::save()
+{
+  Record r;
+  r.magic   = LEDGER_MAGIC;
+  r.version = LEDGER_VERSION;
+  r.size    = sizeof(r);
+
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  r.total   = mTotal;
+  r.firing  = mFiring;
+  r.periods = mPeriods;
+  memcpy(r.tariff, mTariff, sizeof(r.tariff));
+  mDirty  = false;
+  mUrgent = false;
+  xSemaphoreGive(mLock);
+
+  File file = mFs->open(mTmpPath, FILE_WRITE);
+  bool ok   = file && file.write((const uint8_t *)&r, sizeof(r)) == sizeof(r);
+  if (file)
+    file.close();
+  if (ok) {
+    mFs->remove(mPath);
+    ok = mFs->rename(mTmpPath, mPath);
+  }
+
+  if (!ok) {
+    // Try again on the next service()
+    xSemaphoreTake(mLock, portMAX_DELAY);
+    mDirty = true;
+    xSemaphoreGive(mLock);
+    return false;
+  }
+  mCheckpoints++;
+  return true;
+}
+
+bool EnergyLedger::configure(JsonVariantConst tariff)
+{
+  JsonArrayConst tou = tariff["tou"];
+  if (tou.isNull() || tou.size() == 0 || tou.size() > LEDGER_PERIODS)
+    return false;
+
+  TariffPeriod table[LEDGER_PERIODS];
+  uint8_t n = 0;
+  for (JsonVariantConst p : tou) {
+    int start   = p[0] | -1;
+    float price = p[1] | -1.0f;
+    if (start < 0 || start >= 24 * 60 || price < 0 ||
+        (n && start <= table[n - 1].start))
+      return false;
+    table[n].start = start;
+    table[n].price = price;
+    n++;
+  }
+
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  TariffPeriod old[LEDGER_PERIODS];
+  uint8_t periods = mPeriods;
+  memcpy(old, mTariff, sizeof(old));
+  memcpy(mTariff, table, sizeof(table));
+  mPeriods = n;
+  mPeriod  = -1;
+  remap(old, periods);
+  xSemaphoreGive(mLock);
+  return true;
+}
+
+// Moves the period sums kept against table from over to mTariff, by start
+// minute. Caller holds mLock, or is load().
+void EnergyLedger::remap(const TariffPeriod *from, uint8_t periods)
+{
+  double total[LEDGER_PERIODS] = {0};
+  float firing[LEDGER_PERIODS] = {0};
+  bool moved                   = false;
+  for (uint8_t i = 0; i < LEDGER_PERIODS; i++) {
+    uint8_t j = 0;
+    while (j < periods && !(i < mPeriods && from[j].start == mTariff[i].start))
+      j++;
+    if (j < periods) {
+      total[i]  = mTotal.periodWh[j];
+      firing[i] = mFiring.periodWh[j];
+    }
+    moved |= total[i] != mTotal.periodWh[i] || firing[i] != mFiring.periodWh[i];
+  }
+  if (!moved)
+    return;
+  memcpy(mTotal.periodWh, total, sizeof(total));
+  memcpy(mFiring.periodWh, firing, sizeof(firing));
+  mDirty = true;
+}
+
+void EnergyLedger::tariffToJson(JsonObject tariff)
+{
+  JsonArray tou = tariff.createNestedArray("tou");
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  for (uint8_t i = 0; i < mPeriods; i++) {
+    JsonArray p = tou.createNestedArray();
+    p.add(mTariff[i].start);
+    p.add(mTariff[i].price);
+  }
+  xSemaphoreGive(mLock);
+}
+
+// Caller holds mLock
+uint8_t EnergyLedger::periodAt(uint32_t now)
+{
+  if (!Timebase::valid(now))
+    return mPeriod < 0 ? 0 : mPeriod;
+
+  time_t t = now;
+  struct tm local;
+  localtime_r(&t, &local);
+  uint16_t minute = local.tm_hour * 60 + local.tm_min;
+
+  // Before the first start is still the last period of the previous day
+  uint8_t period = mPeriods - 1;
+  for (uint8_t i = 0; i < mPeriods; i++) {
+    if (mTariff[i].start <= minute)
+      period = i;
+  }
+  mPeriod = period;
+  return period;
+}
+
+float EnergyLedger::price(uint32_t now)
+{
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  float p = mTariff[periodAt(now)].price;
+  xSemaphoreGive(mLock);
+  return p;
+}
+
+void EnergyLedger::account(float meterWh, int segment, uint32_t now)
+{
+  if (mLock == nullptr)
+    return;
+
+  // The meter restarts from 0 on boot, the first reading is the baseline
+  if (!mHasMeter || meterWh < mMeterWh) {
+    mMeterWh  = meterWh;
+    mHasMeter = true;
+    return;
+  }
+  float wh = meterWh - mMeterWh;
+  if (wh <= 0)
+    return;
+  mMeterWh = meterWh;
+
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  uint8_t period = periodAt(now);
+  float cost     = wh / 1000.0f * mTariff[period].price;
+
+  mTotal.wh += wh;
+  mTotal.cost += cost;
+  mTotal.periodWh[period] += wh;
+
+  if (mFiring.open) {
+    mFiring.wh += wh;
+    mFiring.cost += cost;
+    mFiring.periodWh[period] += wh;
+    if (segment >= 0 && segment < LEDGER_SEGMENTS)
+      mFiring.segmentWh[segment] += wh;
+  }
+  mDirty = true;
+  xSemaphoreGive(mLock);
+}
+
+void EnergyLedger::startFiring(uint32_t now, bool resume)
+{
+  if (mLock == nullptr)
+    return;
+
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  if (resume && mFiring.open) {
+    xSemaphoreGive(mLock);
+    return;
+  }
+  uint32_t id = mFiring.id + 1;
+  memset(&mFiring, 0, sizeof(mFiring));
+  mFiring.id    = id;
+  mFiring.start = Timebase::valid(now) ? now : 0;
+  mFiring.open  = true;
+  mDirty        = true;
+  mUrgent       = true;
+  xSemaphoreGive(mLock);
+}
+
+void EnergyLedger::endFiring(uint32_t now)
+{
+  if (mLock == nullptr)
+    return;
+
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  if (mFiring.open) {
+    mFiring.end  = Timebase::valid(now) ? now : 0;
+    mFiring.open = false;
+    mDirty       = true;
+    mUrgent      = true;
+  }
+  xSemaphoreGive(mLock);
+}
+
+bool EnergyLedger::service()
+{
+  uint32_t elapsed = millis() - mLastCheckpoint;
+  if (mLock == nullptr || !mDirty ||
+      (!mUrgent && elapsed < LEDGER_CHECKPOINT_S * 1000UL))
+    return false;
+
+  mLastCheckpoint = millis();
+  return save();
+}
+
+LedgerTotals EnergyLedger::total()
+{
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  LedgerTotals t = mTotal;
+  xSemaphoreGive(mLock);
+  return t;
+}
+
+LedgerFiring EnergyLedger::firing()
+{
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  LedgerFiring f = mFiring;
+  xSemaphoreGive(mLock);
+  return f;
+}
+
+void EnergyLedger::toJson(JsonObject ledger)
+{
+  LedgerTotals t = total();
+  LedgerFiring f = firing();
+
+  JsonObject tot = ledger.createNestedObject("tot");
+  tot["Wh"]      = t.wh;
+  tot["$"]       = t.cost;
+  JsonArray per  = tot.createNestedArray("per");
+  for (uint8_t i = 0; i < LEDGER_PERIODS; i++)
+    per.add(t.periodWh[i]);
+
+  JsonObject fir = ledger.createNestedObject("fir");
+  fir["id"]      = f.id;
+  fir["t0"]      = f.start;
+  fir["t1"]      = f.end;
+  fir["open"]    = f.open;
+  fir["Wh"]      = f.wh;
+  fir["$"]       = f.cost;
+  JsonArray seg  = fir.createNestedArray("seg");
+  for (uint8_t i = 0; i < LEDGER_SEGMENTS; i++)
+    seg.add(f.segmentWh[i]);
+  per = fir.createNestedArray("per");
+  for (uint8_t i = 0; i < LEDGER_PERIODS; i++)
+    per.add(f.periodWh[i]);
+
+  tariffToJson(ledger);
+}
@@ -0,0 +1,122 @@
+#ifndef __energy_ledger_h__
+#define __energy_ledger_h__
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <FS.h>
+
+/*
+ * Persistent energy and cost accounting.
+ *
+ * account() is fed the running meter total and credits the difference to the
+ * lifetime totals, to the open firing (per step when one is given) and to the
+ * time-of-use period the energy was used in, at that period's price. The
+ * ledger is checkpointed to flash by service(), at most every
+ * LEDGER_CHECKPOINT_S and right away when a firing opens or closes, so a
+ * reset loses a few minutes of energy at worst and never the firing.
+ *
+ * The tariff is a daily table of up to LEDGER_PERIODS [start minute, price
+ * per kWh] pairs in local time, each period lasting until the next one starts
+ * and the last one wrapping past midnight:
+ *   {"tou":[[0,1.2],[420,2.9],[1320,1.2]]}
+ * Energy used before the clock is synced is charged at the last known period.
+ * The per-period sums are kept by position in the table, so a new table
+ * carries a sum over only to the period starting at the same minute and
+ * starts the others from 0. Checkpoints store the table the sums belong to,
+ * begin() takes it up again until configure() replaces it.
+ *
+ * Checkpoints go to a temporary file first and are renamed over the previous
+ * one, begin() falls back to the temporary file if the rename never happened.
+ */
+
+#define LEDGER_PERIODS      4
+#define LEDGER_SEGMENTS     6
+#define LEDGER_CHECKPOINT_S 300
+
+struct TariffPeriod {
+  uint16_t start; // minutes after local midnight
+  float price;    // per kWh
+};
+
+// Lifetime sums outgrow float resolution for 0.5 Wh steps
+struct LedgerTotals {
+  double wh;
+  double cost;
+  double periodWh[LEDGER_PERIODS];
+};
+
+struct LedgerFiring {
+  uint32_t id;
+  uint32_t start; // epoch, 0 if not synced
+  uint32_t end;   // 0 while the firing is open
+  bool open;
+  float wh;
+  float cost;
+  float segmentWh[LEDGER_SEGMENTS];
+  float periodWh[LEDGER_PERIODS];
+};
+
+class EnergyLedger
+{
+  private:
+  // Flash image, bump the version when the layout changes
+  struct Record {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;
+    LedgerTotals total;
+    LedgerFiring firing;
+    TariffPeriod tariff[LEDGER_PERIODS];
+    uint8_t periods;
+  };
+
+  fs::FS *mFs;
+  const char *mPath;
+  const char *mTmpPath;
+  SemaphoreHandle_t mLock;
+
+  TariffPeriod mTariff[LEDGER_PERIODS];
+  uint8_t mPeriods;
+  int8_t mPeriod; // last known, -1 before the clock is synced
+
+  LedgerTotals mTotal;
+  LedgerFiring mFiring;
+
+  float mMeterWh;
+  bool mHasMeter;
+  bool mDirty;
+  bool mUrgent;
+  uint32_t mLastCheckpoint;
+  uint32_t mCheckpoints;
+
+  uint8_t periodAt(uint32_t now);
+  void remap(const TariffPeriod *from, uint8_t periods);
+  bool load(const char *path);
+  bool save();
+
+  public:
+  EnergyLedger(float price);
+  void begin(fs::FS *fs, const char *path, const char *tmpPath);
+
+  // false if the table is not usable, the current one is kept
+  bool configure(JsonVariantConst tariff);
+  void tariffToJson(JsonObject tariff);
+
+  // meterWh is the meter total since boot, segment < 0 outside a firing step
+  void account(float meterWh, int segment, uint32_t now);
+  // resume carries on with a firing a reset left open instead of a new one
+  void startFiring(uint32_t now, bool resume = false);
+  void endFiring(uint32_t now);
+
+  // Writes a checkpoint when due, true if it did
+  bool service();
+
+  LedgerTotals total();
+  LedgerFiring firing();
+  float price(uint32_t now);
+  uint32_t checkpoints() { return mCheckpoints; }
+
+  void toJson(JsonObject ledger);
+};
+
+#endif
@@ -0,0 +1,155 @@
+#include "FiringPlanner.h"
+
+#include <algorithm>
+
+FiringPlanner::FiringPlanner(PlanPrice price)
+{
+  mPrice    = price;
+  mSlots    = 0;
+  mDuration = 0;
+  memset(mSegments, 0, sizeof(mSegments));
+}
+
+float FiringPlanner::power(float temp, float rate, float elementW)
+{
+  float duty = PLAN_LOSS * (temp - PLAN_AMBIENT) / 1000.0f + PLAN_MASS * rate;
+  return elementW * std::min(1.0f, std::max(0.0f, duty));
+}
+
+// Energy used t seconds after the start
+void FiringPlanner::add(uint32_t t, float wh)
+{
+  uint32_t slot = t / PLAN_SLOT_S;
+  if (slot < PLAN_MAX_SLOTS)
+    mProfile[slot] += wh;
+  mSlots = std::min<uint32_t>(slot + 1, PLAN_MAX_SLOTS + 1);
+}
+
+bool FiringPlanner::profile(const int segments[4][3], float startTemp,
+                            float elementW)
+{
+  memcpy(mSegments, segments, sizeof(mSegments));
+  memset(mProfile, 0, sizeof(mProfile));
+  mSlots    = 0;
+  mDuration = 0;
+
+  // Temperature, rate in °C/h and length of each leg
+  struct Leg {
+    float from;
+    float rate;
+    uint32_t seconds;
+  } legs[4 * 2 + 1];
+  size_t n   = 0;
+  float temp = startTemp;
+
+  for (size_t i = 0; i < 4; i++) {
+    float target = segments[i][0];
+    float rate   = segments[i][1];
+    if (target > temp && rate > 0) {
+      legs[n++] = {temp, rate, (uint32_t)((target - temp) / rate * 3600)};
+      temp      = target;
+    }
+    if (segments[i][2] > 0)
+      legs[n++] = {temp, 0, (uint32_t)segments[i][2] * 60};
+  }
+  if (temp > PLAN_COOL_TO)
+    legs[n++] = {temp, -PLAN_COOL_RATE,
+                 (uint32_t)((temp - PLAN_COOL_TO) / PLAN_COOL_RATE * 3600)};
+
+  for (size_t i = 0; i < n; i++) {
+    const Leg &l = legs[i];
+    for (uint32_t t = 0; t < l.seconds; t += PLAN_STEP_S) {
+      uint32_t dt = std::min<uint32_t>(PLAN_STEP_S, l.seconds - t);
+      float at    = l.from + l.rate * (t + dt / 2.0f) / 3600.0f;
+      add(mDuration + t, power(at, l.rate, elementW) * dt / 3600.0f);
+    }
+    mDuration += l.seconds;
+  }
+
+  if (mSlots > PLAN_MAX_SLOTS) {
+    mSlots = 0;
+    return false;
+  }
+  return mSlots > 0;
+}
+
+bool FiringPlanner::quiet(uint32_t epoch, int16_t from, int16_t to)
+{
+  if (from < 0 || to < 0 || from == to)
+    return false;
+
+  time_t t = epoch;
+  struct tm local;
+  localtime_r(&t, &local);
+  int16_t minute = local.tm_hour * 60 + local.tm_min;
+
+  // Wraps past midnight when from > to, e.g. 22:00-07:00
+  if (from < to)
+    return minute >= from && minute < to;
+  return minute >= from || minute < to;
+}
+
+bool FiringPlanner::plan(uint32_t now, uint32_t deadline, int16_t quietFrom,
+                         int16_t quietTo, FiringPlan &out)
+{
+  if (mSlots == 0)
+    return false;
+
+  uint32_t begin = micros();
+  if (deadline == 0)
+    deadline = now + PLAN_HORIZON_S + mDuration;
+
+  float costNow = 0;
+  float wh      = 0;
+  // Summed as the candidates are, so equal prices tie exactly
+  for (uint16_t j = 0; j < mSlots; j++) {
+    costNow += mProfile[j] * mPrice(now + j * PLAN_SLOT_S + PLAN_SLOT_S / 2);
+    wh += mProfile[j];
+  }
+  costNow /= 1000.0f;
+
+  // Starting at once is a candidate too, the rest are on slot boundaries
+  bool found    = now + mDuration <= deadline;
+  found         = found && !quiet(now, quietFrom, quietTo);
+  uint32_t best = now;
+  float cost    = costNow;
+
+  uint32_t base = (now / PLAN_SLOT_S + 1) * PLAN_SLOT_S;
+  uint32_t last = deadline - mDuration;
+  last          = std::min<uint32_t>(last, now + PLAN_HORIZON_S);
+  if (deadline >= mDuration && last >= base) {
+    uint16_t candidates = (last - base) / PLAN_SLOT_S + 1;
+    uint16_t prices     = candidates + mSlots - 1;
+    for (uint16_t i = 0; i < prices; i++)
+      mPrices[i] = mPrice(base + i * PLAN_SLOT_S + PLAN_SLOT_S / 2);
+
+    for (uint16_t k = 0; k < candidates; k++) {
+      uint32_t start = base + k * PLAN_SLOT_S;
+      if (quiet(start, quietFrom, quietTo))
+        continue;
+
+      float c = 0;
+      for (uint16_t j = 0; j < mSlots; j++)
+        c += mProfile[j] * mPrices[k + j];
+      c /= 1000.0f;
+
+      if (!found || c < cost) {
+        found = true;
+        best  = start;
+        cost  = c;
+      }
+    }
+  }
+
+  if (!found)
+    return false;
+
+  out.start   = best;
+  out.end     = best + mDuration;
+  out.kWh     = wh / 1000.0f;
+  out.cost    = cost;
+  out.costNow = costNow;
+  out.us      = micros() - begin;
+  memcpy(out.schedule, mSegments, sizeof(out.schedule));
+  return true;
+}
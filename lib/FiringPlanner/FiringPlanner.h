@@ -0,0 +1,75 @@
+#ifndef __firing_planner_h__
+#define __firing_planner_h__
+
+#include <Arduino.h>
+
+/*
+ * Delayed start planner, picks the start time with the lowest energy cost.
+ *
+ * The schedule is turned into a predicted energy profile in PLAN_SLOT_S
+ * slots: ramps and holds follow segments[][] from the current temperature,
+ * followed by the controlled cool down to 760°C rampDown() does. The power
+ * at temperature T while heating at R °C/h is
+ *
+ *   P = Pel * min(1, LOSS * (T - ambient) / 1000 + MASS * R)
+ *
+ * LOSS being the share of element power the walls lose per 1000°C and MASS
+ * the share a 1°C/h ramp needs to heat the load and the kiln itself.
+ *
+ * Every slot boundary from now on is a candidate start. Its cost is the
+ * profile times the price of each slot it would cover, so a plan is one
+ * price lookup per slot plus a sliding dot product, a few ms on the ESP32.
+ * Candidates that finish after the deadline or start inside the quiet hours
+ * are skipped, ties go to the earliest start.
+ */
+
+#define PLAN_SLOT_S    900
+#define PLAN_MAX_SLOTS 160 // 40 h, longest firing that can be planned
+#define PLAN_HORIZON_S (48 * 3600UL)
+#define PLAN_STEP_S    60 // profile integration step
+#define PLAN_AMBIENT   20
+#define PLAN_LOSS      0.5f
+#define PLAN_MASS      0.003f
+#define PLAN_COOL_RATE 83 // °C/h, as rampDown()
+#define PLAN_COOL_TO   760
+
+// Price per kWh at a given epoch
+typedef float (*PlanPrice)(uint32_t epoch);
+
+struct FiringPlan {
+  uint32_t start;
+  uint32_t end;
+  float kWh;
+  float cost;
+  float costNow;      // if started at once
+  uint32_t us;        // time spent planning
+  int schedule[4][3]; // what it fires, as given to profile()
+};
+
+class FiringPlanner
+{
+  private:
+  PlanPrice mPrice;
+  int mSegments[4][3];
+  float mProfile[PLAN_MAX_SLOTS]; // Wh per slot
+  uint16_t mSlots;
+  uint32_t mDuration;
+  float mPrices[PLAN_MAX_SLOTS + PLAN_HORIZON_S / PLAN_SLOT_S];
+
+  float power(float temp, float rate, float elementW);
+  void add(uint32_t t, float wh);
+  bool quiet(uint32_t epoch, int16_t from, int16_t to);
+
+  public:
+  FiringPlanner(PlanPrice price);
+
+  // Predicted profile, false if the firing is longer than PLAN_MAX_SLOTS
+  bool profile(const int segments[4][3], float startTemp, float elementW);
+  uint32_t duration() { return mDuration; }
+
+  // Quiet hours are [from, to) minutes after local midnight, -1 for none
+  bool plan(uint32_t now, uint32_t deadline, int16_t quietFrom,
+            int16_t quietTo, FiringPlan &out);
+};
+
+#endif
@@ -0,0 +1,261 @@
+#include "FiringReport.h"
+
+#include <algorithm>
+#include <math.h>
+
+#define REPORT_MAGIC   0x5452464b // "KFRT"
+#define REPORT_VERSION 1
+
+FiringReport::FiringReport(const char *build)
+{
+  memset(&mHeader, 0, sizeof(mHeader));
+  memset(&mLast, 0, sizeof(mLast));
+  memset(&mBaseline, 0, sizeof(mBaseline));
+  memset(&mRun, 0, sizeof(mRun));
+  mHeader.magic   = REPORT_MAGIC;
+  mHeader.version = REPORT_VERSION;
+
+  mFs      = nullptr;
+  mPath    = nullptr;
+  mBuild   = build;
+  mActive  = false;
+  mTop     = 0;
+  mStartWh = 0;
+  mSquares = 0;
+}
+
+void FiringReport::begin(fs::FS *fs, const char *path)
+{
+  mFs   = fs;
+  mPath = path;
+
+  File file = mFs->open(mPath, FILE_READ);
+  if (!file)
+    return;
+
+  Header h;
+  FiringStats last, baseline;
+  bool ok = file.read((uint8_t *)&h, sizeof(h)) == sizeof(h) &&
+            h.magic == REPORT_MAGIC && h.version == REPORT_VERSION &&
+            file.read((uint8_t *)&last, sizeof(last)) == sizeof(last) &&
+            file.read((uint8_t *)&baseline, sizeof(baseline)) ==
+                sizeof(baseline);
+  file.close();
+  if (!ok)
+    return;
+
+  last.build[REPORT_BUILD - 1]     = '\0';
+  baseline.build[REPORT_BUILD - 1] = '\0';
+  portENTER_CRITICAL(&mLock);
+  mHeader   = h;
+  mLast     = last;
+  mBaseline = baseline;
+  portEXIT_CRITICAL(&mLock);
+}
+
+// Not from the control task, flash writes stall the core
+bool FiringReport::save()
+{
+  if (mFs == nullptr)
+    return false;
+
+  Header h;
+  FiringStats last, baseline;
+  portENTER_CRITICAL(&mLock);
+  h        = mHeader;
+  last     = mLast;
+  baseline = mBaseline;
+  portEXIT_CRITICAL(&mLock);
+
+  File file = mFs->open(mPath, FILE_WRITE);
+  if (!file)
+    return false;
+  bool ok = file.write((const uint8_t *)&h, sizeof(h)) == sizeof(h) &&
+            file.write((const uint8_t *)&last, sizeof(last)) ==
+                sizeof(last) &&
+            file.write((const uint8_t *)&baseline, sizeof(baseline)) ==
+                sizeof(baseline);
+  file.close();
+  return ok;
+}
+
+void FiringReport::startFiring(uint32_t now, float top, float Wh)
+{
+  memset(&mRun, 0, sizeof(mRun));
+  mRun.ts        = now;
+  mRun.peak      = -INFINITY;
+  mRun.overshoot = -INFINITY;
+  strlcpy(mRun.build, mBuild, sizeof(mRun.build));
+
+  mActive  = true;
+  mTop     = top;
+  mStartWh = Wh;
+  mSquares = 0;
+}
+
+void FiringReport::sample(float temp, float setpoint)
+{
+  if (!mActive || isnan(temp))
+    return;
+
+  mRun.peak = std::max(mRun.peak, temp);
+  // -9999 until the first ramp update, 0 once cooling naturally
+  if (setpoint <= 0)
+    return;
+
+  float error = temp - setpoint;
+  mSquares += error * error;
+  mRun.max = std::max(mRun.max, fabsf(error));
+  mRun.samples++;
+}
+
+void FiringReport::relay(bool on)
+{
+  if (mActive && on)
+    mRun.cycles++;
+}
+
+bool FiringReport::endFiring(uint32_t now, float Wh)
+{
+  if (!mActive)
+    return false;
+  mActive = false;
+  if (mRun.samples == 0)
+    return false;
+
+  mRun.seconds   = now - mRun.ts;
+  mRun.rms       = sqrt(mSquares / mRun.samples);
+  mRun.overshoot = mRun.peak - mTop;
+  mRun.Wh        = Wh - mStartWh;
+
+  portENTER_CRITICAL(&mLock);
+  mLast           = mRun;
+  mHeader.hasLast = true;
+  portEXIT_CRITICAL(&mLock);
+  return true;
+}
+
+bool FiringReport::last(FiringStats &out)
+{
+  portENTER_CRITICAL(&mLock);
+  bool has = mHeader.hasLast;
+  out      = mLast;
+  portEXIT_CRITICAL(&mLock);
+  return has;
+}
+
+bool FiringReport::setBaseline(JsonVariantConst stats)
+{
+  FiringStats s;
+  if (stats.isNull()) {
+    if (!last(s))
+      return false;
+  } else {
+    if (!stats["rms"].is<float>() || !stats["seconds"].is<uint32_t>())
+      return false;
+    memset(&s, 0, sizeof(s));
+    s.ts        = stats["ts"] | 0;
+    s.seconds   = stats["seconds"];
+    s.rms       = stats["rms"];
+    s.max       = stats["max"] | 0.0f;
+    s.overshoot = stats["overshoot"] | 0.0f;
+    s.peak      = stats["peak"] | 0.0f;
+    s.Wh        = stats["Wh"] | 0.0f;
+    s.cycles    = stats["cycles"] | 0;
+    s.samples   = stats["samples"] | 0;
+    strlcpy(s.build, stats["build"] | "", sizeof(s.build));
+  }
+
+  portENTER_CRITICAL(&mLock);
+  mBaseline           = s;
+  mHeader.hasBaseline = true;
+  portEXIT_CRITICAL(&mLock);
+  return true;
+}
+
+void FiringReport::statsToJson(JsonObject out, const FiringStats &s)
+{
+  out["ts"]        = s.ts;
+  out["build"]     = (char *)s.build; // char *, so it is copied
+  out["seconds"]   = s.seconds;
+  out["rms"]       = s.rms;
+  out["max"]       = s.max;
+  out["overshoot"] = s.overshoot;
+  out["peak"]      = s.peak;
+  out["Wh"]        = s.Wh;
+  out["cycles"]    = s.cycles;
+  out["samples"]   = s.samples;
+}
+
+void FiringReport::toJson(JsonObject report)
+{
+  Header h;
+  FiringStats last, baseline;
+  portENTER_CRITICAL(&mLock);
+  h        = mHeader;
+  last     = mLast;
+  baseline = mBaseline;
+  portEXIT_CRITICAL(&mLock);
+
+  if (h.hasLast)
+    statsToJson(report.createNestedObject("last"), last);
+  if (h.hasBaseline)
+    statsToJson(report.createNestedObject("baseline"), baseline);
+  if (!h.hasLast || !h.hasBaseline)
+    return;
+
+  JsonObject diff   = report.createNestedObject("diff");
+  diff["seconds"]   = (int32_t)(last.seconds - baseline.seconds);
+  diff["rms"]       = last.rms - baseline.rms;
+  diff["max"]       = last.max - baseline.max;
+  diff["overshoot"] = last.overshoot - baseline.overshoot;
+  diff["Wh"]        = last.Wh - baseline.Wh;
+  diff["cycles"]    = (int32_t)(last.cycles - baseline.cycles);
+}
+
+static const char *gauges[] = {
+    "tracking_rms_celsius", "tracking_max_celsius", "overshoot_celsius",
+    "relay_cycles",         "energy_wh",            "runtime_seconds",
+};
+
+static double gauge(const FiringStats &s, uint8_t g)
+{
+  switch (g) {
+  case 0:
+    return s.rms;
+  case 1:
+    return s.max;
+  case 2:
+    return s.overshoot;
+  case 3:
+    return s.cycles;
+  case 4:
+    return s.Wh;
+  default:
+    return s.seconds;
+  }
+}
+
+void FiringReport::print(Print &out)
+{
+  Header h;
+  FiringStats s[2];
+  portENTER_CRITICAL(&mLock);
+  h    = mHeader;
+  s[0] = mLast;
+  s[1] = mBaseline;
+  portEXIT_CRITICAL(&mLock);
+
+  const char *names[2] = {"last", "baseline"};
+  bool has[2]          = {h.hasLast != 0, h.hasBaseline != 0};
+  if (!has[0] && !has[1])
+    return;
+
+  for (uint8_t g = 0; g < sizeof(gauges) / sizeof(gauges[0]); g++) {
+    out.printf("# TYPE kiln_firing_%s gauge\n", gauges[g]);
+    for (uint8_t i = 0; i < 2; i++)
+      if (has[i])
+        out.printf("kiln_firing_%s{firing=\"%s\"} %.2f\n", gauges[g],
+                   names[i], gauge(s[i], g));
+  }
+}
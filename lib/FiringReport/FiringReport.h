@@ -0,0 +1,93 @@
+#ifndef __firing_report_h__
+#define __firing_report_h__
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <FS.h>
+
+/*
+ * How well a firing was controlled, so a change to the controller shows up
+ * as a difference in numbers rather than a feeling about the last glaze.
+ *
+ * While firing, sample() takes every filtered reading with the setpoint it
+ * was held to and relay() every switch. endFiring() reduces that to one
+ * FiringStats:
+ *
+ *  - rms, max  tracking error temp - setpoint in °C, over the readings
+ *              taken while a setpoint was set
+ *  - overshoot peak temperature above the top segment, negative when the
+ *              top was never reached
+ *  - cycles    relay switched on, each one wears the contactor
+ *  - Wh        energy from the meter, runtime from start to end of control
+ *
+ * The stats carry the firmware version that produced them. The last firing
+ * and a baseline are kept in flash; setBaseline() promotes the last firing
+ * or takes numbers from elsewhere, toJson() reports both and the change
+ * from the baseline to the last firing.
+ */
+
+#define REPORT_BUILD 16
+
+struct FiringStats {
+  uint32_t ts;      // firing start, epoch
+  uint32_t seconds; // runtime
+  float rms;        // °C
+  float max;        // °C, largest |temp - setpoint|
+  float overshoot;  // °C above the top segment
+  float peak;       // °C
+  float Wh;
+  uint32_t cycles;
+  uint32_t samples;
+  char build[REPORT_BUILD];
+};
+
+class FiringReport
+{
+  private:
+  struct Header {
+    uint32_t magic;
+    uint16_t version;
+    uint8_t hasLast;
+    uint8_t hasBaseline;
+  };
+
+  fs::FS *mFs;
+  const char *mPath;
+  const char *mBuild;
+  portMUX_TYPE mLock = portMUX_INITIALIZER_UNLOCKED;
+
+  Header mHeader;
+  FiringStats mLast;
+  FiringStats mBaseline;
+
+  // Current firing, control task only
+  bool mActive;
+  float mTop;
+  float mStartWh;
+  double mSquares;
+  FiringStats mRun;
+
+  static void statsToJson(JsonObject out, const FiringStats &s);
+
+  public:
+  FiringReport(const char *build);
+  void begin(fs::FS *fs, const char *path);
+  bool save();
+
+  // Control task, from start to end of control
+  void startFiring(uint32_t now, float top, float Wh);
+  void sample(float temp, float setpoint);
+  void relay(bool on);
+  // True when a firing was recorded, it still has to be saved
+  bool endFiring(uint32_t now, float Wh);
+
+  bool last(FiringStats &out);
+  // The last firing, or the stats in stats when given
+  bool setBaseline(JsonVariantConst stats);
+
+  void toJson(JsonObject report);
+  // Prometheus text format, kiln_firing_*
+  void print(Print &out);
+};
+
+#endif
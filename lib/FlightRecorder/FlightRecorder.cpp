@@ -0,0 +1,196 @@
+#include "FlightRecorder.h"
+
+#include <algorithm>
+
+#include "Trace.h"
+
+#define FLIGHT_MAGIC 0x464c5431u // "FLT1"
+
+struct FlightRing {
+  uint32_t magic;
+  uint32_t boots;
+  uint32_t head; // records written, the ring index is head % FLIGHT_RECORDS
+  uint8_t handler[2];
+  uint16_t reserved;
+  FlightRecord records[FLIGHT_RECORDS];
+  uint32_t check; // ~FLIGHT_MAGIC
+};
+
+// Not cleared by the startup code, survives every reset but power-on
+RTC_NOINIT_ATTR static FlightRing ring;
+
+FlightRecorder flight;
+
+static const char *reasonNames[] = {
+    "unknown",  "power on", "external",   "software", "panic", "int wdt",
+    "task wdt", "wdt",      "deep sleep", "brownout", "sdio",
+};
+
+static const char *handlerName(uint8_t handler)
+{
+  return handler < TRACE_COUNT ? Trace::name((TraceId)handler) : "-";
+}
+
+// Print into a fixed buffer, whatever does not fit is dropped
+class BufferPrint : public Print
+{
+  private:
+  char *mBuf;
+  size_t mLen;
+  size_t mPos;
+
+  public:
+  BufferPrint(char *buf, size_t len) : mBuf(buf), mLen(len), mPos(0) {}
+  size_t write(uint8_t c) override
+  {
+    if (mPos + 1 >= mLen)
+      return 0;
+    mBuf[mPos++] = c;
+    return 1;
+  }
+  size_t write(const uint8_t *data, size_t len) override
+  {
+    size_t n = std::min<size_t>(len, mLen - 1 - mPos);
+    memcpy(mBuf + mPos, data, n);
+    mPos += n;
+    return n;
+  }
+  size_t end()
+  {
+    mBuf[mPos] = '\0';
+    return mPos;
+  }
+};
+
+FlightRecorder::FlightRecorder()
+{
+  mCrash      = nullptr;
+  mCrashCount = 0;
+  mCrashBoots = 0;
+  mReason     = ESP_RST_UNKNOWN;
+
+  mCrashHandler[0] = FLIGHT_NONE;
+  mCrashHandler[1] = FLIGHT_NONE;
+}
+
+bool FlightRecorder::unexpected(esp_reset_reason_t reason)
+{
+  return reason == ESP_RST_PANIC || reason == ESP_RST_INT_WDT ||
+         reason == ESP_RST_TASK_WDT || reason == ESP_RST_WDT ||
+         reason == ESP_RST_BROWNOUT;
+}
+
+void FlightRecorder::begin(esp_reset_reason_t reason)
+{
+  mReason    = reason;
+  bool valid = ring.magic == FLIGHT_MAGIC && ring.check == ~FLIGHT_MAGIC;
+
+  if (valid && unexpected(reason)) {
+    size_t n = std::min<uint32_t>(ring.head, FLIGHT_RECORDS);
+    // Once per crash, at boot
+    mCrash = (FlightRecord *)malloc(std::max<size_t>(n, 1) *
+                                    sizeof(FlightRecord));
+    if (mCrash) {
+      uint32_t first = ring.head - n;
+      for (size_t i = 0; i < n; i++)
+        mCrash[i] = ring.records[(first + i) % FLIGHT_RECORDS];
+      mCrashCount      = n;
+      mCrashBoots      = ring.boots;
+      mCrashHandler[0] = ring.handler[0];
+      mCrashHandler[1] = ring.handler[1];
+    }
+  }
+
+  if (!valid) {
+    memset(&ring, 0, sizeof(ring));
+    ring.magic = FLIGHT_MAGIC;
+    ring.check = ~FLIGHT_MAGIC;
+  }
+  ring.boots++;
+  ring.head       = 0;
+  ring.handler[0] = FLIGHT_NONE;
+  ring.handler[1] = FLIGHT_NONE;
+}
+
+void FlightRecorder::record(uint32_t ts, float temp, float setpoint,
+                            uint8_t step, uint8_t flags)
+{
+  FlightRecord &r = ring.records[ring.head % FLIGHT_RECORDS];
+  long tenths     = isnan(temp) ? INT16_MIN : lroundf(temp * 10);
+  r.ts            = ts;
+  r.temp          = constrain(tenths, INT16_MIN, 32767);
+  r.setpoint      = constrain(lroundf(setpoint * 10), -32767, 32767);
+  r.heap          = std::min<uint32_t>(ESP.getFreeHeap() / 16, UINT16_MAX);
+  r.step          = step;
+  r.flags         = flags;
+  r.handler[0]    = ring.handler[0];
+  r.handler[1]    = ring.handler[1];
+  ring.head++;
+}
+
+uint8_t FlightRecorder::enter(uint8_t handler)
+{
+  int core           = xPortGetCoreID();
+  uint8_t previous   = ring.handler[core];
+  ring.handler[core] = handler;
+  return previous;
+}
+
+void FlightRecorder::leave(uint8_t previous)
+{
+  ring.handler[xPortGetCoreID()] = previous;
+}
+
+void FlightRecorder::summary(char *text, size_t len)
+{
+  text[0] = '\0';
+  if (!crashed())
+    return;
+
+  const char *reason = mReason < sizeof(reasonNames) / sizeof(reasonNames[0])
+                           ? reasonNames[mReason]
+                           : "?";
+  int n = snprintf(text, len, "%s in %s/%s", reason,
+                   handlerName(mCrashHandler[0]),
+                   handlerName(mCrashHandler[1]));
+  if (mCrashCount && n > 0 && (size_t)n < len) {
+    const FlightRecord &r = mCrash[mCrashCount - 1];
+    if (r.temp != INT16_MIN)
+      snprintf(text + n, len - n, ", %.1fC", r.temp / 10.0);
+  }
+}
+
+// {"reason":4,"boots":12,"handlers":["control","http"],
+//  "records":[[ts,temp,setpoint,step,flags,heap,"core 0","core 1"],...]}
+// oldest first, temp null when unknown, heap in bytes
+void FlightRecorder::print(Print &out, size_t last)
+{
+  if (!crashed()) {
+    out.print("{}");
+    return;
+  }
+
+  out.printf("{\"reason\":%u,\"boots\":%u,\"handlers\":[\"%s\",\"%s\"],"
+             "\"records\":[",
+             mReason, (unsigned)mCrashBoots, handlerName(mCrashHandler[0]),
+             handlerName(mCrashHandler[1]));
+  size_t n = std::min(last, mCrashCount);
+  for (size_t i = mCrashCount - n; i < mCrashCount; i++) {
+    const FlightRecord &r = mCrash[i];
+    char temp[12]         = "null";
+    if (r.temp != INT16_MIN)
+      snprintf(temp, sizeof(temp), "%.1f", r.temp / 10.0);
+    out.printf("%s[%u,%s,%.1f,%u,%u,%u,\"%s\",\"%s\"]",
+               i == mCrashCount - n ? "" : ",", (unsigned)r.ts, temp,
+               r.setpoint / 10.0, r.step, r.flags, (unsigned)r.heap * 16,
+               handlerName(r.handler[0]), handlerName(r.handler[1]));
+  }
+  out.print("]}");
+}
+
+size_t FlightRecorder::toJson(char *buf, size_t len, size_t last)
+{
+  BufferPrint out(buf, len);
+  print(out, last);
+  return out.end();
+}
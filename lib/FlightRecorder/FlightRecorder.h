@@ -0,0 +1,73 @@
+#ifndef __flight_recorder_h__
+#define __flight_recorder_h__
+
+#include <Arduino.h>
+
+/*
+ * What the kiln was doing just before a panic, watchdog or brownout reset.
+ *
+ * record() adds temperature, setpoint, relay, step and free heap to a ring
+ * of FLIGHT_RECORDS in RTC slow memory, which a reset other than power-on
+ * leaves alone. enter() and leave() keep the handler running on each core
+ * there as well, TRACE_SCOPE() calls them, so after a crash the recorder
+ * also knows which handler each core was in, best effort since a handler
+ * that blocks can be overtaken by another one on the same core.
+ *
+ * begin() checks the ring survived intact. After an unexpected() reset it
+ * moves the records to the heap, oldest first, for print() and toJson(),
+ * and starts a new ring for this boot. After a power-on the RTC memory is
+ * noise and the magic words don't match, so nothing is reported.
+ */
+
+#define FLIGHT_RECORDS 192 // x 16 bytes, 6 minutes at one per 2s sample
+#define FLIGHT_NONE    0xff
+
+struct FlightRecord {
+  uint32_t ts;        // Timebase seconds
+  int16_t temp;       // 0.1 degC, INT16_MIN when unknown
+  int16_t setpoint;   // 0.1 degC
+  uint16_t heap;      // free heap / 16 bytes
+  uint8_t step;
+  uint8_t flags;      // FLIGHT_*
+  uint8_t handler[2]; // TraceId running on core 0 and 1, FLIGHT_NONE idle
+  uint16_t reserved;
+};
+
+#define FLIGHT_RELAY  (1 << 0)
+#define FLIGHT_FIRING (1 << 1)
+
+class FlightRecorder
+{
+  private:
+  FlightRecord *mCrash; // previous boot's ring after a crash, else null
+  size_t mCrashCount;
+  uint8_t mCrashHandler[2];
+  uint32_t mCrashBoots;
+  uint8_t mReason;
+
+  public:
+  FlightRecorder();
+  // Once, early in setup()
+  void begin(esp_reset_reason_t reason);
+
+  // Panic, watchdogs and brownout
+  static bool unexpected(esp_reset_reason_t reason);
+
+  // Control task only
+  void record(uint32_t ts, float temp, float setpoint, uint8_t step,
+              uint8_t flags);
+  // The handler entered on this core and the one it interrupted
+  uint8_t enter(uint8_t handler);
+  void leave(uint8_t previous);
+
+  bool crashed() { return mCrash != nullptr; }
+  // "panic in control/-, 1021.5C", or empty without a crash
+  void summary(char *text, size_t len);
+  // The newest last records as JSON, see the .cpp
+  void print(Print &out, size_t last = FLIGHT_RECORDS);
+  size_t toJson(char *buf, size_t len, size_t last);
+};
+
+extern FlightRecorder flight;
+
+#endif
@@ -0,0 +1,74 @@
+#include "History.h"
+
+History::History(uint32_t stepMs)
+{
+  mCount  = 0;
+  mStepMs = stepMs;
+  mLastMs = 0;
+}
+
+bool History::due(uint32_t now)
+{
+  return mCount == 0 || (now - mLastMs) > mStepMs;
+}
+
+void History::add(uint32_t now, long epoch, float temp)
+{
+  portENTER_CRITICAL(&mLock);
+  if (mCount == HISTORY_POINTS) {
+    for (size_t i = 0; i < HISTORY_POINTS / 2; i++) {
+      mEpoch[i] = mEpoch[2 * i + 1];
+      mTemp[i]  = mTemp[2 * i + 1];
+    }
+    mCount = HISTORY_POINTS / 2;
+    mStepMs *= 2;
+  }
+  mEpoch[mCount] = epoch;
+  mTemp[mCount]  = temp;
+  mCount++;
+  portEXIT_CRITICAL(&mLock);
+  mLastMs = now;
+}
+
+size_t History::read(long after, long *epoch, float *temp, size_t max)
+{
+  portENTER_CRITICAL(&mLock);
+  // Stamps only ever grow, find the first one past after
+  size_t lo = 0, hi = mCount;
+  while (lo < hi) {
+    size_t mid = (lo + hi) / 2;
+    if (mEpoch[mid] <= after)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  size_t n = mCount - lo < max ? mCount - lo : max;
+  memcpy(epoch, &mEpoch[lo], n * sizeof(*epoch));
+  memcpy(temp, &mTemp[lo], n * sizeof(*temp));
+  portEXIT_CRITICAL(&mLock);
+  return n;
+}
+
+size_t History::size()
+{
+  portENTER_CRITICAL(&mLock);
+  size_t n = mCount;
+  portEXIT_CRITICAL(&mLock);
+  return n;
+}
+
+size_t History::encode(char *out, size_t len, const long *epoch,
+                       const float *temp, size_t n, bool first, size_t &rows)
+{
+  size_t used = 0;
+  for (rows = 0; rows < n; rows++) {
+    char row[32];
+    int w = snprintf(row, sizeof(row), "%s[%ld,%.0f]",
+                     first && rows == 0 ? "" : ",", epoch[rows], temp[rows]);
+    if (w < 0 || used + w > len)
+      break;
+    memcpy(out + used, row, w);
+    used += w;
+  }
+  return used;
+}
@@ -0,0 +1,54 @@
+#ifndef __history_h__
+#define __history_h__
+
+#include <Arduino.h>
+
+/*
+ * Temperature history for the page and WebSocket replay, one point per
+ * step. When full every other point goes and the step doubles, so a firing
+ * of any length fits without the arrays ever growing.
+ *
+ * add() runs on the network task, readers on the AsyncTCP task. Points are
+ * copied out under the lock a chunk at a time, paged by time stamp rather
+ * than index: read() returns the points stamped after the last one the
+ * reader got, so a compaction between two chunks thins out what is left
+ * but never repeats or skips a point that is still kept.
+ *
+ * Stamps are provisional until SNTP synced, see Timebase.h. Those sort below
+ * every real epoch, so the order holds across the sync too.
+ *
+ * encode() writes points as [epoch,temp] JSON rows into a fixed buffer,
+ * whole rows only, so a chunked response can stream the history without
+ * ever holding all of it.
+ */
+
+#define HISTORY_POINTS 1440 // 24 hours at 1 min
+
+class History
+{
+  private:
+  portMUX_TYPE mLock = portMUX_INITIALIZER_UNLOCKED;
+  long mEpoch[HISTORY_POINTS];
+  float mTemp[HISTORY_POINTS];
+  size_t mCount;
+  uint32_t mStepMs;
+  uint32_t mLastMs;
+
+  public:
+  History(uint32_t stepMs);
+  // Every stepMs, the first point right away
+  bool due(uint32_t now);
+  void add(uint32_t now, long epoch, float temp);
+
+  // Up to max points stamped after after, oldest first, 0 once caught up
+  size_t read(long after, long *epoch, float *temp, size_t max);
+  size_t size();
+  uint32_t stepMs() { return mStepMs; }
+
+  // As many of the n points as fit in len, comma separated and preceded by
+  // one unless first. Returns the bytes written, rows the points taken.
+  static size_t encode(char *out, size_t len, const long *epoch,
+                       const float *temp, size_t n, bool first, size_t &rows);
+};
+
+#endif
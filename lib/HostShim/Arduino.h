@@ -0,0 +1,136 @@
+#ifndef __host_arduino_h__
+#define __host_arduino_h__
+
+// Host stand-in for the Arduino core, see HostShim.h
+
+#include <algorithm>
+#include <cmath>
+#include <math.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "HostShim.h"
+#include "WString.h"
+
+using std::isnan;
+using std::max;
+using std::min;
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define IRAM_ATTR
+#define RTC_NOINIT_ATTR
+#define PROGMEM
+
+#define LOW    0
+#define HIGH   1
+#define INPUT  0x01
+#define OUTPUT 0x03
+
+#define ESP_ARDUINO_VERSION_MAJOR 2
+#define ESP_ARDUINO_VERSION_MINOR 0
+#define ESP_ARDUINO_VERSION_PATCH 2
+
+#define RISING  0x01
+#define FALLING 0x02
+#define CHANGE  0x03
+
+#define constrain(amt, low, high)                                             \
+  ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+unsigned long millis();
+unsigned long micros();
+void delay(uint32_t ms);
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+void attachInterrupt(uint8_t pin, void (*fn)(), int mode);
+#define digitalPinToInterrupt(p) (p)
+
+#if !defined(__APPLE__) &&                                                   \
+    !(defined(__GLIBC__) &&                                                   \
+      (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 38)))
+size_t strlcpy(char *dst, const char *src, size_t size);
+#endif
+
+// FreeRTOS, one thread: nothing to lock, nothing runs concurrently
+
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux)      (void)(mux)
+#define portEXIT_CRITICAL(mux)       (void)(mux)
+#define portENTER_CRITICAL_ISR(mux)  (void)(mux)
+#define portEXIT_CRITICAL_ISR(mux)   (void)(mux)
+
+typedef uint32_t TickType_t;
+typedef int BaseType_t;
+typedef void *TaskHandle_t;
+typedef void *SemaphoreHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+#define pdTRUE               1
+#define pdFALSE              0
+#define pdPASS               pdTRUE
+#define portMAX_DELAY        0xffffffffUL
+#define pdMS_TO_TICKS(ms)    ((TickType_t)(ms))
+#define configMAX_PRIORITIES 25
+#define tskNO_AFFINITY       0x7fffffff
+#define portNUM_PROCESSORS   1
+
+SemaphoreHandle_t xSemaphoreCreateMutex();
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem);
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name,
+                                   uint32_t stack, void *arg,
+                                   uint32_t priority, TaskHandle_t *handle,
+                                   BaseType_t core);
+TickType_t xTaskGetTickCount();
+void vTaskDelay(TickType_t ticks);
+void vTaskDelayUntil(TickType_t *wake, TickType_t ticks);
+int xPortGetCoreID();
+
+class Print
+{
+  public:
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t *buf, size_t len);
+  size_t write(const char *s) { return write((const uint8_t *)s, strlen(s)); }
+
+  size_t print(const char *s) { return write(s); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(long n) { return printf("%ld", n); }
+  size_t print(unsigned long n) { return printf("%lu", n); }
+  size_t print(int n) { return print((long)n); }
+  size_t print(unsigned int n) { return print((unsigned long)n); }
+  size_t print(double n, int digits = 2) { return printf("%.*f", digits, n); }
+  size_t println() { return write("\r\n"); }
+  template <typename T> size_t println(const T &v)
+  {
+    return print(v) + println();
+  }
+  size_t printf(const char *format, ...)
+      __attribute__((format(printf, 2, 3)));
+};
+
+struct EspClass {
+  uint32_t getFreeHeap() { return 200000; }
+  uint32_t getMinFreeHeap() { return 150000; }
+  uint32_t getMaxAllocHeap() { return 100000; }
+  uint32_t getCycleCount() { return (uint32_t)(micros() * 240); }
+  uint64_t getEfuseMac() { return 0x0100C40A24ULL; }
+  uint32_t getSketchSize() { return 1200000; }
+  uint32_t getFlashChipSize() { return 4194304; }
+  void restart() {}
+};
+extern EspClass ESP;
+
+#endif
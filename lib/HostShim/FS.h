@@ -0,0 +1,68 @@
+#ifndef __host_fs_h__
+#define __host_fs_h__
+
+// Host stand-in for the Arduino file system API, files live under a host
+// directory given to the FS, see HostShim.h
+
+#include <Arduino.h>
+
+#include <memory>
+#include <string>
+
+#define FILE_READ   "r"
+#define FILE_WRITE  "w"
+#define FILE_APPEND "a"
+
+namespace fs
+{
+
+enum SeekMode {
+  SeekSet = 0,
+  SeekCur = 1,
+  SeekEnd = 2,
+};
+
+class File : public Print
+{
+  private:
+  std::shared_ptr<FILE> mFile;
+
+  public:
+  File() {}
+  File(FILE *file);
+
+  size_t write(uint8_t c) override;
+  size_t write(const uint8_t *buf, size_t len) override;
+  int read();
+  size_t read(uint8_t *buf, size_t len);
+  int available();
+  bool seek(uint32_t pos, SeekMode mode = SeekSet);
+  size_t position();
+  size_t size();
+  void flush();
+  void close();
+  bool isDirectory() { return false; }
+  operator bool() const { return mFile != nullptr; }
+};
+
+class FS
+{
+  private:
+  std::string mRoot;
+  std::string path(const char *path);
+
+  public:
+  // An existing directory, paths like "/x.bin" are taken relative to it
+  FS(const char *root) : mRoot(root) {}
+  File open(const char *path, const char *mode = FILE_READ);
+  bool exists(const char *path);
+  bool remove(const char *path);
+  bool rename(const char *from, const char *to);
+};
+
+} // namespace fs
+
+using fs::File;
+using fs::FS;
+
+#endif
@@ -0,0 +1,282 @@
+#include "HostShim.h"
+
+#include <Arduino.h>
+#include <FS.h>
+#include <WiFi.h>
+
+#include <ftw.h>
+
+#include "esp_sntp.h"
+#include "esp_timer.h"
+
+#define HOST_PINS 40
+
+static int64_t sNowUs   = 0;
+static int64_t sEpochUs = 0; // time of day - sNowUs
+static uint8_t sPins[HOST_PINS];
+static void (*sIsr[HOST_PINS])();
+static sntp_sync_time_cb_t sSntp = nullptr;
+
+EspClass ESP;
+WiFiClass WiFi;
+
+int64_t HostShim::nowUs() { return sNowUs; }
+
+void HostShim::setUs(int64_t us) { sNowUs = us; }
+
+void HostShim::advanceUs(int64_t us) { sNowUs += us; }
+
+uint8_t HostShim::pin(uint8_t pin) { return pin < HOST_PINS ? sPins[pin] : 0; }
+
+void HostShim::setPin(uint8_t pin, uint8_t level)
+{
+  if (pin < HOST_PINS)
+    sPins[pin] = level;
+}
+
+bool HostShim::interrupt(uint8_t pin)
+{
+  if (pin >= HOST_PINS || sIsr[pin] == nullptr)
+    return false;
+  sIsr[pin]();
+  return true;
+}
+
+void HostShim::sntpSync(int64_t epochUs)
+{
+  struct timeval tv;
+  sEpochUs = epochUs - sNowUs;
+  gettimeofday(&tv, nullptr);
+  if (sSntp)
+    sSntp(&tv);
+}
+
+static int removeEntry(const char *path, const struct stat *, int,
+                       struct FTW *)
+{
+  return ::remove(path);
+}
+
+bool HostShim::removeTree(const char *dir)
+{
+  return nftw(dir, removeEntry, 16, FTW_DEPTH | FTW_PHYS) == 0;
+}
+
+int64_t esp_timer_get_time() { return sNowUs; }
+
+unsigned long millis() { return sNowUs / 1000; }
+
+unsigned long micros() { return sNowUs; }
+
+void delay(uint32_t ms) { sNowUs += ms * 1000LL; }
+
+void pinMode(uint8_t pin, uint8_t mode) {}
+
+void digitalWrite(uint8_t pin, uint8_t val) { HostShim::setPin(pin, val); }
+
+int digitalRead(uint8_t pin) { return HostShim::pin(pin); }
+
+void attachInterrupt(uint8_t pin, void (*fn)(), int mode)
+{
+  if (pin < HOST_PINS)
+    sIsr[pin] = fn;
+}
+
+#if !defined(__APPLE__) &&                                                   \
+    !(defined(__GLIBC__) &&                                                   \
+      (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 38)))
+size_t strlcpy(char *dst, const char *src, size_t size)
+{
+  size_t len = strlen(src);
+  if (size) {
+    size_t n = len < size - 1 ? len : size - 1;
+    memcpy(dst, src, n);
+    dst[n] = '\0';
+  }
+  return len;
+}
+#endif
+
+SemaphoreHandle_t xSemaphoreCreateMutex()
+{
+  static int mutex;
+  return &mutex;
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sem, TickType_t wait)
+{
+  return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sem) { return pdTRUE; }
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t fn, const char *name,
+                                   uint32_t stack, void *arg,
+                                   uint32_t priority, TaskHandle_t *handle,
+                                   BaseType_t core)
+{
+  if (handle)
+    *handle = nullptr;
+  return pdPASS;
+}
+
+TickType_t xTaskGetTickCount() { return millis(); }
+
+void vTaskDelay(TickType_t ticks) { delay(ticks); }
+
+void vTaskDelayUntil(TickType_t *wake, TickType_t ticks)
+{
+  *wake += ticks;
+  if ((int32_t)(*wake - millis()) > 0)
+    sNowUs = *wake * 1000LL;
+}
+
+int xPortGetCoreID() { return 0; }
+
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback)
+{
+  sSntp = callback;
+}
+
+int host_gettimeofday(struct timeval *tv, void *tz)
+{
+  int64_t us  = sNowUs + sEpochUs;
+  tv->tv_sec  = us / 1000000;
+  tv->tv_usec = us % 1000000;
+  return 0;
+}
+
+size_t Print::write(const uint8_t *buf, size_t len)
+{
+  size_t n = 0;
+  while (len--)
+    n += write(*buf++);
+  return n;
+}
+
+size_t Print::printf(const char *format, ...)
+{
+  char buf[256];
+  va_list args;
+  va_start(args, format);
+  int len = vsnprintf(buf, sizeof(buf), format, args);
+  va_end(args);
+  if (len < 0)
+    return 0;
+  if ((size_t)len < sizeof(buf))
+    return write((const uint8_t *)buf, len);
+
+  char *big = (char *)malloc(len + 1);
+  va_start(args, format);
+  vsnprintf(big, len + 1, format, args);
+  va_end(args);
+  size_t n = write((const uint8_t *)big, len);
+  free(big);
+  return n;
+}
+
+String::String(int v) : String((long)v) {}
+
+String::String(unsigned int v) : String((unsigned long)v) {}
+
+String::String(long v) { mS = std::to_string(v); }
+
+String::String(unsigned long v) { mS = std::to_string(v); }
+
+String::String(float v, unsigned int decimals) : String((double)v, decimals)
+{
+}
+
+String::String(double v, unsigned int decimals)
+{
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.*f", decimals, v);
+  mS = buf;
+}
+
+String IPAddress::toString() const
+{
+  char buf[16];
+  snprintf(buf, sizeof(buf), "%u.%u.%u.%u", mOctets[0], mOctets[1],
+           mOctets[2], mOctets[3]);
+  return String(buf);
+}
+
+namespace fs
+{
+
+File::File(FILE *file)
+{
+  if (file)
+    mFile.reset(file, fclose);
+}
+
+size_t File::write(uint8_t c) { return write(&c, 1); }
+
+size_t File::write(const uint8_t *buf, size_t len)
+{
+  return mFile ? fwrite(buf, 1, len, mFile.get()) : 0;
+}
+
+int File::read() { return mFile ? fgetc(mFile.get()) : -1; }
+
+size_t File::read(uint8_t *buf, size_t len)
+{
+  return mFile ? fread(buf, 1, len, mFile.get()) : 0;
+}
+
+int File::available() { return mFile ? size() - position() : 0; }
+
+bool File::seek(uint32_t pos, SeekMode mode)
+{
+  return mFile && fseek(mFile.get(), pos, mode) == 0;
+}
+
+size_t File::position() { return mFile ? ftell(mFile.get()) : 0; }
+
+size_t File::size()
+{
+  if (!mFile)
+    return 0;
+  long at = ftell(mFile.get());
+  fseek(mFile.get(), 0, SEEK_END);
+  long size = ftell(mFile.get());
+  fseek(mFile.get(), at, SEEK_SET);
+  return size;
+}
+
+void File::flush()
+{
+  if (mFile)
+    fflush(mFile.get());
+}
+
+void File::close() { mFile.reset(); }
+
+std::string FS::path(const char *path) { return mRoot + path; }
+
+File FS::open(const char *path, const char *mode)
+{
+  std::string m = std::string(mode) + "b";
+  return File(fopen(this->path(path).c_str(), m.c_str()));
+}
+
+bool FS::exists(const char *path)
+{
+  FILE *f = fopen(this->path(path).c_str(), "rb");
+  if (f)
+    fclose(f);
+  return f != nullptr;
+}
+
+bool FS::remove(const char *path)
+{
+  return ::remove(this->path(path).c_str()) == 0;
+}
+
+bool FS::rename(const char *from, const char *to)
+{
+  return ::rename(path(from).c_str(), path(to).c_str()) == 0;
+}
+
+} // namespace fs
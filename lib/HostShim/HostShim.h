@@ -0,0 +1,43 @@
+#ifndef __host_shim_h__
+#define __host_shim_h__
+
+#include <stdint.h>
+
+/*
+ * What the libraries need of Arduino, FreeRTOS and esp-idf, for the native
+ * env only (pio test -e native), so they build and run on the host
+ * unchanged.
+ *
+ * Time is virtual. millis(), micros() and esp_timer_get_time() read one
+ * clock that only moves when a test moves it, so a test steps through a
+ * firing of hours in microseconds and gets the same result every time.
+ *
+ * Everything runs on the test's thread. Critical sections and mutexes are
+ * no-ops, task creation does nothing: tests call what a task would have
+ * called. Pins are plain state, attachInterrupt() keeps the handler so a
+ * test can fire it. SNTP syncs when the test says so, with the callback
+ * Timebase registered. fs::FS keeps its files in a host directory. String
+ * and WiFi are what the page templates use, the station always connected.
+ */
+
+class HostShim
+{
+  public:
+  static int64_t nowUs();
+  static void setUs(int64_t us);
+  static void advanceUs(int64_t us);
+  static void advanceMs(uint32_t ms) { advanceUs(ms * 1000LL); }
+
+  static uint8_t pin(uint8_t pin);
+  static void setPin(uint8_t pin, uint8_t level);
+  // Calls the handler attached to pin, as the edge would
+  static bool interrupt(uint8_t pin);
+
+  // SNTP sync to epoch, through the notification callback
+  static void sntpSync(int64_t epochUs);
+
+  // The directory a test made for fs::FS, with everything in it
+  static bool removeTree(const char *dir);
+};
+
+#endif
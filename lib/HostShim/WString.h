@@ -0,0 +1,67 @@
+#ifndef __host_wstring_h__
+#define __host_wstring_h__
+
+// Host stand-in for the Arduino String, the part of it the page templates
+// use, on a std::string, see HostShim.h
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <string>
+
+class __FlashStringHelper;
+#define F(s)     ((const __FlashStringHelper *)(s))
+#define FPSTR(p) ((const __FlashStringHelper *)(p))
+
+class String
+{
+  private:
+  std::string mS;
+
+  public:
+  String(const char *s = "") : mS(s ? s : "") {}
+  String(const __FlashStringHelper *s) : mS((const char *)s) {}
+  explicit String(char c) : mS(1, c) {}
+  explicit String(int v);
+  explicit String(unsigned int v);
+  explicit String(long v);
+  explicit String(unsigned long v);
+  explicit String(float v, unsigned int decimals = 2);
+  explicit String(double v, unsigned int decimals = 2);
+
+  const char *c_str() const { return mS.c_str(); }
+  unsigned int length() const { return mS.size(); }
+  void reserve(unsigned int size) { mS.reserve(size); }
+  long toInt() const { return atol(mS.c_str()); }
+
+  bool operator==(const String &s) const { return mS == s.mS; }
+  bool operator==(const char *s) const { return mS == s; }
+  bool operator!=(const String &s) const { return mS != s.mS; }
+  bool operator!=(const char *s) const { return mS != s; }
+
+  String &operator+=(const String &s)
+  {
+    mS += s.mS;
+    return *this;
+  }
+  String &operator+=(const char *s)
+  {
+    mS += s;
+    return *this;
+  }
+  String &operator+=(char c)
+  {
+    mS += c;
+    return *this;
+  }
+};
+
+inline String operator+(String a, const String &b) { return a += b; }
+inline String operator+(String a, const char *b) { return a += b; }
+inline String operator+(const char *a, const String &b)
+{
+  return String(a) += b;
+}
+
+#endif
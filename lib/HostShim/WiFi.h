@@ -0,0 +1,32 @@
+#ifndef __host_wifi_h__
+#define __host_wifi_h__
+
+// Host stand-in for the ESP32 WiFi station, always connected to the same
+// network, see HostShim.h
+
+#include <Arduino.h>
+
+class IPAddress
+{
+  private:
+  uint8_t mOctets[4];
+
+  public:
+  IPAddress(uint8_t a = 0, uint8_t b = 0, uint8_t c = 0, uint8_t d = 0)
+      : mOctets{a, b, c, d}
+  {
+  }
+  String toString() const;
+};
+
+struct WiFiClass {
+  bool isConnected() { return true; }
+  String SSID() { return "host"; }
+  IPAddress localIP() { return IPAddress(192, 168, 1, 50); }
+  const char *getHostname() { return "kiln"; }
+  String macAddress() { return "24:0A:C4:00:00:01"; }
+  int8_t RSSI() { return -60; }
+};
+extern WiFiClass WiFi;
+
+#endif
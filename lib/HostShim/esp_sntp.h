@@ -0,0 +1,18 @@
+#ifndef __host_esp_sntp_h__
+#define __host_esp_sntp_h__
+
+// Host stand-in, HostShim::sntpSync() sets the time of day and calls the
+// notification callback. The time of day is virtual as well, seconds since
+// boot until the first sync, so it doesn't hand the host's real clock to
+// whoever reads it.
+
+#include <sys/time.h>
+
+typedef void (*sntp_sync_time_cb_t)(struct timeval *tv);
+
+void sntp_set_time_sync_notification_cb(sntp_sync_time_cb_t callback);
+
+int host_gettimeofday(struct timeval *tv, void *tz);
+#define gettimeofday host_gettimeofday
+
+#endif
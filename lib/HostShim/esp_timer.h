@@ -0,0 +1,10 @@
+#ifndef __host_esp_timer_h__
+#define __host_esp_timer_h__
+
+// Host stand-in, the virtual clock of HostShim.h
+
+#include <stdint.h>
+
+int64_t esp_timer_get_time();
+
+#endif
@@ -0,0 +1,267 @@
+#include "InputRecorder.h"
+
+#include <algorithm>
+
+#include "esp_timer.h"
+
+InputRecorder recorder;
+
+static size_t varint(uint8_t *out, uint64_t v)
+{
+  size_t n = 0;
+  do {
+    out[n] = (v & 0x7f) | (v > 0x7f ? 0x80 : 0);
+    v >>= 7;
+    n++;
+  } while (v);
+  return n;
+}
+
+static uint64_t zigzag(int64_t v) { return ((uint64_t)v << 1) ^ (v >> 63); }
+
+InputRecorder::InputRecorder()
+{
+  mHead    = 0;
+  mTail    = 0;
+  mKeyAt   = 0;
+  mOn      = false;
+  mStart   = false;
+  mNeedKey = true;
+
+  mLastUs      = 0;
+  mLastPulseUs = 0;
+  mGap         = 0;
+  mDropped     = 0;
+
+  mFs       = nullptr;
+  mPath     = nullptr;
+  mOldPath  = nullptr;
+  mFileSize = 0;
+  mFileMax  = REC_FILE_MIN;
+  mFileAt   = 0;
+}
+
+void InputRecorder::begin(fs::FS *fs, const char *path, const char *oldPath)
+{
+  mFs      = fs;
+  mPath    = path;
+  mOldPath = oldPath;
+}
+
+bool InputRecorder::start(size_t maxBytes)
+{
+  if (maxBytes < REC_FILE_MIN)
+    return false;
+  mFileMax = maxBytes;
+  mStart   = true;
+  return true;
+}
+
+// mLock held, room checked
+void InputRecorder::put(const uint8_t *data, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+    mBuf[(mHead + i) % REC_BUFFER] = data[i];
+  mHead += len;
+}
+
+bool InputRecorder::append(RecEvent type, const uint8_t *payload, size_t len,
+                           int64_t now)
+{
+  uint8_t gap[1 + 10 + 5];
+  uint8_t header[1 + 10];
+  size_t gapLen = 0;
+
+  portENTER_CRITICAL(&mLock);
+  if (!mOn || (mNeedKey && type != REC_START)) {
+    portEXIT_CRITICAL(&mLock);
+    return false;
+  }
+
+  // Deltas can't go back
+  if (now < mLastUs)
+    now = mLastUs;
+  if (mGap) {
+    gap[0] = REC_GAP;
+    gapLen = 1 + varint(gap + 1, now - mLastUs);
+    gapLen += varint(gap + gapLen, mGap);
+  }
+  header[0]     = type;
+  size_t length = 1 + varint(header + 1, mGap ? 0 : now - mLastUs);
+
+  if (REC_BUFFER - (mHead - mTail) < gapLen + length + len) {
+    mGap++;
+    mDropped++;
+    portEXIT_CRITICAL(&mLock);
+    return false;
+  }
+  put(gap, gapLen);
+  if (type == REC_START)
+    mKeyAt = mHead;
+  put(header, length);
+  put(payload, len);
+  mGap    = 0;
+  mLastUs = now;
+  portEXIT_CRITICAL(&mLock);
+  return true;
+}
+
+// Absolute time again, a decoder can start at any of these
+void InputRecorder::keyframe(uint32_t epoch, int64_t now)
+{
+  uint8_t payload[12];
+  memcpy(payload, &now, 8);
+  memcpy(payload + 8, &epoch, 4);
+
+  mNeedKey = false;
+  if (append(REC_START, payload, sizeof(payload), now))
+    mLastPulseUs = now;
+  else
+    mNeedKey = true;
+}
+
+void InputRecorder::job(uint8_t id, uint32_t epoch, int64_t us)
+{
+  if (!mOn)
+    return;
+  if (mNeedKey || mHead - mKeyAt >= REC_KEY_BYTES)
+    keyframe(epoch, us);
+  append(REC_JOB, &id, 1, us);
+}
+
+void InputRecorder::frame(float temp, float internal, uint8_t fault)
+{
+  uint8_t payload[9];
+  memcpy(payload, &temp, 4);
+  memcpy(payload + 4, &internal, 4);
+  payload[8] = fault;
+  append(REC_FRAME, payload, sizeof(payload), esp_timer_get_time());
+}
+
+void InputRecorder::pulse(int64_t us)
+{
+  uint8_t payload[10];
+  // Negative when captured before the keyframe that reset mLastPulseUs
+  size_t n = varint(payload, zigzag(us - mLastPulseUs));
+  if (append(REC_PULSE, payload, n, esp_timer_get_time()))
+    mLastPulseUs = us;
+}
+
+void InputRecorder::command(uint8_t cmd, const int segments[4][3],
+                            int64_t us)
+{
+  uint8_t payload[1 + 12 * 5];
+  size_t n     = 0;
+  payload[n++] = cmd;
+  for (uint8_t i = 0; i < 4; i++) {
+    for (uint8_t j = 0; j < 3; j++)
+      n += varint(payload + n, zigzag(segments[i][j]));
+  }
+  append(REC_COMMAND, payload, n, us);
+}
+
+void InputRecorder::time(uint32_t epoch, uint32_t syncs)
+{
+  uint8_t payload[4 + 5];
+  memcpy(payload, &epoch, 4);
+  append(REC_TIME, payload, 4 + varint(payload + 4, syncs),
+         esp_timer_get_time());
+}
+
+void InputRecorder::relay(bool on)
+{
+  uint8_t payload = on;
+  append(REC_RELAY, &payload, 1, esp_timer_get_time());
+}
+
+bool InputRecorder::writeOut(uint32_t from, uint32_t to)
+{
+  if (from == to)
+    return true;
+
+  File file = mFs->open(mPath, FILE_APPEND);
+  if (!file)
+    return false;
+
+  bool ok = true;
+  if (mFileSize == 0) {
+    const uint8_t magic[] = {'K', 'R', 'E', 'C', REC_VERSION};
+    ok                    = file.write(magic, sizeof(magic)) == sizeof(magic);
+    mFileSize += sizeof(magic);
+  }
+  while (ok && from != to) {
+    size_t at  = from % REC_BUFFER;
+    size_t len = std::min<size_t>(to - from, REC_BUFFER - at);
+    ok         = file.write(mBuf + at, len) == len;
+    from += len;
+    mFileSize += len;
+  }
+  file.close();
+  return ok;
+}
+
+void InputRecorder::service()
+{
+  if (mFs == nullptr)
+    return;
+
+  if (mStart) {
+    mStart = false;
+    mOn    = false;
+    portENTER_CRITICAL(&mLock);
+    mHead    = 0;
+    mTail    = 0;
+    mKeyAt   = 0;
+    mLastUs  = 0;
+    mGap     = 0;
+    mDropped = 0;
+    mNeedKey = true;
+    portEXIT_CRITICAL(&mLock);
+    mFs->remove(mPath);
+    mFs->remove(mOldPath);
+    mFileSize = 0;
+    mFileAt   = 0;
+    mOn       = true;
+    return;
+  }
+
+  portENTER_CRITICAL(&mLock);
+  uint32_t head  = mHead;
+  uint32_t tail  = mTail;
+  uint32_t keyAt = mKeyAt;
+  portEXIT_CRITICAL(&mLock);
+  if (head == tail)
+    return;
+
+  // Big enough, and a keyframe to start the next file at. The next one
+  // comes at most REC_KEY_BYTES later, half the budget isn't passed.
+  bool ok = true;
+  if (mFileSize >= mFileMax / 2 - REC_KEY_BYTES && keyAt > mFileAt &&
+      keyAt >= tail && keyAt < head) {
+    ok = writeOut(tail, keyAt);
+    mFs->remove(mOldPath);
+    mFs->rename(mPath, mOldPath);
+    mFileSize = 0;
+    mFileAt   = keyAt;
+    tail      = keyAt;
+  }
+  if (ok)
+    ok = writeOut(tail, head);
+  if (!ok) {
+    // Flash full or gone, better stop than keep a stream with holes
+    mOn = false;
+  }
+
+  portENTER_CRITICAL(&mLock);
+  mTail = head;
+  portEXIT_CRITICAL(&mLock);
+}
+
+void InputRecorder::toJson(JsonObject rec)
+{
+  rec["on"]      = (bool)mOn;
+  rec["bytes"]   = mHead;
+  rec["file"]    = mFileSize;
+  rec["max"]     = mFileMax;
+  rec["dropped"] = mDropped;
+}
@@ -0,0 +1,115 @@
+#ifndef __input_recorder_h__
+#define __input_recorder_h__
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <FS.h>
+
+/*
+ * Everything the controller consumes, in order, so a firing that went wrong
+ * in the field can be stepped through again off the kiln.
+ *
+ * While on, every job the scheduler runs, thermocouple reading, energy
+ * meter timestamp, command taken off the control queue and SNTP sync is
+ * appended to a RAM ring of REC_BUFFER bytes, with the relay decisions the
+ * controller made from them to check a replay against. Jobs and commands
+ * are stamped with the time the control path runs them on, so a replay
+ * sees the clock it saw, see tools/krec. service(), from the network task,
+ * moves the ring to a file. A full ring drops events and says so in the
+ * stream.
+ *
+ * The file is "KREC", a version byte and then events:
+ *
+ *   type (1 byte) | us since the previous event (varint) | payload
+ *
+ *   REC_START   uptime us (8), epoch s (4), keyframe every REC_KEY_BYTES
+ *   REC_JOB     scheduler job id (1)
+ *   REC_FRAME   temp (float), internal (float), fault bits (1)
+ *   REC_PULSE   us since the previous pulse or REC_START (zigzag varint)
+ *   REC_COMMAND command (1), 4 x 3 segment values (zigzag varints)
+ *   REC_TIME    epoch s (4), SNTP syncs so far (varint)
+ *   REC_RELAY   on (1)
+ *   REC_GAP     events dropped before this one (varint)
+ *
+ * Varints are LEB128, everything else little endian. A file always starts
+ * at a REC_START. Once it is within a keyframe interval of half the budget
+ * start() was given it is renamed to the old path at the next REC_START,
+ * so the two hold about the last budget's worth. Roughly 96 KB per
+ * hour of firing.
+ */
+
+#define REC_VERSION   1
+#define REC_BUFFER    4096
+#define REC_KEY_BYTES (16 * 1024)
+#define REC_FILE_MIN  (4 * REC_KEY_BYTES) // smallest budget start() takes
+
+enum RecEvent : uint8_t {
+  REC_START,
+  REC_JOB,
+  REC_FRAME,
+  REC_PULSE,
+  REC_COMMAND,
+  REC_TIME,
+  REC_RELAY,
+  REC_GAP,
+};
+
+class InputRecorder
+{
+  private:
+  portMUX_TYPE mLock = portMUX_INITIALIZER_UNLOCKED;
+  uint8_t mBuf[REC_BUFFER];
+  uint32_t mHead;  // bytes ever appended, ring index is mHead % REC_BUFFER
+  uint32_t mTail;  // bytes written out
+  uint32_t mKeyAt; // offset of the newest REC_START
+  volatile bool mOn;
+  volatile bool mStart;
+  volatile bool mNeedKey; // nothing but a REC_START goes in until one has
+
+  int64_t mLastUs;
+  int64_t mLastPulseUs;
+  uint32_t mGap; // events dropped since the last one that fit
+  uint32_t mDropped;
+
+  // Network task only
+  fs::FS *mFs;
+  const char *mPath;
+  const char *mOldPath;
+  size_t mFileSize;
+  size_t mFileMax;  // both files together
+  uint32_t mFileAt; // offset the current file starts at
+
+  bool append(RecEvent type, const uint8_t *payload, size_t len,
+              int64_t now);
+  void put(const uint8_t *data, size_t len);
+  void keyframe(uint32_t epoch, int64_t now);
+  bool writeOut(uint32_t from, uint32_t to);
+
+  public:
+  InputRecorder();
+  void begin(fs::FS *fs, const char *path, const char *oldPath);
+
+  // Both files start over at the next service() and take at most
+  // maxBytes together, false if that is below REC_FILE_MIN
+  bool start(size_t maxBytes);
+  void stop() { mOn = false; }
+  bool on() { return mOn; }
+
+  // Control task only, job() adds the keyframes. us is the esp_timer time
+  // the job or command runs on.
+  void job(uint8_t id, uint32_t epoch, int64_t us);
+  void frame(float temp, float internal, uint8_t fault);
+  void pulse(int64_t us);
+  void command(uint8_t cmd, const int segments[4][3], int64_t us);
+  void time(uint32_t epoch, uint32_t syncs);
+  // Any task
+  void relay(bool on);
+
+  // Network task, starts a recording and writes out what the ring holds
+  void service();
+  void toJson(JsonObject rec);
+};
+
+extern InputRecorder recorder;
+
+#endif
@@ -0,0 +1,255 @@
+#include "Journal.h"
+
+Journal journal;
+
+Journal::Journal()
+{
+  memset(mCells, 0, sizeof(mCells));
+  memset(mSinks, 0, sizeof(mSinks));
+  for (uint32_t i = 0; i < JOURNAL_CELLS; i++)
+    mCells[i].seq = i;
+
+  mHead      = 0;
+  mTail      = 0;
+  mDropped   = 0;
+  mSinkCount = 0;
+  mTask      = nullptr;
+}
+
+void Journal::begin()
+{
+  // Lowest priority, with the network and away from the control task
+  xTaskCreatePinnedToCore(task, "journal", 3072, this, 1, &mTask, 0);
+}
+
+bool Journal::addSink(Print *out, uint8_t level)
+{
+  if (mSinkCount >= JOURNAL_SINKS)
+    return false;
+  mSinks[mSinkCount].out   = out;
+  mSinks[mSinkCount].sink  = nullptr;
+  mSinks[mSinkCount].level = level;
+  __atomic_store_n(&mSinkCount, mSinkCount + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+bool Journal::addSink(JournalSink *sink, uint8_t level)
+{
+  if (mSinkCount >= JOURNAL_SINKS)
+    return false;
+  mSinks[mSinkCount].out   = nullptr;
+  mSinks[mSinkCount].sink  = sink;
+  mSinks[mSinkCount].level = level;
+  __atomic_store_n(&mSinkCount, mSinkCount + 1, __ATOMIC_RELEASE);
+  return true;
+}
+
+// Bounded MPMC queue after Vyukov: a cell whose seq equals the position is
+// free for it, seq of position + 1 is full
+Journal::Cell *Journal::claim()
+{
+  uint32_t pos = __atomic_load_n(&mHead, __ATOMIC_RELAXED);
+  for (;;) {
+    Cell &cell   = mCells[pos % JOURNAL_CELLS];
+    uint32_t seq = __atomic_load_n(&cell.seq, __ATOMIC_ACQUIRE);
+    int32_t diff = (int32_t)(seq - pos);
+    if (diff == 0) {
+      if (__atomic_compare_exchange_n(&mHead, &pos, pos + 1, true,
+                                      __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+        cell.ms   = millis();
+        cell.size = 0;
+        return &cell;
+      }
+    } else if (diff < 0) {
+      __atomic_fetch_add(&mDropped, 1, __ATOMIC_RELAXED);
+      return nullptr;
+    } else {
+      pos = __atomic_load_n(&mHead, __ATOMIC_RELAXED);
+    }
+  }
+}
+
+void Journal::commit(Cell *cell)
+{
+  uint32_t pos = cell->seq;
+  __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+}
+
+void Journal::put(Cell *cell, const void *value, size_t len)
+{
+  if (cell->size + len > JOURNAL_ARGS) {
+    cell->size = JOURNAL_ARGS; // format() finds nothing from here on
+    return;
+  }
+  memcpy(cell->args + cell->size, value, len);
+  cell->size += len;
+  cell->reserve -= std::min<size_t>(len, cell->reserve);
+}
+
+void Journal::put(Cell *cell, const char *s)
+{
+  if (s == nullptr)
+    s = "(null)";
+  size_t reserve = cell->reserve ? cell->reserve - 1 : 0; // less our '\0'
+  cell->reserve  = reserve;
+  if (cell->size + reserve >= JOURNAL_ARGS) {
+    cell->size = JOURNAL_ARGS;
+    return;
+  }
+  size_t room = JOURNAL_ARGS - cell->size - reserve;
+  size_t len  = strnlen(s, room - 1);
+  memcpy(cell->args + cell->size, s, len);
+  cell->args[cell->size + len] = '\0';
+  cell->size += len + 1;
+}
+
+// Next argument of the cell as T, zero when the line ran out of room
+template <typename T>
+static T take(const uint8_t *args, size_t size, size_t &at)
+{
+  T v = 0;
+  if (at + sizeof(T) <= size)
+    memcpy(&v, args + at, sizeof(T));
+  at += sizeof(T);
+  return v;
+}
+
+// One conversion of the format with up to two '*' widths
+template <typename T>
+static int emit(char *out, size_t len, const char *spec, int stars,
+                const int *star, T v)
+{
+  if (stars == 2)
+    return snprintf(out, len, spec, star[0], star[1], v);
+  if (stars == 1)
+    return snprintf(out, len, spec, star[0], v);
+  return snprintf(out, len, spec, v);
+}
+
+size_t Journal::format(const Cell &cell, char *line, size_t len)
+{
+  size_t n      = 0;
+  size_t at     = 0;
+  const char *f = cell.format;
+
+  while (*f && n < len - 1) {
+    if (*f != '%') {
+      line[n++] = *f++;
+      continue;
+    }
+
+    // %[flags][width][.precision][length]conversion, copied as it is
+    char spec[16];
+    size_t s  = 0;
+    int star[2];
+    int stars = 0;
+    spec[s++] = *f++;
+    while (*f && strchr("-+ #0", *f) && s < sizeof(spec) - 4)
+      spec[s++] = *f++;
+    for (int part = 0; part < 2; part++) {
+      if (part == 1) {
+        if (*f != '.')
+          break;
+        spec[s++] = *f++;
+      }
+      if (*f == '*') {
+        star[stars++] = take<int32_t>(cell.args, cell.size, at);
+        spec[s++]     = *f++;
+      }
+      while (isdigit((unsigned char)*f) && s < sizeof(spec) - 4)
+        spec[s++] = *f++;
+    }
+    char length = 0;
+    while (*f && strchr("hljztL", *f) && s < sizeof(spec) - 2) {
+      length    = (length == 'l' && *f == 'l') ? 'L' : *f;
+      spec[s++] = *f++;
+    }
+    char conversion = *f ? *f++ : '\0';
+    spec[s++]       = conversion;
+    spec[s]         = '\0';
+
+    char *out   = line + n;
+    size_t room = len - n;
+    int w       = 0;
+    if (conversion == '%') {
+      w = snprintf(out, room, "%%");
+    } else if (strchr("diouxXc", conversion)) {
+      if (length == 'L' || length == 'j') {
+        auto v = take<long long>(cell.args, cell.size, at);
+        w      = emit(out, room, spec, stars, star, v);
+      } else if (length == 'l') {
+        auto v = take<long>(cell.args, cell.size, at);
+        w      = emit(out, room, spec, stars, star, v);
+      } else if (length == 'z' || length == 't') {
+        auto v = take<size_t>(cell.args, cell.size, at);
+        w      = emit(out, room, spec, stars, star, v);
+      } else {
+        auto v = take<int32_t>(cell.args, cell.size, at);
+        w      = emit(out, room, spec, stars, star, (int)v);
+      }
+    } else if (strchr("eEfFgGaA", conversion)) {
+      auto v = take<double>(cell.args, cell.size, at);
+      w      = emit(out, room, spec, stars, star, v);
+    } else if (conversion == 's') {
+      const char *v = "";
+      if (at < cell.size) {
+        v = (const char *)cell.args + at;
+        at += strnlen(v, cell.size - at) + 1;
+      }
+      w = emit(out, room, spec, stars, star, v);
+    } else if (conversion == 'p') {
+      auto v = take<uintptr_t>(cell.args, cell.size, at);
+      w      = emit(out, room, spec, stars, star, (void *)v);
+    } else {
+      break; // %n or garbage, the rest would not line up
+    }
+    if (w > 0)
+      n += std::min<size_t>(w, room - 1);
+  }
+  line[n] = '\0';
+  return n;
+}
+
+void Journal::drain()
+{
+  char line[JOURNAL_LINE];
+  char stamp[16];
+  uint8_t sinks = __atomic_load_n(&mSinkCount, __ATOMIC_ACQUIRE);
+  for (;;) {
+    Cell &cell   = mCells[mTail % JOURNAL_CELLS];
+    uint32_t seq = __atomic_load_n(&cell.seq, __ATOMIC_ACQUIRE);
+    if (seq != mTail + 1)
+      break;
+
+    size_t n = format(cell, line, sizeof(line));
+    int w    = snprintf(stamp, sizeof(stamp), "[%u] ", (unsigned)cell.ms);
+    for (uint8_t i = 0; i < sinks; i++) {
+      const Sink &sink = mSinks[i];
+      if (cell.level > sink.level)
+        continue;
+      if (sink.sink) {
+        sink.sink->line(cell.level, cell.ms, line, n);
+      } else {
+        sink.out->write((const uint8_t *)stamp, w);
+        sink.out->write((const uint8_t *)line, n);
+      }
+    }
+
+    __atomic_store_n(&cell.seq, mTail + JOURNAL_CELLS, __ATOMIC_RELEASE);
+    mTail++;
+  }
+
+  for (uint8_t i = 0; i < sinks; i++) {
+    if (mSinks[i].sink)
+      mSinks[i].sink->flush();
+  }
+}
+
+void Journal::task(void *arg)
+{
+  Journal *self = (Journal *)arg;
+  for (;;) {
+    self->drain();
+    vTaskDelay(pdMS_TO_TICKS(JOURNAL_DRAIN_MS));
+  }
+}
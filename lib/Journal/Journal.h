@@ -0,0 +1,173 @@
+#ifndef __journal_h__
+#define __journal_h__
+
+#include <Arduino.h>
+
+#include <algorithm>
+#include <type_traits>
+
+/*
+ * Deferred logging, so a debug line costs the caller a few hundred
+ * nanoseconds instead of the milliseconds Serial needs at 115200 baud.
+ *
+ * JOURNAL() does not format anything. It stores the address of the format
+ * string, the time and the raw arguments in one cell of a lock-free ring of
+ * JOURNAL_CELLS, any task on either core may call it. Strings are copied,
+ * so a String::c_str() or a buffer on the stack may go away right after.
+ * When the ring is full the line is dropped and counted.
+ *
+ * A task at the lowest priority on the network core formats the cells and
+ * writes them to every sink whose level lets them through. A sink is any
+ * Print, Serial or an fs::File, which gets "[millis] line", or a
+ * JournalSink, which gets the level and the line on its own and is flushed
+ * after every pass, see SyslogSink.
+ *
+ * Levels above JOURNAL_LEVEL are removed by the compiler, arguments and
+ * format strings included. The format is still checked against the
+ * arguments as printf() would be.
+ */
+
+#define JOURNAL_OFF   0
+#define JOURNAL_ERROR 1
+#define JOURNAL_WARN  2
+#define JOURNAL_INFO  3
+#define JOURNAL_DEBUG 4
+
+#ifndef JOURNAL_LEVEL
+#define JOURNAL_LEVEL JOURNAL_WARN
+#endif
+
+#define JOURNAL_CELLS    32  // x 128 bytes
+#define JOURNAL_ARGS     112 // argument bytes per line, strings truncated
+#define JOURNAL_SINKS    3
+#define JOURNAL_LINE     256 // formatted, longer lines are cut
+#define JOURNAL_DRAIN_MS 50
+
+class JournalSink
+{
+  public:
+  virtual void line(uint8_t level, uint32_t ms, const char *text,
+                    size_t len) = 0;
+  // After every pass of the journal task, whether there were lines or not
+  virtual void flush() {}
+};
+
+class Journal
+{
+  private:
+  struct Cell {
+    uint32_t seq; // ring position it is free or full for
+    uint32_t ms;
+    const char *format;
+    uint8_t level;
+    uint8_t size;    // of args
+    uint8_t reserve; // for the fixed size arguments still to come
+    uint8_t args[JOURNAL_ARGS];
+  };
+
+  struct Sink {
+    Print *out;
+    JournalSink *sink;
+    uint8_t level;
+  };
+
+  Cell mCells[JOURNAL_CELLS];
+  uint32_t mHead; // next to claim
+  uint32_t mTail; // next to drain, journal task only
+  uint32_t mDropped;
+
+  Sink mSinks[JOURNAL_SINKS];
+  uint8_t mSinkCount;
+  TaskHandle_t mTask;
+
+  Cell *claim();
+  void commit(Cell *cell);
+
+  // One overload per kind of argument, all padded to at least 4 bytes
+  void put(Cell *cell, const void *value, size_t len);
+  void put(Cell *cell, const char *s);
+  void put(Cell *cell, char *s) { put(cell, (const char *)s); }
+  void put(Cell *cell, double v) { put(cell, &v, sizeof(v)); }
+  template <typename T>
+  typename std::enable_if<std::is_integral<T>::value ||
+                          std::is_enum<T>::value>::type
+  put(Cell *cell, T v)
+  {
+    if (sizeof(T) > 4) {
+      uint64_t wide = (uint64_t)v;
+      put(cell, &wide, sizeof(wide));
+    } else {
+      uint32_t word = (uint32_t)v;
+      put(cell, &word, sizeof(word));
+    }
+  }
+  template <typename T> void put(Cell *cell, T *p)
+  {
+    uintptr_t address = (uintptr_t)p;
+    put(cell, &address, sizeof(address));
+  }
+
+  // What put() stores for T, strings at least their '\0' and whatever
+  // room the others leave
+  template <typename T> static constexpr size_t fixed()
+  {
+    return std::is_same<T, const char *>::value ||
+                   std::is_same<T, char *>::value
+               ? 1
+           : std::is_floating_point<T>::value ? sizeof(double)
+           : std::is_pointer<T>::value        ? sizeof(uintptr_t)
+                                              : (sizeof(T) > 4 ? 8 : 4);
+  }
+
+  size_t format(const Cell &cell, char *line, size_t len);
+  static void task(void *arg);
+
+  public:
+  Journal();
+  void begin();
+
+  // From one task, sinks can be added while running but never removed
+  bool addSink(Print *out, uint8_t level);
+  bool addSink(JournalSink *sink, uint8_t level);
+
+  template <typename... Args>
+  void log(uint8_t level, const char *format, Args... args)
+  {
+    Cell *cell = claim();
+    if (cell == nullptr)
+      return;
+    size_t sizes[] = {0, fixed<Args>()...};
+    size_t reserve = 0;
+    for (size_t size : sizes)
+      reserve += size;
+    cell->level   = level;
+    cell->format  = format;
+    cell->reserve = std::min<size_t>(reserve, JOURNAL_ARGS);
+    int expand[]  = {0, (put(cell, args), 0)...};
+    (void)expand;
+    commit(cell);
+  }
+
+  // Formats and writes out everything queued, then flushes the sinks,
+  // journal task only
+  void drain();
+  uint32_t dropped() { return mDropped; }
+};
+
+extern Journal journal;
+
+// Never called, lets the compiler check the format
+static inline void journalFormat(const char *format, ...)
+    __attribute__((format(printf, 1, 2)));
+static inline void journalFormat(const char *format, ...) {}
+
+#define JOURNAL(level, format, ...)                                            \
+  {                                                                            \
+    if (level <= JOURNAL_LEVEL) {                                              \
+      if (false)                                                               \
+        journalFormat(format, ##__VA_ARGS__);                                  \
+      journal.log(level, format, ##__VA_ARGS__);                               \
+    }                                                                          \
+  }
+
+#endif
@@ -0,0 +1,214 @@
+#include "KilnControl.h"
+
+KilnControl::KilnControl(DemandLimiter *demand)
+{
+  mDemand = demand;
+  memset(mSegments, 0, sizeof(mSegments));
+  mTemp     = 0;
+  mRaw      = 0;
+  mFault    = 0;
+  mSetpoint = KILN_UNSET;
+  mStep     = 0;
+  mHoldMs   = 0;
+  mSoakMin  = 0;
+  mStartMs  = 0;
+  mDiff     = 0;
+  mRelay    = false;
+
+  mSum     = 0;
+  mSamples = 0;
+  mTcError = false;
+}
+
+bool KilnControl::valid(const int segments[4][3])
+{
+  for (size_t i = 0; i < 4; i++) {
+    for (size_t j = 0; j < 2; j++) {
+      if (segments[i][j] == 0)
+        return false;
+    }
+  }
+  return segments[2][0] >= segments[1][0] && segments[1][0] >= segments[0][0];
+}
+
+bool KilnControl::field(int segments[4][3], const char *name,
+                        const char *value)
+{
+  if (name[0] != 's' || name[1] < '0' || name[1] > '3' || name[2] < '0' ||
+      name[2] > '2' || name[3] != '\0')
+    return false;
+  segments[name[1] - '0'][name[2] - '0'] = atol(value);
+  return true;
+}
+
+// The average starts over with the firing and the setpoint at the last
+// sample as taken, where the average stood before depends on when sampling
+// started. A replay from the start command decides the same from there.
+void KilnControl::start(const int segments[4][3], uint32_t now)
+{
+  memcpy(mSegments, segments, sizeof(mSegments));
+  mStep     = 0;
+  mHoldMs   = 0;
+  mSetpoint = mRaw;
+  mStartMs  = now;
+  mDiff     = 0;
+  mSum      = 0;
+  mSamples  = 0;
+}
+
+void KilnControl::resume(const int segments[4][3])
+{
+  memcpy(mSegments, segments, sizeof(mSegments));
+  mHoldMs = 0;
+  mDiff   = 0;
+
+  // TODO publish retain and account for hold
+  if (mTemp > mSegments[3][0])
+    mStep = 3;
+  else if (mTemp > mSegments[2][0])
+    mStep = 3;
+  else if (mTemp > mSegments[1][0])
+    mStep = 2;
+  else if (mTemp > mSegments[0][0])
+    mStep = 1;
+
+  mSetpoint = mTemp;
+}
+
+bool KilnControl::skip()
+{
+  if (mStep >= 3)
+    return false;
+  mStep++;
+  mHoldMs = 0;
+  return true;
+}
+
+void KilnControl::stop()
+{
+  mRelay    = false;
+  mSetpoint = KILN_UNSET;
+  mHoldMs   = 0;
+  mStep     = 0;
+}
+
+void KilnControl::sample(float temp, uint8_t fault)
+{
+  mTemp  = temp;
+  mRaw   = temp;
+  mFault = fault;
+}
+
+// Every fourth sample is replaced by the average of the four, the three in
+// between go through as they are
+KilnFilter KilnControl::filter()
+{
+  mSum += mTemp;
+  mSamples++;
+  if (mSamples == 4) {
+    mTemp    = (float)(mSum / mSamples);
+    mSum     = 0;
+    mSamples = 0;
+  }
+
+  // Ignore SCG fault
+  // https://forums.adafruit.com/viewtopic.php?f=31&t=169135#p827564
+  if (!(mFault & 0b001)) {
+    mTcError = false;
+    return KILN_TC_OK;
+  }
+  if (mTcError)
+    return KILN_TC_FAULTED;
+  mTemp    = NAN;
+  mTcError = true;
+  mRelay   = false;
+  return KILN_TC_FAULT;
+}
+
+// http://www.stoneware.net/stoneware/glasyrer/firing.htm
+void KilnControl::ramp()
+{
+  if (mSetpoint == KILN_UNSET)
+    mSetpoint = mTemp;
+
+  // Slower while the demand cap keeps the relay off
+  float scale = mDemand->rampScale(KILN_RAMP_S);
+  if (mStep > 3)
+    return;
+
+  if (mSetpoint >= mSegments[mStep][0]) {
+    // TODO alarm if takes too long
+    mSetpoint = mSegments[mStep][0];
+  } else {
+    mSetpoint +=
+        (float)(mSegments[mStep][1] / (3600.0f / KILN_RAMP_S)) * scale;
+  }
+}
+
+uint8_t KilnControl::hold(uint32_t now)
+{
+  uint8_t events = KILN_E_SOAK;
+  if (mHoldMs == 0) {
+    mHoldMs = now;
+    events |= KILN_E_HOLD;
+  }
+  mSoakMin = (now - mHoldMs) / (60 * 1000);
+
+  if (mSoakMin >= (uint32_t)mSegments[mStep][2]) {
+    mStep++;
+    mHoldMs = 0;
+    events |= KILN_E_NEXT;
+  }
+  return events;
+}
+
+uint8_t KilnControl::control(uint32_t now, float elementW)
+{
+  uint8_t events = 0;
+  if (isnan(mTemp))
+    return events;
+
+  float delta = mSetpoint - mTemp - mDiff;
+  bool heat   = mDemand->allow(delta >= 0, elementW, now);
+  if (heat) {
+    if (!mRelay) {
+      mRelay = true;
+      mDiff  = 0;
+      events |= KILN_E_RELAY;
+    }
+  } else if (mRelay) {
+    mRelay = false;
+    events |= KILN_E_RELAY;
+    // Held off by the demand cap, not above the setpoint
+    if (delta < 0)
+      mDiff = KILN_DIFFERENTIAL;
+  }
+  if (mStep >= 4)
+    return events;
+
+  if (mTemp > mSegments[mStep][0]) {
+    mSetpoint = mSegments[mStep][0];
+    if (mSegments[mStep][2] == -1)
+      mSegments[mStep][2] = 0;
+    events |= hold(now);
+
+    // Past the last soak
+    if (mStep == 4) {
+      mStep++;
+      events |= KILN_E_COOL;
+    }
+  }
+  return events;
+}
+
+uint8_t KilnControl::cool(uint32_t now, float elementW)
+{
+  uint8_t events = 0;
+  if (mSetpoint < KILN_COOL_TO || mStep == 5) {
+    mSetpoint = 0;
+    events    = control(now, elementW) | KILN_E_DONE;
+  }
+
+  mSetpoint -= (float)(KILN_COOL_RATE / (3600.0f / KILN_RAMP_S));
+  return events;
+}
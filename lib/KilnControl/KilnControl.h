@@ -0,0 +1,105 @@
+#ifndef __kiln_control_h__
+#define __kiln_control_h__
+
+#include <Arduino.h>
+
+#include "DemandLimiter.h"
+
+/*
+ * The firing itself, without the hardware, the tasks or the network: the
+ * average of four samples, the setpoint ramp, the soaks, the relay decision
+ * with its differential and the end of the firing.
+ *
+ * The control task feeds it its jobs' inputs and acts on what comes back,
+ * the KREC replayer (tools/krec) and the host tests feed it a recording or a
+ * log the same way, so all of them decide the same. Nothing in here reads a
+ * clock: time is the millis() of the job that runs it, passed in.
+ *
+ * A schedule is four segments of target (degC), rate (degC/h) and soak
+ * (min). step counts through them, 4 is the end of the last soak and 5
+ * cooling. relay() is what the controller decided, the safety monitor may
+ * still hold the pin low.
+ */
+
+#define KILN_DIFFERENTIAL 5     // degC under the setpoint to switch on again
+#define KILN_RAMP_S       60    // setpoint ramp and cooling period
+#define KILN_ELEMENT_W    3600  // W, until PulseMeter measures it
+// https://digitalfire.com/schedule/04dsdh
+#define KILN_COOL_RATE    83.0  // degC/h
+#define KILN_COOL_TO      760   // degC, the firing is over below
+#define KILN_UNSET        -9999 // setpoint while idle
+
+typedef int KilnSchedule[4][3];
+
+enum KilnFilter : uint8_t {
+  KILN_TC_OK,
+  KILN_TC_FAULT,   // came up with this sample, the relay is off
+  KILN_TC_FAULTED, // still there
+};
+
+// What control() and cool() did that the caller has to act on
+#define KILN_E_RELAY (1 << 0) // relay() changed
+#define KILN_E_HOLD  (1 << 1) // a soak started, the ramp stops
+#define KILN_E_SOAK  (1 << 2) // soaking, on every pass of it
+#define KILN_E_NEXT  (1 << 3) // soak over, the ramp goes on to step()
+#define KILN_E_COOL  (1 << 4) // last soak over, slow cooling starts
+#define KILN_E_DONE  (1 << 5) // cooled down, the firing is over
+
+class KilnControl
+{
+  private:
+  DemandLimiter *mDemand;
+  KilnSchedule mSegments;
+  float mTemp;     // filtered, or the raw sample in between, see filter()
+  float mRaw;      // the last sample as taken
+  uint8_t mFault;  // MAX31855 fault bits of the sample
+  float mSetpoint;
+  int mStep;
+  uint32_t mHoldMs; // start of the soak, 0 while ramping
+  uint32_t mSoakMin;
+  uint32_t mStartMs;
+  uint8_t mDiff;
+  bool mRelay;
+
+  float mSum;
+  uint8_t mSamples;
+  bool mTcError;
+
+  uint8_t hold(uint32_t now);
+
+  public:
+  KilnControl(DemandLimiter *demand);
+
+  static bool valid(const int segments[4][3]);
+  // A field of the firing form, "s12" is segments[1][2]. False if name
+  // isn't one, segments untouched.
+  static bool field(int segments[4][3], const char *name, const char *value);
+
+  // Commands, segments valid
+  void start(const int segments[4][3], uint32_t now);
+  // After a reset, the step guessed from the sample just taken
+  void resume(const int segments[4][3]);
+  // To the next segment, the final one can't be skipped
+  bool skip();
+  void stop();
+
+  // Jobs, in the order the scheduler runs them
+  void sample(float temp, uint8_t fault);
+  KilnFilter filter();
+  void ramp();
+  uint8_t control(uint32_t now, float elementW);
+  uint8_t cool(uint32_t now, float elementW);
+
+  const KilnSchedule &segments() { return mSegments; }
+  float temp() { return mTemp; }
+  uint8_t fault() { return mFault; }
+  float setpoint() { return mSetpoint; }
+  int step() { return mStep; }
+  bool holding() { return mHoldMs != 0; }
+  // Of the soak control() last saw, whole minutes
+  uint32_t soaked() { return mSoakMin; }
+  bool relay() { return mRelay; }
+  uint32_t startMs() { return mStartMs; }
+};
+
+#endif
@@ -0,0 +1,301 @@
+#include "KrecReplay.h"
+
+KrecReader::KrecReader(const uint8_t *data, size_t len)
+{
+  mData    = data;
+  mLen     = len;
+  mAt      = 0;
+  mUs      = 0;
+  mPulseUs = 0;
+  mError   = nullptr;
+
+  const uint8_t magic[] = {'K', 'R', 'E', 'C'};
+  if (len < 5 || memcmp(data, magic, 4))
+    mError = "not a KREC file";
+  else if (data[4] != REC_VERSION)
+    mError = "unknown version";
+  else
+    mAt = 5;
+}
+
+bool KrecReader::varint(uint64_t &v)
+{
+  v = 0;
+  for (uint8_t shift = 0; shift < 64 && mAt < mLen; shift += 7) {
+    uint8_t b = mData[mAt++];
+    v |= (uint64_t)(b & 0x7f) << shift;
+    if (!(b & 0x80))
+      return true;
+  }
+  return false;
+}
+
+bool KrecReader::bytes(void *out, size_t len)
+{
+  if (mLen - mAt < len)
+    return false;
+  memcpy(out, mData + mAt, len);
+  mAt += len;
+  return true;
+}
+
+static int64_t unzigzag(uint64_t v)
+{
+  return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+bool KrecReader::next(KrecEvent &e)
+{
+  if (mError || mAt == mLen)
+    return false;
+
+  memset(&e, 0, sizeof(e));
+  e.offset = mAt;
+  e.type   = (RecEvent)mData[mAt++];
+  uint64_t delta, v = 0;
+  bool ok = varint(delta);
+  mUs += delta;
+
+  uint8_t b = 0;
+  switch (e.type) {
+  case REC_START:
+    ok = ok && bytes(&e.us, 8) && bytes(&e.epoch, 4);
+    mUs      = e.us;
+    mPulseUs = e.us;
+    break;
+  case REC_JOB:
+    ok = ok && bytes(&e.job, 1);
+    break;
+  case REC_FRAME:
+    ok = ok && bytes(&e.temp, 4) && bytes(&e.internal, 4) &&
+         bytes(&e.fault, 1);
+    break;
+  case REC_PULSE:
+    ok = ok && varint(v);
+    mPulseUs += unzigzag(v);
+    e.pulseUs = mPulseUs;
+    break;
+  case REC_COMMAND:
+    ok = ok && bytes(&e.cmd, 1);
+    for (uint8_t i = 0; i < 4; i++) {
+      for (uint8_t j = 0; j < 3; j++) {
+        ok                = ok && varint(v);
+        e.schedule[i][j] = unzigzag(v);
+      }
+    }
+    break;
+  case REC_TIME:
+    ok = ok && bytes(&e.epoch, 4) && varint(v);
+    e.syncs = v;
+    break;
+  case REC_RELAY:
+    ok   = ok && bytes(&b, 1);
+    e.on = b;
+    break;
+  case REC_GAP:
+    ok        = ok && varint(v);
+    e.dropped = v;
+    break;
+  default:
+    mError = "unknown event";
+    return false;
+  }
+  e.us = mUs;
+
+  if (!ok) {
+    mError = "truncated event";
+    return false;
+  }
+  return true;
+}
+
+KrecReplay::KrecReplay() : mController(&mDemand)
+{
+  memset(mResumeSchedule, 0, sizeof(mResumeSchedule));
+  mJobUs        = 0;
+  mFiring       = false;
+  mResume       = false;
+  mCompare      = false;
+  mDone         = false;
+  mPendingCount = 0;
+  mEvents       = 0;
+  mDecisions    = 0;
+  mFirings      = 0;
+  mMismatch     = nullptr;
+  memset(&mAt, 0, sizeof(mAt));
+}
+
+bool KrecReplay::demand(JsonVariantConst settings)
+{
+  return mDemand.configure(settings);
+}
+
+void KrecReplay::mismatch(const KrecEvent &e, const char *what)
+{
+  mMismatch = what;
+  mAt       = e;
+  mDone     = true;
+}
+
+// main.cpp's relay(), the decision before the safety override
+void KrecReplay::relay(bool on)
+{
+  mPulseMeter.relay(on, mJobUs);
+  if (!mCompare)
+    return;
+  if (mPendingCount == sizeof(mPending)) {
+    mismatch(mAt, "decided more than the kiln recorded");
+    return;
+  }
+  mPending[mPendingCount++] = on;
+}
+
+float KrecReplay::elementPower()
+{
+  float w = mPulseMeter.elementPower();
+  return w > 0 ? w : KILN_ELEMENT_W;
+}
+
+// What controlEvents() in main.cpp changes of the state a replay needs
+void KrecReplay::controlEvents(uint8_t events)
+{
+  if (events & KILN_E_RELAY)
+    relay(mController.relay());
+  if (events & KILN_E_DONE)
+    mFiring = false;
+}
+
+void KrecReplay::job(const KrecEvent &e)
+{
+  mJobUs = e.us;
+  switch (e.job) {
+  case KREC_JOB_FILTER:
+    if (mController.filter() == KILN_TC_FAULT)
+      relay(false);
+    break;
+  case KREC_JOB_RAMP:
+    mController.ramp();
+    break;
+  case KREC_JOB_CONTROL:
+    controlEvents(mController.control(mJobUs / 1000, elementPower()));
+    break;
+  case KREC_JOB_COOL:
+    controlEvents(mController.cool(mJobUs / 1000, elementPower()));
+    break;
+  }
+}
+
+// getTemp(), the pulses of the sample are in the meter's ring by now
+void KrecReplay::sample(const KrecEvent &e)
+{
+  int segment = mFiring ? mController.step() : -1;
+  mPulseMeter.update(segment, mJobUs);
+  mDemand.account(mPulseMeter.energyWh(), mJobUs / 1000);
+  mController.sample(e.temp, e.fault);
+
+  if (mResume) {
+    mResume = false;
+    mController.resume(mResumeSchedule);
+    mController.ramp();
+    mFiring = true;
+  }
+}
+
+void KrecReplay::command(const KrecEvent &e)
+{
+  mJobUs = e.us;
+  switch (e.cmd) {
+  case KREC_CMD_START:
+    if (!KilnControl::valid(e.schedule))
+      break;
+    mDemand.resetDelay();
+    mController.start(e.schedule, mJobUs / 1000);
+    mController.ramp();
+    mFiring  = true;
+    mCompare = true;
+    mFirings++;
+    break;
+  case KREC_CMD_RESUME:
+    // The step is guessed from the sample resumeFiring() takes next. The
+    // average isn't reset, comparing waits for a start.
+    mDemand.resetDelay();
+    memcpy(mResumeSchedule, e.schedule, sizeof(mResumeSchedule));
+    mResume = true;
+    break;
+  case KREC_CMD_STOP:
+    mFiring = false;
+    mController.stop();
+    relay(false);
+    break;
+  case KREC_CMD_SKIP:
+    if (mFiring)
+      mController.skip();
+    break;
+  }
+}
+
+void KrecReplay::recorded(const KrecEvent &e)
+{
+  if (!mCompare)
+    return;
+  if (mPendingCount == 0) {
+    mismatch(e, "the kiln decided, the replay didn't");
+    return;
+  }
+  bool on = mPending[0];
+  mPendingCount--;
+  memmove(mPending, mPending + 1, mPendingCount);
+  if (on != e.on) {
+    mismatch(e, on ? "replay on, kiln off" : "replay off, kiln on");
+    return;
+  }
+  mDecisions++;
+}
+
+bool KrecReplay::event(const KrecEvent &e)
+{
+  if (mDone)
+    return false;
+  mEvents++;
+  mAt = e;
+
+  // Whatever the last job or command decided came up right after it
+  if ((e.type == REC_JOB || e.type == REC_COMMAND) && mPendingCount) {
+    mismatch(e, "the replay decided, the kiln didn't");
+    return false;
+  }
+
+  switch (e.type) {
+  case REC_JOB:
+    job(e);
+    break;
+  case REC_FRAME:
+    sample(e);
+    break;
+  case REC_PULSE:
+    HostShim::setUs(e.pulseUs);
+    mPulseMeter.capture();
+    break;
+  case REC_COMMAND:
+    command(e);
+    break;
+  case REC_RELAY:
+    recorded(e);
+    break;
+  case REC_GAP:
+    // Inputs are missing, up to the next start
+    mCompare      = false;
+    mPendingCount = 0;
+    break;
+  default:
+    break;
+  }
+  return !mDone;
+}
+
+bool KrecReplay::end()
+{
+  if (!mDone && mPendingCount)
+    mismatch(mAt, "the replay decided, the kiln didn't");
+  return !mDone;
+}
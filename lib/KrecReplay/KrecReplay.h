@@ -0,0 +1,133 @@
+#ifndef __krec_replay_h__
+#define __krec_replay_h__
+
+#include <Arduino.h>
+
+#include "DemandLimiter.h"
+#include "InputRecorder.h"
+#include "KilnControl.h"
+#include "PulseMeter.h"
+
+/*
+ * Reads back what InputRecorder wrote and runs the control logic over it
+ * again, on the host against HostShim: tools/krec and the native tests.
+ *
+ * KrecReader decodes one file into events with absolute esp_timer times.
+ * KrecReplay takes them in order, across the old file and then the current
+ * one, and does what the control task did with each: the jobs it ran, the
+ * samples and meter pulses they took and the commands it was sent. Every
+ * relay() the replay decides on is checked against the REC_RELAY the kiln
+ * recorded at that point, the first one that differs ends the comparison.
+ *
+ * Comparing starts at a start command, the controller's state before it
+ * isn't in the stream. A REC_GAP stops it until the next one. Decisions
+ * are the controller's, before the safety monitor's override, so a trip
+ * doesn't end it. What the demand cap allows depends on the energy used in
+ * its window: with a cap, record from well before the firing, and pass the
+ * settings the kiln had.
+ */
+
+// main.cpp's Job and ControlCommand, the stream has them by number
+#define KREC_JOB_SAMPLE  0
+#define KREC_JOB_FILTER  1
+#define KREC_JOB_RAMP    2
+#define KREC_JOB_CONTROL 3
+#define KREC_JOB_COOL    4
+
+#define KREC_CMD_START  0
+#define KREC_CMD_RESUME 1
+#define KREC_CMD_STOP   2
+#define KREC_CMD_SKIP   3
+
+struct KrecEvent {
+  RecEvent type;
+  int64_t us;    // esp_timer time
+  size_t offset; // in the file
+  uint32_t epoch;
+  uint8_t job;
+  float temp;
+  float internal;
+  uint8_t fault;
+  int64_t pulseUs;
+  uint8_t cmd;
+  int schedule[4][3];
+  uint32_t syncs;
+  bool on;
+  uint32_t dropped;
+};
+
+class KrecReader
+{
+  private:
+  const uint8_t *mData;
+  size_t mLen;
+  size_t mAt;
+  int64_t mUs;
+  int64_t mPulseUs;
+  const char *mError;
+
+  bool varint(uint64_t &v);
+  bool bytes(void *out, size_t len);
+
+  public:
+  KrecReader(const uint8_t *data, size_t len);
+
+  // False at the end of the data or on an error
+  bool next(KrecEvent &e);
+  // nullptr after a clean end
+  const char *error() { return mError; }
+};
+
+class KrecReplay
+{
+  private:
+  DemandLimiter mDemand;
+  PulseMeter mPulseMeter;
+  KilnControl mController;
+  int64_t mJobUs;
+  bool mFiring;  // JOB_CONTROL running on the kiln
+  bool mResume;  // a resume waiting for the sample it guesses from
+  KilnSchedule mResumeSchedule;
+  bool mCompare; // from a start on
+  bool mDone;    // a mismatch ended it
+
+  // Decided, not come up in the recording yet
+  bool mPending[4];
+  uint8_t mPendingCount;
+
+  uint32_t mEvents;
+  uint32_t mDecisions;
+  uint32_t mFirings;
+  const char *mMismatch;
+  KrecEvent mAt;
+
+  void relay(bool on);
+  void controlEvents(uint8_t events);
+  float elementPower();
+  void job(const KrecEvent &e);
+  void command(const KrecEvent &e);
+  void sample(const KrecEvent &e);
+  void recorded(const KrecEvent &e);
+  void mismatch(const KrecEvent &e, const char *what);
+
+  public:
+  KrecReplay();
+  // The kiln's /demand.txt settings, false if it would refuse them
+  bool demand(JsonVariantConst settings);
+
+  // Events in the order they were recorded, false once they stop matching
+  bool event(const KrecEvent &e);
+  // Decisions left over at the end count as a mismatch too
+  bool end();
+
+  uint32_t events() { return mEvents; }
+  // Relay decisions matched against the recording
+  uint32_t decisions() { return mDecisions; }
+  uint32_t firings() { return mFirings; }
+  // nullptr while everything matched, else what differed at mismatchAt()
+  const char *mismatch() { return mMismatch; }
+  const KrecEvent &mismatchAt() { return mAt; }
+  KilnControl &controller() { return mController; }
+};
+
+#endif
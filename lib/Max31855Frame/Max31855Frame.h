@@ -0,0 +1,48 @@
+#ifndef __max31855_frame_h__
+#define __max31855_frame_h__
+
+#include <Arduino.h>
+
+/*
+ * The 32 bit frame the MAX31855 shifts out, decoded. One read gives the
+ * thermocouple, the cold junction and the fault bits of the same
+ * conversion, so getTemp() reads it once instead of once per field.
+ *
+ * The arithmetic is Adafruit_MAX31855's, which decodes through here too:
+ * the thermocouple comes back as converted even with a fault bit set, see
+ * the note in readCelsius(). Header only, so the host benchmarks decode
+ * without the SPI driver.
+ */
+
+class Max31855Frame
+{
+  public:
+  // Thermocouple, degC in 0.25 steps, bits 31..18 two's complement
+  static double celsius(uint32_t frame)
+  {
+    int32_t v;
+    if (frame & 0x80000000)
+      v = 0xFFFFC000 | ((frame >> 18) & 0x00003FFF);
+    else
+      v = frame >> 18;
+    return v * 0.25;
+  }
+
+  // Cold junction, degC in 0.0625 steps, bits 15..4 two's complement
+  static double internal(uint32_t frame)
+  {
+    uint32_t v     = frame >> 4;
+    float internal = v & 0x7FF;
+    if (v & 0x800) {
+      int16_t tmp = 0xF800 | (v & 0x7FF);
+      internal    = tmp;
+    }
+    internal *= 0.0625;
+    return internal;
+  }
+
+  // Open circuit, short to GND, short to VCC in bits 0..2
+  static uint8_t fault(uint32_t frame) { return frame & 0x7; }
+};
+
+#endif
@@ -0,0 +1,134 @@
+#include "Metrics.h"
+
+Metrics metrics;
+
+static const uint32_t bucketUs[METRIC_BUCKETS] = {
+    50, 100, 250, 500, 1000, 2500, 5000, 10000, 25000, 50000};
+
+static const char *bucketLe[METRIC_BUCKETS] = {
+    "5e-05", "0.0001", "0.00025", "0.0005", "0.001",
+    "0.0025", "0.005", "0.01", "0.025", "0.05",
+};
+
+static const char *timerNames[METRIC_T_COUNT] = {
+    "sample", "filter",    "control", "send",
+    "safety", "processor", "sse",     "history",
+    "form"};
+
+// Control stages share a SAMPLE_MS slot with each other and the sender,
+// handlers on AsyncTCP block every other client while they run
+static const uint32_t timerBudgetUs[METRIC_T_COUNT] = {
+    1000,  // sample, three SPI frames and the meter
+    500,   // filter
+    500,   // control
+    10000, // send, JSON and the MQTT enqueue
+    250,   // safety
+    25000, // processor, the history graph included
+    2500,  // sse
+    10000, // history, WS_HISTORY_BURST frames per client
+    2500,  // form
+};
+
+static const char *counterNames[METRIC_C_COUNT] = {
+    "kiln_samples_total",
+    "kiln_relay_toggles_total",
+    "kiln_spi_errors_total",
+    "kiln_mqtt_published_total",
+    "kiln_mqtt_failed_total",
+    "kiln_sse_dropped_total",
+};
+
+Metrics::Metrics()
+{
+  memset(mTimers, 0, sizeof(mTimers));
+  memset(mCounters, 0, sizeof(mCounters));
+  memset(mReported, 0, sizeof(mReported));
+
+  mCyclesPerUs = 240;
+}
+
+void Metrics::begin() { mCyclesPerUs = getCpuFrequencyMhz(); }
+
+const char *Metrics::name(MetricTimer timer)
+{
+  return timer < METRIC_T_COUNT ? timerNames[timer] : "?";
+}
+
+uint32_t Metrics::budgetUs(MetricTimer timer)
+{
+  return timer < METRIC_T_COUNT ? timerBudgetUs[timer] : 0;
+}
+
+void Metrics::observe(MetricTimer timer, uint32_t us)
+{
+  uint8_t b = 0;
+  while (b < METRIC_BUCKETS && us > bucketUs[b])
+    b++;
+
+  portENTER_CRITICAL(&mLock);
+  Histogram &h = mTimers[timer];
+  if (b < METRIC_BUCKETS)
+    h.buckets[b]++;
+  h.count++;
+  h.sumUs += us;
+  if (us > h.maxUs)
+    h.maxUs = us;
+  if (us > timerBudgetUs[timer])
+    h.over++;
+  portEXIT_CRITICAL(&mLock);
+}
+
+uint32_t Metrics::overBudget()
+{
+  uint32_t mask = 0;
+  portENTER_CRITICAL(&mLock);
+  for (uint8_t t = 0; t < METRIC_T_COUNT; t++) {
+    if (mTimers[t].over != mReported[t])
+      mask |= 1 << t;
+    mReported[t] = mTimers[t].over;
+  }
+  portEXIT_CRITICAL(&mLock);
+  return mask;
+}
+
+void Metrics::print(Print &out)
+{
+  out.print("# TYPE kiln_callback_seconds histogram\n");
+  for (uint8_t t = 0; t < METRIC_T_COUNT; t++) {
+    portENTER_CRITICAL(&mLock);
+    Histogram h = mTimers[t];
+    portEXIT_CRITICAL(&mLock);
+
+    uint32_t cumulative = 0;
+    for (uint8_t b = 0; b < METRIC_BUCKETS; b++) {
+      cumulative += h.buckets[b];
+      out.printf("kiln_callback_seconds_bucket{fn=\"%s\",le=\"%s\"} %u\n",
+                 timerNames[t], bucketLe[b], cumulative);
+    }
+    out.printf("kiln_callback_seconds_bucket{fn=\"%s\",le=\"+Inf\"} %u\n",
+               timerNames[t], h.count);
+    out.printf("kiln_callback_seconds_sum{fn=\"%s\"} %.6f\n", timerNames[t],
+               h.sumUs / 1e6);
+    out.printf("kiln_callback_seconds_count{fn=\"%s\"} %u\n", timerNames[t],
+               h.count);
+  }
+
+  out.print("# TYPE kiln_callback_budget_seconds gauge\n");
+  for (uint8_t t = 0; t < METRIC_T_COUNT; t++)
+    out.printf("kiln_callback_budget_seconds{fn=\"%s\"} %.6f\n",
+               timerNames[t], timerBudgetUs[t] / 1e6);
+  out.print("# TYPE kiln_callback_max_seconds gauge\n");
+  for (uint8_t t = 0; t < METRIC_T_COUNT; t++)
+    out.printf("kiln_callback_max_seconds{fn=\"%s\"} %.6f\n", timerNames[t],
+               __atomic_load_n(&mTimers[t].maxUs, __ATOMIC_RELAXED) / 1e6);
+  out.print("# TYPE kiln_callback_over_budget_total counter\n");
+  for (uint8_t t = 0; t < METRIC_T_COUNT; t++)
+    out.printf("kiln_callback_over_budget_total{fn=\"%s\"} %u\n",
+               timerNames[t],
+               __atomic_load_n(&mTimers[t].over, __ATOMIC_RELAXED));
+
+  for (uint8_t c = 0; c < METRIC_C_COUNT; c++) {
+    out.printf("# TYPE %s counter\n", counterNames[c]);
+    out.printf("%s %u\n", counterNames[c], counter((MetricCounter)c));
+  }
+}
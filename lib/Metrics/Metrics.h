@@ -0,0 +1,122 @@
+#ifndef __metrics_h__
+#define __metrics_h__
+
+#include <Arduino.h>
+
+/*
+ * Hot path instrumentation that never allocates.
+ *
+ * A MetricScope reads the CPU cycle counter when it is created and again
+ * when it goes out of scope, and adds the time in between to a histogram
+ * with fixed buckets from 50us to 50ms. The cycle counter is per core and
+ * the measured tasks are pinned, control on core 1, the network task and
+ * AsyncTCP on core 0, so a scope never reads two different counters. It
+ * wraps after 2^32 cycles, 17s at 240MHz, far beyond anything measured
+ * here.
+ *
+ * Every timer has a budget, what the path may take before it starts eating
+ * into the sample period or the AsyncTCP watchdog. Runs over it are counted
+ * and the slowest run kept, overBudget() tells which timers went over since
+ * it was last asked so the caller can raise an alarm.
+ *
+ * Counters are 32 bit and only ever go up, as Prometheus expects. print()
+ * writes all of it in the Prometheus text format:
+ *
+ *   kiln_callback_seconds_bucket{fn="sample",le="0.0001"} 42
+ *   kiln_callback_seconds_sum{fn="sample"} 0.0031
+ *   kiln_callback_seconds_count{fn="sample"} 45
+ *   kiln_callback_budget_seconds{fn="sample"} 0.001
+ *   kiln_callback_max_seconds{fn="sample"} 0.00021
+ *   kiln_callback_over_budget_total{fn="sample"} 0
+ *   kiln_samples_total 45
+ */
+
+#define METRIC_BUCKETS 10 // finite ones, +Inf is count
+
+enum MetricTimer : uint8_t {
+  METRIC_T_SAMPLE,
+  METRIC_T_FILTER,
+  METRIC_T_CONTROL,
+  METRIC_T_SEND,
+  METRIC_T_SAFETY,
+  METRIC_T_PROCESSOR, // page template expansion
+  METRIC_T_SSE,
+  METRIC_T_HISTORY, // WebSocket history replay, per service()
+  METRIC_T_FORM,    // schedule form on the page
+  METRIC_T_COUNT,
+};
+
+enum MetricCounter : uint8_t {
+  METRIC_C_SAMPLES,
+  METRIC_C_RELAY,      // relay toggles
+  METRIC_C_SPI_ERRORS, // MAX31855 faults and NaN readings
+  METRIC_C_MQTT_SENT,
+  METRIC_C_MQTT_FAILED,
+  METRIC_C_SSE_DROPPED,
+  METRIC_C_COUNT,
+};
+
+class Metrics
+{
+  private:
+  struct Histogram {
+    uint32_t buckets[METRIC_BUCKETS]; // not cumulative, print() adds up
+    uint32_t count;
+    uint64_t sumUs;
+    uint32_t maxUs;
+    uint32_t over; // runs over budget
+  };
+
+  portMUX_TYPE mLock = portMUX_INITIALIZER_UNLOCKED;
+  Histogram mTimers[METRIC_T_COUNT];
+  uint32_t mCounters[METRIC_C_COUNT];
+  uint32_t mReported[METRIC_T_COUNT]; // over at the last overBudget()
+  uint32_t mCyclesPerUs;
+
+  public:
+  Metrics();
+  // Once the CPU clock is set
+  void begin();
+
+  void observe(MetricTimer timer, uint32_t us);
+  void observeCycles(MetricTimer timer, uint32_t cycles)
+  {
+    observe(timer, cycles / mCyclesPerUs);
+  }
+  void count(MetricCounter counter, uint32_t n = 1)
+  {
+    __atomic_fetch_add(&mCounters[counter], n, __ATOMIC_RELAXED);
+  }
+  uint32_t counter(MetricCounter counter)
+  {
+    return __atomic_load_n(&mCounters[counter], __ATOMIC_RELAXED);
+  }
+
+  // Bit per timer that went over budget since the last call
+  uint32_t overBudget();
+
+  void print(Print &out);
+
+  static const char *name(MetricTimer timer);
+  static uint32_t budgetUs(MetricTimer timer);
+};
+
+extern Metrics metrics;
+
+class MetricScope
+{
+  private:
+  MetricTimer mTimer;
+  uint32_t mStart;
+
+  public:
+  MetricScope(MetricTimer timer) : mTimer(timer), mStart(ESP.getCycleCount())
+  {
+  }
+  ~MetricScope()
+  {
+    metrics.observeCycles(mTimer, ESP.getCycleCount() - mStart);
+  }
+};
+
+#endif
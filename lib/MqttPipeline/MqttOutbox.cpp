@@ -0,0 +1,136 @@
+#include "MqttOutbox.h"
+
+#include <algorithm>
+
+#include "Timebase.h"
+
+MqttOutbox::MqttOutbox()
+{
+  mHead       = 0;
+  mCount      = 0;
+  mFs         = nullptr;
+  mPath       = nullptr;
+  mFlashMax   = 0;
+  mFlashRead  = 0;
+  mFlashCount = 0;
+  mFlashStale = 0;
+  mDropped    = 0;
+  mSpilled    = 0;
+}
+
+void MqttOutbox::begin(fs::FS *fs, const char *path, size_t flashBytes)
+{
+  mFs       = fs;
+  mPath     = path;
+  mFlashMax = flashBytes / sizeof(TelemetrySample);
+
+  if (mFs == nullptr || mFlashMax == 0)
+    return;
+
+  // Left over from before a reset
+  File file = mFs->open(mPath, FILE_READ);
+  if (file) {
+    size_t size = file.size();
+    file.close();
+    // Written with a different record layout, can't be replayed
+    if (size % sizeof(TelemetrySample))
+      mFs->remove(mPath);
+    else
+      mFlashCount = size / sizeof(TelemetrySample);
+    mFlashStale = mFlashCount;
+  }
+}
+
+bool MqttOutbox::spill(const TelemetrySample &s)
+{
+  if (mFs == nullptr || mFlashCount >= mFlashMax)
+    return false;
+
+  File file = mFs->open(mPath, FILE_APPEND);
+  if (!file)
+    return false;
+
+  bool ok = file.write((const uint8_t *)&s, sizeof(s)) == sizeof(s);
+  file.close();
+  if (ok) {
+    mFlashCount++;
+    mSpilled++;
+  }
+  return ok;
+}
+
+void MqttOutbox::push(const TelemetrySample &s)
+{
+  if (mCount == OUTBOX_RAM) {
+    bool flash = mFs != nullptr && mFlashMax > 0;
+    if (flash && !spill(mRing[mHead])) {
+      // Dropping the oldest in RAM would leave a hole after the file
+      mDropped++;
+      return;
+    }
+    if (!flash)
+      mDropped++;
+    mHead = (mHead + 1) % OUTBOX_RAM;
+    mCount--;
+  }
+
+  mRing[(mHead + mCount) % OUTBOX_RAM] = s;
+  mCount++;
+}
+
+// Oldest first, the file before the ring
+size_t MqttOutbox::peek(TelemetrySample *out, size_t limit)
+{
+  size_t n         = 0;
+  size_t flashLeft = mFlashCount - mFlashRead;
+
+  if (flashLeft) {
+    File file = mFs->open(mPath, FILE_READ);
+    if (file && file.seek(mFlashRead * sizeof(TelemetrySample))) {
+      size_t want = std::min(limit, flashLeft);
+      n = file.read((uint8_t *)out, want * sizeof(TelemetrySample)) /
+          sizeof(TelemetrySample);
+    }
+    // Provisional stamps of an earlier boot, this boot's offset doesn't fit
+    for (size_t i = 0; i < n && mFlashRead + i < mFlashStale; i++) {
+      if (!Timebase::valid(out[i].ts))
+        out[i].ts = 0;
+    }
+    if (file)
+      file.close();
+    if (n == 0) {
+      // Unreadable, give up on the file rather than stall the replay
+      mDropped += flashLeft;
+      mFlashRead = mFlashCount;
+      flashLeft  = 0;
+      pop(0);
+    }
+  }
+
+  // The ring only follows once the whole file is out
+  if (n < flashLeft)
+    return n;
+
+  for (size_t i = 0; n < limit && i < mCount; i++)
+    out[n++] = mRing[(mHead + i) % OUTBOX_RAM];
+
+  return n;
+}
+
+void MqttOutbox::pop(size_t n)
+{
+  size_t fromFlash = std::min(n, mFlashCount - mFlashRead);
+  mFlashRead += fromFlash;
+  n -= fromFlash;
+
+  if (mFlashCount && mFlashRead == mFlashCount) {
+    mFs->remove(mPath);
+    mFlashRead  = 0;
+    mFlashCount = 0;
+    mFlashStale = 0;
+  }
+
+  n = std::min(n, mCount);
+  mHead = (mHead + n) % OUTBOX_RAM;
+  mCount -= n;
+}
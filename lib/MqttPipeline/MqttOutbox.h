@@ -0,0 +1,60 @@
+#ifndef __mqtt_outbox_h__
+#define __mqtt_outbox_h__
+
+#include <Arduino.h>
+#include <FS.h>
+
+#include "TelemetrySample.h"
+
+/*
+ * Bounded store-and-forward queue of telemetry samples.
+ *
+ * New samples go to a RAM ring. When the ring is full and a file system is
+ * attached the oldest sample is appended to a flash file, so the file always
+ * holds older samples than the ring and reading file-then-ring keeps the
+ * original order. Once both are full new samples are dropped and counted:
+ * the series stops rather than getting a hole between file and ring. Without
+ * a file the ring drops its oldest sample instead.
+ *
+ * The file survives a reset and is replayed from the start on the next boot,
+ * consumers can drop duplicates by their timestamp. Samples stamped before
+ * SNTP synced on that earlier boot can't be corrected by this one, they are
+ * replayed with ts 0, "no time".
+ */
+
+#define OUTBOX_RAM 128
+
+class MqttOutbox
+{
+  private:
+  TelemetrySample mRing[OUTBOX_RAM];
+  size_t mHead;
+  size_t mCount;
+
+  fs::FS *mFs;
+  const char *mPath;
+  size_t mFlashMax;  // samples
+  size_t mFlashRead; // samples already replayed from the file
+  size_t mFlashCount;
+  size_t mFlashStale; // samples in the file from before this boot
+
+  uint32_t mDropped;
+  uint32_t mSpilled;
+
+  bool spill(const TelemetrySample &s);
+
+  public:
+  MqttOutbox();
+  void begin(fs::FS *fs, const char *path, size_t flashBytes);
+
+  void push(const TelemetrySample &s);
+  size_t peek(TelemetrySample *out, size_t limit);
+  void pop(size_t n);
+
+  size_t size() { return mCount + mFlashCount - mFlashRead; }
+  bool empty() { return size() == 0; }
+  uint32_t dropped() { return mDropped; }
+  uint32_t spilled() { return mSpilled; }
+};
+
+#endif
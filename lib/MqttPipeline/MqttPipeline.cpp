@@ -0,0 +1,369 @@
+#include "MqttPipeline.h"
+
+#include <algorithm>
+
+#include "Timebase.h"
+
+static const char *fieldNames[MQTT_F_COUNT] = {"T", "Tint", "St", "P", "E"};
+static const char *topicNames[MQTT_TOPIC_COUNT] = {"t", "n", "s",
+                                                   "e", "h", "d"};
+static const char topicPaths[MQTT_TOPIC_COUNT][MQTT_PATH_MAX + 1] = {
+    "g/kiln/json", "f/notify",      "kiln/state",
+    "kiln/energy", "kiln/elements", "kiln/diag"};
+
+static float roundTo(float v, float scale) { return roundf(v * scale) / scale; }
+
+// Epoch, samples stamped before SNTP synced included, 0 while still unknown
+static uint32_t stamp(uint32_t ts)
+{
+  ts = timebase.correct(ts);
+  return Timebase::valid(ts) ? ts : 0;
+}
+
+static float field(const TelemetrySample &s, uint8_t f)
+{
+  switch (f) {
+  case MQTT_F_T:
+    return s.T;
+  case MQTT_F_TINT:
+    return s.Tint;
+  case MQTT_F_ST:
+    return s.St;
+  case MQTT_F_P:
+    return s.P;
+  case MQTT_F_E:
+    return s.E;
+  default:
+    return 0;
+  }
+}
+
+MqttPipeline::MqttPipeline()
+{
+  memset(&mCfg, 0, sizeof(mCfg));
+  mCfg.rateMs                    = 10000;
+  mCfg.heartbeatS                = 60;
+  mCfg.batchMax                  = MQTT_BATCH_MAX;
+  mCfg.deadband[MQTT_F_T]        = 0.5;
+  mCfg.deadband[MQTT_F_TINT]     = 1;
+  mCfg.deadband[MQTT_F_ST]       = 1;
+  mCfg.deadband[MQTT_F_P]        = 0.1;
+  mCfg.deadband[MQTT_F_E]        = 1;
+  mCfg.qos[MQTT_TOPIC_NOTIFY]    = 1;
+  mCfg.qos[MQTT_TOPIC_STATE]     = 1;
+  mCfg.retain[MQTT_TOPIC_STATE]  = true;
+  mCfg.qos[MQTT_TOPIC_ENERGY]    = 1;
+  mCfg.retain[MQTT_TOPIC_ENERGY] = true;
+  mCfg.qos[MQTT_TOPIC_HEALTH]    = 1;
+  mCfg.retain[MQTT_TOPIC_HEALTH] = true;
+  mCfg.slowMs                    = 2000;
+  mCfg.replayMs                  = 1000;
+  mCfg.spillKB                   = 64;
+
+  mPublish    = nullptr;
+  mLock       = nullptr;
+  mConnected  = false;
+  mLastReplay = 0;
+  mHasLast    = false;
+  mLastQueued = 0;
+  mPeak       = NAN;
+  mCount      = 0;
+  mTarget     = 1;
+  mPendingId  = 0;
+  mPendingAt  = 0;
+  mPublished  = 0;
+  mSuppressed = 0;
+  mFailed     = 0;
+  mDropped    = 0;
+}
+
+void MqttPipeline::configure(JsonVariantConst pipe, const char *defaultRoot)
+{
+  strlcpy(mCfg.root, pipe["root"] | defaultRoot, sizeof(mCfg.root));
+  uint8_t batch   = pipe["batch"] | mCfg.batchMax;
+  mCfg.rateMs     = std::max<uint32_t>(1000, pipe["rate"] | mCfg.rateMs);
+  mCfg.heartbeatS = pipe["hb"] | mCfg.heartbeatS;
+  mCfg.batchMax   = constrain(batch, 1, MQTT_BATCH_MAX);
+  mCfg.compact    = pipe["compact"] | mCfg.compact;
+  mCfg.slowMs     = pipe["slow"] | mCfg.slowMs;
+  mCfg.replayMs   = pipe["replay"] | mCfg.replayMs;
+  mCfg.spillKB    = pipe["spill"] | mCfg.spillKB;
+
+  for (uint8_t f = 0; f < MQTT_F_COUNT; f++)
+    mCfg.deadband[f] = pipe["db"][fieldNames[f]] | mCfg.deadband[f];
+
+  for (uint8_t t = 0; t < MQTT_TOPIC_COUNT; t++) {
+    int qos        = pipe["qos"][topicNames[t]] | (int)mCfg.qos[t];
+    mCfg.qos[t]    = std::min(2, qos);
+    mCfg.retain[t] = pipe["ret"][topicNames[t]] | mCfg.retain[t];
+  }
+}
+
+void MqttPipeline::toJson(JsonObject pipe)
+{
+  pipe["root"]    = (const char *)mCfg.root;
+  pipe["rate"]    = mCfg.rateMs;
+  pipe["hb"]      = mCfg.heartbeatS;
+  pipe["batch"]   = mCfg.batchMax;
+  pipe["compact"] = mCfg.compact;
+  pipe["slow"]    = mCfg.slowMs;
+  pipe["replay"]  = mCfg.replayMs;
+  pipe["spill"]   = mCfg.spillKB;
+
+  JsonObject db = pipe.createNestedObject("db");
+  for (uint8_t f = 0; f < MQTT_F_COUNT; f++)
+    db[fieldNames[f]] = mCfg.deadband[f];
+
+  JsonObject qos = pipe.createNestedObject("qos");
+  JsonObject ret = pipe.createNestedObject("ret");
+  for (uint8_t t = 0; t < MQTT_TOPIC_COUNT; t++) {
+    qos[topicNames[t]] = mCfg.qos[t];
+    ret[topicNames[t]] = mCfg.retain[t];
+  }
+}
+
+void MqttPipeline::begin(MqttPublish publish, fs::FS *fs)
+{
+  mPublish = publish;
+  mLock    = xSemaphoreCreateMutex();
+  mOutbox.begin(fs, "/outbox.bin", mCfg.spillKB * 1024UL);
+}
+
+void MqttPipeline::topic(char *out, MqttTopic t)
+{
+  snprintf(out, MQTT_TOPIC_MAX, "%s/%s", mCfg.root, topicPaths[t]);
+}
+
+uint16_t MqttPipeline::publish(MqttTopic t, const char *payload, size_t len)
+{
+  if (mPublish == nullptr)
+    return 0;
+
+  char _topic[MQTT_TOPIC_MAX];
+  topic(_topic, t);
+  return mPublish(_topic, mCfg.qos[t], mCfg.retain[t], payload, len);
+}
+
+bool MqttPipeline::changed(const TelemetrySample &s)
+{
+  if (!mHasLast || s.step != mLast.step)
+    return true;
+  if ((millis() - mLastQueued) >= mCfg.heartbeatS * 1000UL)
+    return true;
+
+  for (uint8_t f = 0; f < MQTT_F_COUNT; f++) {
+    float now = field(s, f);
+    float was = field(mLast, f);
+    if (isnan(now) != isnan(was))
+      return true;
+    if (fabsf(now - was) > mCfg.deadband[f])
+      return true;
+  }
+  return false;
+}
+
+void MqttPipeline::push(const TelemetrySample &s)
+{
+  if (mLock == nullptr)
+    return;
+  xSemaphoreTake(mLock, portMAX_DELAY);
+
+  if (!isnan(s.T) && (isnan(mPeak) || s.T > mPeak))
+    mPeak = s.T;
+
+  if (!changed(s)) {
+    mSuppressed++;
+    xSemaphoreGive(mLock);
+    return;
+  }
+
+  TelemetrySample q = s;
+  q.Tmax            = mPeak;
+
+  mLast             = s;
+  mHasLast          = true;
+  mLastQueued       = millis();
+  mPeak             = NAN;
+
+  if (!mConnected || !mOutbox.empty()) {
+    // Behind the backlog so the broker still sees samples in order
+    mOutbox.push(q);
+  } else {
+    if (mCount == MQTT_BATCH_MAX) {
+      memmove(&mBatch[0], &mBatch[1],
+              sizeof(mBatch[0]) * (MQTT_BATCH_MAX - 1));
+      mCount--;
+      mDropped++;
+    }
+    mBatch[mCount++] = q;
+    if (mCount >= mTarget && !flush())
+      stash();
+  }
+
+  xSemaphoreGive(mLock);
+}
+
+// Move the pending batch to the outbox, it is older than anything queued next
+void MqttPipeline::stash()
+{
+  for (uint8_t i = 0; i < mCount; i++)
+    mOutbox.push(mBatch[i]);
+  mCount = 0;
+}
+
+void MqttPipeline::setConnected(bool connected)
+{
+  if (mLock == nullptr)
+    return;
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  mConnected = connected;
+  if (!connected) {
+    stash();
+    mPendingId = 0;
+  }
+  xSemaphoreGive(mLock);
+}
+
+// Replay the outbox, rate limited, stops at the first failed publish
+void MqttPipeline::service()
+{
+  if (mLock == nullptr || (millis() - mLastReplay) < mCfg.replayMs)
+    return;
+  mLastReplay = millis();
+
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  if (mConnected && !mOutbox.empty()) {
+    size_t len   = 0;
+    size_t n     = mOutbox.peek(mReplay, mCfg.batchMax);
+    uint8_t rows = n ? fit(mReplay, n, len) : 0;
+    uint16_t id  = rows ? publish(MQTT_TOPIC_TELEMETRY, mPayload, len) : 0;
+    if (id) {
+      mOutbox.pop(rows);
+      mPublished += rows;
+    } else if (n && !rows) {
+      // Can never be sent, don't let it stall the replay
+      mOutbox.pop(1);
+      mDropped++;
+    } else {
+      mFailed++;
+    }
+  }
+  xSemaphoreGive(mLock);
+}
+
+// Legacy Adafruit IO group layout for a single sample, otherwise one header
+// of keys plus one row per sample. 0 when it doesn't fit mPayload.
+size_t MqttPipeline::serialize(const TelemetrySample *samples, uint8_t n)
+{
+  mDoc.clear();
+
+  if (n == 1 && !mCfg.compact) {
+    const TelemetrySample &s = samples[0];
+    JsonObject feeds         = mDoc.createNestedObject("feeds");
+    feeds["T"]               = s.T;
+    feeds["Tmax"]            = s.Tmax;
+    feeds["I"]               = s.I;
+    feeds["P"]               = s.P;
+    feeds["Pel"]             = s.Pel;
+    feeds["E"]               = s.E;
+    feeds["$"]               = s.cost;
+    feeds["Dly"]             = s.Dly;
+    feeds["Tint"]            = s.Tint;
+    feeds["St"]              = s.St;
+    feeds["Step"]            = s.step;
+    feeds["RSSI"]            = s.rssi;
+    if (stamp(s.ts))
+      feeds["ts"] = stamp(s.ts);
+  } else {
+    JsonArray k = mDoc.createNestedArray("k");
+    for (const char *key : {"ts", "T", "Tmax", "Tint", "St", "P", "Pel", "E",
+                            "$", "Dly", "Step", "RSSI"})
+      k.add(key);
+
+    JsonArray d = mDoc.createNestedArray("d");
+    for (uint8_t i = 0; i < n; i++) {
+      const TelemetrySample &s = samples[i];
+      JsonArray row            = d.createNestedArray();
+      row.add(stamp(s.ts));
+      row.add(roundTo(s.T, 10));
+      row.add(roundTo(s.Tmax, 10));
+      row.add(roundTo(s.Tint, 10));
+      row.add(roundTo(s.St, 10));
+      row.add(roundTo(s.P, 100));
+      row.add(roundTo(s.Pel, 100));
+      row.add(s.E);
+      row.add(roundTo(s.cost, 100));
+      row.add(roundTo(s.Dly, 10));
+      row.add(s.step);
+      row.add(s.rssi);
+    }
+  }
+
+  if (mDoc.overflowed())
+    return 0;
+  // Truncated output is cut to sizeof(mPayload) - 1 characters
+  size_t len = serializeJson(mDoc, mPayload, sizeof(mPayload));
+  return len < sizeof(mPayload) - 1 ? len : 0;
+}
+
+// The leading samples that serialize into mPayload, all n unless the batch
+// is too large, 0 if not even the first one fits
+uint8_t MqttPipeline::fit(const TelemetrySample *s, uint8_t n, size_t &len)
+{
+  while (n > 0 && (len = serialize(s, n)) == 0)
+    n--;
+  return n;
+}
+
+bool MqttPipeline::flush()
+{
+  if (mCount == 0)
+    return true;
+
+  size_t len = 0;
+  uint8_t n  = fit(mBatch, mCount, len);
+  if (n == 0) {
+    // Can never be sent, neither now nor from the outbox
+    memmove(&mBatch[0], &mBatch[1], sizeof(mBatch[0]) * (mCount - 1));
+    mCount--;
+    mDropped++;
+    return flush();
+  }
+
+  uint16_t id = publish(MQTT_TOPIC_TELEMETRY, mPayload, len);
+  if (id == 0) {
+    // Caller stashes the samples, send more of them at once next time
+    mFailed++;
+    mTarget = std::min<uint8_t>(mCfg.batchMax, mTarget * 2);
+    return false;
+  }
+
+  mPublished += n;
+  mCount -= n;
+  memmove(&mBatch[0], &mBatch[n], sizeof(mBatch[0]) * mCount);
+
+  if (mCfg.qos[MQTT_TOPIC_TELEMETRY] == 0) {
+    mTarget = std::max(1, mTarget / 2);
+  } else {
+    mPendingId = id;
+    mPendingAt = millis();
+  }
+  // What didn't fit goes in a message of its own
+  return mCount ? flush() : true;
+}
+
+// AsyncTCP task
+void MqttPipeline::ack(uint16_t packetId)
+{
+  if (mLock == nullptr)
+    return;
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  if (packetId == mPendingId) {
+    if ((millis() - mPendingAt) > mCfg.slowMs)
+      mTarget = std::min<uint8_t>(mCfg.batchMax, mTarget * 2);
+    else
+      mTarget = std::max(1, mTarget / 2);
+    mPendingId = 0;
+  }
+  xSemaphoreGive(mLock);
+}
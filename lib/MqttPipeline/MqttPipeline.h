@@ -0,0 +1,140 @@
+#ifndef __mqtt_pipeline_h__
+#define __mqtt_pipeline_h__
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <FS.h>
+
+#include "MqttOutbox.h"
+#include "TelemetrySample.h"
+
+/*
+ * MQTT telemetry pipeline: deadband suppression, adaptive batching and per
+ * topic QoS/retain.
+ *
+ * A sample is only queued when one of the fields moved more than its deadband
+ * since the last queued sample, or when the heartbeat expires. The highest
+ * temperature seen since the last queued sample travels along as Tmax so
+ * suppression never hides a peak. The batch size grows while publishing fails
+ * or acks are slow and shrinks back once the link recovers.
+ *
+ * Samples that can't be sent, because the client is down or publish fails,
+ * go to an MqttOutbox. While it is not empty new samples queue behind it and
+ * service() replays it in order, batchMax rows every "replay" ms, keeping
+ * the original timestamps.
+ *
+ * Settings live in mqtt.txt under "pipe":
+ *   {"root":"user","rate":10000,"hb":60,"batch":8,"compact":false,
+ *    "db":{"T":0.5,"Tint":1,"St":1,"P":0.1,"E":1},
+ *    "qos":{"t":0,"n":1,"s":1,"e":1,"h":1,"d":0},
+ *    "ret":{"t":false,"n":false,"s":true,"e":true,"h":true,"d":false},
+ *    "slow":2000,
+ *    "replay":1000,"spill":64}
+ * spill is the flash budget of the outbox in KB, 0 keeps it in RAM only.
+ */
+
+#define MQTT_BATCH_MAX   10
+#define MQTT_PAYLOAD_MAX 1024
+#define MQTT_ROOT_MAX    48 // a longer root is cut to fit
+#define MQTT_PATH_MAX    13 // "kiln/elements", the longest topic path
+#define MQTT_TOPIC_MAX   (MQTT_ROOT_MAX + MQTT_PATH_MAX + 2)
+
+enum MqttField : uint8_t {
+  MQTT_F_T,
+  MQTT_F_TINT,
+  MQTT_F_ST,
+  MQTT_F_P,
+  MQTT_F_E,
+  MQTT_F_COUNT,
+};
+
+enum MqttTopic : uint8_t {
+  MQTT_TOPIC_TELEMETRY,
+  MQTT_TOPIC_NOTIFY,
+  MQTT_TOPIC_STATE,
+  MQTT_TOPIC_ENERGY,
+  MQTT_TOPIC_HEALTH,
+  MQTT_TOPIC_DIAG,
+  MQTT_TOPIC_COUNT,
+};
+
+struct MqttPipelineConfig {
+  char root[MQTT_ROOT_MAX];
+  uint32_t rateMs;
+  uint16_t heartbeatS;
+  uint8_t batchMax;
+  bool compact;
+  float deadband[MQTT_F_COUNT];
+  uint8_t qos[MQTT_TOPIC_COUNT];
+  bool retain[MQTT_TOPIC_COUNT];
+  uint16_t slowMs; // ack latency above this grows the batch
+  uint16_t replayMs;
+  uint16_t spillKB;
+};
+
+// Returns the packet id, 0 if the client could not take the message
+typedef uint16_t (*MqttPublish)(const char *topic, uint8_t qos, bool retain,
+                                const char *payload, size_t len);
+
+class MqttPipeline
+{
+  private:
+  MqttPipelineConfig mCfg;
+  MqttPublish mPublish;
+  SemaphoreHandle_t mLock;
+  bool mConnected;
+
+  TelemetrySample mLast;
+  bool mHasLast;
+  uint32_t mLastQueued;
+  float mPeak;
+
+  TelemetrySample mBatch[MQTT_BATCH_MAX];
+  uint8_t mCount;
+  uint8_t mTarget;
+
+  MqttOutbox mOutbox;
+  TelemetrySample mReplay[MQTT_BATCH_MAX];
+  uint32_t mLastReplay;
+
+  uint16_t mPendingId;
+  uint32_t mPendingAt;
+
+  char mPayload[MQTT_PAYLOAD_MAX];
+  StaticJsonDocument<3072> mDoc;
+
+  uint32_t mPublished;
+  uint32_t mSuppressed;
+  uint32_t mFailed;
+  uint32_t mDropped;
+
+  bool changed(const TelemetrySample &s);
+  size_t serialize(const TelemetrySample *s, uint8_t n);
+  uint8_t fit(const TelemetrySample *s, uint8_t n, size_t &len);
+  void stash();
+  bool flush();
+
+  public:
+  MqttPipeline();
+  void begin(MqttPublish publish, fs::FS *fs);
+  void configure(JsonVariantConst pipe, const char *defaultRoot);
+  void toJson(JsonObject pipe);
+  const MqttPipelineConfig &config() { return mCfg; }
+
+  void topic(char *out, MqttTopic t);
+  uint16_t publish(MqttTopic t, const char *payload, size_t len);
+
+  void push(const TelemetrySample &s);
+  void service();
+  void setConnected(bool connected);
+  void ack(uint16_t packetId);
+
+  uint32_t published() { return mPublished; }
+  uint32_t suppressed() { return mSuppressed; }
+  uint32_t failed() { return mFailed; }
+  uint32_t dropped() { return mDropped + mOutbox.dropped(); }
+  size_t backlog() { return mOutbox.size(); }
+  uint32_t spilled() { return mOutbox.spilled(); }
+};
+
+#endif
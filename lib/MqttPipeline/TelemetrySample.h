@@ -0,0 +1,23 @@
+#ifndef __telemetry_sample_h__
+#define __telemetry_sample_h__
+
+#include <Arduino.h>
+
+// One telemetry record, packed as it is also the outbox file format
+struct __attribute__((packed)) TelemetrySample {
+  uint32_t ts; // epoch, 0 if not synced
+  float T;
+  float Tmax;
+  float Tint;
+  float St;
+  float P;   // kW, averaged over the metering window
+  float Pel; // kW, element power while the relay is on
+  float I;
+  float E; // Wh
+  float cost;
+  float Dly; // min the demand cap added to the firing
+  int8_t step;
+  int8_t rssi;
+};
+
+#endif
@@ -0,0 +1,104 @@
+#include "PageTemplate.h"
+
+#include <WiFi.h>
+
+PageTemplate::PageTemplate(const PageText *texts, size_t count,
+                           ElementHealth *health, const char *version,
+                           const char *built)
+{
+  mTexts   = texts;
+  mCount   = count;
+  mHealth  = health;
+  mVersion = version;
+  mBuilt   = built;
+}
+
+String PageTemplate::value(const String &var)
+{
+  for (size_t i = 0; i < mCount; i++) {
+    if (var == mTexts[i].var)
+      return FPSTR(mTexts[i].text);
+  }
+  if (var == "HTML_INFO_BOX") {
+    String ret = "";
+    if (WiFi.isConnected()) {
+      ret = "<strong> Connected</ strong> to ";
+      ret += WiFi.SSID();
+      ret += "<br><em><small> with IP ";
+      ret += WiFi.localIP().toString();
+      ret += "</small>";
+    } else
+      ret = "<strong> Not Connected</ strong>";
+    return ret;
+  }
+  if (var == "HTML_CONFIG_SSID")
+    return WiFi.SSID();
+  if (var == "UPTIME") {
+    String ret = String(millis() / 1000 / 60);
+    ret += " min ";
+    ret += String((millis() / 1000) % 60);
+    ret += " sec";
+    return ret;
+  }
+  if (var == "CHIP_ID") {
+    String ret = String((uint32_t)ESP.getEfuseMac());
+    return ret;
+  }
+  if (var == "FREE_HEAP") {
+    String ret = String(ESP.getFreeHeap());
+    ret += " bytes";
+    return ret;
+  }
+  if (var == "SKETCH_INFO") {
+    //%USED_BYTES% / &FLASH_SIZE&<br><progress value="%USED_BYTES%"
+    // max="&FLASH_SIZE&">
+    String ret = String(ESP.getSketchSize());
+    ret += " / ";
+    ret += String(ESP.getFlashChipSize());
+    ret += "<br><progress value=\"";
+    ret += String(ESP.getSketchSize());
+    ret += "\" max=\"";
+    ret += String(ESP.getFlashChipSize());
+    ret += "\">";
+    return ret;
+  }
+  if (var == "HOSTNAME")
+    return String(WiFi.getHostname());
+  if (var == "MY_MAC")
+    return WiFi.macAddress();
+  if (var == "MY_RSSI")
+    return String(WiFi.RSSI());
+  if (var == "FW_VER")
+    return String(mVersion);
+  if (var == "SDK_VER")
+    return String(ESP_ARDUINO_VERSION_MAJOR) + "." +
+           String(ESP_ARDUINO_VERSION_MINOR) + "." +
+           String(ESP_ARDUINO_VERSION_PATCH);
+  if (var == "ABOUT_DATE")
+    return String(mBuilt);
+  if (var == "ELEMENT_HEALTH")
+    return health();
+  return String();
+}
+
+String PageTemplate::health()
+{
+  HealthRecord r;
+  if (!mHealth->last(r))
+    return F("<dt>Last firing</dt><dd>Not recorded yet</dd>");
+  int left   = mHealth->forecast();
+  String ret = "<dt>Power</dt><dd>" + String(r.W / 1000, 2) + " kW (";
+  ret += String(mHealth->driftPercent(), 1) + "%)</dd>";
+  ret += "<dt>Resistance</dt><dd>";
+  ret += String(HEALTH_MAINS_V * HEALTH_MAINS_V / r.W, 1) + " &#8486;</dd>";
+  ret += "<dt>Final ramp</dt><dd>" + String((int)r.rate) + " of ";
+  ret += String((int)r.target) + " &deg;C/h, needs ";
+  ret += String(r.need / 1000, 2) + " kW</dd>";
+  ret += "<dt>Forecast</dt><dd>";
+  if (left < 0)
+    ret += "No decline over " + String(mHealth->count()) + " firings";
+  else
+    ret += String(left) + " firings left";
+  ret += "</dd>";
+  return ret;
+}
@@ -0,0 +1,42 @@
+#ifndef __page_template_h__
+#define __page_template_h__
+
+#include <Arduino.h>
+
+#include "ElementHealth.h"
+
+/*
+ * The %VAR% placeholders of the pages in include/, what processor() hands
+ * AsyncWebServer for each one it finds while sending a page.
+ *
+ * The style sheet, script and title are fixed texts in flash main.cpp
+ * passes in as a table, everything else is worked out when asked: WiFi,
+ * uptime, chip and firmware info and the element health summary. value()
+ * runs once per placeholder per page, on the AsyncTCP task.
+ */
+
+struct PageText {
+  const char *var;
+  const char *text; // PROGMEM
+};
+
+class PageTemplate
+{
+  private:
+  const PageText *mTexts;
+  size_t mCount;
+  ElementHealth *mHealth;
+  const char *mVersion;
+  const char *mBuilt;
+
+  String health();
+
+  public:
+  PageTemplate(const PageText *texts, size_t count, ElementHealth *health,
+               const char *version, const char *built);
+
+  // What replaces %var%, empty for one it doesn't know
+  String value(const String &var);
+};
+
+#endif
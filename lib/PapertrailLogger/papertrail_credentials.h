@@ -1,2 +0,0 @@
-#define PAPERTRAIL_HOST "YOUR_PAPERTRAIL_HOST"
-#define PAPERTRAIL_PORT YOUR_PAPERTRAIL_PORT
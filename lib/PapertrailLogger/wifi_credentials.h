@@ -1,2 +0,0 @@
-#define SSID "YOUR_SSID"
-#define PASSWORD "YOUR_PASSWORD"
@@ -0,0 +1,187 @@
+#include "PulseMeter.h"
+
+#include "esp_timer.h"
+
+PulseMeter::PulseMeter()
+{
+  mHead          = 0;
+  mOverflow      = 0;
+  mTail          = 0;
+  mHistHead      = 0;
+  mHistCount     = 0;
+  mLastPulse     = 0;
+  mEdgeHead      = 0;
+  mEdgeCount     = 0;
+  mRelay         = false;
+  mPulses        = 0;
+  mBounces       = 0;
+  mPower         = 0;
+  mElementPower  = 0;
+  mIntervalPower = 0;
+  mHook          = nullptr;
+  resetSegments();
+}
+
+void IRAM_ATTR PulseMeter::capture()
+{
+  uint32_t head = mHead;
+  if (head - mTail >= PULSE_RING) {
+    mOverflow++;
+    return;
+  }
+  mRing[head % PULSE_RING] = esp_timer_get_time();
+  // Publish the slot before the index
+  __sync_synchronize();
+  mHead = head + 1;
+}
+
+void PulseMeter::relay(bool on, int64_t now)
+{
+  portENTER_CRITICAL(&mLock);
+  if (on != mRelay) {
+    if (mEdgeCount == PULSE_RELAY_EDGES) {
+      mEdgeHead = (mEdgeHead + 1) % PULSE_RELAY_EDGES;
+      mEdgeCount--;
+    }
+    Edge &e = mEdges[(mEdgeHead + mEdgeCount) % PULSE_RELAY_EDGES];
+    e.t     = now;
+    e.on    = on;
+    mEdgeCount++;
+    mRelay = on;
+  }
+  portEXIT_CRITICAL(&mLock);
+}
+
+// Relay on time inside [from, to], edges older than the window only tell the
+// state at its start
+int64_t PulseMeter::relayOnTime(int64_t from, int64_t to)
+{
+  int64_t on    = 0;
+  int64_t since = from;
+  bool state    = false;
+
+  portENTER_CRITICAL(&mLock);
+  for (size_t i = 0; i < mEdgeCount; i++) {
+    const Edge &e = mEdges[(mEdgeHead + i) % PULSE_RELAY_EDGES];
+    if (e.t <= from) {
+      state = e.on;
+      continue;
+    }
+    if (state)
+      on += e.t - since;
+    since = e.t;
+    state = e.on;
+  }
+  portEXIT_CRITICAL(&mLock);
+
+  if (state)
+    on += to - since;
+  return on;
+}
+
+void PulseMeter::update(int segment, int64_t now)
+{
+  uint32_t head = mHead;
+  __sync_synchronize();
+
+  while (mTail != head) {
+    int64_t t = mRing[mTail % PULSE_RING];
+    mTail     = mTail + 1;
+    if (mHook)
+      mHook(t);
+
+    if (mLastPulse && (t - mLastPulse) < PULSE_DEBOUNCE_US) {
+      mBounces++;
+      continue;
+    }
+
+    if (mLastPulse)
+      mIntervalPower = PULSE_WH * 3600e6f / (float)(t - mLastPulse);
+    mLastPulse = t;
+    mPulses++;
+    if (segment >= 0 && segment < PULSE_SEGMENTS)
+      mSegmentWh[segment] += PULSE_WH;
+
+    if (mHistCount == PULSE_HISTORY) {
+      mHistHead = (mHistHead + 1) % PULSE_HISTORY;
+      mHistCount--;
+    }
+    mHistory[(mHistHead + mHistCount) % PULSE_HISTORY] = t;
+    mHistCount++;
+  }
+
+  int64_t from = now - PULSE_WINDOW_S * 1000000LL;
+  while (mHistCount && mHistory[mHistHead] < from) {
+    mHistHead = (mHistHead + 1) % PULSE_HISTORY;
+    mHistCount--;
+  }
+
+  // Until a full window has passed since boot average over what we have
+  int64_t span = now < PULSE_WINDOW_S * 1000000LL ? now : now - from;
+  float wh     = mHistCount * PULSE_WH;
+  mPower       = span > 0 ? wh * 3600e6f / span : 0;
+
+  int64_t on   = relayOnTime(from, now);
+  // A second of on time is too little to tell the element power
+  if (on > 1000000LL)
+    mElementPower = wh * 3600e6f / on;
+  if (mHistCount == 0)
+    mIntervalPower = 0;
+}
+
+void PulseMeter::resetSegments()
+{
+  for (size_t i = 0; i < PULSE_SEGMENTS; i++)
+    mSegmentWh[i] = 0;
+}
+
+float PulseMeter::segmentWh(int segment)
+{
+  if (segment < 0 || segment >= PULSE_SEGMENTS)
+    return 0;
+  return mSegmentWh[segment];
+}
+
+int64_t PulseMeter::sinceLastPulseUs()
+{
+  if (mLastPulse == 0)
+    return -1;
+  return esp_timer_get_time() - mLastPulse;
+}
+
+bool PulseMeter::nextPulse(PulseCursor &cursor, int64_t &us)
+{
+  for (;;) {
+    uint32_t head = mHead;
+    __sync_synchronize();
+    if (cursor.index == head)
+      return false;
+    if (head - cursor.index > PULSE_RING)
+      cursor.index = head - PULSE_RING;
+
+    int64_t t = mRing[cursor.index % PULSE_RING];
+    __sync_synchronize();
+    // The ISR writes index + PULSE_RING into the same slot
+    if (mHead - cursor.index >= PULSE_RING) {
+      cursor.index = mHead - PULSE_RING + 1;
+      continue;
+    }
+    cursor.index++;
+
+    if (cursor.last && t - cursor.last < PULSE_DEBOUNCE_US)
+      continue;
+    cursor.last = t;
+    us          = t;
+    return true;
+  }
+}
+
+// -1 before the first pulse, the slot stays valid until the ring wraps
+int64_t PulseMeter::lastCaptureUs()
+{
+  uint32_t head = mHead;
+  if (head == 0)
+    return -1;
+  __sync_synchronize();
+  return mRing[(head - 1) % PULSE_RING];
+}
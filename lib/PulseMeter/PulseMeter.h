@@ -0,0 +1,110 @@
+#ifndef __pulse_meter_h__
+#define __pulse_meter_h__
+
+#include <Arduino.h>
+
+#include "esp_timer.h"
+
+/*
+ * S0 energy meter reader.
+ *
+ * capture() is the only thing running in the ISR: it stores the
+ * esp_timer_get_time() timestamp in a single producer / single consumer ring.
+ * update() drains the ring outside interrupt context, debounces, counts the
+ * energy and keeps the accepted pulses of the last PULSE_WINDOW_S so that:
+ *
+ *  - power()        energy in the window / window length
+ *  - elementPower() energy in the window / time the relay was on in it, the
+ *                   real element power regardless of duty cycle
+ *  - segmentWh(i)   energy per firing step, credited to the step passed to
+ *                   update()
+ */
+
+#define PULSE_WH          0.5f // 2000 imp/kWh
+#define PULSE_DEBOUNCE_US 100000
+#define PULSE_WINDOW_S    60
+#define PULSE_RING        64  // ISR -> consumer
+#define PULSE_HISTORY     256 // accepted pulses kept for the window
+#define PULSE_RELAY_EDGES 32
+#define PULSE_SEGMENTS    6
+
+// Every captured timestamp, bounces included, as update() takes it
+typedef void (*PulseHook)(int64_t us);
+
+// A second reader's place in the capture ring, see nextPulse()
+struct PulseCursor {
+  uint32_t index;
+  int64_t last; // last accepted capture, 0 before the first
+};
+
+class PulseMeter
+{
+  private:
+  // Written by the ISR only
+  volatile int64_t mRing[PULSE_RING];
+  volatile uint32_t mHead;
+  volatile uint32_t mOverflow;
+  // Written by the consumer only
+  volatile uint32_t mTail;
+
+  int64_t mHistory[PULSE_HISTORY];
+  size_t mHistHead;
+  size_t mHistCount;
+  int64_t mLastPulse;
+
+  struct Edge {
+    int64_t t;
+    bool on;
+  };
+  Edge mEdges[PULSE_RELAY_EDGES];
+  size_t mEdgeHead;
+  size_t mEdgeCount;
+  bool mRelay;
+  portMUX_TYPE mLock = portMUX_INITIALIZER_UNLOCKED;
+
+  uint32_t mPulses;
+  uint32_t mBounces;
+  float mSegmentWh[PULSE_SEGMENTS];
+
+  float mPower;
+  float mElementPower;
+  float mIntervalPower;
+  PulseHook mHook;
+
+  int64_t relayOnTime(int64_t from, int64_t to);
+
+  public:
+  PulseMeter();
+
+  void IRAM_ATTR capture();
+  // Relay transitions, needed for elementPower(). now is esp_timer time,
+  // the control path passes its job's so a replay gets the same result.
+  void relay(bool on, int64_t now);
+  void relay(bool on) { relay(on, esp_timer_get_time()); }
+  void update(int segment, int64_t now);
+  void update(int segment) { update(segment, esp_timer_get_time()); }
+  void resetSegments();
+  void hook(PulseHook hook) { mHook = hook; }
+
+  uint32_t pulses() { return mPulses; }
+  float energyWh() { return mPulses * PULSE_WH; }
+  float segmentWh(int segment);
+  float power() { return mPower; }
+  float elementPower() { return mElementPower; }
+  // From the last pulse interval alone, noisy but immediate
+  float intervalPower() { return mIntervalPower; }
+  // -1 before the first pulse
+  int64_t sinceLastPulseUs();
+  // Raw ISR side, for checks that must not depend on update() running
+  uint32_t captured() { return mHead; }
+  // The next capture after the cursor that passes the debounce update()
+  // applies, false when there is none yet. Doesn't consume the ring, so it
+  // runs next to update() and without it. Captures overwritten before the
+  // cursor got to them are skipped.
+  bool nextPulse(PulseCursor &cursor, int64_t &us);
+  int64_t lastCaptureUs();
+  uint32_t overflows() { return mOverflow; }
+  uint32_t bounces() { return mBounces; }
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef __request_pool_h__
+#define __request_pool_h__
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+/*
+ * Fixed pool of request buffers, no heap once constructed.
+ *
+ * A slot is owned by one AsyncWebServerRequest from its first body chunk (or
+ * from the handler when there is no body) until the client disconnects, so it
+ * can hold the request body for in place parsing and then the serialized
+ * response that send_P() streams out asynchronously.
+ */
+
+template <size_t SLOTS, size_t SIZE> class RequestPool
+{
+  public:
+  struct Slot {
+    AsyncWebServerRequest *owner;
+    size_t len;
+    char buf[SIZE];
+  };
+
+  private:
+  Slot mSlots[SLOTS];
+  portMUX_TYPE mLock = portMUX_INITIALIZER_UNLOCKED;
+  uint32_t mExhausted;
+
+  public:
+  RequestPool() : mExhausted(0)
+  {
+    for (size_t i = 0; i < SLOTS; i++) {
+      mSlots[i].owner = nullptr;
+      mSlots[i].len   = 0;
+    }
+  }
+
+  // Slot already owned by this request, or a fresh one
+  Slot *acquire(AsyncWebServerRequest *request)
+  {
+    Slot *slot = nullptr;
+    bool fresh = false;
+
+    portENTER_CRITICAL(&mLock);
+    for (size_t i = 0; i < SLOTS; i++) {
+      if (mSlots[i].owner == request) {
+        slot = &mSlots[i];
+        break;
+      }
+    }
+    for (size_t i = 0; i < SLOTS && slot == nullptr; i++) {
+      if (mSlots[i].owner == nullptr) {
+        slot        = &mSlots[i];
+        slot->owner = request;
+        slot->len   = 0;
+        fresh       = true;
+      }
+    }
+    if (slot == nullptr)
+      mExhausted++;
+    portEXIT_CRITICAL(&mLock);
+
+    if (fresh)
+      request->onDisconnect([this, slot]() { release(slot); });
+
+    return slot;
+  }
+
+  void release(Slot *slot)
+  {
+    portENTER_CRITICAL(&mLock);
+    slot->owner = nullptr;
+    slot->len   = 0;
+    portEXIT_CRITICAL(&mLock);
+  }
+
+  uint32_t exhausted() { return mExhausted; }
+};
+
+#endif
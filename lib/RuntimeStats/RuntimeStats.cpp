@@ -0,0 +1,159 @@
+#include "RuntimeStats.h"
+
+#include <algorithm>
+
+#include "esp_timer.h"
+
+#if configUSE_TRACE_FACILITY
+// Too big for the caller's stack, sample() is only ever run by one task
+static TaskStatus_t status[RUNTIME_TASKS];
+#endif
+
+RuntimeStats::RuntimeStats()
+{
+  memset(mRing, 0, sizeof(mRing));
+  memset(mTasks, 0, sizeof(mTasks));
+  memset(mLast, 0, sizeof(mLast));
+
+  mLock      = nullptr;
+  mHead      = 0;
+  mCount     = 0;
+  mTaskCount = 0;
+  mLastCount = 0;
+  mLastTotal = 0;
+}
+
+void RuntimeStats::begin() { mLock = xSemaphoreCreateMutex(); }
+
+void RuntimeStats::sample()
+{
+  RuntimeSample s;
+  s.ts       = esp_timer_get_time() / 1000000;
+  s.freeHeap = ESP.getFreeHeap();
+  s.largest  = ESP.getMaxAllocHeap();
+  s.minFree  = ESP.getMinFreeHeap();
+
+  RuntimeTask tasks[RUNTIME_TASKS];
+  size_t n = 0;
+
+#if configUSE_TRACE_FACILITY
+  // 0 when there are more tasks than RUNTIME_TASKS
+  uint32_t total   = 0;
+  n                = uxTaskGetSystemState(status, RUNTIME_TASKS, &total);
+  uint32_t elapsed = total - mLastTotal;
+
+  Runtime now[RUNTIME_TASKS];
+  for (size_t i = 0; i < n; i++) {
+    const TaskStatus_t &t = status[i];
+    RuntimeTask &r        = tasks[i];
+    strlcpy(r.name, t.pcTaskName, sizeof(r.name));
+#if configTASKLIST_INCLUDE_COREID
+    r.core = t.xCoreID < portNUM_PROCESSORS ? t.xCoreID : 0xff;
+#else
+    r.core = 0xff;
+#endif
+    r.priority  = t.uxCurrentPriority;
+    r.stackFree = t.usStackHighWaterMark * sizeof(StackType_t);
+    r.cpu       = -1;
+
+    now[i].number  = t.xTaskNumber;
+    now[i].counter = t.ulRunTimeCounter;
+#if configGENERATE_RUN_TIME_STATS
+    for (size_t j = 0; j < mLastCount && mLastTotal && elapsed; j++) {
+      if (mLast[j].number != t.xTaskNumber)
+        continue;
+      uint64_t ran = t.ulRunTimeCounter - mLast[j].counter;
+      r.cpu        = std::min<uint64_t>(1000, ran * 1000 / elapsed);
+      break;
+    }
+#endif
+  }
+  memcpy(mLast, now, n * sizeof(Runtime));
+  mLastCount = n;
+  mLastTotal = total;
+#endif
+
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  mRing[mHead] = s;
+  mHead        = (mHead + 1) % RUNTIME_RING;
+  if (mCount < RUNTIME_RING)
+    mCount++;
+  memcpy(mTasks, tasks, n * sizeof(RuntimeTask));
+  mTaskCount = n;
+  xSemaphoreGive(mLock);
+}
+
+RuntimeSample RuntimeStats::latest()
+{
+  RuntimeSample s = {};
+  if (mLock == nullptr)
+    return s;
+
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  if (mCount)
+    s = mRing[(mHead + RUNTIME_RING - 1) % RUNTIME_RING];
+  xSemaphoreGive(mLock);
+  return s;
+}
+
+float RuntimeStats::leakPerHour()
+{
+  if (mLock == nullptr)
+    return 0;
+
+  double sx = 0, sy = 0, sxx = 0, sxy = 0;
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  size_t n     = mCount;
+  size_t first = (mHead + RUNTIME_RING - n) % RUNTIME_RING;
+  uint32_t t0  = mRing[first].ts;
+  for (size_t i = 0; i < n; i++) {
+    const RuntimeSample &s = mRing[(first + i) % RUNTIME_RING];
+    double x               = (s.ts - t0) / 3600.0;
+    sx += x;
+    sy += s.freeHeap;
+    sxx += x * x;
+    sxy += x * s.freeHeap;
+  }
+  xSemaphoreGive(mLock);
+
+  double d = n * sxx - sx * sx;
+  if (n < 3 || d <= 0)
+    return 0;
+  return (n * sxy - sx * sy) / d;
+}
+
+void RuntimeStats::toJson(JsonObject runtime, size_t last)
+{
+  runtime["free"]    = ESP.getFreeHeap();
+  runtime["largest"] = ESP.getMaxAllocHeap();
+  runtime["min"]     = ESP.getMinFreeHeap();
+  runtime["leak"]    = (int32_t)leakPerHour();
+
+  if (mLock == nullptr)
+    return;
+
+  JsonArray tasks = runtime.createNestedArray("tasks");
+  JsonArray ring  = runtime.createNestedArray("ring");
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  for (size_t i = 0; i < mTaskCount; i++) {
+    RuntimeTask &t = mTasks[i]; // char *, so the name is copied
+    JsonArray row  = tasks.createNestedArray();
+    row.add(t.name);
+    row.add(t.core == 0xff ? -1 : t.core);
+    row.add(t.priority);
+    row.add(t.cpu);
+    row.add(t.stackFree);
+  }
+
+  size_t n     = std::min<size_t>(last, mCount);
+  size_t first = (mHead + RUNTIME_RING - n) % RUNTIME_RING;
+  for (size_t i = 0; i < n; i++) {
+    const RuntimeSample &s = mRing[(first + i) % RUNTIME_RING];
+    JsonArray row          = ring.createNestedArray();
+    row.add(s.ts);
+    row.add(s.freeHeap);
+    row.add(s.largest);
+    row.add(s.minFree);
+  }
+  xSemaphoreGive(mLock);
+}
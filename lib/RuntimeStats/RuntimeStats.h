@@ -0,0 +1,82 @@
+#ifndef __runtime_stats_h__
+#define __runtime_stats_h__
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+/*
+ * Where the CPU, the stacks and the heap go, so a leak shows as a trend
+ * hours before it resets the kiln mid-firing.
+ *
+ * Every sample() adds free heap, the largest block that can still be
+ * allocated and the lowest free heap since boot to a ring of RUNTIME_RING.
+ * Free heap falling from sample to sample is a leak, the largest block
+ * falling behind free heap is fragmentation. leakPerHour() is the least
+ * squares slope of free heap over the ring.
+ *
+ * The task table is only kept for the latest sample: name, core, priority,
+ * stack high-water mark and the share of one core the task had since the
+ * previous sample, from the FreeRTOS run time counters. Builds without
+ * configGENERATE_RUN_TIME_STATS report -1 for the share, without
+ * configUSE_TRACE_FACILITY there is no task table at all.
+ *
+ * Nothing allocates, sample() works in the buffers it owns.
+ */
+
+#define RUNTIME_RING      48 // x RUNTIME_PERIOD_MS = 4 hours
+#define RUNTIME_PERIOD_MS 300000
+#define RUNTIME_TASKS     24
+
+struct RuntimeSample {
+  uint32_t ts;       // seconds since boot
+  uint32_t freeHeap; // bytes
+  uint32_t largest;
+  uint32_t minFree;
+};
+
+struct RuntimeTask {
+  char name[16];
+  uint8_t core; // 0xff when not pinned
+  uint8_t priority;
+  int16_t cpu;        // permille of one core, -1 unknown
+  uint32_t stackFree; // bytes never used
+};
+
+class RuntimeStats
+{
+  private:
+  struct Runtime {
+    uint32_t number; // xTaskNumber, to find the task again
+    uint32_t counter;
+  };
+
+  SemaphoreHandle_t mLock;
+
+  RuntimeSample mRing[RUNTIME_RING];
+  size_t mHead;
+  size_t mCount;
+
+  RuntimeTask mTasks[RUNTIME_TASKS];
+  size_t mTaskCount;
+
+  // Run time counters of the previous sample
+  Runtime mLast[RUNTIME_TASKS];
+  size_t mLastCount;
+  uint32_t mLastTotal;
+
+  public:
+  RuntimeStats();
+  void begin();
+
+  // From one task only, RUNTIME_PERIOD_MS apart
+  void sample();
+
+  RuntimeSample latest();
+  // Bytes of free heap per hour over the ring, negative while leaking
+  float leakPerHour();
+
+  // Heap now, trend, tasks and the newest last samples, oldest first
+  void toJson(JsonObject runtime, size_t last = RUNTIME_RING);
+};
+
+#endif
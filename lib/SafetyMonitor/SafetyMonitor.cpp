@@ -0,0 +1,257 @@
+#include "SafetyMonitor.h"
+
+#include <algorithm>
+
+#include "esp_timer.h"
+
+static const char *faultNames[SAFETY_FAULT_COUNT] = {
+    "ok", "stale", "stuck relay", "open element", "overtemp", "runaway",
+    "tc drift"};
+
+SafetyMonitor::SafetyMonitor(uint8_t relayPin, PulseMeter *meter)
+{
+  mPin         = relayPin;
+  mMeter       = meter;
+  mTask        = nullptr;
+  mRelay       = false;
+  mRelayMs     = 0;
+  mTemp        = NAN;
+  mSetpoint    = NAN;
+  mSampleMs    = 0;
+  mSampleSeq   = 0;
+  mFiring      = false;
+  mDriftRise   = SAFETY_DRIFT_RISE;
+  mLastRelay   = false;
+  mLastRelayMs = 0;
+  mSeenSeq     = 0;
+  mPhaseUs     = 0;
+  mCursor      = {0, 0};
+  mOffCount    = 0;
+  mOverCount   = 0;
+  mCoastArmed  = false;
+  mCoastLow    = NAN;
+  mOnTemp      = NAN;
+  mFault       = SAFETY_OK;
+  mTrips       = 0;
+#ifdef SAFETY_INJECT
+  mInject   = SAFETY_OK;
+  mFakeTemp = NAN;
+#endif
+}
+
+void SafetyMonitor::begin()
+{
+  // Above the loop and the timer task, on the application core
+  xTaskCreatePinnedToCore(task, "safety", 3072, this, configMAX_PRIORITIES - 2,
+                          &mTask, 1);
+}
+
+const char *SafetyMonitor::name(SafetyFault fault)
+{
+  return fault < SAFETY_FAULT_COUNT ? faultNames[fault] : "?";
+}
+
+void SafetyMonitor::relay(bool on)
+{
+  portENTER_CRITICAL(&mLock);
+  if (on != mRelay) {
+    mRelay   = on;
+    mRelayMs = millis();
+  }
+  portEXIT_CRITICAL(&mLock);
+}
+
+void SafetyMonitor::post(float temp, float setpoint)
+{
+#ifdef SAFETY_INJECT
+  if (mInject == SAFETY_STALE)
+    return;
+#endif
+  portENTER_CRITICAL(&mLock);
+  mTemp     = temp;
+  mSetpoint = setpoint;
+  mSampleMs = millis();
+  mSampleSeq++;
+  portEXIT_CRITICAL(&mLock);
+}
+
+void SafetyMonitor::firing(bool active)
+{
+  portENTER_CRITICAL(&mLock);
+  mFiring = active;
+  portEXIT_CRITICAL(&mLock);
+}
+
+void SafetyMonitor::headroom(float share)
+{
+  float spare = constrain(share / SAFETY_DRIFT_SPARE, 0.0f, 1.0f);
+  portENTER_CRITICAL(&mLock);
+  mDriftRise = SAFETY_DRIFT_RISE * (2 * spare - 1);
+  portEXIT_CRITICAL(&mLock);
+}
+
+void SafetyMonitor::reset()
+{
+  portENTER_CRITICAL(&mLock);
+  mFault      = SAFETY_OK;
+  mOverCount  = 0;
+  mOffCount   = 0;
+  mCoastArmed = false;
+  mOnTemp     = NAN;
+#ifdef SAFETY_INJECT
+  mInject = SAFETY_OK;
+#endif
+  portEXIT_CRITICAL(&mLock);
+}
+
+#ifdef SAFETY_INJECT
+void SafetyMonitor::inject(SafetyFault fault)
+{
+  portENTER_CRITICAL(&mLock);
+  mInject   = fault;
+  mFakeTemp = NAN;
+  portEXIT_CRITICAL(&mLock);
+}
+#endif
+
+void SafetyMonitor::trip(SafetyFault fault)
+{
+  digitalWrite(mPin, LOW);
+  if (mFault == SAFETY_OK) {
+    mFault = fault;
+    mTrips++;
+  }
+}
+
+// A pulse with the relay off and released, the last SAFETY_STUCK_PULSES kept
+void SafetyMonitor::offPulse(int64_t us)
+{
+  mOffPulses[mOffCount % SAFETY_STUCK_PULSES] = us;
+  mOffCount++;
+}
+
+void SafetyMonitor::task(void *arg)
+{
+  SafetyMonitor *self = (SafetyMonitor *)arg;
+  TickType_t wake     = xTaskGetTickCount();
+  for (;;) {
+    self->check();
+    vTaskDelayUntil(&wake, pdMS_TO_TICKS(SAFETY_PERIOD_MS));
+  }
+}
+
+void SafetyMonitor::check()
+{
+  uint32_t now = millis();
+
+  portENTER_CRITICAL(&mLock);
+  bool relay        = mRelay;
+  uint32_t relayMs  = mRelayMs;
+  float temp        = mTemp;
+  float setpoint    = mSetpoint;
+  uint32_t sampleMs = mSampleMs;
+  uint32_t seq      = mSampleSeq;
+  bool firing       = mFiring;
+  float driftRise   = mDriftRise;
+  portEXIT_CRITICAL(&mLock);
+
+  if (mFault != SAFETY_OK) {
+    // Whatever the controller does, the relay stays off
+    digitalWrite(mPin, LOW);
+    return;
+  }
+
+  uint32_t inState = now - relayMs;
+  int64_t nowUs    = esp_timer_get_time();
+
+  // A new relay phase restarts the checks that depend on it
+  if (relay != mLastRelay || relayMs != mLastRelayMs) {
+    mLastRelay   = relay;
+    mLastRelayMs = relayMs;
+    mPhaseUs     = nowUs - inState * 1000LL;
+    mOffCount    = 0;
+    mCoastArmed  = false;
+    mOnTemp      = NAN;
+  }
+  if (!firing)
+    mCoastArmed = false;
+
+  // Pulses that came in with the contactor released
+  int64_t releaseUs = mPhaseUs + SAFETY_RELEASE_MS * 1000LL;
+  int64_t pulseUs;
+  while (mMeter->nextPulse(mCursor, pulseUs)) {
+    if (!relay && pulseUs > releaseUs)
+      offPulse(pulseUs);
+  }
+
+  int64_t last    = mMeter->lastCaptureUs();
+  int64_t sinceUs = last < 0 ? INT64_MAX : nowUs - last;
+
+#ifdef SAFETY_INJECT
+  switch (mInject) {
+  case SAFETY_STUCK:
+    if (!relay && nowUs > releaseUs)
+      offPulse(nowUs);
+    break;
+  case SAFETY_OPEN:
+    sinceUs = INT64_MAX;
+    break;
+  case SAFETY_OVERTEMP:
+    temp = SAFETY_TMAX + 1;
+    break;
+  case SAFETY_RUNAWAY:
+    mFakeTemp = isnan(mFakeTemp) ? temp : mFakeTemp + 1;
+    temp      = mFakeTemp;
+    break;
+  case SAFETY_TC_DRIFT:
+    mFakeTemp = isnan(mFakeTemp) ? temp : mFakeTemp;
+    temp      = mFakeTemp;
+    break;
+  default:
+    break;
+  }
+#endif
+
+  if (sampleMs && now - sampleMs > SAFETY_STALE_MS)
+    return trip(SAFETY_STALE);
+
+  if (!relay && mOffCount >= SAFETY_STUCK_PULSES) {
+    int64_t first = mOffPulses[mOffCount % SAFETY_STUCK_PULSES];
+    int64_t last  = mOffPulses[(mOffCount - 1) % SAFETY_STUCK_PULSES];
+    if (last - first <= SAFETY_STUCK_MS * 1000LL)
+      return trip(SAFETY_STUCK);
+  }
+
+  if (relay && inState > SAFETY_OPEN_MS && sinceUs > SAFETY_OPEN_MS * 1000LL)
+    return trip(SAFETY_OPEN);
+
+  // The rest only once per temperature reading
+  if (seq == mSeenSeq || isnan(temp))
+    return;
+  mSeenSeq = seq;
+
+  bool over = temp > SAFETY_TMAX;
+  if (relay && setpoint > 0 && temp > setpoint + SAFETY_MARGIN)
+    over = true;
+  mOverCount = over ? mOverCount + 1 : 0;
+  if (mOverCount >= SAFETY_TRIP_SAMPLES)
+    return trip(SAFETY_OVERTEMP);
+
+  if (firing && !relay && inState > SAFETY_COAST_MS) {
+    if (!mCoastArmed) {
+      mCoastArmed = true;
+      mCoastLow   = temp;
+    }
+    mCoastLow = std::min(mCoastLow, temp);
+    if (temp - mCoastLow > SAFETY_COAST_RISE)
+      return trip(SAFETY_RUNAWAY);
+  }
+
+  if (relay) {
+    if (isnan(mOnTemp))
+      mOnTemp = temp;
+    if (inState > SAFETY_DRIFT_MS && temp < SAFETY_DRIFT_BELOW &&
+        temp - mOnTemp < driftRise)
+      return trip(SAFETY_TC_DRIFT);
+  }
+}
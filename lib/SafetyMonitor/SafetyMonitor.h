@@ -0,0 +1,146 @@
+#ifndef __safety_monitor_h__
+#define __safety_monitor_h__
+
+#include <Arduino.h>
+
+#include "PulseMeter.h"
+
+/*
+ * Independent safety monitor.
+ *
+ * Runs in its own task every SAFETY_PERIOD_MS and checks the relay state it
+ * is told about against the S0 pulses from the ISR, read through its own
+ * PulseCursor with the meter's debounce, and the temperature getTemp()
+ * posts, so a stuck timer or a hung controller can't hide a fault.
+ * On a fault it drives the relay pin low itself, keeps it low and latches the
+ * fault until reset().
+ *
+ * Worst case detection latency, P = SAFETY_PERIOD_MS, S = 2 s sample period:
+ *
+ *  STALE     no sample for SAFETY_STALE_MS, + P
+ *  STUCK     relay off for SAFETY_RELEASE_MS, then SAFETY_STUCK_PULSES
+ *            pulses within SAFETY_STUCK_MS, + P
+ *  OPEN      relay on with no pulse for SAFETY_OPEN_MS, + P
+ *  OVERTEMP  SAFETY_TRIP_SAMPLES x S over SAFETY_TMAX, or SAFETY_MARGIN over
+ *            the setpoint with the relay on, + P
+ *  RUNAWAY   firing, relay off for SAFETY_COAST_MS, then SAFETY_COAST_RISE
+ *            over the lowest reading since, + S + P
+ *  TC_DRIFT  relay on for SAFETY_DRIFT_MS below SAFETY_DRIFT_BELOW with less
+ *            than the drift rise gained, + S + P
+ *
+ * With the relay off nothing should use energy or add heat. Three pulses in
+ * a minute are two intervals of 30 s at most, 0.5 Wh / 30 s = 60 W through
+ * the meter: far above meter creep and the controller's own draw and far
+ * below an element, so a slow trickle of pulses doesn't trip STUCK and a
+ * closed contactor does in a few seconds. Once the walls have soaked out
+ * the kiln can only cool, a rise from its lowest point is heat from
+ * somewhere. Outside a firing no heat is expected either way and a kiln
+ * warmed by the sun or a lid opened hot isn't a runaway, so that check only
+ * arms while firing(true).
+ *
+ * Elements with power to spare climb SAFETY_DRIFT_RISE in SAFETY_DRIFT_MS
+ * easily, aged ones may barely hold the ramp and stall. headroom() takes
+ * what ElementHealth knows of that: the drift rise goes down with the spare
+ * power from SAFETY_DRIFT_SPARE on, to a fall of SAFETY_DRIFT_RISE with
+ * none, so a stall isn't taken for a drifting thermocouple.
+ *
+ * Built with SAFETY_INJECT, inject() fakes each fault at the monitor's inputs
+ * so the detection and the shutdown path can be exercised on the bench.
+ */
+
+#define SAFETY_PERIOD_MS    500
+#define SAFETY_STALE_MS     10000 // 5 missed samples
+#define SAFETY_RELEASE_MS   3000  // contactor drop out and the last pulse
+#define SAFETY_STUCK_PULSES 3
+#define SAFETY_STUCK_MS     60000 // window for the pulses
+#define SAFETY_OPEN_MS      4000 // 8x the pulse interval at 3.6 kW
+#define SAFETY_TMAX         1300
+#define SAFETY_MARGIN       40
+#define SAFETY_TRIP_SAMPLES 3
+#define SAFETY_COAST_MS     (5 * 60 * 1000UL) // heat soaking out of the walls
+#define SAFETY_COAST_RISE   15
+#define SAFETY_DRIFT_MS     (10 * 60 * 1000UL)
+#define SAFETY_DRIFT_BELOW  1000
+#define SAFETY_DRIFT_RISE   5
+#define SAFETY_DRIFT_SPARE  0.2f // spare power for the full rise
+
+enum SafetyFault : uint8_t {
+  SAFETY_OK,
+  SAFETY_STALE,
+  SAFETY_STUCK,
+  SAFETY_OPEN,
+  SAFETY_OVERTEMP,
+  SAFETY_RUNAWAY,
+  SAFETY_TC_DRIFT,
+  SAFETY_FAULT_COUNT,
+};
+
+class SafetyMonitor
+{
+  private:
+  uint8_t mPin;
+  PulseMeter *mMeter;
+  TaskHandle_t mTask;
+  portMUX_TYPE mLock = portMUX_INITIALIZER_UNLOCKED;
+
+  // Inputs
+  bool mRelay;
+  uint32_t mRelayMs;
+  float mTemp;
+  float mSetpoint;
+  uint32_t mSampleMs;
+  uint32_t mSampleSeq;
+  bool mFiring;
+  float mDriftRise;
+
+  // Monitor task only
+  bool mLastRelay;
+  uint32_t mLastRelayMs;
+  uint32_t mSeenSeq;
+  int64_t mPhaseUs; // esp_timer time of the last relay change
+  PulseCursor mCursor;
+  int64_t mOffPulses[SAFETY_STUCK_PULSES]; // last ones after the release
+  uint32_t mOffCount;
+  uint8_t mOverCount;
+  bool mCoastArmed;
+  float mCoastLow;
+  float mOnTemp;
+
+  volatile SafetyFault mFault;
+  uint32_t mTrips;
+#ifdef SAFETY_INJECT
+  volatile SafetyFault mInject;
+  float mFakeTemp;
+#endif
+
+  static void task(void *arg);
+  void offPulse(int64_t us);
+  void trip(SafetyFault fault);
+
+  public:
+  SafetyMonitor(uint8_t relayPin, PulseMeter *meter);
+  void begin();
+
+  // Every relay change and every temperature reading
+  void relay(bool on);
+  void post(float temp, float setpoint);
+  // From the start of a firing until it stops, cooling down included
+  void firing(bool active);
+  // Share of element power spare, ElementHealth::headroom()
+  void headroom(float share);
+
+  // One pass of the checks, the task's every SAFETY_PERIOD_MS
+  void check();
+
+  bool tripped() { return mFault != SAFETY_OK; }
+  SafetyFault fault() { return mFault; }
+  static const char *name(SafetyFault fault);
+  uint32_t trips() { return mTrips; }
+  void reset();
+
+#ifdef SAFETY_INJECT
+  void inject(SafetyFault fault);
+#endif
+};
+
+#endif
@@ -0,0 +1,231 @@
+#include "Scheduler.h"
+
+#include <algorithm>
+
+#include "esp_timer.h"
+
+Scheduler::Scheduler(SchedClock clock)
+{
+  memset(mJobs, 0, sizeof(mJobs));
+
+  mClock   = clock;
+  mHook    = nullptr;
+  mEpochUs = 0;
+  mPasses  = 0;
+}
+
+void Scheduler::begin() { mEpochUs = now(); }
+
+int64_t Scheduler::now() { return mClock ? mClock() : esp_timer_get_time(); }
+
+bool Scheduler::add(uint8_t id, const char *name, SchedStage stage,
+                    uint32_t periodMs, uint32_t phaseMs, SchedFn fn)
+{
+  if (id >= SCHED_JOBS || stage >= SCHED_STAGES || fn == nullptr)
+    return false;
+
+  portENTER_CRITICAL(&mLock);
+  Job &j     = mJobs[id];
+  j.name     = name;
+  j.fn       = fn;
+  j.stage    = stage;
+  j.periodMs = periodMs;
+  j.phaseMs  = phaseMs;
+  j.active   = false;
+  j.dueUs    = 0;
+  memset(&j.stats, 0, sizeof(j.stats));
+  portEXIT_CRITICAL(&mLock);
+  return true;
+}
+
+void Scheduler::start(uint8_t id)
+{
+  if (id >= SCHED_JOBS || mJobs[id].periodMs == 0)
+    return;
+
+  int64_t t = now();
+  portENTER_CRITICAL(&mLock);
+  Job &j         = mJobs[id];
+  int64_t period = j.periodMs * 1000LL;
+  int64_t first  = mEpochUs + j.phaseMs * 1000LL;
+  // Strictly after now, a job started from a job doesn't run in that pass
+  j.dueUs  = t < first ? first : first + ((t - first) / period + 1) * period;
+  j.active = true;
+  portEXIT_CRITICAL(&mLock);
+}
+
+void Scheduler::once(uint8_t id, uint32_t delayMs)
+{
+  if (id >= SCHED_JOBS)
+    return;
+
+  int64_t t = now();
+  portENTER_CRITICAL(&mLock);
+  mJobs[id].dueUs  = t + delayMs * 1000LL;
+  mJobs[id].active = mJobs[id].fn != nullptr;
+  portEXIT_CRITICAL(&mLock);
+}
+
+void Scheduler::stop(uint8_t id)
+{
+  if (id >= SCHED_JOBS)
+    return;
+
+  portENTER_CRITICAL(&mLock);
+  mJobs[id].active = false;
+  portEXIT_CRITICAL(&mLock);
+}
+
+// Moves a due job to its next release, counting the ones it missed
+bool Scheduler::take(uint8_t id, int64_t nowUs)
+{
+  bool due = false;
+
+  portENTER_CRITICAL(&mLock);
+  Job &j = mJobs[id];
+  if (j.active && j.dueUs <= nowUs) {
+    due          = true;
+    int64_t late = nowUs - j.dueUs;
+    if (j.periodMs) {
+      int64_t period  = j.periodMs * 1000LL;
+      uint32_t missed = late / period;
+      j.dueUs += (missed + 1) * period;
+      j.stats.misses += missed;
+    } else {
+      j.active = false;
+    }
+
+    SchedStats &s = j.stats;
+    s.lateUs      = late;
+    s.maxLateUs   = std::max<uint32_t>(s.maxLateUs, late);
+    s.jitterUs += ((int32_t)s.lateUs - (int32_t)s.jitterUs) / 16;
+  }
+  portEXIT_CRITICAL(&mLock);
+  return due;
+}
+
+uint32_t Scheduler::run(uint32_t maxMs)
+{
+  int64_t t     = now();
+  uint32_t wait = run(t, maxMs);
+  uint32_t took = (now() - t) / 1000;
+  return wait > took ? wait - took : 0;
+}
+
+uint32_t Scheduler::run(int64_t nowUs, uint32_t maxMs)
+{
+  mPasses++;
+
+  for (uint8_t stage = 0; stage < SCHED_STAGES; stage++) {
+    for (uint8_t id = 0; id < SCHED_JOBS; id++) {
+      if (mJobs[id].stage != stage || !take(id, nowUs))
+        continue;
+
+      if (mHook)
+        mHook(id);
+      int64_t t = now();
+      mJobs[id].fn();
+      uint32_t runUs = now() - t;
+
+      portENTER_CRITICAL(&mLock);
+      SchedStats &s = mJobs[id].stats;
+      s.runs++;
+      s.runUs    = runUs;
+      s.maxRunUs = std::max<uint32_t>(s.maxRunUs, runUs);
+      portEXIT_CRITICAL(&mLock);
+    }
+  }
+
+  int64_t next = nowUs + maxMs * 1000LL;
+  portENTER_CRITICAL(&mLock);
+  for (uint8_t id = 0; id < SCHED_JOBS; id++) {
+    if (mJobs[id].active && mJobs[id].dueUs < next)
+      next = mJobs[id].dueUs;
+  }
+  portEXIT_CRITICAL(&mLock);
+
+  return next <= nowUs ? 0 : (next - nowUs + 999) / 1000;
+}
+
+SchedStats Scheduler::stats(uint8_t id)
+{
+  SchedStats s = {};
+  if (id >= SCHED_JOBS)
+    return s;
+
+  portENTER_CRITICAL(&mLock);
+  s = mJobs[id].stats;
+  portEXIT_CRITICAL(&mLock);
+  return s;
+}
+
+void Scheduler::resetStats()
+{
+  portENTER_CRITICAL(&mLock);
+  for (uint8_t id = 0; id < SCHED_JOBS; id++)
+    memset(&mJobs[id].stats, 0, sizeof(SchedStats));
+  portEXIT_CRITICAL(&mLock);
+}
+
+void Scheduler::toJson(JsonArray jobs)
+{
+  for (uint8_t id = 0; id < SCHED_JOBS; id++) {
+    const Job &j = mJobs[id];
+    if (j.fn == nullptr)
+      continue;
+
+    SchedStats s  = stats(id);
+    JsonArray row = jobs.createNestedArray();
+    row.add(j.name);
+    row.add(j.periodMs);
+    row.add(j.phaseMs);
+    row.add(j.active);
+    row.add(s.runs);
+    row.add(s.misses);
+    row.add(s.lateUs);
+    row.add(s.maxLateUs);
+    row.add(s.jitterUs);
+    row.add(s.maxRunUs);
+  }
+}
+
+// Prometheus wants every family in one group, so one pass per family
+void Scheduler::print(Print &out)
+{
+  static const char *families[] = {
+      "runs_total",       "misses_total",     "late_seconds",
+      "late_max_seconds", "run_max_seconds",
+  };
+  SchedStats snap[SCHED_JOBS];
+  for (uint8_t id = 0; id < SCHED_JOBS; id++)
+    snap[id] = stats(id);
+
+  for (uint8_t f = 0; f < 5; f++) {
+    out.printf("# TYPE kiln_job_%s %s\n", families[f],
+               f < 2 ? "counter" : "gauge");
+    for (uint8_t id = 0; id < SCHED_JOBS; id++) {
+      const SchedStats &s = snap[id];
+      if (mJobs[id].fn == nullptr)
+        continue;
+
+      out.printf("kiln_job_%s{job=\"%s\"} ", families[f], mJobs[id].name);
+      switch (f) {
+      case 0:
+        out.printf("%u\n", s.runs);
+        break;
+      case 1:
+        out.printf("%u\n", s.misses);
+        break;
+      case 2:
+        out.printf("%.6f\n", s.jitterUs / 1e6);
+        break;
+      case 3:
+        out.printf("%.6f\n", s.maxLateUs / 1e6);
+        break;
+      default:
+        out.printf("%.6f\n", s.maxRunUs / 1e6);
+        break;
+      }
+    }
+  }
+}
@@ -0,0 +1,105 @@
+#ifndef __scheduler_h__
+#define __scheduler_h__
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+/*
+ * One timeline for all the periodic work, run from the control task.
+ *
+ * Every job has a period and a phase offset on a grid that starts at
+ * begin(), it is due at begin + phase + k * period. Jobs due at the same
+ * time run by stage, sample, filter, control and then publish, and within a
+ * stage by id. Which of two jobs runs first never depends on which timer
+ * happened to fire first.
+ *
+ * start() puts a job on its next grid slot after now, once() runs it a
+ * single time after a delay. Both may be called from any task, whoever
+ * calls run() should be woken so it can wait for the new due time.
+ *
+ * How late a job runs after its due time is its jitter. A job still not run
+ * when its next release comes is a deadline miss, the releases in between
+ * are skipped rather than made up.
+ *
+ * The clock is esp_timer_get_time() unless another one is given. run(nowUs)
+ * takes the time from the caller, so the same job table can be stepped on a
+ * virtual clock. The hook, when set, is called with every job about to run,
+ * which is all a recording needs to know about timer firings.
+ */
+
+#define SCHED_JOBS 12
+
+enum SchedStage : uint8_t {
+  SCHED_SAMPLE,
+  SCHED_FILTER,
+  SCHED_CONTROL,
+  SCHED_PUBLISH,
+  SCHED_STAGES,
+};
+
+typedef void (*SchedFn)();
+typedef int64_t (*SchedClock)();
+typedef void (*SchedHook)(uint8_t id);
+
+struct SchedStats {
+  uint32_t runs;
+  uint32_t misses;    // releases skipped as the job ran too late
+  uint32_t lateUs;    // last run after its due time
+  uint32_t maxLateUs;
+  uint32_t jitterUs;  // mean late, 1/16 exponential average
+  uint32_t runUs;     // last run time
+  uint32_t maxRunUs;
+};
+
+class Scheduler
+{
+  private:
+  struct Job {
+    const char *name;
+    SchedFn fn;
+    SchedStage stage;
+    uint32_t periodMs; // 0 only runs through once()
+    uint32_t phaseMs;
+    bool active;
+    int64_t dueUs;
+    SchedStats stats;
+  };
+
+  SchedClock mClock;
+  SchedHook mHook;
+  portMUX_TYPE mLock = portMUX_INITIALIZER_UNLOCKED;
+  Job mJobs[SCHED_JOBS];
+  int64_t mEpochUs;
+  uint32_t mPasses;
+
+  bool take(uint8_t id, int64_t nowUs);
+
+  public:
+  Scheduler(SchedClock clock = nullptr);
+  void begin();
+
+  bool add(uint8_t id, const char *name, SchedStage stage, uint32_t periodMs,
+           uint32_t phaseMs, SchedFn fn);
+  void start(uint8_t id);
+  void once(uint8_t id, uint32_t delayMs);
+  void stop(uint8_t id);
+  bool active(uint8_t id) { return id < SCHED_JOBS && mJobs[id].active; }
+
+  // Runs whatever is due, returns ms until the next job is, at most maxMs
+  uint32_t run(uint32_t maxMs = 1000);
+  uint32_t run(int64_t nowUs, uint32_t maxMs);
+
+  int64_t now();
+  void hook(SchedHook hook) { mHook = hook; }
+  uint32_t passes() { return mPasses; }
+  SchedStats stats(uint8_t id);
+  void resetStats();
+
+  // Per job: name, period, phase, active, runs, misses, late, max late,
+  // jitter, max run time
+  void toJson(JsonArray jobs);
+  // Runs, misses and lateness per job in the Prometheus text format
+  void print(Print &out);
+};
+
+#endif
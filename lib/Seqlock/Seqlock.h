@@ -0,0 +1,61 @@
+#ifndef __seqlock_h__
+#define __seqlock_h__
+
+#include <Arduino.h>
+
+/*
+ * Single writer, many readers, nobody waits.
+ *
+ * Two copies of T behind a sequence counter. The writer bumps the counter
+ * before updating each copy, so readers always copy the one that isn't being
+ * written (seq & 1) and only go round again when a whole half update slipped
+ * in during their copy. Readers never hold up the writer and never see a
+ * torn T, which is what lets the control task publish to web and MQTT
+ * readers on the other core without a lock.
+ *
+ * T must be trivially copyable and written from one task only.
+ */
+
+template <typename T> class Seqlock
+{
+  private:
+  T mBuf[2];
+  uint32_t mSeq;
+  uint32_t mRetries;
+
+  public:
+  Seqlock() : mSeq(0), mRetries(0) { memset(mBuf, 0, sizeof(mBuf)); }
+
+  void write(const T &value)
+  {
+    uint32_t seq = __atomic_load_n(&mSeq, __ATOMIC_RELAXED);
+
+    // Readers move to mBuf[1] while mBuf[0] is written, then back
+    __atomic_store_n(&mSeq, seq + 1, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    mBuf[0] = value;
+    __atomic_store_n(&mSeq, seq + 2, __ATOMIC_RELEASE);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    mBuf[1] = value;
+  }
+
+  T read()
+  {
+    T value;
+    uint32_t seq;
+    for (;;) {
+      seq   = __atomic_load_n(&mSeq, __ATOMIC_ACQUIRE);
+      value = mBuf[seq & 1];
+      __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      if (__atomic_load_n(&mSeq, __ATOMIC_RELAXED) == seq)
+        return value;
+      mRetries++;
+    }
+  }
+
+  // Changes on every write, to tell whether there is anything new
+  uint32_t version() { return __atomic_load_n(&mSeq, __ATOMIC_ACQUIRE); }
+  uint32_t retries() { return mRetries; }
+};
+
+#endif
@@ -0,0 +1,167 @@
+#include "StateSnapshot.h"
+
+#include "Timebase.h"
+
+// One decimal, as a double so it prints as one
+static double tenths(float v) { return round(v * 10) / 10.0; }
+
+StateSnapshot::StateSnapshot()
+{
+  mLock = nullptr;
+  strcpy(mState, "idle");
+  mInfo[0] = '\0';
+  memset(mSchedule, 0, sizeof(mSchedule));
+  mPayload[0] = '\0';
+
+  mStep        = 0;
+  mSetpoint    = NAN;
+  mTemp        = NAN;
+  mHead        = 0;
+  mCount       = 0;
+  mAlarmHead   = 0;
+  mAlarmCount  = 0;
+  mDirty       = true;
+  mUrgent      = true;
+  mLastPublish = 0;
+}
+
+void StateSnapshot::begin() { mLock = xSemaphoreCreateMutex(); }
+
+void StateSnapshot::setState(const char *state, const char *info, int step)
+{
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  if (strcmp(state, mState) || step != mStep)
+    mUrgent = true;
+  strlcpy(mState, state, sizeof(mState));
+  strlcpy(mInfo, info, sizeof(mInfo));
+  mStep  = step;
+  mDirty = true;
+  xSemaphoreGive(mLock);
+}
+
+void StateSnapshot::setProcess(float temp, float setpoint)
+{
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  mTemp     = temp;
+  mSetpoint = setpoint;
+  mDirty    = true;
+  xSemaphoreGive(mLock);
+}
+
+void StateSnapshot::setSchedule(const int schedule[4][3])
+{
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  memcpy(mSchedule, schedule, sizeof(mSchedule));
+  mDirty  = true;
+  mUrgent = true;
+  xSemaphoreGive(mLock);
+}
+
+void StateSnapshot::addHistory(uint32_t ts, float temp)
+{
+  if (ts == 0 || isnan(temp))
+    return;
+
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  size_t last = (mHead + mCount + SNAPSHOT_POINTS - 1) % SNAPSHOT_POINTS;
+  if (mCount == 0 || ts - mHistory[last].ts >= SNAPSHOT_STEP_S) {
+    if (mCount == SNAPSHOT_POINTS) {
+      mHead = (mHead + 1) % SNAPSHOT_POINTS;
+      mCount--;
+    }
+    Point &p = mHistory[(mHead + mCount) % SNAPSHOT_POINTS];
+    p.ts     = ts;
+    p.temp   = temp;
+    mCount++;
+    mDirty = true;
+  }
+  xSemaphoreGive(mLock);
+}
+
+void StateSnapshot::addAlarm(uint32_t ts, const char *msg)
+{
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  if (mAlarmCount == SNAPSHOT_ALARMS) {
+    mAlarmHead = (mAlarmHead + 1) % SNAPSHOT_ALARMS;
+    mAlarmCount--;
+  }
+  Alarm &a = mAlarms[(mAlarmHead + mAlarmCount) % SNAPSHOT_ALARMS];
+  a.ts     = ts;
+  strlcpy(a.msg, msg, sizeof(a.msg));
+  mAlarmCount++;
+  mDirty  = true;
+  mUrgent = true;
+  xSemaphoreGive(mLock);
+}
+
+void StateSnapshot::refresh()
+{
+  mDirty  = true;
+  mUrgent = true;
+}
+
+bool StateSnapshot::flush(uint32_t now, uint32_t minMs, SnapshotSink sink)
+{
+  if (mLock == nullptr || !mDirty ||
+      (!mUrgent && (millis() - mLastPublish) < minMs))
+    return false;
+
+  // Held across the sink so mPayload can't change under the transport
+  xSemaphoreTake(mLock, portMAX_DELAY);
+  size_t len = serialize(now);
+  bool sent  = len && sink(mPayload, len);
+  if (sent) {
+    mDirty       = false;
+    mUrgent      = false;
+    mLastPublish = millis();
+  }
+  xSemaphoreGive(mLock);
+
+  return sent;
+}
+
+// Strings go in by pointer, mLock keeps them as they are until written.
+// 0 when it doesn't fit mPayload.
+size_t StateSnapshot::serialize(uint32_t now)
+{
+  mDoc.clear();
+  mDoc["v"]  = 1;
+  mDoc["ts"] = timebase.correct(now);
+  mDoc["s"]  = (const char *)mState;
+  mDoc["i"]  = (const char *)mInfo;
+  mDoc["st"] = mStep;
+  mDoc["sp"] = tenths(mSetpoint); // NaN goes out as null
+  mDoc["T"]  = tenths(mTemp);
+
+  JsonArray sch = mDoc.createNestedArray("sch");
+  for (size_t i = 0; i < 4; i++) {
+    JsonArray seg = sch.createNestedArray();
+    for (size_t j = 0; j < 3; j++)
+      seg.add(mSchedule[i][j]);
+  }
+
+  // Points taken before SNTP synced are put right here
+  uint32_t h0 = mCount ? timebase.correct(mHistory[mHead].ts) : 0;
+  mDoc["h0"]  = h0;
+  JsonArray h = mDoc.createNestedArray("h");
+  for (size_t i = 0; i < mCount; i++) {
+    const Point &p = mHistory[(mHead + i) % SNAPSHOT_POINTS];
+    JsonArray row  = h.createNestedArray();
+    row.add(timebase.correct(p.ts) - h0);
+    row.add(tenths(p.temp));
+  }
+
+  JsonArray alarms = mDoc.createNestedArray("a");
+  for (size_t i = 0; i < mAlarmCount; i++) {
+    const Alarm &a = mAlarms[(mAlarmHead + i) % SNAPSHOT_ALARMS];
+    JsonArray row  = alarms.createNestedArray();
+    row.add(timebase.correct(a.ts));
+    row.add((const char *)a.msg);
+  }
+
+  if (mDoc.overflowed())
+    return 0;
+  // Truncated output is cut to sizeof(mPayload) - 1 characters
+  size_t len = serializeJson(mDoc, mPayload, sizeof(mPayload));
+  return len < sizeof(mPayload) - 1 ? len : 0;
+}
@@ -0,0 +1,85 @@
+#ifndef __state_snapshot_h__
+#define __state_snapshot_h__
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+/*
+ * Compact picture of the kiln for a retained MQTT message, so a subscriber
+ * gets state, schedule, recent history and alarms in one round trip.
+ *
+ * Each setter only touches its own field, history is decimated on the way in
+ * to one point per SNAPSHOT_STEP_S, so keeping it current is cheap and only
+ * serialize() walks the whole thing.
+ *
+ * {"v":1,"ts":1645000000,"s":"firing","i":"Firing @1240°C","st":2,"sp":612.5,
+ *  "T":610.2,"sch":[[100,100,15],...],"h0":1644992800,"h":[[0,21.5],...],
+ *  "a":[[1644999000,"High internal temp: 61.0°C"]]}
+ * h holds [seconds after h0, temperature] pairs, a the newest alarms last.
+ */
+
+#define SNAPSHOT_POINTS  60
+#define SNAPSHOT_STEP_S  120 // 60 points x 2 min = last 2 hours
+#define SNAPSHOT_ALARMS  4
+#define SNAPSHOT_TEXT    48
+#define SNAPSHOT_PAYLOAD 1536
+#define SNAPSHOT_DOC     4096 // 218 slots with every point and alarm
+
+// Hands the serialized snapshot to the transport, true once it is queued
+typedef bool (*SnapshotSink)(const char *payload, size_t len);
+
+class StateSnapshot
+{
+  private:
+  struct Point {
+    uint32_t ts;
+    float temp;
+  };
+  struct Alarm {
+    uint32_t ts;
+    char msg[SNAPSHOT_TEXT];
+  };
+
+  SemaphoreHandle_t mLock;
+
+  char mState[12];
+  char mInfo[SNAPSHOT_TEXT];
+  int mStep;
+  float mSetpoint;
+  float mTemp;
+  int mSchedule[4][3];
+
+  Point mHistory[SNAPSHOT_POINTS];
+  size_t mHead;
+  size_t mCount;
+
+  Alarm mAlarms[SNAPSHOT_ALARMS];
+  size_t mAlarmHead;
+  size_t mAlarmCount;
+
+  bool mDirty;
+  bool mUrgent;
+  uint32_t mLastPublish;
+
+  char mPayload[SNAPSHOT_PAYLOAD];
+  StaticJsonDocument<SNAPSHOT_DOC> mDoc;
+
+  size_t serialize(uint32_t now);
+
+  public:
+  StateSnapshot();
+  void begin();
+
+  void setState(const char *state, const char *info, int step);
+  void setProcess(float temp, float setpoint);
+  void setSchedule(const int schedule[4][3]);
+  void addHistory(uint32_t ts, float temp);
+  void addAlarm(uint32_t ts, const char *msg);
+
+  // Publish again on the next flush(), e.g. after a reconnect
+  void refresh();
+  // Sends when dirty and either urgent or minMs after the last one
+  bool flush(uint32_t now, uint32_t minMs, SnapshotSink sink);
+};
+
+#endif
@@ -0,0 +1,169 @@
+#include "SyslogSink.h"
+
+#include <WiFi.h>
+
+#include <algorithm>
+
+#define SYSLOG_FACILITY 16 // local0
+
+// By journal level
+static const uint8_t severities[] = {7, 3, 4, 6, 7};
+
+SyslogSink::SyslogSink(const char *host, uint16_t port, const char *hostname,
+                       const char *app)
+{
+  strlcpy(mHost, host, sizeof(mHost));
+  mPort    = port;
+  mLevel   = JOURNAL_WARN;
+  mRate    = SYSLOG_RATE;
+  mChanged = true;
+
+  mName[0]   = '\0';
+  mSendPort  = 0;
+  mResolved  = false;
+  mResolveMs = 0;
+  mTailLen   = snprintf(mTail, sizeof(mTail), "1 - %s %s - - - ", hostname,
+                        app);
+  mTailLen   = std::min<size_t>(mTailLen, sizeof(mTail) - 1);
+
+  memset(mQueue, 0, sizeof(mQueue));
+  mHead     = 0;
+  mCount    = 0;
+  mTokens   = SYSLOG_QUEUE * 1000;
+  mRefillMs = 0;
+
+  mSent         = 0;
+  mQueueDropped = 0;
+  mRateDropped  = 0;
+  mFailed       = 0;
+}
+
+bool SyslogSink::configure(JsonVariantConst syslog)
+{
+  const char *host = syslog["host"] | (const char *)mHost;
+  long port        = syslog["port"] | (long)mPort;
+  int level        = syslog["level"] | (int)mLevel;
+  int rate         = syslog["rate"] | (int)mRate;
+  if (!*host || strlen(host) >= sizeof(mHost) || port < 1 || port > 65535 ||
+      level < JOURNAL_OFF || level > JOURNAL_DEBUG || rate < 1 || rate > 100)
+    return false;
+
+  char copy[sizeof(mHost)];
+  strlcpy(copy, host, sizeof(copy)); // may be mHost itself
+  portENTER_CRITICAL(&mLock);
+  strlcpy(mHost, copy, sizeof(mHost));
+  mPort    = port;
+  mLevel   = level;
+  mRate    = rate;
+  mChanged = true;
+  portEXIT_CRITICAL(&mLock);
+  return true;
+}
+
+void SyslogSink::toJson(JsonObject syslog)
+{
+  char host[sizeof(mHost)];
+  portENTER_CRITICAL(&mLock);
+  strlcpy(host, mHost, sizeof(host));
+  portEXIT_CRITICAL(&mLock);
+
+  syslog["host"]  = host; // char *, copied
+  syslog["port"]  = mPort;
+  syslog["level"] = mLevel;
+  syslog["rate"]  = mRate;
+}
+
+void SyslogSink::line(uint8_t level, uint32_t ms, const char *text,
+                      size_t len)
+{
+  if (level > mLevel)
+    return;
+
+  // Refill since the last line, up to a burst of a full queue
+  uint32_t elapsed = std::min<uint32_t>(ms - mRefillMs, SYSLOG_QUEUE * 1000);
+  uint32_t burst   = SYSLOG_QUEUE * 1000;
+  mTokens          = std::min<uint32_t>(burst, mTokens + elapsed * mRate);
+  mRefillMs        = ms;
+  if (mTokens < 1000) {
+    mRateDropped++;
+    return;
+  }
+  if (mCount == SYSLOG_QUEUE) {
+    mQueueDropped++;
+    return;
+  }
+  mTokens -= 1000;
+
+  while (len && (text[len - 1] == '\n' || text[len - 1] == '\r'))
+    len--;
+  Line &l    = mQueue[(mHead + mCount) % SYSLOG_QUEUE];
+  l.severity = severities[std::min<uint8_t>(level, JOURNAL_DEBUG)];
+  l.len      = std::min<size_t>(len, SYSLOG_TEXT);
+  memcpy(l.text, text, l.len);
+  mCount++;
+}
+
+bool SyslogSink::resolve(uint32_t now)
+{
+  portENTER_CRITICAL(&mLock);
+  bool changed = mChanged;
+  if (changed) {
+    strlcpy(mName, mHost, sizeof(mName));
+    mSendPort = mPort;
+    mChanged  = false;
+  }
+  portEXIT_CRITICAL(&mLock);
+
+  if (changed) {
+    mAddress   = IPAddress();
+    mResolved  = false;
+    mResolveMs = 0;
+  }
+
+  uint32_t every = mResolved ? SYSLOG_RESOLVE_MS : SYSLOG_RETRY_MS;
+  if (mResolveMs == 0 || now - mResolveMs >= every) {
+    // Blocks for the lookup, fine on the journal task
+    IPAddress address;
+    mResolveMs = now ? now : 1;
+    mResolved  = WiFi.hostByName(mName, address) == 1;
+    if (mResolved)
+      mAddress = address;
+  }
+  // A failed refresh keeps sending to the address we had
+  return (uint32_t)mAddress != 0;
+}
+
+void SyslogSink::flush()
+{
+  if (mCount == 0 || !WiFi.isConnected() || !resolve(millis()))
+    return;
+
+  char packet[8 + sizeof(mTail) + SYSLOG_TEXT];
+  for (uint8_t i = 0; i < SYSLOG_BATCH && mCount; i++) {
+    const Line &l = mQueue[mHead];
+    int n         = snprintf(packet, sizeof(packet), "<%u>",
+                             SYSLOG_FACILITY * 8 + l.severity);
+    memcpy(packet + n, mTail, mTailLen);
+    memcpy(packet + n + mTailLen, l.text, l.len);
+
+    if (mUdp.beginPacket(mAddress, mSendPort) &&
+        mUdp.write((const uint8_t *)packet, n + mTailLen + l.len) &&
+        mUdp.endPacket())
+      mSent++;
+    else
+      mFailed++;
+    mHead = (mHead + 1) % SYSLOG_QUEUE;
+    mCount--;
+  }
+}
+
+void SyslogSink::print(Print &out)
+{
+  out.print("# TYPE kiln_syslog_sent_total counter\n");
+  out.printf("kiln_syslog_sent_total %u\n", mSent);
+  out.print("# TYPE kiln_syslog_dropped_total counter\n");
+  out.printf("kiln_syslog_dropped_total{reason=\"queue\"} %u\n",
+             mQueueDropped);
+  out.printf("kiln_syslog_dropped_total{reason=\"rate\"} %u\n", mRateDropped);
+  out.printf("kiln_syslog_dropped_total{reason=\"send\"} %u\n", mFailed);
+}
@@ -0,0 +1,95 @@
+#ifndef __syslog_sink_h__
+#define __syslog_sink_h__
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <WiFiUdp.h>
+
+#include "Journal.h"
+
+/*
+ * Journal lines to a remote syslog server (RFC 5424 over UDP), Papertrail
+ * or anything listening on a UDP port, `nc -ul 5514` on a laptop will do.
+ *
+ * line() only queues, up to SYSLOG_QUEUE lines. flush() runs after every
+ * pass of the journal task and sends up to SYSLOG_BATCH of them, so the
+ * network never holds up the journal for long and never the caller at all.
+ * Lines wait in the queue while WiFi is down.
+ *
+ * The host name is resolved once and again every SYSLOG_RESOLVE_MS, not per
+ * packet. Everything in the header after the priority is the same for all
+ * lines and built once when configured. A token bucket limits lines to
+ * rate per second with bursts up to the queue size, lines over it or
+ * arriving at a full queue are dropped and counted, like packets that
+ * could not be sent.
+ *
+ * Journal levels map to syslog severities, error 3, warning 4, info 6 and
+ * debug 7, all of them at facility local0.
+ */
+
+#define SYSLOG_QUEUE      16
+#define SYSLOG_TEXT       160 // per line, longer ones are cut
+#define SYSLOG_BATCH      8   // lines per flush()
+#define SYSLOG_RESOLVE_MS (3600 * 1000)
+#define SYSLOG_RETRY_MS   (30 * 1000) // after a failed lookup
+#define SYSLOG_RATE       10          // lines per second
+
+class SyslogSink : public JournalSink
+{
+  private:
+  struct Line {
+    uint8_t severity;
+    uint8_t len;
+    char text[SYSLOG_TEXT];
+  };
+
+  portMUX_TYPE mLock = portMUX_INITIALIZER_UNLOCKED;
+
+  // Configuration, written by configure() under mLock
+  char mHost[64];
+  uint16_t mPort;
+  uint8_t mLevel;
+  uint16_t mRate;
+  bool mChanged;
+
+  // Journal task only from here on
+  WiFiUDP mUdp;
+  char mName[64]; // resolved
+  uint16_t mSendPort;
+  IPAddress mAddress;
+  bool mResolved;
+  uint32_t mResolveMs;
+  char mTail[48]; // "1 - hostname app - - - " after the priority
+  size_t mTailLen;
+
+  Line mQueue[SYSLOG_QUEUE];
+  uint8_t mHead;
+  uint8_t mCount;
+  uint32_t mTokens; // thousandths of a line
+  uint32_t mRefillMs;
+
+  uint32_t mSent;
+  uint32_t mQueueDropped;
+  uint32_t mRateDropped;
+  uint32_t mFailed;
+
+  bool resolve(uint32_t now);
+
+  public:
+  SyslogSink(const char *host, uint16_t port, const char *hostname,
+             const char *app);
+
+  // {"host":"logs.example.com","port":514,"level":2,"rate":10}, false and
+  // nothing changed when invalid
+  bool configure(JsonVariantConst syslog);
+  void toJson(JsonObject syslog);
+
+  void line(uint8_t level, uint32_t ms, const char *text,
+            size_t len) override;
+  void flush() override;
+
+  // Prometheus text format, kiln_syslog_*
+  void print(Print &out);
+};
+
+#endif
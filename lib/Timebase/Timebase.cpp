@@ -0,0 +1,66 @@
+#include "Timebase.h"
+
+#include "esp_sntp.h"
+#include "esp_timer.h"
+#include <sys/time.h>
+
+Timebase timebase;
+
+Timebase::Timebase()
+{
+  mSynced   = false;
+  mOffsetUs = 0;
+  mSyncs    = 0;
+}
+
+void Timebase::begin()
+{
+  sntp_set_time_sync_notification_cb(onSync);
+
+  // Kept across a soft restart
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  if (valid(tv.tv_sec))
+    set(tv.tv_sec * 1000000LL + tv.tv_usec);
+}
+
+// From the lwIP task
+void Timebase::onSync(struct timeval *tv)
+{
+  timebase.set(tv->tv_sec * 1000000LL + tv->tv_usec);
+}
+
+void Timebase::set(int64_t epochUs)
+{
+  int64_t offset = epochUs - esp_timer_get_time();
+  portENTER_CRITICAL(&mLock);
+  mOffsetUs = offset;
+  mSynced   = true;
+  mSyncs++;
+  portEXIT_CRITICAL(&mLock);
+}
+
+int64_t Timebase::uptimeUs() { return esp_timer_get_time(); }
+
+uint32_t Timebase::now()
+{
+  int64_t us = esp_timer_get_time();
+  if (!mSynced)
+    return us / 1000000 + 1;
+
+  portENTER_CRITICAL(&mLock);
+  int64_t offset = mOffsetUs;
+  portEXIT_CRITICAL(&mLock);
+  return (us + offset) / 1000000;
+}
+
+uint32_t Timebase::correct(uint32_t ts)
+{
+  if (ts == 0 || valid(ts) || !mSynced)
+    return ts;
+
+  portENTER_CRITICAL(&mLock);
+  int64_t offset = mOffsetUs;
+  portEXIT_CRITICAL(&mLock);
+  return (ts - 1) + offset / 1000000;
+}
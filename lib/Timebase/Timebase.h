@@ -0,0 +1,47 @@
+#ifndef __timebase_h__
+#define __timebase_h__
+
+#include <Arduino.h>
+
+/*
+ * Wall clock that never blocks.
+ *
+ * Time is kept on esp_timer_get_time(), microseconds since boot, plus the
+ * offset to epoch taken from the SNTP sync notification and cached until the
+ * next one. Nothing waits for SNTP like getLocalTime() does.
+ *
+ * Until the first sync now() hands out provisional stamps, seconds since
+ * boot + 1, well below TIMEBASE_VALID. Once synced correct() turns those into
+ * epoch, so whatever was stamped early is put right wherever it is read back:
+ * history, snapshot, alarms, MQTT. 0 stays 0, "no time".
+ */
+
+#define TIMEBASE_VALID 1600000000UL // anything below is provisional
+
+class Timebase
+{
+  private:
+  portMUX_TYPE mLock = portMUX_INITIALIZER_UNLOCKED;
+  volatile bool mSynced;
+  int64_t mOffsetUs; // epoch us - esp_timer us
+  uint32_t mSyncs;
+
+  static void onSync(struct timeval *tv);
+  void set(int64_t epochUs);
+
+  public:
+  Timebase();
+  // After configTzTime(), keeps the offset current on every SNTP sync
+  void begin();
+
+  bool synced() { return mSynced; }
+  uint32_t syncs() { return mSyncs; }
+  int64_t uptimeUs();
+  uint32_t now();
+  uint32_t correct(uint32_t ts);
+  static bool valid(uint32_t ts) { return ts >= TIMEBASE_VALID; }
+};
+
+extern Timebase timebase;
+
+#endif
@@ -0,0 +1,126 @@
+#include "Trace.h"
+
+#include "esp_timer.h"
+
+Trace trace;
+
+static const char *traceNames[TRACE_COUNT] = {
+    "sched", "sample", "filter", "control", "safety", "publish",
+    "send",  "sse",    "http",   "mqtt",    "pulse",
+};
+
+Trace::Trace()
+{
+  memset(mEvents, 0, sizeof(mEvents));
+
+  mHead      = 0;
+  mEnabled   = true;
+  mExporting = false;
+  mExport    = 0;
+  mFirst     = 0;
+  mEnd       = 0;
+  mCursor    = 0;
+  mHeader    = false;
+  mFooter    = false;
+}
+
+const char *Trace::name(TraceId id)
+{
+  return id < TRACE_COUNT ? traceNames[id] : "?";
+}
+
+void IRAM_ATTR Trace::record(TraceId id, char phase)
+{
+  if (!mEnabled || mExporting)
+    return;
+
+  uint32_t i = __atomic_fetch_add(&mHead, 1, __ATOMIC_RELAXED);
+  Event &e   = mEvents[i % TRACE_EVENTS];
+  e.ts       = esp_timer_get_time();
+  e.task     = (uint32_t)(uintptr_t)xTaskGetCurrentTaskHandle();
+  e.id       = id;
+  e.phase    = phase;
+}
+
+void IRAM_ATTR Trace::recordIsr(TraceId id)
+{
+  if (!mEnabled || mExporting)
+    return;
+
+  uint32_t i = __atomic_fetch_add(&mHead, 1, __ATOMIC_RELAXED);
+  Event &e   = mEvents[i % TRACE_EVENTS];
+  e.ts       = esp_timer_get_time();
+  e.task     = 0;
+  e.id       = id;
+  e.phase    = 'i';
+}
+
+uint32_t Trace::startExport()
+{
+  bool idle = false;
+  if (!__atomic_compare_exchange_n(&mExporting, &idle, true, false,
+                                   __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+    return 0;
+
+  // Whatever was being written when recording paused is in the ring by now
+  mEnd    = __atomic_load_n(&mHead, __ATOMIC_ACQUIRE);
+  mFirst  = mEnd > TRACE_EVENTS ? mEnd - TRACE_EVENTS : 0;
+  mCursor = mFirst;
+  mHeader = false;
+  mFooter = false;
+  if (++mExport == 0)
+    mExport = 1;
+  return mExport;
+}
+
+size_t Trace::exportJson(char *buf, size_t len)
+{
+  if (!mExporting)
+    return 0;
+
+  size_t n = 0;
+  if (!mHeader) {
+    const char *header = "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+    n                  = strlen(header);
+    if (n > len)
+      return TRACE_AGAIN;
+    memcpy(buf, header, n);
+    mHeader = true;
+  }
+
+  uint32_t t0 = mEvents[mFirst % TRACE_EVENTS].ts;
+  char line[112];
+  while (mCursor < mEnd) {
+    const Event &e = mEvents[mCursor % TRACE_EVENTS];
+    // Relative to the oldest event, fine across the 71 minute wrap of ts
+    int w = snprintf(line, sizeof(line),
+                     "%s{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%u,\"pid\":1,"
+                     "\"tid\":%u%s}",
+                     mCursor == mFirst ? "" : ",", name((TraceId)e.id),
+                     e.phase, (unsigned)(e.ts - t0), (unsigned)e.task,
+                     e.phase == 'i' ? ",\"s\":\"t\"" : "");
+    if (n + w > len)
+      return n ? n : TRACE_AGAIN;
+    memcpy(buf + n, line, w);
+    n += w;
+    mCursor++;
+  }
+
+  if (!mFooter) {
+    if (n + 2 > len)
+      return n ? n : TRACE_AGAIN;
+    memcpy(buf + n, "]}", 2);
+    mFooter = true;
+    return n + 2;
+  }
+
+  __atomic_store_n(&mExporting, false, __ATOMIC_RELEASE);
+  return 0;
+}
+
+// A completed export cleared mExporting already, a later one has a new id
+void Trace::endExport(uint32_t id)
+{
+  if (id == mExport)
+    __atomic_store_n(&mExporting, false, __ATOMIC_RELEASE);
+}
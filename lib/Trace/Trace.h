@@ -0,0 +1,125 @@
+#ifndef __trace_h__
+#define __trace_h__
+
+#include <Arduino.h>
+
+#include "FlightRecorder.h"
+
+/*
+ * Execution timeline for stalls that don't reproduce on the bench.
+ *
+ * Built with TRACING, TRACE_SCOPE() records a begin event where it is
+ * declared and an end event where it goes out of scope, TRACE_INSTANT() a
+ * single point, ISRs included. Events go to a ring of TRACE_EVENTS in RAM
+ * with microsecond timestamps, the newest overwriting the oldest, with one
+ * atomic add and three stores per event so tracing can stay on for a whole
+ * firing. Without TRACING the macros are empty, except that a scope still
+ * tells the flight recorder which handler runs on its core.
+ *
+ * exportJson() writes the ring as Chrome trace JSON, one track per task,
+ * for chrome://tracing or ui.perfetto.dev, chunk by chunk so the export
+ * needs no buffer of its own. Recording pauses while it runs, until the
+ * export completes or whoever started it ends it early, say because the
+ * client went away halfway.
+ */
+
+#ifdef TRACING
+#define TRACE_EVENTS 1024 // 12 KB
+#else
+#define TRACE_EVENTS 1
+#endif
+#define TRACE_AGAIN ((size_t)-1) // buffer too small for the next event
+
+enum TraceId : uint8_t {
+  TRACE_SCHED,   // scheduler pass
+  TRACE_SAMPLE,
+  TRACE_FILTER,
+  TRACE_CONTROL,
+  TRACE_SAFETY,
+  TRACE_PUBLISH, // work the network task took over from control
+  TRACE_SEND,
+  TRACE_SSE,
+  TRACE_HTTP,
+  TRACE_MQTT,    // client callbacks
+  TRACE_PULSE,   // energy meter ISR
+  TRACE_COUNT,
+};
+
+class Trace
+{
+  private:
+  struct Event {
+    uint32_t ts;   // us, low half of esp_timer
+    uint32_t task; // 0 in an ISR
+    uint8_t id;
+    char phase;    // 'B', 'E' or 'i'
+    uint16_t reserved;
+  };
+
+  Event mEvents[TRACE_EVENTS];
+  uint32_t mHead; // total recorded, the ring index is mHead % TRACE_EVENTS
+  volatile bool mEnabled;
+
+  // Export state
+  volatile bool mExporting;
+  uint32_t mExport; // id of the running or last export
+  uint32_t mFirst;
+  uint32_t mEnd;
+  uint32_t mCursor;
+  bool mHeader;
+  bool mFooter;
+
+  public:
+  Trace();
+
+  void record(TraceId id, char phase);
+  void recordIsr(TraceId id);
+  void enable(bool on) { mEnabled = on; }
+  bool enabled() { return mEnabled; }
+  uint32_t recorded() { return mHead; }
+
+  // Id of the export to end it with, 0 while another one runs
+  uint32_t startExport();
+  // Next part of the JSON, 0 once complete and recording again
+  size_t exportJson(char *buf, size_t len);
+  // Recording again, unless that export already completed and another runs
+  void endExport(uint32_t id);
+
+  static const char *name(TraceId id);
+};
+
+extern Trace trace;
+
+class TraceScope
+{
+  private:
+  TraceId mId;
+  uint8_t mPrevious; // handler this one interrupted
+
+  public:
+  TraceScope(TraceId id) : mId(id)
+  {
+    mPrevious = flight.enter(id);
+#ifdef TRACING
+    trace.record(id, 'B');
+#endif
+  }
+  ~TraceScope()
+  {
+#ifdef TRACING
+    trace.record(mId, 'E');
+#endif
+    flight.leave(mPrevious);
+  }
+};
+
+#define TRACE_SCOPE(id) TraceScope _trace(id)
+#ifdef TRACING
+#define TRACE_INSTANT(id)     trace.record(id, 'i')
+#define TRACE_INSTANT_ISR(id) trace.recordIsr(id)
+#else
+#define TRACE_INSTANT(id)
+#define TRACE_INSTANT_ISR(id)
+#endif
+
+#endif
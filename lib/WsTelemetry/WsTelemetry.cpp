@@ -0,0 +1,291 @@
+#include "WsTelemetry.h"
+
+#include "AllocWatch.h"
+#include "Timebase.h"
+
+WsTelemetry::WsTelemetry()
+{
+  mWs             = nullptr;
+  mHistory        = nullptr;
+  mSend           = nullptr;
+  mDropped        = 0;
+  mHistoryPending = false;
+  memset(mSubs, 0, sizeof(mSubs));
+}
+
+void WsTelemetry::begin(AsyncWebSocket *ws, History *history)
+{
+  mSend    = xSemaphoreCreateMutex();
+  mWs      = ws;
+  mHistory = history;
+}
+
+void WsTelemetry::subscribe(uint32_t id, uint8_t topics, uint8_t hz)
+{
+  if (hz == 0 || hz > WS_MAX_HZ)
+    hz = WS_MAX_HZ;
+
+  portENTER_CRITICAL(&mLock);
+  Subscriber *free = nullptr;
+  Subscriber *s    = nullptr;
+  for (size_t i = 0; i < WS_MAX_SUBSCRIBERS; i++) {
+    if (mSubs[i].id == id) {
+      s = &mSubs[i];
+      break;
+    }
+    if (mSubs[i].id == 0 && free == nullptr)
+      free = &mSubs[i];
+  }
+  if (s == nullptr) {
+    s = free;
+    if (s != nullptr)
+      s->seq = 0;
+  }
+  if (s != nullptr) {
+    s->id           = id;
+    s->topics       = topics;
+    s->intervalMs   = 1000 / hz;
+    s->lastLive     = 0;
+    s->history      = topics & WS_TOPIC_HISTORY;
+    s->historyAfter = 0;
+    s->replay++;
+  }
+  portEXIT_CRITICAL(&mLock);
+  if (topics & WS_TOPIC_HISTORY)
+    mHistoryPending = true;
+}
+
+void WsTelemetry::unsubscribe(uint32_t id)
+{
+  portENTER_CRITICAL(&mLock);
+  for (size_t i = 0; i < WS_MAX_SUBSCRIBERS; i++) {
+    if (mSubs[i].id == id)
+      mSubs[i].id = 0;
+  }
+  portEXIT_CRITICAL(&mLock);
+}
+
+// Collect the clients that should get a frame of this topic, live frames also
+// go through the per client rate limit
+size_t WsTelemetry::targets(uint8_t topic, uint32_t *ids, bool live)
+{
+  size_t n     = 0;
+  uint32_t now = millis();
+
+  portENTER_CRITICAL(&mLock);
+  for (size_t i = 0; i < WS_MAX_SUBSCRIBERS; i++) {
+    Subscriber &s = mSubs[i];
+    if (s.id == 0 || !(s.topics & topic))
+      continue;
+    if (live) {
+      if (s.lastLive != 0 && (now - s.lastLive) < s.intervalMs)
+        continue;
+      s.lastLive = now;
+    }
+    ids[n++] = s.id;
+  }
+  portEXIT_CRITICAL(&mLock);
+
+  return n;
+}
+
+// False when the client is gone or its queue is full. A dropped frame still
+// takes a seq so the client sees the gap, one that isn't (drop false, the
+// caller sends it again later) doesn't.
+bool WsTelemetry::sendTo(uint32_t id, WsFrameHeader *frame, size_t len,
+                         bool drop)
+{
+  AsyncWebSocketClient *client = mWs->client(id);
+  if (client == nullptr || client->status() != WS_CONNECTED) {
+    unsubscribe(id);
+    return false;
+  }
+
+  xSemaphoreTake(mSend, portMAX_DELAY);
+  bool full = client->queueIsFull();
+  if (!full || drop) {
+    portENTER_CRITICAL(&mLock);
+    for (size_t i = 0; i < WS_MAX_SUBSCRIBERS; i++) {
+      if (mSubs[i].id == id) {
+        frame->seq = mSubs[i].seq++;
+        break;
+      }
+    }
+    portEXIT_CRITICAL(&mLock);
+  }
+  if (!full) {
+    AllocExempt exempt;
+    client->binary((const char *)frame, len);
+  }
+  else if (drop)
+    mDropped++;
+  xSemaphoreGive(mSend);
+  return !full;
+}
+
+void WsTelemetry::fillHeader(WsFrameHeader &hdr, uint8_t type)
+{
+  hdr.type    = type;
+  hdr.version = WS_FRAME_VERSION;
+  hdr.seq     = 0; // per client, set in sendTo()
+}
+
+void WsTelemetry::onEvent(AsyncWebSocketClient *client, AwsEventType type,
+                          void *arg, uint8_t *data, size_t len)
+{
+  switch (type) {
+  case WS_EVT_DISCONNECT:
+    unsubscribe(client->id());
+    break;
+  case WS_EVT_DATA: {
+    AwsFrameInfo *info = (AwsFrameInfo *)arg;
+    // Commands are tiny, ignore anything fragmented
+    if (!info->final || info->index != 0 || info->len != len ||
+        info->opcode != WS_BINARY || len < 3)
+      return;
+    if (data[0] == WS_CMD_SUBSCRIBE)
+      subscribe(client->id(), data[1], data[2]);
+    break;
+  }
+  default:
+    break;
+  }
+}
+
+void WsTelemetry::publishLive(float temp, float setpoint, float tInt,
+                              uint32_t power, uint8_t step, bool relay)
+{
+  if (mWs == nullptr)
+    return;
+
+  uint32_t ids[WS_MAX_SUBSCRIBERS];
+  size_t n = targets(WS_TOPIC_LIVE, ids, true);
+  if (n == 0)
+    return;
+
+  WsLiveFrame f;
+  fillHeader(f.hdr, WS_FRAME_LIVE);
+  f.ts       = timebase.now();
+  f.temp     = isnan(temp) ? INT16_MIN : (int16_t)(temp * 10);
+  f.setpoint = (int16_t)(setpoint * 10);
+  f.tInt     = (int16_t)(tInt * 10);
+  f.power    = power > UINT16_MAX ? UINT16_MAX : power;
+  f.step     = step;
+  f.relay    = relay;
+
+  for (size_t i = 0; i < n; i++)
+    sendTo(ids[i], &f.hdr, sizeof(f));
+}
+
+void WsTelemetry::publishState(uint8_t step, const char *info)
+{
+  if (mWs == nullptr)
+    return;
+
+  uint32_t ids[WS_MAX_SUBSCRIBERS];
+  size_t n = targets(WS_TOPIC_STATE, ids);
+  if (n == 0)
+    return;
+
+  WsTextFrame f;
+  fillHeader(f.hdr, WS_FRAME_STATE);
+  f.code = step;
+  f.len  = strlcpy(f.text, info, sizeof(f.text));
+  if (f.len >= sizeof(f.text))
+    f.len = sizeof(f.text) - 1;
+
+  for (size_t i = 0; i < n; i++)
+    sendTo(ids[i], &f.hdr, sizeof(f) - sizeof(f.text) + f.len);
+}
+
+void WsTelemetry::publishAlarm(uint8_t code, const char *msg)
+{
+  if (mWs == nullptr)
+    return;
+
+  uint32_t ids[WS_MAX_SUBSCRIBERS];
+  size_t n = targets(WS_TOPIC_ALARM, ids);
+  if (n == 0)
+    return;
+
+  WsTextFrame f;
+  fillHeader(f.hdr, WS_FRAME_ALARM);
+  f.code = code;
+  f.len  = strlcpy(f.text, msg, sizeof(f.text));
+  if (f.len >= sizeof(f.text))
+    f.len = sizeof(f.text) - 1;
+
+  for (size_t i = 0; i < n; i++)
+    sendTo(ids[i], &f.hdr, sizeof(f) - sizeof(f.text) + f.len);
+}
+
+void WsTelemetry::publishHistory()
+{
+  portENTER_CRITICAL(&mLock);
+  for (size_t i = 0; i < WS_MAX_SUBSCRIBERS; i++) {
+    if (mSubs[i].id != 0 && (mSubs[i].topics & WS_TOPIC_HISTORY))
+      mSubs[i].history = true;
+  }
+  portEXIT_CRITICAL(&mLock);
+  mHistoryPending = true;
+}
+
+// The chunk after after, false once caught up or when the client queue is
+// full, then full says which. Network task only, the buffers are shared.
+bool WsTelemetry::sendHistory(uint32_t id, long &after, bool &full)
+{
+  static long epoch[WS_HISTORY_CHUNK];
+  static float temp[WS_HISTORY_CHUNK];
+  WsHistoryFrame f;
+
+  full    = false;
+  f.count = mHistory->read(after, epoch, temp, WS_HISTORY_CHUNK);
+  if (f.count == 0)
+    return false;
+
+  fillHeader(f.hdr, WS_FRAME_HISTORY);
+  for (size_t i = 0; i < f.count; i++) {
+    f.points[i].epoch = timebase.correct(epoch[i]);
+    f.points[i].temp  = (int16_t)(temp[i] * 10);
+  }
+  size_t len = sizeof(f) - sizeof(f.points) + f.count * sizeof(f.points[0]);
+  if (!sendTo(id, &f.hdr, len, false)) {
+    full = true;
+    return false;
+  }
+  after = epoch[f.count - 1];
+  return true;
+}
+
+void WsTelemetry::service()
+{
+  if (mWs == nullptr || mHistory == nullptr || !mHistoryPending)
+    return;
+  mHistoryPending = false;
+
+  for (size_t i = 0; i < WS_MAX_SUBSCRIBERS; i++) {
+    portENTER_CRITICAL(&mLock);
+    Subscriber s = mSubs[i];
+    portEXIT_CRITICAL(&mLock);
+    if (s.id == 0 || !s.history)
+      continue;
+
+    long after = s.historyAfter;
+    bool full  = false;
+    uint8_t n  = 0;
+    while (n < WS_HISTORY_BURST && sendHistory(s.id, after, full))
+      n++;
+    // A whole burst or a full queue, come back for the rest
+    bool more = full || n == WS_HISTORY_BURST;
+
+    portENTER_CRITICAL(&mLock);
+    // Unless it subscribed again meanwhile and starts over
+    if (mSubs[i].id == s.id && mSubs[i].replay == s.replay) {
+      mSubs[i].historyAfter = after;
+      mSubs[i].history      = more;
+    }
+    portEXIT_CRITICAL(&mLock);
+    if (more)
+      mHistoryPending = true;
+  }
+}
@@ -0,0 +1,136 @@
+#ifndef __ws_telemetry_h__
+#define __ws_telemetry_h__
+
+#include <Arduino.h>
+#include <ESPAsyncWebServer.h>
+
+#include "History.h"
+
+/*
+ * Binary telemetry over WebSocket.
+ *
+ * Client -> server, one binary message:
+ *   {WS_CMD_SUBSCRIBE, topics bitmask, max live rate in Hz}
+ *
+ * Server -> client, little-endian packed frames, all starting with
+ * WsFrameHeader. Live samples are rate limited per client, state and alarm
+ * frames are sent as they happen unless the client queue is full.
+ *
+ * A live frame goes out per filtered sample, so every SAMPLE_MS: nothing
+ * in it changes any faster. A client gets the lower of that and its max
+ * rate, which only thins the stream, WS_MAX_HZ is the most it may ask for.
+ * Frames are stamped with timebase.now(), like history points and MQTT.
+ *
+ * seq counts per client and also moves on for a frame dropped on a full
+ * queue, so a gap tells the client it missed something. Frames to one client
+ * go out under one lock in seq order, whichever task sends them.
+ *
+ * History is never dropped. Subscribing replays it from the start, each new
+ * point follows, and service() pages it out of History from where the
+ * client got to, as far as its queue has room.
+ */
+
+#define WS_FRAME_VERSION   2
+#define WS_CMD_SUBSCRIBE   0x01
+#define WS_MAX_HZ          10
+#define WS_MAX_SUBSCRIBERS 8
+#define WS_HISTORY_CHUNK   64  // points per history frame
+#define WS_HISTORY_BURST   4   // history frames per client and service()
+#define WS_TEXT_MAX        48
+
+enum WsTopic : uint8_t {
+  WS_TOPIC_LIVE    = 0x01,
+  WS_TOPIC_STATE   = 0x02,
+  WS_TOPIC_ALARM   = 0x04,
+  WS_TOPIC_HISTORY = 0x08,
+};
+
+enum WsFrameType : uint8_t {
+  WS_FRAME_LIVE = 1,
+  WS_FRAME_STATE,
+  WS_FRAME_ALARM,
+  WS_FRAME_HISTORY,
+};
+
+struct __attribute__((packed)) WsFrameHeader {
+  uint8_t type;
+  uint8_t version;
+  uint16_t seq;
+};
+
+struct __attribute__((packed)) WsLiveFrame {
+  WsFrameHeader hdr;
+  uint32_t ts;      // epoch, provisional until synced, see Timebase.h
+  int16_t temp;     // 0.1 degC
+  int16_t setpoint; // 0.1 degC
+  int16_t tInt;     // 0.1 degC
+  uint16_t power;   // W
+  uint8_t step;
+  uint8_t relay;
+};
+
+struct __attribute__((packed)) WsTextFrame {
+  WsFrameHeader hdr;
+  uint8_t code; // step for STATE, alarm code for ALARM
+  uint8_t len;
+  char text[WS_TEXT_MAX];
+};
+
+struct __attribute__((packed)) WsHistoryPoint {
+  uint32_t epoch;
+  int16_t temp; // 0.1 degC
+};
+
+struct __attribute__((packed)) WsHistoryFrame {
+  WsFrameHeader hdr;
+  uint16_t count;
+  WsHistoryPoint points[WS_HISTORY_CHUNK];
+};
+
+class WsTelemetry
+{
+  private:
+  struct Subscriber {
+    uint32_t id;
+    uint8_t topics;
+    uint16_t intervalMs;
+    uint32_t lastLive;
+    uint16_t seq;
+    bool history;      // points left to replay
+    long historyAfter; // stamp of the last point sent
+    uint8_t replay;    // subscriptions, a new one restarts the replay
+  };
+
+  AsyncWebSocket *mWs;
+  History *mHistory;
+  Subscriber mSubs[WS_MAX_SUBSCRIBERS];
+  portMUX_TYPE mLock = portMUX_INITIALIZER_UNLOCKED;
+  SemaphoreHandle_t mSend;
+  uint32_t mDropped;
+  volatile bool mHistoryPending;
+
+  size_t targets(uint8_t topic, uint32_t *ids, bool live = false);
+  bool sendTo(uint32_t id, WsFrameHeader *frame, size_t len,
+              bool drop = true);
+  bool sendHistory(uint32_t id, long &after, bool &full);
+  void subscribe(uint32_t id, uint8_t topics, uint8_t hz);
+  void unsubscribe(uint32_t id);
+  void fillHeader(WsFrameHeader &hdr, uint8_t type);
+
+  public:
+  WsTelemetry();
+  void begin(AsyncWebSocket *ws, History *history);
+  void onEvent(AsyncWebSocketClient *client, AwsEventType type, void *arg,
+               uint8_t *data, size_t len);
+  void publishLive(float temp, float setpoint, float tInt, uint32_t power,
+                   uint8_t step, bool relay);
+  void publishState(uint8_t step, const char *info);
+  void publishAlarm(uint8_t code, const char *msg);
+  // A point was added to History, history subscribers get it on service()
+  void publishHistory();
+  // Network task, pages history out to the clients waiting for it
+  void service();
+  uint32_t dropped() { return mDropped; }
+};
+
+#endif
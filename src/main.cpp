@@ -21,7 +21,6 @@ extern "C" {
 #include <AsyncMqttClient.h>
 
 #include "esp_system.h"
-#include <Ticker.h>
 #include <pthread.h>
 
 #include <DNSServer.h>
@@ -36,39 +35,55 @@ extern "C" {
 
 #include "SPIFFS.h"
 
-// PapertrailLogger
-#include "PapertrailLogger.h"
-#include <WiFiUdp.h>
-
 // MAX31855
 #include <SPI.h>
 #include <Wire.h>
 
 #include "Adafruit_MAX31855.h"
+#include "Max31855Frame.h"
 
 #include "time.h"
 
 #include "html_strings.h"
 
+#include "AlarmEngine.h"
+#include "AllocWatch.h"
+#include "DemandLimiter.h"
+#include "ElementHealth.h"
+#include "EnergyLedger.h"
+#include "FiringPlanner.h"
+#include "FiringReport.h"
+#include "FlightRecorder.h"
+#include "History.h"
+#include "InputRecorder.h"
+#include "Journal.h"
+#include "KilnControl.h"
+#include "Metrics.h"
+#include "MqttPipeline.h"
+#include "PageTemplate.h"
+#include "PulseMeter.h"
+#include "RequestPool.h"
+#include "RuntimeStats.h"
+#include "SafetyMonitor.h"
+#include "Scheduler.h"
+#include "Seqlock.h"
+#include "StateSnapshot.h"
+#include "SyslogSink.h"
+#include "Timebase.h"
+#include "Trace.h"
+#include "WsTelemetry.h"
+
 #define PAPERTRAIL_HOST "logs2.papertrailapp.com"
 #define PAPERTRAIL_PORT 53139
 
-#ifdef VERBOSE
-#define DBG(msg, ...)                                                          \
-  {                                                                            \
-    Serial.printf("[%lu] " msg, millis(), ##__VA_ARGS__);                      \
-    Serial.flush();                                                            \
-  }
-#else
-#define DBG(...)
-#endif
+// Queued, the journal task writes it out, see Journal.h
+#define DBG(msg, ...) JOURNAL(JOURNAL_DEBUG, msg, ##__VA_ARGS__)
 
-#define NOTIFY(msg, ...)                                                       \
+#define NOTIFY(id, msg, ...)                                                   \
   {                                                                            \
-    char _msg[64] = "";                                                        \
-    sprintf(_msg, msg, ##__VA_ARGS__);                                         \
-    Blynk.logEvent("alarm", _msg);                                             \
-    DBG("%s\n", _msg);                                                         \
+    char _msg[ALARM_TEXT] = "";                                                \
+    snprintf(_msg, sizeof(_msg), msg, ##__VA_ARGS__);                          \
+    alarms.event(id, _msg);                                                    \
   }
 
 // https://randomnerdtutorials.com/esp8266-pinout-reference-gpios/
@@ -90,9 +105,9 @@ extern "C" {
 
 #define COSTKWH      2.14
 
-#define RATEUPDATE   60 // every 60 seconds
-
-#define DIFFERENTIAL 5 // degC
+#define RATEUPDATE   KILN_RAMP_S
+#define SAMPLE_MS    2000
+#define CONTROL_MS   6000 // every third sample
 
 const char *p_mqtt   = "/mqtt.txt";
 char mqtt_user[64]   = {'\0'};
@@ -102,51 +117,134 @@ uint16_t mqtt_port   = 1883;
 
 String ssid, pass;
 
-float temp;
+// Written by the control task only, other tasks read kiln
 float tInt;
-float currentSetpoint = -9999;
-std::vector<float> readings;
-std::vector<long> epocTime;
-volatile float current;
-volatile uint32_t instPower;
-volatile uint32_t energy = 0;
-volatile uint32_t pulseInterval;
-
-// Control variables
-volatile uint32_t energyMillis = 0;
-uint32_t initMillis            = 0;
-uint32_t holdMillis            = 0;
-int step                       = 0;
-
-String info                    = "Idle 💤";
-
-// Timer instance numbers
-Ticker controlTimer;
-Ticker safetyTimer;
-Ticker rampTimer;
-Ticker slowCool;
-Ticker tempTimer;
-Ticker sendTimer;
-Ticker restart;
+History history(60 * 1000); // for the page and WebSocket, see History.h
+PulseMeter pulseMeter; // S0 pulses from the energy meter
+SafetyMonitor safety(RELAY, &pulseMeter);
+AlarmEngine alarms;
+EnergyLedger ledger(COSTKWH);
+const char *p_tariff = "/tariff.txt";
+FiringPlanner planner([](uint32_t t) { return ledger.price(t); });
+FiringPlan plan      = {}; // delayed start, start is 0, see setPlan()
+const char *p_plan   = "/plan.txt";
+DemandLimiter demand;
+const char *p_demand = "/demand.txt";
+KilnControl controller(&demand); // the firing, owned by the control task
+int64_t jobUs; // esp_timer time of the control task's job or command
+ElementHealth health;
+FiringReport report(FIRMWARE_VERSION); // tracking against a baseline firing
+// The pages' fixed texts, the rest of the placeholders PageTemplate fills in
+const PageText pageTexts[] = {
+    {"CSS_TEMPLATE", HTTP_STYLE},
+    {"INDEX_JS", HTTP_JS},
+    {"HTML_HEAD_TITLE", HTML_HEAD_TITLE},
+};
+PageTemplate page(pageTexts, sizeof(pageTexts) / sizeof(pageTexts[0]),
+                  &health, FIRMWARE_VERSION, __DATE__ " " __TIME__);
+
+enum KilnPhase : uint8_t {
+  KILN_IDLE,
+  KILN_FIRING,
+  KILN_HOLD,
+  KILN_COOLING,
+};
+
+// What the control task publishes after every pass, for everyone else
+struct KilnState {
+  float temp;
+  float tInt;
+  float setpoint;
+  int step;
+  bool relay;
+  KilnPhase phase;
+};
+Seqlock<KilnState> kiln;
+
+// The control task takes firing changes as commands with the schedule to
+// use, a notification wakes it for those and for scheduler changes. Recorded
+// by number like the jobs.
+enum ControlCommand : uint8_t {
+  CONTROL_START,
+  CONTROL_RESUME, // after a crash, picks the step from the temperature
+  CONTROL_STOP,
+  CONTROL_SKIP,
+};
+struct ControlMessage {
+  ControlCommand cmd;
+  int schedule[4][3];
+};
+
+#define CONTROL_COMMAND  (1 << 0)
+#define CONTROL_SCHEDULE (1 << 1)
+
+TaskHandle_t controlHandle;
+QueueHandle_t controlQueue;
+
+// Networking the control task leaves for the network task, on core 0 with
+// AsyncTCP and the WiFi stack
+#define NET_INFO    (1 << 0)
+#define NET_SAMPLE  (1 << 1)
+#define NET_HEALTH  (1 << 2)
+#define NET_SEND    (1 << 3)
+#define NET_RUNTIME (1 << 4)
+#define NET_CRASH   (1 << 5)
+#define NET_REPORT  (1 << 6)
+#define NET_POLL_MS 10 // services run at least this often
+
+TaskHandle_t netHandle;
+uint32_t netWork = 0;
+
+portMUX_TYPE infoLock = portMUX_INITIALIZER_UNLOCKED;
+char info[SNAPSHOT_TEXT] = "Idle 💤";
+portMUX_TYPE planLock    = portMUX_INITIALIZER_UNLOCKED;
+
+// Scheduler jobs, those due together run by stage and then in this order.
+// Recordings have them by number, see KrecReplay.h.
+enum Job : uint8_t {
+  JOB_SAMPLE,  // sensors and the power meter
+  JOB_FILTER,  // average, thermocouple errors, health, safety monitor
+  JOB_RAMP,    // setpoint ramp, before the PID tick it feeds
+  JOB_CONTROL, // relay, running means firing
+  JOB_COOL,    // slow cooling setpoint
+  JOB_SAFETY,  // internal temperature alarm
+  JOB_SEND,    // MQTT telemetry, through the network task
+  JOB_RESTART, // once, after a response went out
+  JOB_RUNTIME, // heap and task statistics
+};
+
+Scheduler scheduler;
 
 DNSServer dnsServer;
 
 AsyncWebServer server(80);
 AsyncEventSource events("/events"); // event source (Server-Sent events)
 AsyncWebSocket ws("/ws");           // access at ws://[esp ip]/ws
+WsTelemetry wsTelemetry;            // binary frames, see WsTelemetry.h
 
 Adafruit_MAX31855 thermocouple(SPI_CLK, SPI_CS, SPI_MISO);
 
-PapertrailLogger *errorLog;
+// Journal lines up to its level, alarms at warning
+SyslogSink syslogSink(PAPERTRAIL_HOST, PAPERTRAIL_PORT, "untrol.io", "kiln");
+const char *p_syslog = "/syslog.txt";
 
 AsyncMqttClient mqttClient;
+MqttPipeline mqttPipeline;
+StateSnapshot snapshot; // retained on <root>/kiln/state
+RuntimeStats runtime;   // heap and tasks on <root>/kiln/diag
 TimerHandle_t mqttReconnectTimer;
 TimerHandle_t wifiReconnectTimer;
 
 void printSegments();
+extern int schedule[4][3];
+bool control(ControlCommand cmd, const int sched[4][3] = schedule);
+bool cancelPlan();
+const char *firingState();
 void rampRate();
+void rampDown();
 void tControl();
 void getTemp();
+void networkTask(void *arg);
 String processor(const String &var);
 String readFile(fs::FS &fs, const char *path);
 void writeFile(fs::FS &fs, const char *path, const char *message);
@@ -181,6 +279,133 @@ class CaptiveRequestHandler : public AsyncWebHandler
 
 void espRestart() { ESP.restart(); }
 
+#ifdef ALLOC_WATCH
+// Inside malloc, ROM printf as it doesn't allocate
+void allocTrap(AllocPath path, size_t size, void *caller)
+{
+  ets_printf("Alloc %u B in %s path from %p\n", size, AllocWatch::name(path),
+             caller);
+}
+#endif
+
+void wake(uint32_t work) { xTaskNotify(controlHandle, work, eSetBits); }
+
+// Any task, the network task picks it up once created
+void defer(uint32_t work)
+{
+  __atomic_fetch_or(&netWork, work, __ATOMIC_RELEASE);
+  if (netHandle)
+    xTaskNotifyGive(netHandle);
+}
+
+// Any task, the network task publishes it. Formatted on the stack, no String
+void setInfo(const char *format, ...)
+{
+  char text[sizeof(info)];
+  va_list args;
+  va_start(args, format);
+  vsnprintf(text, sizeof(text), format, args);
+  va_end(args);
+
+  portENTER_CRITICAL(&infoLock);
+  memcpy(info, text, sizeof(info));
+  portEXIT_CRITICAL(&infoLock);
+  defer(NET_INFO);
+}
+
+// text holds SNAPSHOT_TEXT
+void getInfo(char *text)
+{
+  portENTER_CRITICAL(&infoLock);
+  memcpy(text, info, sizeof(info));
+  portEXIT_CRITICAL(&infoLock);
+}
+
+// Any task, set by the API and setup(), due by the network task
+void setPlan(const FiringPlan &next)
+{
+  portENTER_CRITICAL(&planLock);
+  plan = next;
+  portEXIT_CRITICAL(&planLock);
+}
+
+FiringPlan getPlan()
+{
+  portENTER_CRITICAL(&planLock);
+  FiringPlan p = plan;
+  portEXIT_CRITICAL(&planLock);
+  return p;
+}
+
+// Any task, leaves a second for the response to go out
+void restartSoon()
+{
+  scheduler.once(JOB_RESTART, 1000);
+  wake(CONTROL_SCHEDULE);
+}
+
+void sendDue() { defer(NET_SEND); }
+
+// Hot paths that ran over their budget since the last look, see Metrics
+void checkBudgets()
+{
+  uint32_t over = metrics.overBudget();
+  if (!over)
+    return;
+
+  char names[ALARM_TEXT] = "";
+  for (uint8_t t = 0; t < METRIC_T_COUNT; t++) {
+    if (!(over & (1 << t)))
+      continue;
+    if (*names)
+      strlcat(names, " ", sizeof(names));
+    strlcat(names, Metrics::name((MetricTimer)t), sizeof(names));
+  }
+  NOTIFY(ALARM_BUDGET, "Over budget: %s", names);
+}
+
+void sampleRuntime()
+{
+  runtime.sample();
+  checkBudgets();
+  defer(NET_RUNTIME);
+}
+
+// AsyncEventSource drops messages silently once a client has
+// SSE_MAX_QUEUED_MESSAGES waiting, count them from the average queue
+void sseSend(const char *msg, const char *event)
+{
+  MetricScope scope(METRIC_T_SSE);
+  TRACE_SCOPE(TRACE_SSE);
+  if (events.count() && events.avgPacketsWaiting() >= SSE_MAX_QUEUED_MESSAGES)
+    metrics.count(METRIC_C_SSE_DROPPED);
+  AllocExempt exempt;
+  events.send(msg, event);
+}
+
+// Control task, with what the controller decided
+void relay(bool on)
+{
+  recorder.relay(on);
+  // The monitor keeps the pin low once tripped, don't fight it
+  if (safety.tripped())
+    on = false;
+  if (on != digitalRead(RELAY)) {
+    metrics.count(METRIC_C_RELAY);
+    report.relay(on);
+  }
+  digitalWrite(RELAY, on);
+  pulseMeter.relay(on, jobUs);
+  safety.relay(on);
+}
+
+// Measured while firing, the nameplate value until then
+float elementPower()
+{
+  float w = pulseMeter.elementPower();
+  return w > 0 ? w : KILN_ELEMENT_W;
+}
+
 void ledOff()
 {
   digitalWrite(LED_R, HIGH);
@@ -224,13 +449,131 @@ void led(led_color_t color)
   }
 }
 
-// Send notification to HA, max 32 bytes
-void notify(char *msg, size_t length)
+bool snapshotSink(const char *payload, size_t len)
+{
+  return mqttPipeline.publish(MQTT_TOPIC_STATE, payload, len) != 0;
+}
+
+// State changes and alarms go out at once, everything else at most every 30s
+void publishSnapshot()
+{
+  snapshot.flush(timebase.now(), 30000, snapshotSink);
+}
+
+// Retained, so the totals are there for whoever subscribes next
+void publishLedger()
+{
+  StaticJsonDocument<768> doc;
+  char output[512];
+
+  ledger.toJson(doc.to<JsonObject>());
+  size_t len = serializeJson(doc, output);
+  mqttPipeline.publish(MQTT_TOPIC_ENERGY, output, len);
+}
+
+// Heap trend and tasks for kiln/diag, without the ring
+void publishRuntime()
+{
+  StaticJsonDocument<3072> doc;
+  char output[1024];
+
+  runtime.toJson(doc.to<JsonObject>(), 0);
+  size_t len = serializeJson(doc, output);
+  mqttPipeline.publish(MQTT_TOPIC_DIAG, output, len);
+}
+
+// The end of the flight recorder after a crash, once MQTT is up
+void publishCrash()
+{
+  static bool published = false;
+  char output[2048];
+
+  if (published)
+    return;
+  size_t len = flight.toJson(output, sizeof(output), 24);
+  if (mqttPipeline.publish(MQTT_TOPIC_DIAG, output, len))
+    published = true;
+}
+
+void publishHealth()
+{
+  StaticJsonDocument<1536> doc;
+  char output[768];
+
+  health.toJson(doc.to<JsonObject>());
+  size_t len = serializeJson(doc, output);
+  mqttPipeline.publish(MQTT_TOPIC_HEALTH, output, len);
+}
+
+// Every alarm raised or cleared goes out from here, called by
+// alarms.service() in the network task
+void deliverAlarm(const AlarmRecord &alarm)
+{
+  const char *severity = AlarmEngine::severityName(
+      (AlarmSeverity)alarm.severity);
+  char msg[ALARM_TEXT + 12];
+  if (alarm.raised)
+    strlcpy(msg, alarm.msg, sizeof(msg));
+  else
+    snprintf(msg, sizeof(msg), "Cleared: %s", alarm.msg);
+
+  mqttPipeline.publish(MQTT_TOPIC_NOTIFY, msg, strlen(msg));
+  sseSend(msg, "alarm");
+  wsTelemetry.publishAlarm(alarm.id, msg);
+  JOURNAL(JOURNAL_WARN, "%s %s\n", severity, msg);
+  if (alarm.raised) {
+    snapshot.addAlarm(alarm.ts, msg);
+    publishSnapshot();
+  }
+}
+
+// Record what the firing told about the elements, the network task
+// publishes it
+void recordHealth()
+{
+  if (health.endFiring())
+    defer(NET_HEALTH);
+}
+
+// How the firing tracked its setpoint, the network task saves and
+// publishes it
+void recordReport()
+{
+  if (report.endFiring(timebase.now(), pulseMeter.energyWh()))
+    defer(NET_REPORT);
+}
+
+void publishReport()
+{
+  StaticJsonDocument<1024> doc;
+  char output[768];
+
+  report.save();
+  report.toJson(doc.to<JsonObject>());
+  size_t len = serializeJson(doc, output);
+  mqttPipeline.publish(MQTT_TOPIC_DIAG, output, len);
+}
+
+// Warn when the elements are close to not making the final ramp anymore
+void healthRecorded()
+{
+  publishHealth();
+
+  int left = health.forecast();
+  if (left >= 0 && left <= 3)
+    NOTIFY(ALARM_ELEMENTS, "Elements: %d firings left", left);
+}
+
+// Push the status line to the web page, WebSocket and MQTT state subscribers
+void publishInfo()
 {
-  DBG("%s\n", msg);
-  char topic[64] = {'\0'};
-  sprintf(topic, "%s/f/notify", mqtt_user);
-  mqttClient.publish(topic, 0, false, msg, length);
+  char text[SNAPSHOT_TEXT];
+  getInfo(text);
+  int st = kiln.read().step;
+  sseSend(text, "display");
+  wsTelemetry.publishState(st, text);
+  snapshot.setState(firingState(), text, st);
+  publishSnapshot();
 }
 
 void onUpload(AsyncWebServerRequest *request, String filename, size_t index,
@@ -252,7 +595,7 @@ void onUpload(AsyncWebServerRequest *request, String filename, size_t index,
     if (Update.end(true)) {
       DBG("Update Success: %uB\n", index + len);
       request->redirect("/");
-      restart.once_ms(1000, espRestart);
+      restartSoon();
     } else {
       Update.printError(Serial);
     }
@@ -269,97 +612,14 @@ void onEvent(AsyncWebSocket *server, AsyncWebSocketClient *client,
              AwsEventType type, void *arg, uint8_t *data, size_t len)
 {
   // Handle WebSocket event
+  wsTelemetry.onEvent(client, type, arg, data, len);
 }
 
 String processor(const String &var)
 {
-  if (var == "CSS_TEMPLATE")
-    return FPSTR(HTTP_STYLE);
-  if (var == "INDEX_JS")
-    return FPSTR(HTTP_JS);
-  if (var == "HTML_HEAD_TITLE")
-    return FPSTR(HTML_HEAD_TITLE);
-  if (var == "HTML_INFO_BOX") {
-    String ret = "";
-    if (WiFi.isConnected()) {
-      ret = "<strong> Connected</ strong> to ";
-      ret += WiFi.SSID();
-      ret += "<br><em><small> with IP ";
-      ret += WiFi.localIP().toString();
-      ret += "</small>";
-    } else
-      ret = "<strong> Not Connected</ strong>";
-    return ret;
-  }
-  if (var == "HTML_CONFIG_SSID")
-    return WiFi.SSID();
-  if (var == "UPTIME") {
-    String ret = String(millis() / 1000 / 60);
-    ret += " min ";
-    ret += String((millis() / 1000) % 60);
-    ret += " sec";
-    return ret;
-  }
-  if (var == "CHIP_ID") {
-    String ret = String((uint32_t)ESP.getEfuseMac());
-    return ret;
-  }
-  if (var == "FREE_HEAP") {
-    String ret = String(ESP.getFreeHeap());
-    ret += " bytes";
-    return ret;
-  }
-  if (var == "SKETCH_INFO") {
-    //%USED_BYTES% / &FLASH_SIZE&<br><progress value="%USED_BYTES%"
-    // max="&FLASH_SIZE&">
-    String ret = String(ESP.getSketchSize());
-    ret += " / ";
-    ret += String(ESP.getFlashChipSize());
-    ret += "<br><progress value=\"";
-    ret += String(ESP.getSketchSize());
-    ret += "\" max=\"";
-    ret += String(ESP.getFlashChipSize());
-    ret += "\">";
-    return ret;
-  }
-  if (var == "HOSTNAME")
-    return String(WiFi.getHostname());
-  if (var == "MY_MAC")
-    return WiFi.macAddress();
-  if (var == "MY_RSSI")
-    return String(WiFi.RSSI());
-  if (var == "FW_VER")
-    return String(FIRMWARE_VERSION);
-  if (var == "SDK_VER")
-    return String(ESP_ARDUINO_VERSION_MAJOR) + "." +
-           String(ESP_ARDUINO_VERSION_MINOR) + "." +
-           String(ESP_ARDUINO_VERSION_PATCH);
-  if (var == "ABOUT_DATE") {
-    String ret = String(__DATE__) + " " + String(__TIME__);
-    return ret;
-  }
-  if (var == "GRAPH_DATA" && readings.size()) {
-    String graphString;
-    graphString.reserve(readings.size() * 2);
-    graphString = "[";
-    for (size_t i = 0; i < readings.size() - 1; i++) {
-      graphString += "[";
-      graphString += String(epocTime[i]);
-      graphString += ",";
-      graphString += String(readings[i], 0);
-      graphString += "]";
-      graphString += ",";
-    }
-    graphString += "[";
-    graphString += String(epocTime[readings.size() - 1]);
-    graphString += ",";
-    graphString += String(readings[readings.size() - 1], 0);
-    graphString += "]";
-    graphString += "]";
-    return graphString;
-  }
-
-  return String();
+  MetricScope scope(METRIC_T_PROCESSOR);
+  TRACE_SCOPE(TRACE_HTTP);
+  return page.value(var);
 }
 
 void configServer()
@@ -406,7 +666,7 @@ void configServer()
       delay(100);
     }
     DBG("Connected\n");
-    restart.once_ms(1000, espRestart);
+    restartSoon();
     request->redirect("http://" + WiFi.localIP().toString());
   });
 }
@@ -418,7 +678,7 @@ String readFile(fs::FS &fs, const char *path)
 
   File file = fs.open(path);
   if (!file || file.isDirectory()) {
-    DBG("- failed to open file for reading\n");
+    JOURNAL(JOURNAL_ERROR, "- failed to open file for reading\n");
     return String();
   }
 
@@ -438,97 +698,111 @@ void writeFile(fs::FS &fs, const char *path, const char *message)
 
   File file = fs.open(path, FILE_WRITE);
   if (!file) {
-    DBG("- failed to open file for writing\n");
+    JOURNAL(JOURNAL_ERROR, "- failed to open file for writing\n");
     return;
   }
   if (file.print(message)) {
     DBG("- file written\n");
   } else {
-    DBG("- frite failed\n");
+    JOURNAL(JOURNAL_ERROR, "- frite failed\n");
   }
 }
 
-// temperature, rate, hold/soak (min)
-int segments[4][3]     = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+// temperature, rate, hold/soak (min), schedule is what the page and the API
+// edit, controller.segments() the copy the control task is firing
+int schedule[4][3]     = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
 const char *p_segments = "/segments.txt";
 
 void onFire(AsyncWebServerRequest *request)
 {
+  MetricScope scope(METRIC_T_FORM);
   int params = request->params();
 
   for (int i = 0; i < params; i++) {
     AsyncWebParameter *p = request->getParam(i);
-    if (p->isPost()) {
-      if (p->name() == "s00")
-        segments[0][0] = p->value().toInt();
-      if (p->name() == "s01")
-        segments[0][1] = p->value().toInt();
-      if (p->name() == "s02")
-        segments[0][2] = p->value().toInt();
-      if (p->name() == "s10")
-        segments[1][0] = p->value().toInt();
-      if (p->name() == "s11")
-        segments[1][1] = p->value().toInt();
-      if (p->name() == "s12")
-        segments[1][2] = p->value().toInt();
-      if (p->name() == "s20")
-        segments[2][0] = p->value().toInt();
-      if (p->name() == "s21")
-        segments[2][1] = p->value().toInt();
-      if (p->name() == "s22")
-        segments[2][2] = p->value().toInt();
-      if (p->name() == "s30")
-        segments[3][0] = p->value().toInt();
-      if (p->name() == "s31")
-        segments[3][1] = p->value().toInt();
-      if (p->name() == "s32")
-        segments[3][2] = p->value().toInt();
-    }
+    if (p->isPost())
+      KilnControl::field(schedule, p->name().c_str(), p->value().c_str());
   }
 
-  for (size_t i = 0; i < sizeof(segments) / sizeof(segments[0]); i++) {
-    for (size_t j = 0; j < sizeof(segments[0]) / (sizeof(int)) - 1; j++) {
-      if (segments[i][j] == 0) {
-        DBG("Check the settings, i: %u j: %u\n", i, j);
-        return;
-      }
-    }
+  cancelPlan();
+  control(CONTROL_START);
+}
+
+const char *segmentNames[] = {"preheat", "step1", "step2", "final"};
+
+void segmentsToJson(JsonDocument &doc, const int sched[4][3])
+{
+  for (size_t i = 0; i < 4; i++) {
+    JsonObject s = doc.createNestedObject(segmentNames[i]);
+    s["st"]      = sched[i][0];
+    s["r"]       = sched[i][1];
+    s["h"]       = sched[i][2];
   }
+}
 
-  if (/*segments[3][0] < segments[2][0] ||*/ segments[2][0] < segments[1][0] ||
-      segments[1][0] < segments[0][0]) {
-    DBG("Invalid Target temperature");
-    return;
+void segmentsFromJson(JsonDocument &doc, int sched[4][3])
+{
+  for (size_t i = 0; i < 4; i++) {
+    sched[i][0] = doc[segmentNames[i]]["st"];
+    sched[i][1] = doc[segmentNames[i]]["r"];
+    sched[i][2] = doc[segmentNames[i]]["h"];
   }
+}
 
-  StaticJsonDocument<384> doc;
-  char output[384]   = {'\0'};
+bool validSegments(const int sched[4][3])
+{
+  if (KilnControl::valid(sched))
+    return true;
+  DBG("Check the settings, a target or rate is 0 or the targets fall\n");
+  return false;
+}
+
+// Queue a firing change for the control task with a copy of sched, false if
+// the queue is full
+bool control(ControlCommand cmd, const int sched[4][3])
+{
+  ControlMessage m;
+  m.cmd = cmd;
+  memcpy(m.schedule, sched, sizeof(m.schedule));
+  if (xQueueSend(controlQueue, &m, 0) != pdTRUE)
+    return false;
+  wake(CONTROL_COMMAND);
+  return true;
+}
 
-  JsonObject preheat = doc.createNestedObject("preheat");
-  preheat["st"]      = segments[0][0];
-  preheat["r"]       = segments[0][1];
-  preheat["h"]       = segments[0][2];
+// Not idle, as far as the last control pass told
+bool firingActive() { return kiln.read().phase != KILN_IDLE; }
 
-  JsonObject step1   = doc.createNestedObject("step1");
-  step1["st"]        = segments[1][0];
-  step1["r"]         = segments[1][1];
-  step1["h"]         = segments[1][2];
+// Control task. Validate and persist sched then start the firing, false if
+// rejected
+bool startFiring(const int sched[4][3])
+{
+  if (!validSegments(sched))
+    return false;
+
+  safety.reset();
+  safety.headroom(health.headroom());
+  safety.firing(true);
+  alarms.ack(ALARM_SAFETY);
+  controller.start(sched, jobUs / 1000);
+  const KilnSchedule &segments = controller.segments();
+  snapshot.setSchedule(segments);
+  pulseMeter.resetSegments();
+  ledger.startFiring(timebase.now());
+  demand.resetDelay();
+  health.startFiring(timebase.now(), segments[3][1]);
+  report.startFiring(timebase.now(), segments[3][0], pulseMeter.energyWh());
 
-  JsonObject step2   = doc.createNestedObject("step2");
-  step2["st"]        = segments[2][0];
-  step2["r"]         = segments[2][1];
-  step2["h"]         = segments[2][2];
+  StaticJsonDocument<384> doc;
+  char output[384] = {'\0'};
 
-  JsonObject final   = doc.createNestedObject("final");
-  final["st"]        = segments[3][0];
-  final["r"]         = segments[3][1];
-  final["h"]         = segments[3][2];
+  segmentsToJson(doc, segments);
 
   serializeJson(doc, output);
   writeFile(SPIFFS, p_segments, output);
 
   if (true) { // TODO check disable button
-    initMillis = millis();
+    float temp = controller.temp();
     int tTotal = (segments[0][0] - temp) / segments[0][1] * 60 + segments[0][2];
     tTotal += (segments[1][0] - segments[0][0]) * 60 / segments[1][1] +
               segments[1][2];
@@ -539,330 +813,1110 @@ void onFire(AsyncWebServerRequest *request)
 
     DBG("tTotal %dmin\n", tTotal);
 
-    info = "Firing 🔥 @" + String(segments[step][0]) + "°C";
+    setInfo("Firing 🔥 @%d°C", segments[0][0]);
     led(PURPLE);
 
     printSegments();
     rampRate();
-    controlTimer.attach_ms(5530L, tControl);
-    rampTimer.attach_ms(RATEUPDATE * 1000L, rampRate);
+    scheduler.start(JOB_CONTROL);
+    scheduler.start(JOB_RAMP);
   } else {
     DBG("Button pressed, disable temp control\n");
     writeFile(SPIFFS, p_segments, "");
-    restart.once_ms(1000, espRestart);
+    restartSoon();
   }
+  return true;
+}
+
+// Control task
+void stopFiring()
+{
+  scheduler.stop(JOB_CONTROL);
+  scheduler.stop(JOB_RAMP);
+  scheduler.stop(JOB_COOL);
+  controller.stop();
+  relay(false);
+  safety.firing(false);
+  ledger.endFiring(timebase.now());
+  recordHealth();
+  recordReport();
+
+  writeFile(SPIFFS, p_segments, "");
+
+  if (safety.tripped()) {
+    setInfo("Fault ⚠️ %s", SafetyMonitor::name(safety.fault()));
+    led(RED);
+  } else {
+    setInfo("Idle 💤");
+    led(GREEN);
+  }
+}
+
+void planInfo()
+{
+  time_t at = getPlan().start;
+  struct tm local;
+  char hhmm[6];
+  localtime_r(&at, &local);
+  strftime(hhmm, sizeof(hhmm), "%H:%M", &local);
+  setInfo("Start 🕒 @%s", hhmm);
 }
 
-void onFire(String input)
+// Delayed start of sched at the cheapest time that is done by the deadline.
+// The plan keeps its own copy to start with, the schedule shows it once
+// planned and can't be edited until the plan is gone. Saved with the plan
+// so a reset doesn't lose it.
+bool planFiring(const int sched[4][3], uint32_t deadline, int16_t quietFrom,
+                int16_t quietTo)
 {
+  if (!validSegments(sched))
+    return false;
+
+  float t = kiln.read().temp;
+  FiringPlan next;
+  if (!planner.profile(sched, isnan(t) ? PLAN_AMBIENT : t, elementPower()) ||
+      !planner.plan(timebase.now(), deadline, quietFrom, quietTo, next))
+    return false;
+  setPlan(next);
+  memcpy(schedule, sched, sizeof(schedule));
+
   StaticJsonDocument<384> doc;
-  deserializeJson(doc, input);
-
-  segments[0][0] = doc["preheat"]["st"];
-  segments[0][1] = doc["preheat"]["r"];
-  segments[0][2] = doc["preheat"]["h"];
-  segments[1][0] = doc["step1"]["st"];
-  segments[1][1] = doc["step1"]["r"];
-  segments[1][2] = doc["step1"]["h"];
-  segments[2][0] = doc["step2"]["st"];
-  segments[2][1] = doc["step2"]["r"];
-  segments[2][2] = doc["step2"]["h"];
-  segments[3][0] = doc["final"]["st"];
-  segments[3][1] = doc["final"]["r"];
-  segments[3][2] = doc["final"]["h"];
+  char output[384] = {'\0'};
+  segmentsToJson(doc, next.schedule);
+  doc["at"] = next.start;
+  serializeJson(doc, output);
+  writeFile(SPIFFS, p_plan, output);
 
-  getTemp();
+  DBG("Planned start in %us, %.2f instead of %.2f, %uus\n",
+      next.start - (uint32_t)timebase.now(), next.cost, next.costNow, next.us);
+  snapshot.setSchedule(schedule);
+  planInfo();
+  return true;
+}
+
+// Any task, false if there was no plan or another task took it first
+bool cancelPlan()
+{
+  portENTER_CRITICAL(&planLock);
+  bool planned = plan.start != 0;
+  plan.start   = 0;
+  portEXIT_CRITICAL(&planLock);
+  if (planned)
+    writeFile(SPIFFS, p_plan, "");
+  return planned;
+}
+
+// Control task. Jump to the next segment, the final one can't be skipped
+bool skipStep()
+{
+  if (!scheduler.active(JOB_CONTROL) || !controller.skip())
+    return false;
 
-  // guess the step
-  // TODO publish retain and account for hold
-  if (temp > segments[3][0])
-    step = 3;
-  else if (temp > segments[2][0])
-    step = 3;
-  else if (temp > segments[1][0])
-    step = 2;
-  else if (temp > segments[0][0])
-    step = 1;
+  int step = controller.step();
+  scheduler.start(JOB_RAMP);
+  DBG("Skip to step: %d\n", step);
 
-  currentSetpoint = temp;
+  setInfo("Firing 🔥 @%d°C", controller.segments()[step][0]);
+  return true;
+}
 
-  info            = "Firing 🔥 @" + String(segments[step][0]) + "°C";
+// Control task. Carry on with sched after a crash
+void resumeFiring(const int sched[4][3])
+{
+  snapshot.setSchedule(sched);
+  safety.headroom(health.headroom());
+  safety.firing(true);
+  pulseMeter.resetSegments();
+  ledger.startFiring(timebase.now(), true);
+  demand.resetDelay();
+  health.startFiring(timebase.now(), sched[3][1]);
+
+  getTemp();
+  // Guesses the step from that sample
+  controller.resume(sched);
+
+  // Tracked from here, the part before the reset is gone
+  report.startFiring(timebase.now(), sched[3][0], pulseMeter.energyWh());
+
+  setInfo("Firing 🔥 @%d°C", sched[controller.step()][0]);
 
   printSegments();
   rampRate();
-  controlTimer.attach_ms(5530L, tControl);
-  rampTimer.attach_ms(RATEUPDATE * 1000L, rampRate);
+  scheduler.start(JOB_CONTROL);
+  scheduler.start(JOB_RAMP);
 }
 
-void sendData()
+/*
+ * JSON API, version API_VERSION
+ *   GET  /api/v1/status
+ *   GET  /api/v1/history, [[epoch,temp],...] streamed for the chart
+ *   GET  /api/v1/schedule, POST sets it while idle
+ *   POST /api/v1/firing/start (optional schedule body), /stop, /skip
+ *   GET  /api/v1/firing/plan, POST {"by":epoch,"quiet":[from,to]} plus an
+ *        optional schedule sets a delayed start, /stop cancels it
+ *   GET  /api/v1/energy, ledger totals and the current or last firing
+ *   GET  /api/v1/tariff, POST replaces the time-of-use table
+ *   GET  /api/v1/demand, POST sets the average power cap
+ *   GET  /api/v1/elements, element power history and forecast
+ *   GET  /api/v1/firing/report, tracking of the last firing against the
+ *        baseline, POST /baseline makes the last firing the baseline or
+ *        takes the stats in the body
+ *   GET  /api/v1/config, POST saves MQTT settings and restarts while idle
+ * Responses are serialized into a pooled buffer that lives until the client
+ * disconnects, request bodies are parsed in place from the same buffer. A
+ * body that doesn't fit is answered 413, and nothing it carried is applied.
+ */
+#define API_VERSION    1
+#define API_POOL_SLOTS 4
+#define API_BUF_SIZE   1024
+#define SCAN_MAX       10 // networks that fit API_BUF_SIZE
+
+RequestPool<API_POOL_SLOTS, API_BUF_SIZE> apiPool;
+
+const char *firingState()
 {
-  StaticJsonDocument<192> doc;
-  char payload[192];
+  switch (kiln.read().phase) {
+  case KILN_COOLING:
+    return "cooling";
+  case KILN_HOLD:
+    return "hold";
+  case KILN_FIRING:
+    return "firing";
+  default:
+    return getPlan().start ? "planned" : "idle";
+  }
+}
 
-  current          = (instPower / 1000.0f) / 230.0f;
+// From a pool slot. The few that don't fit one, runtime and scheduler stats,
+// are streamed through the library's buffers rather than cut short.
+void apiSend(AsyncWebServerRequest *request, int code, JsonDocument &doc)
+{
+  TRACE_SCOPE(TRACE_HTTP);
+  if (measureJson(doc) >= API_BUF_SIZE) {
+    AsyncResponseStream *response =
+        request->beginResponseStream("application/json");
+    response->setCode(code);
+    serializeJson(doc, *response);
+    request->send(response);
+    return;
+  }
 
-  JsonObject feeds = doc.createNestedObject("feeds");
-  feeds["T"]       = temp;
-  feeds["I"]       = current;
-  feeds["P"]       = instPower / 1000.0f;
-  feeds["E"]       = energy;
-  feeds["$"]       = energy / 1000.0f * COSTKWH;
-  feeds["Tint"]    = tInt;
-  feeds["St"]      = currentSetpoint;
-  feeds["Step"]    = step;
-  feeds["RSSI"]    = WiFi.RSSI();
+  auto *slot = apiPool.acquire(request);
+  if (slot == nullptr) {
+    request->send(503);
+    return;
+  }
+  slot->len = serializeJson(doc, slot->buf, sizeof(slot->buf));
+  request->send_P(code, "application/json", (const uint8_t *)slot->buf,
+                  slot->len);
+}
 
-  serializeJson(doc, payload);
+void apiError(AsyncWebServerRequest *request, int code, const char *error)
+{
+  StaticJsonDocument<64> doc;
+  doc["v"]     = API_VERSION;
+  doc["error"] = error;
+  apiSend(request, code, doc);
+}
 
-  char topic[64] = {'\0'};
-  sprintf(topic, "%s/g/kiln/json", mqtt_user);
+// A body of API_BUF_SIZE or more is turned away, len API_BUF_SIZE marks it
+void apiBody(AsyncWebServerRequest *request, uint8_t *data, size_t len,
+             size_t index, size_t total)
+{
+  TRACE_SCOPE(TRACE_HTTP);
+  auto *slot = apiPool.acquire(request);
+  if (slot == nullptr)
+    return;
+  if (total >= API_BUF_SIZE) {
+    slot->len = API_BUF_SIZE;
+    return;
+  }
+  memcpy(slot->buf + index, data, len);
+  slot->len = index + len;
+}
 
-  mqttClient.publish(topic, 0, false, payload, strlen(payload));
+bool apiTooLarge(AsyncWebServerRequest *request)
+{
+  auto *slot = apiPool.acquire(request);
+  return slot != nullptr && slot->len >= API_BUF_SIZE;
+}
 
-  DBG("topic: %s\n", topic);
-  DBG("Publish: %s\n", payload);
+// Zero-copy, strings in doc point into the slot until the response is built
+bool apiParse(AsyncWebServerRequest *request, JsonDocument &doc)
+{
+  auto *slot = apiPool.acquire(request);
+  if (slot == nullptr || slot->len == 0 || slot->len >= API_BUF_SIZE)
+    return false;
+  slot->buf[slot->len] = '\0';
+  return !deserializeJson(doc, slot->buf, slot->len);
+}
 
-  current   = 0;
-  instPower = 0;
+// False if the pool had no slot for the body as it came in, it's gone
+bool apiBodyKept(AsyncWebServerRequest *request)
+{
+  auto *slot = apiPool.acquire(request);
+  return slot != nullptr && slot->len >= request->contentLength();
 }
 
-void safetyCheck()
+// A body apiParse() couldn't take: 413 if it was too large to keep, 503 if
+// there was no room for it, else it isn't JSON
+void apiBadBody(AsyncWebServerRequest *request)
 {
-  static bool tIntError  = false;
-  static bool noRlyError = false;
-
-  // if (controlTimer.active()) {
-  //   if (temp > (currentSetpoint + 10)) // TODO check differential
-  //   {
-  //     DBG("HIGH TEMPERATURE ALARM\n");
-  //   } else if (temp < (currentSetpoint - 20)) {
-  //     DBG("LOW TEMPERATURE ALARM\n");
-  //   }
-  // }
-
-  if (tInt > 60) {
-    if (!tIntError) {
-      char tIntChar[32];
-      sprintf(tIntChar, "High internal temp: %.1f°C", tInt);
-      notify(tIntChar, strlen(tIntChar));
-      tIntError = true;
-    }
-  } else {
-    tIntError = false;
-  }
+  if (apiTooLarge(request))
+    return apiError(request, 413, "length");
+  if (!apiBodyKept(request))
+    return apiError(request, 503, "busy");
+  apiError(request, 400, "json");
+}
 
-  if (digitalRead(RELAY)) {
-    if ((millis() - energyMillis) > 2000L) {
-      if (!noRlyError) {
-        notify((char *)"noRlyError", strlen("noRlyError"));
-        noRlyError = true;
-      }
-    } else {
-      noRlyError = true;
-    }
+void apiStatus(AsyncWebServerRequest *request)
+{
+  LedgerFiring firing = ledger.firing();
+  KilnState k         = kiln.read();
+  char text[SNAPSHOT_TEXT];
+  getInfo(text);
+
+  StaticJsonDocument<768> doc;
+  doc["v"]      = API_VERSION;
+  doc["state"]  = firingState();
+  doc["info"]   = text;
+  doc["T"]      = k.temp;
+  doc["Tint"]   = k.tInt;
+  doc["St"]     = k.setpoint;
+  doc["Step"]   = k.step;
+  doc["relay"]  = k.relay;
+  doc["P"]      = pulseMeter.power() / 1000.0f;
+  doc["Pel"]    = pulseMeter.elementPower() / 1000.0f;
+  doc["E"]      = firing.wh;
+  doc["$"]      = firing.cost;
+  doc["uptime"] = millis() / 1000;
+  doc["heap"]   = ESP.getFreeHeap();
+  doc["RSSI"]   = WiFi.RSSI();
+  if (safety.tripped())
+    doc["fault"] = SafetyMonitor::name(safety.fault());
+  if (alarms.highest() >= 0)
+    doc["alarm"] = AlarmEngine::severityName((AlarmSeverity)alarms.highest());
+  JsonArray seg = doc.createNestedArray("seg");
+  for (int i = 0; i < LEDGER_SEGMENTS; i++)
+    seg.add(firing.segmentWh[i]);
+  if (demand.enabled()) {
+    JsonObject dem = doc.createNestedObject("demand");
+    dem["avg"]     = demand.average();
+    dem["duty"]    = demand.duty();
+    dem["delay"]   = demand.delayS();
   }
+  apiSend(request, 200, doc);
 }
 
-void printSegments()
+// [[epoch,temp],...] for the page's chart, streamed a chunk of points at a
+// time so the whole history is never held as one string
+void apiHistory(AsyncWebServerRequest *request)
 {
-  DBG("Firing ");
-  for (size_t i = 0; i < sizeof(segments) / sizeof(segments[0]); i++) {
-    Serial.print("{");
-    for (size_t j = 0; j < sizeof(segments[0]) / (sizeof(int)); j++) {
-      Serial.printf("%d,", segments[i][j]);
-    }
-    Serial.print("} ");
-  }
-  Serial.print("\n");
+  long after = 0;
+  bool first = true, done = false;
+
+  request->send(request->beginChunkedResponse(
+      "application/json",
+      [after, first, done](uint8_t *buf, size_t maxLen,
+                           size_t index) mutable -> size_t {
+        char *out  = (char *)buf;
+        size_t len = 0;
+        if (done)
+          return 0;
+        if (index == 0 && maxLen)
+          out[len++] = '[';
+
+        long epoch[64], raw[64];
+        float temps[64];
+        size_t n = history.read(after, raw, temps, 64);
+        if (n == 0) {
+          if (len < maxLen) {
+            out[len++] = ']';
+            done       = true;
+          }
+        } else {
+          for (size_t i = 0; i < n; i++)
+            epoch[i] = timebase.correct(raw[i]);
+          size_t rows;
+          len += History::encode(out + len, maxLen - len, epoch, temps, n,
+                                 first, rows);
+          if (rows) {
+            after = raw[rows - 1];
+            first = false;
+          }
+        }
+        return len ? len : (size_t)RESPONSE_TRY_AGAIN;
+      }));
 }
 
-void IRAM_ATTR readPower()
+void apiSchedule(AsyncWebServerRequest *request)
 {
-  if (energy == 0) {
-    // We don't know the time difference between pulse, reset
-    // TODO get from cloud in case MCU reset
-    energy       = 1;
-    current      = 0;
-    instPower    = 0;
+  StaticJsonDocument<384> doc;
+  doc["v"] = API_VERSION;
+  segmentsToJson(doc, schedule);
+  apiSend(request, 200, doc);
+}
 
-    energyMillis = millis();
-  } else {
-    pulseInterval = millis() - energyMillis;
+void apiSetSchedule(AsyncWebServerRequest *request)
+{
+  if (firingActive())
+    return apiError(request, 409, "firing");
+  // The plan fires its own copy, firing/stop cancels it to edit
+  if (getPlan().start)
+    return apiError(request, 409, "planned");
 
-    if (pulseInterval < 100) { // 10*sqrt(2) Amps =~ 1106.8ms
-      // DBG("DEBOUNCE");
-      return;
-    }
+  StaticJsonDocument<384> doc;
+  if (!apiParse(request, doc))
+    return apiBadBody(request);
 
-    energy++;                         // each pulse is 0,5Wh
-    instPower = 7200 * pulseInterval; // 1Wh = 3600J calculate in mW avoid float
+  int next[4][3];
+  segmentsFromJson(doc, next);
+  if (!validSegments(next))
+    return apiError(request, 400, "schedule");
+  memcpy(schedule, next, sizeof(schedule));
+  snapshot.setSchedule(schedule);
 
-    energyMillis = millis();
+  apiSchedule(request);
+}
+
+// Answers with the status before the control task took the command
+void apiStart(AsyncWebServerRequest *request)
+{
+  if (firingActive())
+    return apiError(request, 409, "firing");
+
+  // The stored schedule without a body, kept only once started
+  int next[4][3];
+  memcpy(next, schedule, sizeof(next));
+  if (request->contentLength()) {
+    StaticJsonDocument<384> doc;
+    if (!apiParse(request, doc))
+      return apiBadBody(request);
+    segmentsFromJson(doc, next);
   }
 
-  volatile static bool problem = false;
-  if (digitalRead(RELAY)) {
-    if (problem == true) {
-      // notify((char *)"shortError", strlen("shortError"));
-    }
-    problem = true;
-  } else
-    problem = false;
+  if (!validSegments(next))
+    return apiError(request, 400, "schedule");
+  cancelPlan();
+  if (!control(CONTROL_START, next))
+    return apiError(request, 503, "busy");
+  memcpy(schedule, next, sizeof(schedule));
+
+  apiStatus(request);
 }
 
-void getTemp()
+void apiPlan(AsyncWebServerRequest *request)
 {
-  static float _t   = 0;
-  static uint8_t _s = 0;
-  static bool tErr  = false;
-
-  temp              = thermocouple.readCelsius();
-  tInt              = thermocouple.readInternal();
-  uint8_t error     = thermocouple.readError();
-
-  // average 5x samples
-  _t += temp;
-  _s++;
-  if (_s == 4) {
-    temp = (float)(_t / _s);
-    _t   = 0;
-    _s   = 0;
+  StaticJsonDocument<192> doc;
+  FiringPlan plan = getPlan();
+  doc["v"]        = API_VERSION;
+  if (plan.start) {
+    doc["at"]   = plan.start;
+    doc["end"]  = plan.end;
+    doc["kWh"]  = plan.kWh;
+    doc["$"]    = plan.cost;
+    doc["$now"] = plan.costNow;
+    doc["us"]   = plan.us;
   }
+  apiSend(request, 200, doc);
+}
 
-  // Ignore SCG fault
-  // https://forums.adafruit.com/viewtopic.php?f=31&t=169135#p827564
-  if (error & 0b001) {
-    if (!tErr) {
-      temp = NAN;
-      tErr = true;
+void apiSetPlan(AsyncWebServerRequest *request)
+{
+  if (firingActive())
+    return apiError(request, 409, "firing");
+  if (!timebase.synced())
+    return apiError(request, 409, "time");
 
-      char tcError[24];
-      sprintf(tcError, "Thermocouple error #%i", error);
-      notify(tcError, strlen(tcError));
+  StaticJsonDocument<384> doc;
+  if (!apiParse(request, doc))
+    return apiBadBody(request);
+  int next[4][3];
+  memcpy(next, schedule, sizeof(next));
+  if (doc.containsKey(segmentNames[0]))
+    segmentsFromJson(doc, next);
+
+  if (!planFiring(next, doc["by"] | 0UL, doc["quiet"][0] | -1,
+                  doc["quiet"][1] | -1))
+    return apiError(request, 400, "plan");
+
+  apiPlan(request);
+}
 
-      digitalWrite(RELAY, LOW);
-    }
+void apiStop(AsyncWebServerRequest *request)
+{
+  cancelPlan();
+  if (!control(CONTROL_STOP))
+    return apiError(request, 503, "busy");
+  apiStatus(request);
+}
+
+void apiSkip(AsyncWebServerRequest *request)
+{
+  KilnState k = kiln.read();
+  if (k.phase == KILN_IDLE || k.step >= 3)
+    return apiError(request, 409, "skip");
+  if (!control(CONTROL_SKIP))
+    return apiError(request, 503, "busy");
+  apiStatus(request);
+}
+
+void apiEnergy(AsyncWebServerRequest *request)
+{
+  StaticJsonDocument<768> doc;
+  doc["v"] = API_VERSION;
+  ledger.toJson(doc.as<JsonObject>());
+  apiSend(request, 200, doc);
+}
+
+void apiTariff(AsyncWebServerRequest *request)
+{
+  StaticJsonDocument<192> doc;
+  doc["v"] = API_VERSION;
+  ledger.tariffToJson(doc.as<JsonObject>());
+  apiSend(request, 200, doc);
+}
+
+// Applies at once, no restart needed
+void apiSetTariff(AsyncWebServerRequest *request)
+{
+  StaticJsonDocument<192> doc;
+  if (!apiParse(request, doc))
+    return apiBadBody(request);
+  if (!ledger.configure(doc))
+    return apiError(request, 400, "tariff");
+
+  StaticJsonDocument<192> file;
+  char output[128] = {'\0'};
+  ledger.tariffToJson(file.to<JsonObject>());
+  serializeJson(file, output);
+  writeFile(SPIFFS, p_tariff, output);
+
+  apiTariff(request);
+}
+
+void apiDemand(AsyncWebServerRequest *request)
+{
+  StaticJsonDocument<96> doc;
+  doc["v"] = API_VERSION;
+  demand.toJson(doc.as<JsonObject>());
+  apiSend(request, 200, doc);
+}
+
+void apiSetDemand(AsyncWebServerRequest *request)
+{
+  StaticJsonDocument<96> doc;
+  if (!apiParse(request, doc))
+    return apiBadBody(request);
+  if (!demand.configure(doc))
+    return apiError(request, 400, "demand");
+
+  StaticJsonDocument<96> file;
+  char output[64] = {'\0'};
+  demand.toJson(file.to<JsonObject>());
+  serializeJson(file, output);
+  writeFile(SPIFFS, p_demand, output);
+
+  apiDemand(request);
+}
+
+void apiSyslog(AsyncWebServerRequest *request)
+{
+  StaticJsonDocument<192> doc;
+  doc["v"] = API_VERSION;
+  syslogSink.toJson(doc.as<JsonObject>());
+  apiSend(request, 200, doc);
+}
+
+// {"host":"192.168.1.20","port":5514,"level":4,"rate":10}, see SyslogSink.h
+void apiSetSyslog(AsyncWebServerRequest *request)
+{
+  StaticJsonDocument<192> doc;
+  if (!apiParse(request, doc))
+    return apiBadBody(request);
+  if (!syslogSink.configure(doc))
+    return apiError(request, 400, "syslog");
+
+  StaticJsonDocument<192> file;
+  char output[128] = {'\0'};
+  syslogSink.toJson(file.to<JsonObject>());
+  serializeJson(file, output);
+  writeFile(SPIFFS, p_syslog, output);
+
+  apiSyslog(request);
+}
+
+void apiElements(AsyncWebServerRequest *request)
+{
+  StaticJsonDocument<1536> doc;
+  doc["v"] = API_VERSION;
+  health.toJson(doc.as<JsonObject>());
+  apiSend(request, 200, doc);
+}
+
+void apiReport(AsyncWebServerRequest *request)
+{
+  StaticJsonDocument<1024> doc;
+  doc["v"] = API_VERSION;
+  report.toJson(doc.as<JsonObject>());
+  apiSend(request, 200, doc);
+}
+
+void apiSetBaseline(AsyncWebServerRequest *request)
+{
+  // The last firing without a body
+  StaticJsonDocument<384> doc;
+  bool body = request->contentLength() != 0;
+  if (body && !apiParse(request, doc))
+    return apiBadBody(request);
+  if (!report.setBaseline(body ? doc.as<JsonVariantConst>()
+                               : JsonVariantConst()))
+    return apiError(request, body ? 400 : 404, body ? "report" : "none");
+
+  defer(NET_REPORT);
+  apiReport(request);
+}
+
+void apiAlarms(AsyncWebServerRequest *request)
+{
+  StaticJsonDocument<1024> doc;
+  doc["v"] = API_VERSION;
+  alarms.toJson(doc.as<JsonObject>(), 8);
+  apiSend(request, 200, doc);
+}
+
+// Prometheus text format, scraped by the monitoring
+void apiMetrics(AsyncWebServerRequest *request)
+{
+  TRACE_SCOPE(TRACE_HTTP);
+  AsyncResponseStream *response =
+      request->beginResponseStream("text/plain; version=0.0.4");
+  metrics.print(*response);
+  scheduler.print(*response);
+  response->print("# TYPE kiln_allocs_total counter\n");
+  for (uint8_t p = 0; p < ALLOC_PATHS; p++)
+    response->printf("kiln_allocs_total{path=\"%s\"} %u\n",
+                     AllocWatch::name((AllocPath)p),
+                     allocWatch.count((AllocPath)p));
+  response->print("# TYPE kiln_log_dropped_total counter\n");
+  response->printf("kiln_log_dropped_total %u\n", journal.dropped());
+  syslogSink.print(*response);
+  report.print(*response);
+  request->send(response);
+}
+
+// Heap, its trend over the last hours and the tasks, see RuntimeStats
+void apiRuntime(AsyncWebServerRequest *request)
+{
+  StaticJsonDocument<3072> doc;
+  doc["v"] = API_VERSION;
+  runtime.toJson(doc.as<JsonObject>(), 6);
+  apiSend(request, 200, doc);
+}
+
+// Deadline misses and jitter per job, see Scheduler::toJson()
+void apiScheduler(AsyncWebServerRequest *request)
+{
+  StaticJsonDocument<2048> doc;
+  doc["v"]      = API_VERSION;
+  doc["passes"] = scheduler.passes();
+  scheduler.toJson(doc.createNestedArray("jobs"));
+  apiSend(request, 200, doc);
+}
+
+// {"id":"tc"} acknowledges one alarm, no id all of them
+void apiAckAlarm(AsyncWebServerRequest *request)
+{
+  StaticJsonDocument<64> doc;
+  if (!apiParse(request, doc))
+    return apiBadBody(request);
+
+  const char *id = doc["id"] | "";
+  if (!*id) {
+    alarms.ackAll();
+  } else if (AlarmEngine::find(id) < ALARM_COUNT) {
+    alarms.ack(AlarmEngine::find(id));
   } else {
-    static uint32_t log = millis();
-    tErr                = false;
-    char msg[8];
-    sprintf(msg, "%.01f", temp);
-
-    struct tm timeinfo;
-    if (((millis() - log) > (60 * 1000) || readings.size() == 0) &&
-        getLocalTime(&timeinfo)) {
-      time_t epoc = mktime(&timeinfo);
-      epocTime.push_back((long)epoc);
-      readings.push_back(temp);
-      DBG("strlen: %u\n", readings.size());
-      log = millis();
+    return apiError(request, 400, "id");
+  }
+  apiAlarms(request);
+}
+
+// Records before the last crash, see FlightRecorder::print()
+void apiLastCrash(AsyncWebServerRequest *request)
+{
+  if (!flight.crashed())
+    return apiError(request, 404, "none");
+
+  AsyncResponseStream *response =
+      request->beginResponseStream("application/json");
+  flight.print(*response);
+  request->send(response);
+}
+
+// Input recording, see InputRecorder.h. Both files get what the partition
+// has left after the other files, the outbox's spill budget and room for
+// SPIFFS to garbage collect.
+#define REC_RESERVE (32 * 1024)
+
+size_t recordingBudget()
+{
+  size_t other = REC_RESERVE + mqttPipeline.config().spillKB * 1024UL;
+  size_t total = SPIFFS.totalBytes();
+  return total > other ? total - other : 0;
+}
+
+void apiRecording(AsyncWebServerRequest *request)
+{
+  StaticJsonDocument<128> doc;
+  doc["v"] = API_VERSION;
+  recorder.toJson(doc.as<JsonObject>());
+  apiSend(request, 200, doc);
+}
+
+void apiSetRecording(AsyncWebServerRequest *request)
+{
+  StaticJsonDocument<32> doc;
+  if (!apiParse(request, doc) || !doc["on"].is<bool>())
+    return apiBadBody(request);
+
+  if (!doc["on"])
+    recorder.stop();
+  else if (!recorder.start(recordingBudget()))
+    return apiError(request, 507, "no room");
+  apiRecording(request);
+}
+
+// The stream itself, ?old=1 for the one before
+void apiRecordingFile(AsyncWebServerRequest *request)
+{
+  const char *path = request->hasParam("old") ? "/rec.old" : "/rec.bin";
+  if (!SPIFFS.exists(path))
+    return apiError(request, 404, "none");
+  request->send(SPIFFS, path, "application/octet-stream");
+}
+
+#ifdef TRACING
+// Chrome trace JSON of the event ring, see Trace.h
+void apiTrace(AsyncWebServerRequest *request)
+{
+  uint32_t id = trace.startExport();
+  if (!id)
+    return apiError(request, 409, "busy");
+
+  // Also after a complete export, it's a no-op then
+  request->onDisconnect([id]() { trace.endExport(id); });
+  request->send(request->beginChunkedResponse(
+      "application/json", [](uint8_t *buf, size_t maxLen, size_t index) {
+        size_t n = trace.exportJson((char *)buf, maxLen);
+        return n == TRACE_AGAIN ? (size_t)RESPONSE_TRY_AGAIN : n;
+      }));
+}
+#endif
+
+#ifdef SAFETY_INJECT
+// {"fault":"stuck relay"}, see SafetyMonitor::name()
+void apiInject(AsyncWebServerRequest *request)
+{
+  StaticJsonDocument<64> doc;
+  if (!apiParse(request, doc))
+    return apiBadBody(request);
+
+  const char *name = doc["fault"] | "";
+  for (uint8_t f = SAFETY_STALE; f < SAFETY_FAULT_COUNT; f++) {
+    if (!strcmp(name, SafetyMonitor::name((SafetyFault)f))) {
+      safety.inject((SafetyFault)f);
+      return apiStatus(request);
     }
+  }
+  apiError(request, 400, "fault");
+}
+#endif
+
+void apiConfig(AsyncWebServerRequest *request)
+{
+  StaticJsonDocument<512> doc;
+  doc["v"]    = API_VERSION;
+  doc["s"]    = mqtt_server;
+  doc["u"]    = mqtt_user;
+  doc["port"] = mqtt_port;
+  mqttPipeline.toJson(doc.createNestedObject("pipe"));
+  apiSend(request, 200, doc);
+}
+
+void apiSetConfig(AsyncWebServerRequest *request)
+{
+  if (firingActive())
+    return apiError(request, 409, "firing");
+
+  StaticJsonDocument<384> doc;
+  if (!apiParse(request, doc) || !doc["s"].is<const char *>() ||
+      !doc["u"].is<const char *>())
+    return apiBadBody(request);
+
+  // Same layout configServer() writes, port is kept as a string
+  StaticJsonDocument<768> file;
+  char port[6];
+  char output[512] = {'\0'};
+  snprintf(port, sizeof(port), "%u", doc["port"] | mqtt_port);
+  file["s"]    = doc["s"];
+  file["u"]    = doc["u"];
+  file["pass"] = doc["pass"] | (const char *)mqtt_pass;
+  file["port"] = port;
+  if (doc.containsKey("pipe"))
+    file["pipe"] = doc["pipe"];
+  // setup() reads it back into a buffer of the same size
+  if (serializeJson(file, output) >= sizeof(output) - 1)
+    return apiError(request, 400, "length");
+  writeFile(SPIFFS, p_mqtt, output);
+
+  restartSoon();
+
+  StaticJsonDocument<32> resp;
+  resp["v"] = API_VERSION;
+  apiSend(request, 202, resp);
+}
 
-    char instPowerString[8];
-    sprintf(instPowerString, "%.01f", instPower / 1000.0f);
-    events.send(msg, "temperature");
-    events.send(instPowerString, "KW");
-    DBG("T: %sdegC P: %sW\n", msg, instPowerString);
+void apiServer()
+{
+  server.on("/api/v1/status", HTTP_GET, apiStatus);
+  server.on("/api/v1/history", HTTP_GET, apiHistory);
+  server.on("/api/v1/schedule", HTTP_GET, apiSchedule);
+  server.on("/api/v1/schedule", HTTP_POST, apiSetSchedule, nullptr, apiBody);
+  server.on("/api/v1/firing/start", HTTP_POST, apiStart, nullptr, apiBody);
+  server.on("/api/v1/firing/plan", HTTP_GET, apiPlan);
+  server.on("/api/v1/firing/plan", HTTP_POST, apiSetPlan, nullptr, apiBody);
+  server.on("/api/v1/firing/stop", HTTP_POST, apiStop);
+  server.on("/api/v1/firing/skip", HTTP_POST, apiSkip);
+  server.on("/api/v1/firing/report", HTTP_GET, apiReport);
+  server.on("/api/v1/firing/baseline", HTTP_POST, apiSetBaseline, nullptr,
+            apiBody);
+  server.on("/api/v1/energy", HTTP_GET, apiEnergy);
+  server.on("/api/v1/tariff", HTTP_GET, apiTariff);
+  server.on("/api/v1/tariff", HTTP_POST, apiSetTariff, nullptr, apiBody);
+  server.on("/api/v1/demand", HTTP_GET, apiDemand);
+  server.on("/api/v1/demand", HTTP_POST, apiSetDemand, nullptr, apiBody);
+  server.on("/api/v1/syslog", HTTP_GET, apiSyslog);
+  server.on("/api/v1/syslog", HTTP_POST, apiSetSyslog, nullptr, apiBody);
+  server.on("/api/v1/elements", HTTP_GET, apiElements);
+  server.on("/api/v1/alarms", HTTP_GET, apiAlarms);
+  server.on("/api/v1/alarms/ack", HTTP_POST, apiAckAlarm, nullptr, apiBody);
+  server.on("/api/v1/scheduler", HTTP_GET, apiScheduler);
+  server.on("/metrics", HTTP_GET, apiMetrics);
+  server.on("/api/v1/debug/runtime", HTTP_GET, apiRuntime);
+  server.on("/api/v1/debug/last-crash", HTTP_GET, apiLastCrash);
+  server.on("/api/v1/debug/recording", HTTP_GET, apiRecording);
+  server.on("/api/v1/debug/recording", HTTP_POST, apiSetRecording, nullptr,
+            apiBody);
+  server.on("/api/v1/debug/recording.bin", HTTP_GET, apiRecordingFile);
+  server.on("/api/v1/config", HTTP_GET, apiConfig);
+  server.on("/api/v1/config", HTTP_POST, apiSetConfig, nullptr, apiBody);
+#ifdef TRACING
+  server.on("/api/v1/debug/trace", HTTP_GET, apiTrace);
+#endif
+#ifdef SAFETY_INJECT
+  server.on("/api/v1/debug/inject", HTTP_POST, apiInject, nullptr, apiBody);
+#endif
+}
+
+uint16_t mqttPublish(const char *topic, uint8_t qos, bool retain,
+                     const char *payload, size_t len)
+{
+  DBG("topic: %s\n", topic);
+  DBG("Publish: %.*s\n", (int)len, payload);
+  uint16_t id;
+  {
+    AllocExempt exempt;
+    id = mqttClient.publish(topic, qos, retain, payload, len);
   }
+  metrics.count(id ? METRIC_C_MQTT_SENT : METRIC_C_MQTT_FAILED);
+  return id;
 }
 
-void holdTimer(uint32_t _segment)
+void sendData()
 {
-  if (holdMillis == 0) {
-    DBG("Start hold for %dmin\n", _segment);
-    holdMillis = millis();
-    rampTimer.detach();
+  MetricScope scope(METRIC_T_SEND);
+  TRACE_SCOPE(TRACE_SEND);
+  TelemetrySample s;
+  float power         = pulseMeter.power();
+  LedgerFiring firing = ledger.firing();
+  KilnState k         = kiln.read();
+
+  s.ts   = timebase.now();
+  s.T    = k.temp;
+  s.Tint = k.tInt;
+  s.St   = k.setpoint;
+  s.P    = power / 1000.0f;
+  s.Pel  = pulseMeter.elementPower() / 1000.0f;
+  s.I    = power / 230.0f;
+  s.E    = firing.wh;
+  s.cost = firing.cost;
+  s.Dly  = demand.delayS() / 60.0f;
+  s.step = k.step;
+  s.rssi = WiFi.RSSI();
+
+  mqttPipeline.push(s);
+  publishSnapshot();
+}
+
+// Relay, pulse and kiln temperature checks are in SafetyMonitor
+void safetyCheck()
+{
+  MetricScope scope(METRIC_T_SAFETY);
+  TRACE_SCOPE(TRACE_SAFETY);
+  float t = kiln.read().tInt;
+  char msg[32];
+  snprintf(msg, sizeof(msg), "High internal temp: %.1f°C", t);
+  alarms.level(ALARM_TINT, t, msg);
+}
+
+// Stop the firing and tell once the monitor has tripped, network task only
+void safetyFault()
+{
+  static SafetyFault reported = SAFETY_OK;
+
+  SafetyFault fault = safety.fault();
+  if (fault == reported)
+    return;
+  reported = fault;
+  if (fault == SAFETY_OK) {
+    alarms.condition(ALARM_SAFETY, false, "");
+    return;
   }
-  uint32_t _elapsed = (millis() - holdMillis) / (60 * 1000);
-  info = "Hold: " + String(currentSetpoint, 0) + "°C-" + String(_elapsed) +
-         "/" + String(_segment) + "min";
-  events.send(info.c_str(), "display");
-
-  if (_elapsed >= _segment) {
-    step++;
-    holdMillis = 0;
-    rampTimer.attach_ms(RATEUPDATE * 1000L, rampRate);
-    DBG("Done with hold, step: %d\n", step);
-    info = "Firing 🔥 @" + String(segments[step][0]) + "°C";
-    events.send(info.c_str(), "display");
+
+  // Shows the fault once stopped
+  cancelPlan();
+  control(CONTROL_STOP);
+
+  char msg[32];
+  snprintf(msg, sizeof(msg), "Safety: %s", SafetyMonitor::name(fault));
+  alarms.condition(ALARM_SAFETY, true, msg);
+}
+
+void printSegments()
+{
+  const KilnSchedule &s = controller.segments();
+  DBG("Firing {%d,%d,%d,} {%d,%d,%d,} {%d,%d,%d,} {%d,%d,%d,} \n", s[0][0],
+      s[0][1], s[0][2], s[1][0], s[1][1], s[1][2], s[2][0], s[2][1], s[2][2],
+      s[3][0], s[3][1], s[3][2]);
+}
+
+// Timestamp only, PulseMeter::update() does the rest outside the ISR
+void IRAM_ATTR readPower()
+{
+  TRACE_INSTANT_ISR(TRACE_PULSE);
+  pulseMeter.capture();
+}
+
+// Sample stage, raw readings for filterTemp()
+void getTemp()
+{
+  MetricScope scope(METRIC_T_SAMPLE);
+  TRACE_SCOPE(TRACE_SAMPLE);
+  int segment = scheduler.active(JOB_CONTROL) ? controller.step() : -1;
+  pulseMeter.update(segment, jobUs);
+  ledger.account(pulseMeter.energyWh(), segment, timebase.now());
+  demand.account(pulseMeter.energyWh(), jobUs / 1000);
+
+  // One frame, all three from the same conversion
+  uint32_t frame  = thermocouple.readFrame();
+  float temp      = Max31855Frame::celsius(frame);
+  tInt            = Max31855Frame::internal(frame);
+  uint8_t tcFault = Max31855Frame::fault(frame);
+  recorder.frame(temp, tInt, tcFault);
+  controller.sample(temp, tcFault);
+
+  metrics.count(METRIC_C_SAMPLES);
+  if (tcFault || isnan(temp))
+    metrics.count(METRIC_C_SPI_ERRORS);
+}
+
+// Filter stage, the network task publishes what passed
+void filterTemp()
+{
+  MetricScope scope(METRIC_T_FILTER);
+  TRACE_SCOPE(TRACE_FILTER);
+  KilnFilter tc  = controller.filter();
+  float temp     = controller.temp();
+  float setpoint = controller.setpoint();
+  bool firing    = scheduler.active(JOB_CONTROL);
+
+  if (tc == KILN_TC_FAULT) {
+    char tcError[24];
+    sprintf(tcError, "Thermocouple error #%i", controller.fault());
+    alarms.condition(ALARM_TC, true, tcError);
+
+    relay(false);
+  } else if (tc == KILN_TC_OK) {
+    alarms.condition(ALARM_TC, false, "");
+    bool soak = firing && controller.step() == 3 && !controller.holding();
+    health.sample(digitalRead(RELAY), pulseMeter.elementPower(), temp, soak);
+    report.sample(temp, setpoint);
+    defer(NET_SAMPLE);
   }
+
+  safety.post(temp, setpoint);
+
+  uint8_t flags = (digitalRead(RELAY) ? FLIGHT_RELAY : 0) |
+                  (firing ? FLIGHT_FIRING : 0);
+  flight.record(timebase.now(), temp, setpoint, controller.step(), flags);
 }
 
-void rampDown()
+// The reading getTemp() took, to the page, WebSocket, snapshot and history
+void publishSample()
 {
-  // https://digitalfire.com/schedule/04dsdh
-  if (currentSetpoint < 760 || step == 5) {
-    controlTimer.detach();
-    slowCool.detach();
-    currentSetpoint = 0;
-    tControl();
-    writeFile(SPIFFS, p_segments, "");
-    info = "Cooling ❄️";
-    events.send(info.c_str(), "display");
+  KilnState k = kiln.read();
+  char msg[8];
+  sprintf(msg, "%.01f", k.temp);
+
+  // Provisional until SNTP synced, corrected where history is read back
+  if (history.due(millis())) {
+    uint32_t epoc = timebase.now();
+    history.add(millis(), epoc, k.temp);
+    wsTelemetry.publishHistory();
+    snapshot.addHistory(epoc, k.temp);
+    DBG("History: %u\n", history.size());
   }
 
-  currentSetpoint -= (float)(83.0 / (3600.0f / RATEUPDATE));
+  char instPowerString[8];
+  sprintf(instPowerString, "%.01f", pulseMeter.power() / 1000.0f);
+  sseSend(msg, "temperature");
+  sseSend(instPowerString, "KW");
+  wsTelemetry.publishLive(k.temp, k.setpoint, k.tInt, pulseMeter.power(),
+                          k.step, k.relay);
+  snapshot.setProcess(k.temp, k.setpoint);
+  DBG("T: %sdegC P: %skW\n", msg, instPowerString);
 }
 
-void tControl()
+// Control task, after every pass
+void publishState()
+{
+  KilnState k;
+  k.temp     = controller.temp();
+  k.tInt     = tInt;
+  k.setpoint = controller.setpoint();
+  k.step     = controller.step();
+  k.relay    = digitalRead(RELAY);
+  if (scheduler.active(JOB_COOL))
+    k.phase = KILN_COOLING;
+  else if (!scheduler.active(JOB_CONTROL))
+    k.phase = KILN_IDLE;
+  else
+    k.phase = controller.holding() ? KILN_HOLD : KILN_FIRING;
+  kiln.write(k);
+}
+
+// Ahead of every job. The time it runs on, recorded with the clock whenever
+// SNTP moved it.
+void recordJob(uint8_t id)
 {
-  DBG("Control ST: %.01fdegC, step: %d\n", currentSetpoint, step);
-  static uint8_t diff;
-
-  if (!isnan(temp)) {
-    float delta_t = currentSetpoint - temp - diff;
-    if (delta_t >= 0) {
-      if (!digitalRead(RELAY)) {
-        digitalWrite(RELAY, HIGH);
-        // restart timer so relay have time to pulse
-        safetyTimer.detach();
-        safetyTimer.attach_ms(2115L, safetyCheck);
-        diff = 0;
+  static uint32_t syncs = 0;
+  jobUs                 = esp_timer_get_time();
+  if (!recorder.on())
+    return;
+  recorder.job(id, timebase.now(), jobUs);
+  if (timebase.syncs() != syncs) {
+    syncs = timebase.syncs();
+    recorder.time(timebase.now(), syncs);
+  }
+}
+
+// Sleeps until the next job is due or a notification says something changed
+void controlTask(void *arg)
+{
+  uint32_t waitMs = 0;
+  for (;;) {
+    xTaskNotifyWait(0, UINT32_MAX, nullptr, pdMS_TO_TICKS(waitMs));
+
+    ControlMessage m;
+    while (xQueueReceive(controlQueue, &m, 0) == pdTRUE) {
+      jobUs = esp_timer_get_time();
+      recorder.command(m.cmd, m.schedule, jobUs);
+      switch (m.cmd) {
+      case CONTROL_START:
+        startFiring(m.schedule);
+        break;
+      case CONTROL_RESUME:
+        resumeFiring(m.schedule);
+        break;
+      case CONTROL_STOP:
+        stopFiring();
+        break;
+      case CONTROL_SKIP:
+        skipStep();
+        break;
       }
-    } else if (digitalRead(RELAY)) {
-      digitalWrite(RELAY, LOW);
-      diff = DIFFERENTIAL;
+      publishState();
     }
-    if (step == 5)
-      return;
-    if (temp > segments[step][0]) {
-      currentSetpoint = segments[step][0];
-
-      if (segments[step][2] == -1)
-        segments[step][2] = 0;
-      holdTimer(segments[step][2]);
-
-      if (step == 4) {
-        uint8_t h = (millis() - initMillis) / (1000 * 3600);
-        uint8_t m = ((millis() - initMillis) - (h * 3600 * 1000)) / (60 * 1000);
-        char endInfo[64];
-        sprintf(endInfo, "Reached Temp, after: %d:%d", h, m);
-        DBG("%s", endInfo);
-        info = "Slow Cooling ❄️";
-        events.send(info.c_str(), "display");
-        slowCool.attach_ms(RATEUPDATE * 1000L, rampDown);
-        rampTimer.detach();
-        step++;
-      }
+
+    {
+      AllocScope scope(ALLOC_CONTROL);
+      TRACE_SCOPE(TRACE_SCHED);
+      waitMs = scheduler.run();
     }
+    publishState();
   }
 }
 
-void rampRate()
+// What a control pass did, see KilnControl.h
+void controlEvents(uint8_t events)
 {
-  // http://www.stoneware.net/stoneware/glasyrer/firing.htm
+  int step = controller.step();
+  if (events & KILN_E_RELAY)
+    relay(controller.relay());
+  if (events & KILN_E_HOLD) {
+    DBG("Start hold for %dmin\n", controller.segments()[step][2]);
+    scheduler.stop(JOB_RAMP);
+  }
+  if ((events & KILN_E_SOAK) && !(events & KILN_E_NEXT))
+    setInfo("Hold: %.0f°C-%u/%umin", controller.setpoint(),
+            controller.soaked(), controller.segments()[step][2]);
+  if (events & KILN_E_NEXT) {
+    scheduler.start(JOB_RAMP);
+    DBG("Done with hold, step: %d\n", step);
+    if (step < 4)
+      setInfo("Firing 🔥 @%d°C", controller.segments()[step][0]);
+  }
+  if (events & KILN_E_COOL) {
+    uint32_t elapsed = millis() - controller.startMs();
+    uint8_t h        = elapsed / (1000 * 3600);
+    uint8_t m        = (elapsed - (h * 3600 * 1000)) / (60 * 1000);
+    DBG("Reached Temp, after: %d:%d", h, m);
+    setInfo("Slow Cooling ❄️");
+    scheduler.start(JOB_COOL);
+    scheduler.stop(JOB_RAMP);
+  }
+  if (events & KILN_E_DONE) {
+    scheduler.stop(JOB_CONTROL);
+    scheduler.stop(JOB_COOL);
+    safety.firing(false);
+    writeFile(SPIFFS, p_segments, "");
+    ledger.endFiring(timebase.now());
+    recordHealth();
+    recordReport();
+    setInfo("Cooling ❄️");
+  }
+}
 
-  if (currentSetpoint == -9999)
-    currentSetpoint = temp;
+void rampDown()
+{
+  controlEvents(controller.cool(jobUs / 1000, elementPower()));
+}
 
-  if (currentSetpoint >= segments[step][0]) {
-    // TODO alarm if takes too long
-    currentSetpoint = segments[step][0];
-  } else {
-    currentSetpoint += (float)(segments[step][1] / (3600.0f / RATEUPDATE));
-  }
+void tControl()
+{
+  MetricScope scope(METRIC_T_CONTROL);
+  TRACE_SCOPE(TRACE_CONTROL);
+  DBG("Control ST: %.01fdegC, step: %d\n", controller.setpoint(),
+      controller.step());
+  controlEvents(controller.control(jobUs / 1000, elementPower()));
+}
 
-  DBG("Current Setpoint: %.02fdegC, step: %d\n", currentSetpoint, step);
+void rampRate()
+{
+  controller.ramp();
+  DBG("Current Setpoint: %.02fdegC, step: %d\n", controller.setpoint(),
+      controller.step());
 }
 
 void pinInit()
@@ -879,11 +1933,24 @@ void pinInit()
   ledOff();
 }
 
-void onMqttConnect(bool sessionPresent) { DBG("Connected to MQTT.\n"); }
+void onMqttConnect(bool sessionPresent)
+{
+  TRACE_SCOPE(TRACE_MQTT);
+  DBG("Connected to MQTT.\n");
+  mqttPipeline.setConnected(true);
+  if (flight.crashed())
+    defer(NET_CRASH);
+  snapshot.refresh();
+  publishSnapshot();
+  publishLedger();
+  publishHealth();
+}
 
 void onMqttDisconnect(AsyncMqttClientDisconnectReason reason)
 {
+  TRACE_SCOPE(TRACE_MQTT);
   DBG("Disconnected from MQTT, reason: %u\n", (uint8_t)reason);
+  mqttPipeline.setConnected(false);
 
   if (WiFi.isConnected()) {
     xTimerStart(mqttReconnectTimer, 0);
@@ -951,14 +2018,17 @@ void otaInit()
 
 void setup()
 {
-#ifdef VERBOSE
+  // First, before any handler overwrites what the last one left in RTC
+  flight.begin(esp_reset_reason());
+
+#if JOURNAL_LEVEL > JOURNAL_OFF
   Serial.begin(115200);
-  DBG("VERSION %s\n", FIRMWARE_VERSION);
+  journal.addSink(&Serial, JOURNAL_DEBUG);
+  journal.begin();
 #endif
+  DBG("VERSION %s\n", FIRMWARE_VERSION);
 
-  // 1440 samples, every 1 min = 24 hours
-  readings.reserve(1440);
-  epocTime.reserve(1440);
+  snapshot.begin();
 
 #ifdef CALIBRATE
   // Measure GPIO in order to determine Vref to gpio 25 or 26 or 27
@@ -968,6 +2038,36 @@ void setup()
 #endif
 
   pinInit();
+  metrics.begin();
+#ifdef ALLOC_WATCH
+  allocWatch.hook(allocTrap);
+#endif
+  runtime.begin();
+  safety.begin();
+
+  // Sampling and control on the application core under the safety monitor,
+  // the network stack and AsyncTCP are on the other one. Samples are on the
+  // grid at 0, control ticks on every third of them, checks in between.
+  scheduler.begin();
+  scheduler.hook(recordJob);
+  pulseMeter.hook([](int64_t us) { recorder.pulse(us); });
+  scheduler.add(JOB_SAMPLE, "sample", SCHED_SAMPLE, SAMPLE_MS, 0, getTemp);
+  scheduler.add(JOB_FILTER, "filter", SCHED_FILTER, SAMPLE_MS, 0, filterTemp);
+  scheduler.add(JOB_RAMP, "ramp", SCHED_CONTROL, RATEUPDATE * 1000L, 0,
+                rampRate);
+  scheduler.add(JOB_CONTROL, "control", SCHED_CONTROL, CONTROL_MS, 0,
+                tControl);
+  scheduler.add(JOB_COOL, "cool", SCHED_CONTROL, RATEUPDATE * 1000L, 0,
+                rampDown);
+  scheduler.add(JOB_SAFETY, "safety", SCHED_PUBLISH, SAMPLE_MS, SAMPLE_MS / 2,
+                safetyCheck);
+  scheduler.add(JOB_RESTART, "restart", SCHED_PUBLISH, 0, 0, espRestart);
+  scheduler.add(JOB_RUNTIME, "runtime", SCHED_PUBLISH, RUNTIME_PERIOD_MS,
+                SAMPLE_MS * 3 / 4, sampleRuntime);
+  publishState();
+  controlQueue = xQueueCreate(4, sizeof(ControlMessage));
+  xTaskCreatePinnedToCore(controlTask, "control", 6144, nullptr,
+                          configMAX_PRIORITIES - 3, &controlHandle, 1);
   led(RED);
 
   mqttReconnectTimer =
@@ -981,19 +2081,37 @@ void setup()
 
   // Initialize SPIFFS
   if (!SPIFFS.begin(true)) {
-    DBG("An Error has occurred while mounting SPIFFS\n");
+    JOURNAL(JOURNAL_ERROR, "An Error has occurred while mounting SPIFFS\n");
     return;
   }
 
+  ledger.begin(&SPIFFS, "/ledger.bin", "/ledger.tmp");
+  health.begin(&SPIFFS, "/elements.bin");
+  report.begin(&SPIFFS, "/report.bin");
+  alarms.begin(&SPIFFS, "/alarms.bin");
+  recorder.begin(&SPIFFS, "/rec.bin", "/rec.old");
+  StaticJsonDocument<192> tariff;
+  if (!deserializeJson(tariff, readFile(SPIFFS, p_tariff)) &&
+      !ledger.configure(tariff))
+    DBG("Invalid tariff, using %.2f/kWh\n", COSTKWH);
+  StaticJsonDocument<96> cap;
+  if (!deserializeJson(cap, readFile(SPIFFS, p_demand)) &&
+      !demand.configure(cap))
+    DBG("Invalid demand cap, not limiting\n");
+  StaticJsonDocument<192> remote;
+  if (!deserializeJson(remote, readFile(SPIFFS, p_syslog)) &&
+      !syslogSink.configure(remote))
+    DBG("Invalid syslog settings, using %s\n", PAPERTRAIL_HOST);
+
   // This function does not return so not true if sensor is faulty
   if (!thermocouple.begin()) {
-    DBG("ERROR.\n");
+    JOURNAL(JOURNAL_ERROR, "ERROR.\n");
   } else
     DBG("MAX31855 Good\n");
 
   if (WiFi.waitForConnectResult() == WL_DISCONNECTED ||
       WiFi.waitForConnectResult() == WL_NO_SSID_AVAIL) { //~ 100 * 100ms
-    DBG("WiFi Failed!: %u\n", WiFi.status());
+    JOURNAL(JOURNAL_ERROR, "WiFi Failed!: %u\n", WiFi.status());
 
     configServer();
 
@@ -1013,11 +2131,12 @@ void setup()
 
     configTzTime("CET-1CEST,M3.5.0,M10.5.0/3", "0.pool.ntp.org",
                  "1.pool.ntp.org");
+    timebase.begin();
 
-    char input[192] = {'\0'};
-    sprintf(input, "%s", readFile(SPIFFS, p_mqtt).c_str());
+    char input[512] = {'\0'};
+    snprintf(input, sizeof(input), "%s", readFile(SPIFFS, p_mqtt).c_str());
 
-    StaticJsonDocument<64> doc;
+    StaticJsonDocument<512> doc;
     DeserializationError error = deserializeJson(doc, input);
 
     if (error) {
@@ -1037,7 +2156,14 @@ void setup()
     mqttClient.setServer(mqtt_server, 1883);
     mqttClient.setCredentials(mqtt_user, mqtt_pass);
 
+    mqttPipeline.configure(doc["pipe"], mqtt_user);
+    mqttPipeline.begin(mqttPublish, &SPIFFS);
+
     mqttClient.onConnect(onMqttConnect);
+    mqttClient.onPublish([](uint16_t id) {
+      TRACE_SCOPE(TRACE_MQTT);
+      mqttPipeline.ack(id);
+    });
     mqttClient.onDisconnect(onMqttDisconnect);
     connectToMqtt();
 
@@ -1045,9 +2171,15 @@ void setup()
 
     server.addHandler(&events);
 
+    ws.onEvent(onEvent);
+    wsTelemetry.begin(&ws, &history);
+    server.addHandler(&ws);
+
     events.onConnect([](AsyncEventSourceClient *client) {
       DBG("Client connected!\n");
-      events.send(info.c_str(), "display");
+      char text[SNAPSHOT_TEXT];
+      getInfo(text);
+      sseSend(text, "display");
     });
 
     server.on("/", HTTP_GET, [](AsyncWebServerRequest *request) {
@@ -1068,6 +2200,7 @@ void setup()
     });
 
     configServer();
+    apiServer();
 
     server.on("/info", HTTP_GET, [](AsyncWebServerRequest *request) {
       request->send_P(200, "text/html", HTTP_INFO, processor);
@@ -1075,7 +2208,7 @@ void setup()
 
     server.on("/reset", HTTP_GET, [](AsyncWebServerRequest *request) {
       request->redirect("/");
-      restart.once_ms(1000, espRestart);
+      restartSoon();
     });
 
     server.on("/update", HTTP_GET, [](AsyncWebServerRequest *request) {
@@ -1085,57 +2218,73 @@ void setup()
     server.on(
         "/update", HTTP_POST, [](AsyncWebServerRequest *request) {}, onUpload);
 
+    // Strongest SCAN_MAX networks, read from the scan records as they are
     server.on("/scan", HTTP_GET, [](AsyncWebServerRequest *request) {
-      String json = "[";
-      int n       = WiFi.scanComplete();
+      StaticJsonDocument<1536> doc;
+      JsonArray list = doc.to<JsonArray>();
+      int n          = WiFi.scanComplete();
       if (n == WIFI_SCAN_FAILED)
         WiFi.scanNetworks(false, false, false, 100);
 
       n = WiFi.scanComplete();
 
-      if (n) {
-        for (int i = 0; i < n; ++i) {
-          if (i)
-            json += ",";
-          json += "{";
-          json += "\"rssi\":" + String(WiFi.RSSI(i));
-          json += ",\"ssid\":\"" + WiFi.SSID(i) + "\"";
-          json += ",\"bssid\":\"" + WiFi.BSSIDstr(i) + "\"";
-          json += ",\"channel\":" + String(WiFi.channel(i));
-          json += ",\"secure\":" + String(WiFi.encryptionType(i));
-          json += "}";
+      if (n > 0) {
+        for (int i = 0; i < std::min<int>(n, SCAN_MAX); ++i) {
+          auto *ap = (wifi_ap_record_t *)WiFi.getScanInfoByIndex(i);
+          char bssid[18];
+          snprintf(bssid, sizeof(bssid), "%02X:%02X:%02X:%02X:%02X:%02X",
+                   ap->bssid[0], ap->bssid[1], ap->bssid[2], ap->bssid[3],
+                   ap->bssid[4], ap->bssid[5]);
+          JsonObject net = list.createNestedObject();
+          net["rssi"]    = ap->rssi;
+          net["ssid"]    = (char *)ap->ssid;
+          net["bssid"]   = bssid;
+          net["channel"] = ap->primary;
+          net["secure"]  = (int)ap->authmode;
         }
         WiFi.scanDelete();
       }
-      json += "]";
-      Serial.println(json);
-      request->send(200, "application/json", json);
-      json = String();
+      apiSend(request, 200, doc);
     });
 
-    tempTimer.attach(2, getTemp);
-    sendTimer.attach_ms(10000L, sendData);
+    scheduler.add(JOB_SEND, "send", SCHED_PUBLISH,
+                  mqttPipeline.config().rateMs, SAMPLE_MS / 4, sendDue);
+    scheduler.start(JOB_SAMPLE);
+    scheduler.start(JOB_FILTER);
+    scheduler.start(JOB_SEND);
+    wake(CONTROL_SCHEDULE);
 
     led(GREEN);
 
+    // Alarms go to syslog too, the sink filters by its configured level
+    journal.addSink(&syslogSink, JOURNAL_DEBUG);
+
     // https://github.com/espressif/arduino-esp32/blob/master/libraries/ESP32/examples/ResetReason/ResetReason.ino
     esp_reset_reason_t reset_reason = esp_reset_reason();
-    if (reset_reason == ESP_RST_PANIC || reset_reason == ESP_RST_INT_WDT ||
-        reset_reason == ESP_RST_TASK_WDT || reset_reason == ESP_RST_WDT ||
-        reset_reason == ESP_RST_BROWNOUT) {
-      errorLog = new PapertrailLogger(PAPERTRAIL_HOST, PAPERTRAIL_PORT,
-                                      LogLevel::Error, "\033[0;31m",
-                                      "untrol.io", "kiln");
-
-      char rstMsg[12];
-      sprintf(rstMsg, "RST= %u", reset_reason);
-      errorLog->printf("%s\n", rstMsg);
-
-      notify(rstMsg, strlen(rstMsg));
-
-      String segmentRecover = readFile(SPIFFS, p_segments);
-      if (segmentRecover.length())
-        onFire(segmentRecover);
+    bool resumed                    = false;
+    if (FlightRecorder::unexpected(reset_reason)) {
+      NOTIFY(ALARM_RESET, "RST= %u", reset_reason);
+      char crash[64];
+      flight.summary(crash, sizeof(crash));
+      if (*crash)
+        JOURNAL(JOURNAL_ERROR, "Crash: %s\n", crash);
+
+      StaticJsonDocument<384> recover;
+      if (!deserializeJson(recover, readFile(SPIFFS, p_segments))) {
+        segmentsFromJson(recover, schedule);
+        resumed = control(CONTROL_RESUME);
+      }
+    }
+
+    StaticJsonDocument<384> planned;
+    if (!resumed && !deserializeJson(planned, readFile(SPIFFS, p_plan))) {
+      FiringPlan next = {};
+      next.start      = planned["at"];
+      segmentsFromJson(planned, next.schedule);
+      memcpy(schedule, next.schedule, sizeof(schedule));
+      snapshot.setSchedule(schedule);
+      setPlan(next);
+      planInfo();
     }
 
     server.onNotFound(onRequest);
@@ -1143,15 +2292,79 @@ void setup()
 
   // otaInit();
 
-  safetyTimer.attach_ms(2115L, safetyCheck);
+  scheduler.start(JOB_SAFETY);
+  scheduler.start(JOB_RUNTIME);
+  wake(CONTROL_SCHEDULE);
 
   server.begin();
+  xTaskCreatePinnedToCore(networkTask, "network", 8192, nullptr, 1,
+                          &netHandle, 0);
 }
 
-void loop()
+// Core 0, everything that sends: MQTT, SSE and WebSocket. Runs what was
+// deferred to it as soon as it is, the services every NET_POLL_MS.
+void networkTask(void *arg)
 {
-  if (WiFi.getMode() == WIFI_MODE_AP || WiFi.getMode() == WIFI_MODE_APSTA)
-    dnsServer.processNextRequest();
+  for (;;) {
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(NET_POLL_MS));
+
+    if (WiFi.getMode() == WIFI_MODE_AP || WiFi.getMode() == WIFI_MODE_APSTA)
+      dnsServer.processNextRequest();
+
+    uint32_t work = __atomic_exchange_n(&netWork, 0, __ATOMIC_ACQUIRE);
+    if (work) {
+      // The library sends inside are exempt, see AllocWatch.h
+      AllocScope scope(ALLOC_TELEMETRY);
+      TRACE_SCOPE(TRACE_PUBLISH);
+      if (work & NET_SAMPLE)
+        publishSample();
+      if (work & NET_INFO)
+        publishInfo();
+      if (work & NET_HEALTH)
+        healthRecorded();
+      if (work & NET_SEND)
+        sendData();
+      if (work & NET_RUNTIME)
+        publishRuntime();
+      if (work & NET_CRASH)
+        publishCrash();
+      if (work & NET_REPORT)
+        publishReport();
+    }
+
+    safetyFault();
+    alarms.service(deliverAlarm);
+    mqttPipeline.service();
+    {
+      MetricScope scope(METRIC_T_HISTORY);
+      wsTelemetry.service();
+    }
+    recorder.service();
+    if (ledger.service())
+      publishLedger();
+
+    // Off for longer than a slot past the start, the deadline can't be met.
+    // A stop from the API between the check and the cancel wins.
+    FiringPlan planned = getPlan();
+    if (planned.start && timebase.now() >= (time_t)planned.start &&
+        cancelPlan()) {
+      if (timebase.now() - planned.start > PLAN_SLOT_S) {
+        NOTIFY(ALARM_PLAN, "Planned start missed");
+        setInfo("Idle 💤");
+      } else {
+        control(CONTROL_START, planned.schedule);
+      }
+    }
+
+    static uint32_t wsCleanup = 0;
+    if (millis() - wsCleanup > 1000) {
+      ws.cleanupClients();
+      wsCleanup = millis();
+    }
+
+    // ArduinoOTA.handle();
+  }
+}
 
-  // ArduinoOTA.handle();
-}
\ No newline at end of file
+// The network task does the work, setup() is all the Arduino task is for
+void loop() { vTaskDelete(nullptr); }
\ No newline at end of file
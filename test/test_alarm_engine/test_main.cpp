@@ -0,0 +1,93 @@
+/*
+ * AlarmEngine: debounce, repeat suppression and the clears that go with it.
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include <vector>
+
+#include "AlarmEngine.h"
+#include "Timebase.h"
+
+static std::vector<AlarmRecord> sent;
+
+static void sink(const AlarmRecord &alarm) { sent.push_back(alarm); }
+
+static AlarmEngine *alarms;
+
+// Checks the condition every second for ms, delivering as loop() does
+static void hold(AlarmId id, bool active, uint32_t ms)
+{
+  for (uint32_t t = 0; t < ms; t += 1000) {
+    alarms->condition(id, active, "tc error");
+    alarms->service(sink);
+    HostShim::advanceMs(1000);
+  }
+}
+
+void setUp()
+{
+  sent.clear();
+  alarms = new AlarmEngine();
+  HostShim::advanceMs(3600000);
+}
+
+void tearDown() { delete alarms; }
+
+void test_raise_and_clear_are_delivered()
+{
+  hold(ALARM_TC, true, 5000);
+  TEST_ASSERT_TRUE(alarms->active(ALARM_TC));
+  hold(ALARM_TC, false, 15000);
+  TEST_ASSERT_FALSE(alarms->active(ALARM_TC));
+
+  TEST_ASSERT_EQUAL(2, sent.size());
+  TEST_ASSERT_EQUAL(1, sent[0].raised);
+  TEST_ASSERT_EQUAL(0, sent[1].raised);
+}
+
+void test_repeat_suppresses_the_raise_and_its_clear()
+{
+  // tc clears after 10 s and repeats after 60 s
+  hold(ALARM_TC, true, 2000);
+  hold(ALARM_TC, false, 12000);
+  hold(ALARM_TC, true, 2000);
+  hold(ALARM_TC, false, 12000);
+  TEST_ASSERT_EQUAL(1, alarms->repeated());
+  TEST_ASSERT_EQUAL(2, sent.size());
+
+  // Past repeatMs both go out again
+  HostShim::advanceMs(60000);
+  hold(ALARM_TC, true, 2000);
+  hold(ALARM_TC, false, 12000);
+  TEST_ASSERT_EQUAL(4, sent.size());
+  TEST_ASSERT_EQUAL(1, sent[2].raised);
+  TEST_ASSERT_EQUAL(0, sent[3].raised);
+}
+
+void test_latched_clears_on_ack()
+{
+  alarms->condition(ALARM_SAFETY, true, "stuck relay");
+  alarms->condition(ALARM_SAFETY, false, "");
+  alarms->service(sink);
+  TEST_ASSERT_TRUE(alarms->active(ALARM_SAFETY));
+  TEST_ASSERT_EQUAL(1, sent.size());
+
+  alarms->ack(ALARM_SAFETY);
+  alarms->service(sink);
+  TEST_ASSERT_FALSE(alarms->active(ALARM_SAFETY));
+  TEST_ASSERT_EQUAL(2, sent.size());
+  TEST_ASSERT_EQUAL(0, sent[1].raised);
+}
+
+int main(int argc, char **argv)
+{
+  timebase.begin();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_raise_and_clear_are_delivered);
+  RUN_TEST(test_repeat_suppresses_the_raise_and_its_clear);
+  RUN_TEST(test_latched_clears_on_ack);
+  return UNITY_END();
+}
@@ -0,0 +1,298 @@
+/*
+ * Host benchmarks of the paths the kiln runs most, each against a budget in
+ * ns per call: pio test -e bench. Not part of the native env, a loaded
+ * machine would fail it for nothing.
+ *
+ * Time is the host's steady clock, not HostShim's, the best of five runs so
+ * a preemption doesn't count. Budgets are about ten times what the paths
+ * take at -O2 on a desktop: they catch one that got an order of magnitude
+ * slower, an allocation in a loop or an encode gone quadratic, not noise.
+ * KILN_BENCH_SCALE in the environment multiplies them for a slow runner.
+ * What a path may take on the kiln itself is Metrics' budget, see
+ * Metrics.h.
+ *
+ * The history is synthetic and goes beyond HISTORY_POINTS, so encode()'s
+ * cost per point is seen to stay flat from 1k to 100k points.
+ */
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <FS.h>
+#include <unity.h>
+
+#include <stdlib.h>
+
+#include <chrono>
+#include <vector>
+
+#include "DemandLimiter.h"
+#include "ElementHealth.h"
+#include "History.h"
+#include "KilnControl.h"
+#include "Max31855Frame.h"
+#include "MqttPipeline.h"
+#include "PageTemplate.h"
+#include "Timebase.h"
+
+#include "html_strings.h"
+
+#define BENCH_RUNS 5
+
+static char root[] = "/tmp/kiln_test_XXXXXX";
+static FS *flash;
+static double scale = 1;
+static volatile double sink; // keeps results the compiler could drop
+
+static const int SCHEDULE[4][3] = {
+    {120, 3000, 0}, {180, 1500, 1}, {240, 3000, 0}, {300, 1500, 2}};
+
+// ns per call of fn, over n calls, the best of BENCH_RUNS
+template <typename F> static double measure(uint32_t n, F fn)
+{
+  typedef std::chrono::steady_clock Clock;
+  double best = 1e30;
+  for (int r = 0; r < BENCH_RUNS; r++) {
+    Clock::time_point from = Clock::now();
+    for (uint32_t i = 0; i < n; i++)
+      fn(i);
+    std::chrono::duration<double, std::nano> took = Clock::now() - from;
+    best = std::min(best, took.count() / n);
+  }
+  return best;
+}
+
+static void budget(const char *path, double ns, double budgetNs)
+{
+  char line[96];
+  snprintf(line, sizeof(line), "%-28s %10.1f ns, budget %8.0f", path, ns,
+           budgetNs * scale);
+  TEST_MESSAGE(line);
+  TEST_ASSERT_LESS_OR_EQUAL_MESSAGE(budgetNs * scale, ns, path);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_max31855_decode()
+{
+  // The datasheet's examples: 1600 and -250 degC, 127 and -55 degC
+  TEST_ASSERT_EQUAL_FLOAT(1600, Max31855Frame::celsius(0x64000000));
+  TEST_ASSERT_EQUAL_FLOAT(-250, Max31855Frame::celsius(0xF0600000));
+  TEST_ASSERT_EQUAL_FLOAT(127, Max31855Frame::internal(0x00007F00));
+  TEST_ASSERT_EQUAL_FLOAT(-55, Max31855Frame::internal(0x0000C900));
+  TEST_ASSERT_EQUAL(0b001, Max31855Frame::fault(0x00010001));
+
+  uint32_t frames[64];
+  uint32_t seed = 1;
+  for (size_t i = 0; i < 64; i++) {
+    seed      = seed * 1103515245 + 12345;
+    frames[i] = seed;
+  }
+  double ns = measure(1000000, [&](uint32_t i) {
+    uint32_t f = frames[i & 63];
+    sink = Max31855Frame::celsius(f) + Max31855Frame::internal(f) +
+           Max31855Frame::fault(f);
+  });
+  budget("MAX31855 decode", ns, 30);
+}
+
+void test_filter_chain()
+{
+  DemandLimiter demand;
+  KilnControl controller(&demand);
+  uint32_t seed = 1;
+  double ns     = measure(1000000, [&](uint32_t i) {
+    seed = seed * 1103515245 + 12345;
+    // A glitch now and then, the filter's other branch
+    uint8_t fault = (seed >> 24) == 0 ? 0b001 : 0;
+    controller.sample(800 + (seed >> 16 & 0xff) / 64.0f, fault);
+    sink = controller.filter();
+  });
+  budget("sample + filter", ns, 50);
+}
+
+void test_control_step()
+{
+  StaticJsonDocument<64> doc;
+  deserializeJson(doc, "{\"cap\":1200,\"win\":600}");
+  DemandLimiter demand;
+  TEST_ASSERT_TRUE(demand.configure(doc.as<JsonVariantConst>()));
+  KilnControl controller(&demand);
+  controller.sample(20, 0);
+  controller.start(SCHEDULE, 0);
+
+  // Every 6 s, the setpoint ramp every minute, a kiln that never catches
+  // up so the firing doesn't end
+  double ns = measure(200000, [&](uint32_t i) {
+    uint32_t now = i * 6000;
+    demand.account(i * 0.5f, now);
+    controller.sample(controller.setpoint() - 10, 0);
+    controller.filter();
+    if (i % 10 == 0)
+      controller.ramp();
+    sink = controller.control(now, KILN_ELEMENT_W);
+  });
+  budget("control step", ns, 200);
+}
+
+static uint16_t packetId;
+
+static uint16_t publish(const char *topic, uint8_t qos, bool retain,
+                        const char *payload, size_t len)
+{
+  sink     = payload[len - 1];
+  packetId = packetId % 60000 + 1; // 0 is a failed publish
+  return packetId;
+}
+
+void test_send_data_serialization()
+{
+  StaticJsonDocument<64> cfg;
+  cfg["spill"]    = 0;
+  MqttPipeline *p = new MqttPipeline();
+  p->configure(cfg.as<JsonVariantConst>(), "bench");
+  p->begin(publish, flash);
+  p->setConnected(true);
+
+  // What sendData() pushes, every field moved past its deadband
+  TelemetrySample s;
+  memset(&s, 0, sizeof(s));
+  uint32_t published = p->published();
+  double ns          = measure(20000, [&](uint32_t i) {
+    HostShim::advanceMs(2000);
+    s.ts   = timebase.now();
+    s.T    = 800 + (i & 1) * 5;
+    s.Tint = 25 + (i & 1) * 2;
+    s.St   = 805 + (i & 1) * 2;
+    s.P    = 3.6f;
+    s.Pel  = 3.6f;
+    s.I    = 15.6f;
+    s.E    = i;
+    s.step = 1;
+    s.rssi = -60;
+    p->push(s);
+    p->ack(packetId);
+  });
+  TEST_ASSERT_EQUAL(published + BENCH_RUNS * 20000, p->published());
+  budget("sendData serialization", ns, 50000);
+  delete p;
+}
+
+void test_processor()
+{
+  ElementHealth health;
+  health.begin(flash, "/health.bin");
+  // Four firings losing power, so the forecast has a fit to give
+  for (int f = 0; f < 4; f++) {
+    health.startFiring(1700000000 + f * 86400, 150);
+    for (int t = 0; t < 900; t += 2) {
+      HostShim::advanceMs(2000);
+      health.sample(t % 3 != 0, 3600 - f * 50, 1100 + t / 30.0f, true);
+    }
+    TEST_ASSERT_TRUE(health.endFiring());
+  }
+
+  const PageText texts[] = {
+      {"CSS_TEMPLATE", HTTP_STYLE},
+      {"INDEX_JS", HTTP_JS},
+      {"HTML_HEAD_TITLE", HTML_HEAD_TITLE},
+  };
+  PageTemplate page(texts, 3, &health, "bench", __DATE__ " " __TIME__);
+  TEST_ASSERT_EQUAL_STRING("bench", page.value("FW_VER").c_str());
+  TEST_ASSERT_EQUAL_STRING("", page.value("NOT_A_VAR").c_str());
+
+  // Every placeholder the pages have, in turn
+  const String vars[] = {
+      "CSS_TEMPLATE", "INDEX_JS", "HTML_HEAD_TITLE", "HTML_INFO_BOX",
+      "HTML_CONFIG_SSID", "UPTIME", "CHIP_ID", "FREE_HEAP", "SKETCH_INFO",
+      "HOSTNAME", "MY_MAC", "MY_RSSI", "FW_VER", "SDK_VER", "ABOUT_DATE",
+      "ELEMENT_HEALTH"};
+  const size_t n = sizeof(vars) / sizeof(vars[0]);
+  TEST_ASSERT_NOT_NULL(strstr(page.value("ELEMENT_HEALTH").c_str(),
+                              "firings left"));
+  double ns = measure(20000, [&](uint32_t i) {
+    sink = page.value(vars[i % n]).length();
+  });
+  budget("processor()", ns, 3000);
+}
+
+// All n points through encode() in response sized chunks, as the history
+// endpoint streams them
+static size_t encodeAll(const long *epoch, const float *temp, size_t n)
+{
+  char buf[1024];
+  size_t bytes = 0, at = 0;
+  while (at < n) {
+    size_t rows;
+    bytes += History::encode(buf, sizeof(buf), epoch + at, temp + at,
+                             n - at, at == 0, rows);
+    at += rows;
+  }
+  return bytes;
+}
+
+void test_history_encode()
+{
+  const size_t sizes[] = {1000, 10000, 100000};
+  std::vector<long> epoch(100000);
+  std::vector<float> temp(100000);
+  for (size_t i = 0; i < epoch.size(); i++) {
+    epoch[i] = 1700000000 + i * 60;
+    temp[i]  = 20 + (i % 1300) + (i % 7) / 8.0f;
+  }
+
+  for (size_t s = 0; s < 3; s++) {
+    size_t n = sizes[s];
+    char path[32];
+    snprintf(path, sizeof(path), "History::encode %uk", (unsigned)(n / 1000));
+    double ns = measure(1, [&](uint32_t) {
+      sink = encodeAll(epoch.data(), temp.data(), n);
+    });
+    // Per point, flat over the sizes
+    budget(path, ns / n, 3000);
+  }
+}
+
+void test_on_fire_parsing()
+{
+  // The firing form as the page posts it, its submit button last
+  const char *names[] = {"s00", "s01", "s02", "s10", "s11", "s12", "s20",
+                         "s21", "s22", "s30", "s31", "s32", "fire"};
+  const char *values[] = {"120", "3000", "0",    "180", "1500", "1",   "240",
+                          "3000", "0",   "300",  "1500", "2",  "Fire"};
+  int schedule[4][3];
+  memset(schedule, 0, sizeof(schedule));
+  double ns = measure(200000, [&](uint32_t) {
+    for (size_t f = 0; f < 13; f++)
+      KilnControl::field(schedule, names[f], values[f]);
+    sink = schedule[3][2];
+  });
+  TEST_ASSERT_EQUAL_MEMORY(SCHEDULE, schedule, sizeof(schedule));
+  TEST_ASSERT_FALSE(KilnControl::field(schedule, "s40", "1"));
+  TEST_ASSERT_FALSE(KilnControl::field(schedule, "s031", "1"));
+  budget("onFire parsing", ns, 3000);
+}
+
+int main(int argc, char **argv)
+{
+  if (mkdtemp(root) == nullptr)
+    return 1;
+  flash = new FS(root);
+  timebase.begin();
+  const char *s = getenv("KILN_BENCH_SCALE");
+  if (s && atof(s) > 0)
+    scale = atof(s);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_max31855_decode);
+  RUN_TEST(test_filter_chain);
+  RUN_TEST(test_control_step);
+  RUN_TEST(test_send_data_serialization);
+  RUN_TEST(test_processor);
+  RUN_TEST(test_history_encode);
+  RUN_TEST(test_on_fire_parsing);
+  int failed = UNITY_END();
+  HostShim::removeTree(root);
+  return failed;
+}
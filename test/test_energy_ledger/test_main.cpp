@@ -0,0 +1,157 @@
+/*
+ * EnergyLedger period sums across tariff changes and checkpoints.
+ */
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <FS.h>
+#include <unity.h>
+
+#include <stdlib.h>
+
+#include "EnergyLedger.h"
+
+#define MIDNIGHT 1699920000UL // 2023-11-14 00:00 UTC
+
+static char root[] = "/tmp/kiln_test_XXXXXX";
+static FS *flash;
+
+static const char *DAY   = "{\"tou\":[[0,1.2],[420,2.9],[1320,1.2]]}";
+static const char *SHIFT = "{\"tou\":[[0,1.2],[480,3.1],[1200,2],[1320,1]]}";
+
+static EnergyLedger *ledger()
+{
+  EnergyLedger *l = new EnergyLedger(2.0);
+  l->begin(flash, "/ledger.bin", "/ledger.tmp");
+  return l;
+}
+
+static void configure(EnergyLedger *l, const char *tariff)
+{
+  StaticJsonDocument<192> doc;
+  deserializeJson(doc, tariff);
+  TEST_ASSERT_TRUE(l->configure(doc.as<JsonVariantConst>()));
+}
+
+// 100 Wh in each of the three day periods
+static void useDay(EnergyLedger *l)
+{
+  l->account(0, -1, MIDNIGHT + 60);
+  l->account(100, 0, MIDNIGHT + 3600);
+  l->account(200, 0, MIDNIGHT + 10 * 3600);
+  l->account(300, 0, MIDNIGHT + 23 * 3600);
+}
+
+void setUp()
+{
+  flash->remove("/ledger.bin");
+  flash->remove("/ledger.tmp");
+}
+
+void tearDown() {}
+
+void test_new_table_keeps_only_periods_with_the_same_start()
+{
+  EnergyLedger *l = ledger();
+  configure(l, DAY);
+  l->startFiring(MIDNIGHT);
+  useDay(l);
+
+  configure(l, SHIFT);
+  LedgerTotals t = l->total();
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 100, t.periodWh[0]);
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 0, t.periodWh[1]); // 420 moved to 480
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 0, t.periodWh[2]); // new at 1200
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 100, t.periodWh[3]);
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 300, t.wh);
+  LedgerFiring f = l->firing();
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 100, f.periodWh[0]);
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 0, f.periodWh[1]);
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 100, f.periodWh[3]);
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 300, f.wh);
+  delete l;
+}
+
+void test_same_table_changes_nothing()
+{
+  EnergyLedger *l = ledger();
+  configure(l, DAY);
+  useDay(l);
+  configure(l, DAY);
+  LedgerTotals t = l->total();
+  for (int i = 0; i < 3; i++)
+    TEST_ASSERT_FLOAT_WITHIN(0.01, 100, t.periodWh[i]);
+  delete l;
+}
+
+void test_checkpoint_keeps_the_table_of_its_sums()
+{
+  EnergyLedger *l = ledger();
+  configure(l, DAY);
+  useDay(l);
+  HostShim::advanceMs(LEDGER_CHECKPOINT_S * 1000UL);
+  TEST_ASSERT_TRUE(l->service());
+  delete l;
+
+  // Boot order, the tariff file is read after begin()
+  l = ledger();
+  configure(l, DAY);
+  LedgerTotals t = l->total();
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 300, t.wh);
+  for (int i = 0; i < 3; i++)
+    TEST_ASSERT_FLOAT_WITHIN(0.01, 100, t.periodWh[i]);
+
+  // Changed while off, only the matching starts carry over
+  delete l;
+  l = ledger();
+  configure(l, SHIFT);
+  t = l->total();
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 100, t.periodWh[0]);
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 0, t.periodWh[1]);
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 100, t.periodWh[3]);
+  delete l;
+}
+
+void test_resume_carries_on_with_the_open_firing()
+{
+  EnergyLedger *l = ledger();
+  l->startFiring(MIDNIGHT);
+  useDay(l);
+  uint32_t id = l->firing().id;
+  TEST_ASSERT_TRUE(l->service());
+  delete l;
+
+  // Reset mid firing, the meter starts from 0 again
+  l = ledger();
+  l->startFiring(MIDNIGHT + 24 * 3600, true);
+  l->account(0, 2, MIDNIGHT + 24 * 3600);
+  l->account(50, 2, MIDNIGHT + 24 * 3600 + 60);
+  LedgerFiring f = l->firing();
+  TEST_ASSERT_EQUAL(id, f.id);
+  TEST_ASSERT_TRUE(f.open);
+  TEST_ASSERT_FLOAT_WITHIN(0.01, 350, f.wh);
+
+  // Nothing open, a resume opens a new one
+  l->endFiring(MIDNIGHT + 25 * 3600);
+  l->startFiring(MIDNIGHT + 26 * 3600, true);
+  TEST_ASSERT_EQUAL(id + 1, l->firing().id);
+  delete l;
+}
+
+int main(int argc, char **argv)
+{
+  if (mkdtemp(root) == nullptr)
+    return 1;
+  flash = new FS(root);
+  setenv("TZ", "UTC0", 1);
+  tzset();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_new_table_keeps_only_periods_with_the_same_start);
+  RUN_TEST(test_same_table_changes_nothing);
+  RUN_TEST(test_checkpoint_keeps_the_table_of_its_sums);
+  RUN_TEST(test_resume_carries_on_with_the_open_firing);
+  int failed = UNITY_END();
+  HostShim::removeTree(root);
+  return failed;
+}
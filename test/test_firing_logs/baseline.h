@@ -0,0 +1,33 @@
+#ifndef __firing_logs_baseline_h__
+#define __firing_logs_baseline_h__
+
+/*
+ * What test_firing_logs got for each log in extras/ with the controller as
+ * it is. Numbers as in FiringStats and HealthRecord: runtime s, tracking
+ * error rms and max °C, overshoot °C, relay cycles, energy Wh, final ramp
+ * rate °C/h and duty.
+ *
+ * None of the logged firings quite reached the top target, so the last soak
+ * never starts and the runtime is the log's up to its peak.
+ */
+
+struct LogBaseline {
+  const char *log;
+  uint32_t seconds;
+  float rms;
+  float max;
+  float overshoot;
+  uint32_t cycles;
+  float Wh;
+  float rate;
+  float duty;
+};
+
+static const LogBaseline BASELINE[] = {
+    {"20210212_1st_Bisque", 25742, 5.37, 24.48, -0.91, 5, 3006, 60.9, 0.00},
+    {"20210212_1st_Glaze", 32102, 17.47, 63.18, -1.43, 22, 11828, 30.2, 0.13},
+    {"20210221_2nd_Bisque", 40382, 31.62, 58.05, -21.14, 5, 27092, 50.4, 0.01},
+    {"20210223_2nd_Glaze", 30602, 6.75, 31.31, -0.67, 12, 8624, 44.1, 0.22},
+};
+
+#endif
@@ -0,0 +1,234 @@
+/*
+ * The firings logged in extras/ run through the controller again, against
+ * the numbers in baseline.h, so a control change shows up as a difference
+ * in tracking error, relay cycles, energy or runtime.
+ *
+ * The CSVs are sheet 1 of the xlsx logs as they are: a minute average of
+ * the temperature in A, its epoch in ms in B, and the program the kiln
+ * fired in the table under "Program" (G: segment, H: target, I: rate,
+ * J: soak). 20210211_1st_test_after_blanket.csv has no program and isn't
+ * used.
+ *
+ * The log can't answer the relay, so this is open loop: the temperature
+ * comes from the log, interpolated to the 2 s samples, and KilnControl
+ * rebuilds the setpoint from the program and decides the relay on it as
+ * the control task would, at the same periods. FiringReport and
+ * ElementHealth take what they take on the kiln, energy is the relay's on
+ * time at KILN_ELEMENT_W. A change that moves a number on purpose updates
+ * baseline.h with the line the test prints.
+ */
+
+#include <Arduino.h>
+#include <FS.h>
+#include <unity.h>
+
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include "DemandLimiter.h"
+#include "ElementHealth.h"
+#include "FiringReport.h"
+#include "KilnControl.h"
+
+#include "baseline.h"
+
+static char root[] = "/tmp/kiln_test_XXXXXX";
+static FS *flash;
+
+struct FiringLog {
+  std::vector<float> temp;
+  std::vector<int64_t> ms; // epoch
+  int schedule[4][3];
+};
+
+// Repository root, from where this file is
+static std::string repo()
+{
+  std::string path = __FILE__;
+  size_t at        = path.rfind("test/test_firing_logs/");
+  return at == std::string::npos ? "" : path.substr(0, at);
+}
+
+static std::vector<std::string> split(const std::string &line)
+{
+  std::vector<std::string> fields;
+  size_t from = 0, to;
+  while ((to = line.find(',', from)) != std::string::npos) {
+    fields.push_back(line.substr(from, to - from));
+    from = to + 1;
+  }
+  fields.push_back(line.substr(from));
+  fields.resize(std::max<size_t>(fields.size(), 10));
+  return fields;
+}
+
+static bool load(const char *name, FiringLog &log)
+{
+  std::string path = repo() + "extras/" + name + ".csv";
+  FILE *f          = fopen(path.c_str(), "r");
+  if (f == nullptr)
+    return false;
+
+  memset(log.schedule, 0, sizeof(log.schedule));
+  char buf[256];
+  int segment = -1;
+  while (fgets(buf, sizeof(buf), f)) {
+    std::string line(buf);
+    line.erase(line.find_last_not_of("\r\n") + 1);
+    std::vector<std::string> c = split(line);
+
+    if (!c[0].empty() && !c[1].empty()) {
+      log.temp.push_back(atof(c[0].c_str()));
+      log.ms.push_back(atoll(c[1].c_str()));
+    }
+    if (c[6] == "Program") {
+      segment = 0;
+    } else if (segment >= 0 && segment < 4 &&
+               atoi(c[6].c_str()) == segment + 1) {
+      log.schedule[segment][0] = atoi(c[7].c_str());
+      log.schedule[segment][1] = atoi(c[8].c_str());
+      log.schedule[segment][2] = atoi(c[9].c_str());
+      segment++;
+    }
+  }
+  fclose(f);
+  return segment == 4 && log.temp.size() > 1;
+}
+
+// The log at t ms after its first row, straight between the minutes
+static float at(const FiringLog &log, int64_t t)
+{
+  int64_t ms = log.ms[0] + t;
+  size_t i   = 1;
+  while (i < log.ms.size() - 1 && log.ms[i] < ms)
+    i++;
+  float f = (float)(ms - log.ms[i - 1]) / (log.ms[i] - log.ms[i - 1]);
+  return log.temp[i - 1] + (log.temp[i] - log.temp[i - 1]) * f;
+}
+
+struct Firing {
+  FiringStats stats;
+  HealthRecord health;
+};
+
+// From the start command to the end of cooling or of the firing in the log
+static void fire(const FiringLog &log, Firing &out)
+{
+  DemandLimiter demand;
+  KilnControl controller(&demand);
+  FiringReport report("host");
+  ElementHealth health;
+  health.begin(flash, "/health.bin");
+
+  // To the peak and the final soak after it, the rest of the log is the
+  // kiln cooling on its own
+  size_t peak = 0;
+  for (size_t i = 1; i < log.temp.size(); i++) {
+    if (log.temp[i] > log.temp[peak])
+      peak = i;
+  }
+  int64_t length = log.ms[peak] - log.ms[0] + log.schedule[3][2] * 60000LL;
+  length         = std::min(length, log.ms.back() - log.ms[0]);
+  uint32_t epoch = log.ms[0] / 1000;
+  uint32_t start = 10000; // uptime, 0 is no time to the controller
+  bool ramp = true, control = true, cool = false;
+  uint32_t onMs = 0;
+
+  HostShim::setUs(start * 1000LL);
+  controller.sample(log.temp[0], 0);
+  controller.start(log.schedule, start);
+  controller.ramp();
+  report.startFiring(epoch, log.schedule[3][0], 0);
+  health.startFiring(epoch, log.schedule[3][1]);
+
+  int64_t t = 0;
+  for (; control && t <= length; t += 2000) {
+    uint32_t now = start + t;
+    HostShim::setUs(now * 1000LL);
+
+    controller.sample(at(log, t), 0);
+    if (controller.filter() == KILN_TC_OK) {
+      bool soak = controller.step() == 3 && !controller.holding();
+      health.sample(controller.relay(), KILN_ELEMENT_W, controller.temp(),
+                    soak);
+      report.sample(controller.temp(), controller.setpoint());
+    }
+
+    uint8_t events = 0;
+    if (ramp && t % (KILN_RAMP_S * 1000) == 0)
+      controller.ramp();
+    if (t % 6000 == 0)
+      events |= controller.control(now, KILN_ELEMENT_W);
+    if (cool && t % (KILN_RAMP_S * 1000) == 0)
+      events |= controller.cool(now, KILN_ELEMENT_W);
+
+    if (events & KILN_E_RELAY)
+      report.relay(controller.relay());
+    if (events & KILN_E_HOLD)
+      ramp = false;
+    if (events & KILN_E_NEXT)
+      ramp = true;
+    if (events & KILN_E_COOL) {
+      cool = true;
+      ramp = false;
+    }
+    if (events & KILN_E_DONE)
+      control = false;
+    if (controller.relay())
+      onMs += 2000;
+  }
+
+  report.endFiring(epoch + t / 1000, onMs / 3600000.0f * KILN_ELEMENT_W);
+  TEST_ASSERT_TRUE(report.last(out.stats));
+  memset(&out.health, 0, sizeof(out.health));
+  if (health.endFiring())
+    health.last(out.health);
+}
+
+void setUp() {}
+
+void tearDown() {}
+
+void test_logs_against_the_baseline()
+{
+  for (size_t i = 0; i < sizeof(BASELINE) / sizeof(BASELINE[0]); i++) {
+    const LogBaseline &b = BASELINE[i];
+    FiringLog log;
+    TEST_ASSERT_TRUE_MESSAGE(load(b.log, log), b.log);
+    TEST_ASSERT_TRUE_MESSAGE(KilnControl::valid(log.schedule), b.log);
+
+    Firing f;
+    fire(log, f);
+    const FiringStats &s = f.stats;
+    char line[192];
+    snprintf(line, sizeof(line),
+             "{\"%s\", %u, %.2f, %.2f, %.2f, %u, %.0f, %.1f, %.2f},", b.log,
+             s.seconds, s.rms, s.max, s.overshoot, s.cycles, s.Wh,
+             f.health.rate, f.health.duty);
+    TEST_MESSAGE(line);
+
+    TEST_ASSERT_EQUAL_MESSAGE(b.seconds, s.seconds, b.log);
+    TEST_ASSERT_FLOAT_WITHIN_MESSAGE(0.01, b.rms, s.rms, b.log);
+    TEST_ASSERT_FLOAT_WITHIN_MESSAGE(0.01, b.max, s.max, b.log);
+    TEST_ASSERT_FLOAT_WITHIN_MESSAGE(0.01, b.overshoot, s.overshoot, b.log);
+    TEST_ASSERT_EQUAL_MESSAGE(b.cycles, s.cycles, b.log);
+    TEST_ASSERT_FLOAT_WITHIN_MESSAGE(1, b.Wh, s.Wh, b.log);
+    TEST_ASSERT_FLOAT_WITHIN_MESSAGE(0.1, b.rate, f.health.rate, b.log);
+    TEST_ASSERT_FLOAT_WITHIN_MESSAGE(0.01, b.duty, f.health.duty, b.log);
+  }
+}
+
+int main(int argc, char **argv)
+{
+  if (mkdtemp(root) == nullptr)
+    return 1;
+  flash = new FS(root);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_logs_against_the_baseline);
+  int failed = UNITY_END();
+  HostShim::removeTree(root);
+  return failed;
+}
@@ -0,0 +1,122 @@
+/*
+ * FiringPlanner: profile shape, cheapest start, deadline and quiet hours
+ * against a day/night tariff.
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include "FiringPlanner.h"
+
+#define MIDNIGHT 1699920000UL // 2023-11-14 00:00 UTC
+#define HOUR     3600UL
+
+// Cheap from 22:00 to 06:00
+static float dayNight(uint32_t epoch)
+{
+  uint32_t hour = epoch % (24 * HOUR) / HOUR;
+  return hour >= 22 || hour < 6 ? 1.0f : 3.0f;
+}
+
+static float flat(uint32_t epoch) { return 2.0f; }
+
+// About 7 h to 1000°C and a 10 min soak, then the cool down to 760°C
+static const int glaze[4][3] = {
+    {120, 110, 0}, {500, 230, 0}, {960, 130, 0}, {1000, 60, 10}};
+
+// About 5 h, stays below the cool down
+static const int bisque[4][3] = {
+    {120, 110, 0}, {500, 230, 0}, {700, 130, 0}, {700, 0, 30}};
+
+static FiringPlanner planner(dayNight);
+
+void setUp() { HostShim::setUs(0); }
+
+void tearDown() {}
+
+void test_profile_follows_the_schedule()
+{
+  TEST_ASSERT_TRUE(planner.profile(glaze, 20, 3000));
+  uint32_t heat = (100 / 110.0 + 380 / 230.0 + 460 / 130.0 + 40 / 60.0) * HOUR;
+  uint32_t cool = 240 / (float)PLAN_COOL_RATE * HOUR;
+  TEST_ASSERT_UINT32_WITHIN(60, heat + 600 + cool, planner.duration());
+}
+
+void test_too_long_is_refused()
+{
+  const int slow[4][3] = {{1000, 10, 0}, {1000, 0, 0}, {1000, 0, 0},
+                          {1000, 0, 0}};
+  TEST_ASSERT_FALSE(planner.profile(slow, 20, 3000));
+  FiringPlan plan;
+  TEST_ASSERT_FALSE(planner.plan(MIDNIGHT, 0, -1, -1, plan));
+}
+
+void test_flat_price_starts_at_once()
+{
+  FiringPlanner f(flat);
+  TEST_ASSERT_TRUE(f.profile(glaze, 20, 3000));
+  FiringPlan plan;
+  uint32_t now = MIDNIGHT + 10 * HOUR + 120;
+  TEST_ASSERT_TRUE(f.plan(now, 0, -1, -1, plan));
+  TEST_ASSERT_EQUAL(now, plan.start);
+  TEST_ASSERT_FLOAT_WITHIN(0.001, plan.costNow, plan.cost);
+  TEST_ASSERT_EQUAL(now + f.duration(), plan.end);
+  // It fires what it was planned for
+  TEST_ASSERT_EQUAL_MEMORY(glaze, plan.schedule, sizeof(glaze));
+}
+
+void test_waits_for_the_night()
+{
+  TEST_ASSERT_TRUE(planner.profile(bisque, 20, 3000));
+  FiringPlan plan;
+  uint32_t now = MIDNIGHT + 10 * HOUR;
+  TEST_ASSERT_TRUE(planner.plan(now, 0, -1, -1, plan));
+  // All of it inside 22:00-06:00, on a slot boundary
+  TEST_ASSERT_GREATER_OR_EQUAL(MIDNIGHT + 22 * HOUR, plan.start);
+  TEST_ASSERT_LESS_OR_EQUAL(MIDNIGHT + 30 * HOUR, plan.end);
+  TEST_ASSERT_EQUAL(0, plan.start % PLAN_SLOT_S);
+  TEST_ASSERT_LESS_THAN(plan.costNow, plan.cost);
+  TEST_ASSERT_FLOAT_WITHIN(0.01, plan.kWh * 1.0f, plan.cost);
+}
+
+void test_deadline_is_kept()
+{
+  TEST_ASSERT_TRUE(planner.profile(glaze, 20, 3000));
+  FiringPlan plan;
+  uint32_t now      = MIDNIGHT + 10 * HOUR;
+  uint32_t deadline = MIDNIGHT + 26 * HOUR;
+  TEST_ASSERT_TRUE(planner.plan(now, deadline, -1, -1, plan));
+  TEST_ASSERT_LESS_OR_EQUAL(deadline, plan.end);
+  // As much of the night as the deadline leaves
+  TEST_ASSERT_GREATER_THAN(deadline - PLAN_SLOT_S, plan.end);
+
+  // Can't be done in time at all
+  TEST_ASSERT_FALSE(
+      planner.plan(now, now + planner.duration() - 1, -1, -1, plan));
+}
+
+void test_quiet_hours_are_skipped()
+{
+  TEST_ASSERT_TRUE(planner.profile(glaze, 20, 3000));
+  FiringPlan plan;
+  uint32_t now = MIDNIGHT + 10 * HOUR;
+  // No start from 21:00 to 01:00, wrapping past midnight
+  TEST_ASSERT_TRUE(planner.plan(now, 0, 21 * 60, 60, plan));
+  uint32_t hour = plan.start % (24 * HOUR) / HOUR;
+  TEST_ASSERT_TRUE(hour >= 1 && hour < 21);
+}
+
+int main(int argc, char **argv)
+{
+  setenv("TZ", "UTC0", 1);
+  tzset();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_profile_follows_the_schedule);
+  RUN_TEST(test_too_long_is_refused);
+  RUN_TEST(test_flat_price_starts_at_once);
+  RUN_TEST(test_waits_for_the_night);
+  RUN_TEST(test_deadline_is_kept);
+  RUN_TEST(test_quiet_hours_are_skipped);
+  return UNITY_END();
+}
@@ -0,0 +1,109 @@
+/*
+ * History paging and the JSON rows the history endpoint streams: whole rows
+ * per chunk, nothing repeated or skipped across a compaction.
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include <string>
+
+#include "History.h"
+
+static History *history;
+
+// What apiHistory() sends, in chunks of at most len bytes
+static std::string stream(size_t len)
+{
+  std::string json = "[";
+  long after       = 0;
+  bool first       = true;
+  long epoch[64];
+  float temp[64];
+  size_t n;
+  char buf[256];
+
+  while ((n = history->read(after, epoch, temp, 64)) > 0) {
+    size_t rows;
+    size_t w = History::encode(buf, len, epoch, temp, n, first, rows);
+    TEST_ASSERT_GREATER_THAN(0, rows);
+    TEST_ASSERT_LESS_OR_EQUAL(len, w);
+    json.append(buf, w);
+    after = epoch[rows - 1];
+    first = false;
+  }
+  return json + "]";
+}
+
+void setUp() { history = new History(1000); }
+
+void tearDown() { delete history; }
+
+void test_encode_takes_whole_rows_only()
+{
+  long epoch[] = {1700000000, 1700000060, 1700000120};
+  float temp[] = {20.4f, 21.6f, 1250.0f};
+  char buf[64];
+  size_t rows;
+
+  size_t w = History::encode(buf, sizeof(buf), epoch, temp, 3, true, rows);
+  TEST_ASSERT_EQUAL(3, rows);
+  std::string json(buf, w);
+  TEST_ASSERT_EQUAL_STRING(
+      "[1700000000,20],[1700000060,22],[1700000120,1250]", json.c_str());
+
+  // Room for one and a half rows, the comma goes with its row
+  w = History::encode(buf, 24, epoch, temp, 3, false, rows);
+  TEST_ASSERT_EQUAL(1, rows);
+  json.assign(buf, w);
+  TEST_ASSERT_EQUAL_STRING(",[1700000000,20]", json.c_str());
+
+  w = History::encode(buf, 8, epoch, temp, 3, true, rows);
+  TEST_ASSERT_EQUAL(0, rows);
+  TEST_ASSERT_EQUAL(0, w);
+}
+
+void test_stream_in_small_chunks_matches_one_pass()
+{
+  for (long i = 0; i < 500; i++)
+    history->add(i * 2000, 1700000000 + i * 60, 20 + i);
+
+  std::string whole = stream(256);
+  std::string small = stream(40);
+  TEST_ASSERT_EQUAL_STRING(whole.c_str(), small.c_str());
+  TEST_ASSERT_EQUAL(0, whole.find("[[1700000000,20],[1700000060,21],"));
+  TEST_ASSERT_EQUAL(whole.size() - 18, whole.find(",[1700029940,519]]"));
+}
+
+void test_compaction_between_chunks_keeps_order()
+{
+  for (long i = 0; i < HISTORY_POINTS; i++)
+    history->add(i * 2000, 1000 + i, i);
+
+  long epoch[64];
+  float temp[64];
+  size_t n = history->read(0, epoch, temp, 64);
+  TEST_ASSERT_EQUAL(64, n);
+  long after = epoch[n - 1];
+
+  // Full, every other point goes
+  history->add(HISTORY_POINTS * 2000, 1000 + HISTORY_POINTS, 0);
+  long last = after;
+  while ((n = history->read(after, epoch, temp, 64)) > 0) {
+    for (size_t i = 0; i < n; i++) {
+      TEST_ASSERT_GREATER_THAN(last, epoch[i]);
+      last = epoch[i];
+    }
+    after = epoch[n - 1];
+  }
+  TEST_ASSERT_EQUAL(1000 + HISTORY_POINTS, last);
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_encode_takes_whole_rows_only);
+  RUN_TEST(test_stream_in_small_chunks_matches_one_pass);
+  RUN_TEST(test_compaction_between_chunks_keeps_order);
+  return UNITY_END();
+}
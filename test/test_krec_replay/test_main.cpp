@@ -0,0 +1,320 @@
+/*
+ * A firing recorded with InputRecorder the way the control task records it,
+ * then replayed with KrecReplay: every relay decision again, bit for bit,
+ * and a recording that was tampered with is caught where it differs.
+ */
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <FS.h>
+#include <unity.h>
+
+#include <stdlib.h>
+
+#include <string>
+#include <vector>
+
+#include "DemandLimiter.h"
+#include "InputRecorder.h"
+#include "KilnControl.h"
+#include "KrecReplay.h"
+#include "PulseMeter.h"
+
+#define EPOCH 1700000000UL
+
+static char root[] = "/tmp/kiln_test_XXXXXX";
+static FS *flash;
+
+static const int SCHEDULE[4][3] = {
+    {120, 3000, 0}, {180, 1500, 1}, {240, 3000, 0}, {300, 1500, 2}};
+
+// The control task's side of main.cpp, with a kiln that heats while the
+// relay is on and an S0 meter pulsing every 0.5 Wh of a 3600 W element
+struct Kiln {
+  DemandLimiter demand;
+  PulseMeter meter;
+  KilnControl controller;
+  bool ramp, control, cool;
+  int64_t jobUs;
+  float temp;
+  int64_t onUs; // element on time not pulsed for yet
+  uint32_t seed;
+
+  Kiln() : controller(&demand)
+  {
+    ramp = control = cool = false;
+    jobUs                 = 0;
+    temp                  = 20;
+    onUs                  = 0;
+    seed                  = 1;
+  }
+
+  void relay(bool on)
+  {
+    recorder.relay(on);
+    meter.relay(on, jobUs);
+  }
+
+  void job(uint8_t id)
+  {
+    HostShim::advanceUs(150);
+    jobUs = HostShim::nowUs();
+    recorder.job(id, EPOCH + jobUs / 1000000, jobUs);
+  }
+
+  void events(uint8_t e)
+  {
+    if (e & KILN_E_RELAY)
+      relay(controller.relay());
+    if (e & KILN_E_HOLD)
+      ramp = false;
+    if (e & KILN_E_NEXT)
+      ramp = true;
+    if (e & KILN_E_COOL) {
+      cool = true;
+      ramp = false;
+    }
+    if (e & KILN_E_DONE)
+      control = cool = false;
+  }
+
+  void command(uint8_t cmd)
+  {
+    jobUs = HostShim::nowUs();
+    recorder.command(cmd, SCHEDULE, jobUs);
+    if (cmd == KREC_CMD_START) {
+      controller.start(SCHEDULE, jobUs / 1000);
+      demand.resetDelay();
+      controller.ramp();
+      ramp = control = true;
+    } else if (cmd == KREC_CMD_STOP) {
+      ramp = control = cool = false;
+      controller.stop();
+      relay(false);
+    }
+  }
+
+  // Two seconds of the scheduler, fault bits on the sample if any
+  void tick(uint32_t s, uint8_t fault = 0)
+  {
+    int64_t from = HostShim::nowUs();
+    int64_t to   = from + 2000000;
+    // 0.5 Wh at 3600 W is 0.5 s on
+    if (controller.relay())
+      onUs += 2000000;
+    for (int64_t t = from + 250000; onUs >= 500000 && t < to; t += 500000) {
+      HostShim::setUs(t);
+      meter.capture();
+      onUs -= 500000;
+    }
+    HostShim::setUs(to);
+
+    seed = seed * 1103515245 + 12345;
+    temp += (controller.relay() ? 1.6f : 0) - (temp - 20) * 0.0015f;
+    float noise = (int)(seed >> 16 & 0xff) / 256.0f - 0.5f;
+
+    job(KREC_JOB_SAMPLE);
+    meter.update(control ? controller.step() : -1, jobUs);
+    demand.account(meter.energyWh(), jobUs / 1000);
+    recorder.frame(temp + noise, 25, fault);
+    controller.sample(temp + noise, fault);
+
+    job(KREC_JOB_FILTER);
+    if (controller.filter() == KILN_TC_FAULT)
+      relay(false);
+
+    if (ramp && s % KILN_RAMP_S == 0) {
+      job(KREC_JOB_RAMP);
+      controller.ramp();
+    }
+    if (control && s % 6 == 0) {
+      job(KREC_JOB_CONTROL);
+      events(controller.control(jobUs / 1000, elementW()));
+    }
+    if (cool && s % KILN_RAMP_S == 0) {
+      job(KREC_JOB_COOL);
+      events(controller.cool(jobUs / 1000, elementW()));
+    }
+    // Not the controller's
+    job(5);
+    recorder.service();
+  }
+
+  float elementW()
+  {
+    float w = meter.elementPower();
+    return w > 0 ? w : KILN_ELEMENT_W;
+  }
+};
+
+static std::vector<uint8_t> readFile(const char *path)
+{
+  std::string name = std::string(root) + path;
+  std::vector<uint8_t> data;
+  FILE *f = fopen(name.c_str(), "rb");
+  if (f == nullptr)
+    return data;
+  uint8_t buf[512];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    data.insert(data.end(), buf, buf + n);
+  fclose(f);
+  return data;
+}
+
+// Both files in order, false at the first event that doesn't match
+static bool replay(KrecReplay &r, std::vector<uint8_t> *files[2])
+{
+  for (size_t i = 0; i < 2; i++) {
+    if (files[i]->empty())
+      continue;
+    KrecReader reader(files[i]->data(), files[i]->size());
+    KrecEvent e;
+    while (reader.next(e)) {
+      if (!r.event(e))
+        return false;
+    }
+    TEST_ASSERT_NULL(reader.error());
+  }
+  return r.end();
+}
+
+static Kiln *kiln;
+static std::vector<uint8_t> oldFile, curFile;
+
+// Sampling before the start, a thermocouple glitch while ramping, to the end
+// of cooling under the demand settings given
+static void fire(const char *demand)
+{
+  StaticJsonDocument<64> doc;
+  deserializeJson(doc, demand);
+  TEST_ASSERT_TRUE(kiln->demand.configure(doc.as<JsonVariantConst>()));
+
+  TEST_ASSERT_FALSE(recorder.start(REC_FILE_MIN - 1));
+  TEST_ASSERT_TRUE(recorder.start(REC_FILE_MIN));
+  recorder.service();
+
+  uint32_t s = 0;
+  for (; s < 30; s += 2)
+    kiln->tick(s);
+  kiln->command(KREC_CMD_START);
+  for (; kiln->control && s < 4 * 3600; s += 2)
+    kiln->tick(s, s >= 600 && s < 606 ? 0b001 : 0);
+  TEST_ASSERT_FALSE(kiln->control);
+  for (uint32_t end = s + 60; s < end; s += 2)
+    kiln->tick(s);
+
+  recorder.stop();
+  recorder.service();
+  oldFile = readFile("/rec.old");
+  curFile = readFile("/rec.bin");
+}
+
+void setUp()
+{
+  HostShim::setUs(5000000);
+  kiln = new Kiln();
+  kiln->meter.hook([](int64_t us) { recorder.pulse(us); });
+  recorder.begin(flash, "/rec.bin", "/rec.old");
+}
+
+void tearDown() { delete kiln; }
+
+void test_replay_decides_the_same()
+{
+  const char *demand = "{\"cap\":1200,\"win\":600}";
+  fire(demand);
+  TEST_ASSERT_GREATER_THAN(0, curFile.size());
+
+  KrecReplay r;
+  StaticJsonDocument<64> doc;
+  deserializeJson(doc, demand);
+  TEST_ASSERT_TRUE(r.demand(doc.as<JsonVariantConst>()));
+  std::vector<uint8_t> *files[2] = {&oldFile, &curFile};
+  bool ok                        = replay(r, files);
+  TEST_ASSERT_NULL(r.mismatch());
+  TEST_ASSERT_TRUE(ok);
+  // The cap held the ramp back
+  TEST_ASSERT_GREATER_THAN(0, kiln->demand.delayS());
+  TEST_ASSERT_EQUAL(1, r.firings());
+  TEST_ASSERT_GREATER_THAN(20, r.decisions());
+  TEST_ASSERT_EQUAL(5, r.controller().step());
+  float replayed = r.controller().setpoint();
+  float fired    = kiln->controller.setpoint();
+  TEST_ASSERT_EQUAL_MEMORY(&fired, &replayed, sizeof(float));
+}
+
+void test_replay_without_the_cap_differs()
+{
+  fire("{\"cap\":1200,\"win\":600}");
+
+  KrecReplay r;
+  std::vector<uint8_t> *files[2] = {&oldFile, &curFile};
+  TEST_ASSERT_FALSE(replay(r, files));
+  TEST_ASSERT_NOT_NULL(r.mismatch());
+}
+
+void test_flipped_decision_is_caught_there()
+{
+  fire("{\"cap\":0}");
+
+  // The third relay decision, turned around. Its payload is the last byte
+  // before the next event.
+  std::vector<uint8_t> *file = oldFile.empty() ? &curFile : &oldFile;
+  KrecReader reader(file->data(), file->size());
+  KrecEvent e;
+  size_t at    = 0;
+  uint8_t seen = 0;
+  while (seen < 3 && reader.next(e)) {
+    if (e.type == REC_RELAY && ++seen == 3)
+      at = e.offset;
+  }
+  TEST_ASSERT_TRUE(reader.next(e));
+  TEST_ASSERT_EQUAL(REC_RELAY, (*file)[at]);
+  (*file)[e.offset - 1] ^= 1;
+
+  KrecReplay r;
+  std::vector<uint8_t> *files[2] = {&oldFile, &curFile};
+  TEST_ASSERT_FALSE(replay(r, files));
+  TEST_ASSERT_EQUAL(at, r.mismatchAt().offset);
+}
+
+void test_reader_stops_at_a_cut_event()
+{
+  fire("{\"cap\":0}");
+
+  // To the last job, on the clock it ran on
+  KrecReader whole(curFile.data(), curFile.size());
+  KrecEvent e;
+  int64_t last = 0;
+  while (whole.next(e))
+    last = e.us;
+  TEST_ASSERT_NULL(whole.error());
+  TEST_ASSERT_EQUAL(HostShim::nowUs(), last);
+
+  std::vector<uint8_t> cut(curFile.begin(), curFile.begin() + 5 + 3);
+  KrecReader reader(cut.data(), cut.size());
+  TEST_ASSERT_FALSE(reader.next(e));
+  TEST_ASSERT_EQUAL_STRING("truncated event", reader.error());
+
+  const uint8_t other[] = {'K', 'R', 'E', 'C', REC_VERSION + 1};
+  KrecReader newer(other, sizeof(other));
+  TEST_ASSERT_FALSE(newer.next(e));
+  TEST_ASSERT_EQUAL_STRING("unknown version", newer.error());
+}
+
+int main(int argc, char **argv)
+{
+  if (mkdtemp(root) == nullptr)
+    return 1;
+  flash = new FS(root);
+
+  UNITY_BEGIN();
+  RUN_TEST(test_replay_decides_the_same);
+  RUN_TEST(test_replay_without_the_cap_differs);
+  RUN_TEST(test_flipped_decision_is_caught_there);
+  RUN_TEST(test_reader_stops_at_a_cut_event);
+  int failed = UNITY_END();
+  HostShim::removeTree(root);
+  return failed;
+}
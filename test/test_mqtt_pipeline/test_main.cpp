@@ -0,0 +1,226 @@
+/*
+ * MqttPipeline and MqttOutbox against a broker stand-in: outages, replay
+ * order, a full flash budget and a reboot with samples in the outbox file.
+ */
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <FS.h>
+#include <unity.h>
+
+#include <stdlib.h>
+#include <vector>
+
+#include "MqttPipeline.h"
+#include "Timebase.h"
+
+#define SYNC_EPOCH 1700000000LL
+
+// What reached the broker, one row per sample in the order received
+struct Row {
+  uint32_t ts;
+  float T;
+};
+
+static struct {
+  bool up = true;
+  uint16_t id;
+  uint32_t messages;
+  std::vector<Row> rows;
+} broker;
+
+static char root[] = "/tmp/kiln_test_XXXXXX";
+static FS *flash;
+
+// Takes both layouts, legacy feeds for a single sample and compact rows
+static uint16_t publish(const char *topic, uint8_t qos, bool retain,
+                        const char *payload, size_t len)
+{
+  if (!broker.up)
+    return 0;
+
+  DynamicJsonDocument doc(4096);
+  TEST_ASSERT_FALSE(deserializeJson(doc, payload, len));
+  broker.messages++;
+  if (doc.containsKey("feeds")) {
+    broker.rows.push_back({doc["feeds"]["ts"] | 0U, doc["feeds"]["T"]});
+  } else {
+    for (JsonArray row : doc["d"].as<JsonArray>())
+      broker.rows.push_back({row[0], row[1]});
+  }
+  return ++broker.id;
+}
+
+static TelemetrySample sample(float T)
+{
+  TelemetrySample s;
+  memset(&s, 0, sizeof(s));
+  s.ts = timebase.now();
+  s.T  = T;
+  return s;
+}
+
+static MqttPipeline *pipeline(uint16_t spillKB = 64)
+{
+  StaticJsonDocument<64> cfg;
+  cfg["spill"] = spillKB;
+  MqttPipeline *p = new MqttPipeline();
+  p->configure(cfg.as<JsonVariantConst>(), "test");
+  p->begin(publish, flash);
+  return p;
+}
+
+// Replay until the backlog is gone, one batch per replay period
+static void drain(MqttPipeline *p)
+{
+  for (int i = 0; i < 1000 && p->backlog(); i++) {
+    HostShim::advanceMs(p->config().replayMs);
+    p->service();
+  }
+}
+
+static void assertSeries(float first, size_t n)
+{
+  TEST_ASSERT_EQUAL(n, broker.rows.size());
+  for (size_t i = 0; i < n; i++)
+    TEST_ASSERT_FLOAT_WITHIN(0.01, first + i, broker.rows[i].T);
+}
+
+void setUp()
+{
+  broker.up       = true;
+  broker.id       = 0;
+  broker.messages = 0;
+  broker.rows.clear();
+  flash->remove("/outbox.bin");
+  HostShim::advanceMs(60000);
+}
+
+void tearDown() {}
+
+void test_connected_publishes_every_change()
+{
+  MqttPipeline *p = pipeline();
+  p->setConnected(true);
+  for (int i = 0; i < 10; i++) {
+    p->push(sample(100 + i));
+    p->push(sample(100 + i)); // within the deadband
+    HostShim::advanceMs(2000);
+  }
+  assertSeries(100, 10);
+  TEST_ASSERT_EQUAL(10, p->suppressed());
+  TEST_ASSERT_EQUAL(0, p->backlog());
+  delete p;
+}
+
+void test_outage_replays_in_order_through_flash()
+{
+  MqttPipeline *p = pipeline();
+  for (int i = 0; i < 300; i++) {
+    p->push(sample(i));
+    HostShim::advanceMs(2000);
+  }
+  TEST_ASSERT_EQUAL(0, broker.messages);
+  TEST_ASSERT_EQUAL(300, p->backlog());
+  TEST_ASSERT_EQUAL(300 - OUTBOX_RAM, p->spilled());
+
+  p->setConnected(true);
+  // Queued behind the backlog, not ahead of it
+  p->push(sample(300));
+  TEST_ASSERT_EQUAL(0, broker.messages);
+  drain(p);
+
+  assertSeries(0, 301);
+  TEST_ASSERT_EQUAL(0, p->dropped());
+  TEST_ASSERT_FALSE(flash->exists("/outbox.bin"));
+  delete p;
+}
+
+void test_broker_down_while_connected_keeps_samples()
+{
+  MqttPipeline *p = pipeline();
+  p->setConnected(true);
+  broker.up = false;
+  for (int i = 0; i < 20; i++) {
+    p->push(sample(i));
+    HostShim::advanceMs(2000);
+  }
+  TEST_ASSERT_EQUAL(20, p->backlog());
+  TEST_ASSERT_GREATER_THAN(0, p->failed());
+
+  broker.up = true;
+  drain(p);
+  assertSeries(0, 20);
+  delete p;
+}
+
+void test_full_flash_drops_newest_not_middle()
+{
+  // 1 KB of flash, whatever doesn't fit after RAM and file is lost
+  MqttPipeline *p = pipeline(1);
+  size_t inFile   = 1024 / sizeof(TelemetrySample);
+  size_t kept     = OUTBOX_RAM + inFile;
+  for (size_t i = 0; i < kept + 25; i++) {
+    p->push(sample(i));
+    HostShim::advanceMs(2000);
+  }
+  TEST_ASSERT_EQUAL(25, p->dropped());
+  TEST_ASSERT_EQUAL(kept, p->backlog());
+
+  p->setConnected(true);
+  drain(p);
+  // One unbroken series from the first sample, the end is what's missing
+  assertSeries(0, kept);
+  delete p;
+}
+
+// Last, it syncs the clock for good
+void test_reboot_zeroes_provisional_stamps_of_the_last_boot()
+{
+  TEST_ASSERT_FALSE(timebase.synced());
+  MqttPipeline *p = pipeline();
+  for (int i = 0; i < OUTBOX_RAM + 10; i++) {
+    p->push(sample(i));
+    HostShim::advanceMs(2000);
+  }
+  TEST_ASSERT_EQUAL(10, p->spilled());
+  // Reset, RAM is gone, the file stays
+  delete p;
+
+  HostShim::setUs(5 * 1000000LL);
+  p = pipeline();
+  TEST_ASSERT_EQUAL(10, p->backlog());
+  TelemetrySample early = sample(1000);
+  p->push(early);
+  HostShim::sntpSync(SYNC_EPOCH * 1000000);
+  TEST_ASSERT_TRUE(timebase.synced());
+
+  p->setConnected(true);
+  drain(p);
+  TEST_ASSERT_EQUAL(11, broker.rows.size());
+  // The earlier boot's offset is unknown, no time rather than a wrong one
+  for (size_t i = 0; i < 10; i++)
+    TEST_ASSERT_EQUAL(0, broker.rows[i].ts);
+  // Stamped early in this boot, put right by this boot's offset
+  TEST_ASSERT_EQUAL(timebase.correct(early.ts), broker.rows[10].ts);
+  TEST_ASSERT_TRUE(Timebase::valid(broker.rows[10].ts));
+  delete p;
+}
+
+int main(int argc, char **argv)
+{
+  if (mkdtemp(root) == nullptr)
+    return 1;
+  flash = new FS(root);
+  timebase.begin();
+
+  UNITY_BEGIN();
+  RUN_TEST(test_connected_publishes_every_change);
+  RUN_TEST(test_outage_replays_in_order_through_flash);
+  RUN_TEST(test_broker_down_while_connected_keeps_samples);
+  RUN_TEST(test_full_flash_drops_newest_not_middle);
+  RUN_TEST(test_reboot_zeroes_provisional_stamps_of_the_last_boot);
+  int failed = UNITY_END();
+  HostShim::removeTree(root);
+  return failed;
+}
@@ -0,0 +1,281 @@
+/*
+ * SafetyMonitor fault injection: a simulated kiln, relay and S0 meter on the
+ * virtual clock, with faults and the things that must not look like one.
+ */
+
+#include <Arduino.h>
+#include <unity.h>
+
+#include "PulseMeter.h"
+#include "SafetyMonitor.h"
+
+#define RELAY     26
+#define STEP_MS   100
+#define SAMPLE_MS 2000
+
+static PulseMeter *meter;
+static SafetyMonitor *monitor;
+
+// The kiln and the meter as the monitor sees them
+static struct {
+  bool relay;
+  float temp;
+  float setpoint;
+  float ratePerMin; // °C
+  uint32_t pulseMs; // 0 for none
+  uint8_t bounces;  // extra edges per pulse, 20 ms apart
+  bool sampling;
+  uint32_t pulseAt;
+  uint32_t sampleAt;
+} kiln;
+
+static void relay(bool on)
+{
+  kiln.relay = on;
+  digitalWrite(RELAY, on ? HIGH : LOW);
+  meter->relay(on);
+  monitor->relay(on);
+}
+
+// Steps the kiln, the meter's ISR and update(), and the monitor's task
+static void run(uint32_t ms)
+{
+  for (uint32_t t = 0; t < ms; t += STEP_MS) {
+    HostShim::advanceMs(STEP_MS);
+    uint32_t now = millis();
+
+    if (kiln.pulseMs && now - kiln.pulseAt >= kiln.pulseMs) {
+      kiln.pulseAt = now;
+      meter->capture();
+      for (uint8_t i = 0; i < kiln.bounces; i++) {
+        HostShim::advanceMs(20);
+        meter->capture();
+      }
+    }
+    if (kiln.sampling && now - kiln.sampleAt >= SAMPLE_MS) {
+      kiln.sampleAt = now;
+      kiln.temp += kiln.ratePerMin * SAMPLE_MS / 60000.0f;
+      monitor->post(kiln.temp, kiln.setpoint);
+    }
+    if (now % 1000 < STEP_MS)
+      meter->update(-1);
+    if (now % SAFETY_PERIOD_MS < STEP_MS)
+      monitor->check();
+  }
+}
+
+void setUp()
+{
+  meter   = new PulseMeter();
+  monitor = new SafetyMonitor(RELAY, meter);
+  memset(&kiln, 0, sizeof(kiln));
+  kiln.temp     = 600;
+  kiln.setpoint = 600;
+  kiln.sampling = true;
+  monitor->firing(true);
+  relay(false);
+  run(10000);
+}
+
+void tearDown()
+{
+  delete monitor;
+  delete meter;
+}
+
+static void assertTripped(SafetyFault fault)
+{
+  TEST_ASSERT_EQUAL_STRING(SafetyMonitor::name(fault),
+                           SafetyMonitor::name(monitor->fault()));
+  TEST_ASSERT_EQUAL(LOW, HostShim::pin(RELAY));
+}
+
+void test_heating_normally_is_fine()
+{
+  kiln.pulseMs    = 500; // 3.6 kW
+  kiln.ratePerMin = 2;
+  relay(true);
+  run(20 * 60 * 1000UL);
+  relay(false);
+  kiln.pulseMs    = 0;
+  kiln.ratePerMin = -1;
+  run(20 * 60 * 1000UL);
+  TEST_ASSERT_FALSE(monitor->tripped());
+}
+
+void test_stuck_contactor_trips()
+{
+  kiln.pulseMs = 500;
+  relay(true);
+  run(60000);
+  // Told off, the pulses don't stop
+  relay(false);
+  run(SAFETY_RELEASE_MS + 2000);
+  assertTripped(SAFETY_STUCK);
+}
+
+void test_pulses_while_releasing_dont_trip()
+{
+  kiln.pulseMs = 500;
+  relay(true);
+  run(60000);
+  relay(false);
+  run(SAFETY_RELEASE_MS - 500);
+  kiln.pulseMs = 0;
+  run(5 * 60 * 1000UL);
+  TEST_ASSERT_FALSE(monitor->tripped());
+}
+
+void test_bouncing_contacts_dont_trip()
+{
+  // One pulse every 5 min, each with a burst of bounces
+  kiln.pulseMs = 5 * 60 * 1000UL;
+  kiln.bounces = 4;
+  run(30 * 60 * 1000UL);
+  TEST_ASSERT_FALSE(monitor->tripped());
+  TEST_ASSERT_GREATER_THAN(0, meter->bounces());
+}
+
+void test_slow_trickle_doesnt_trip()
+{
+  // 40 W, a meter creeping or something else on the same meter
+  kiln.pulseMs = 45000;
+  run(30 * 60 * 1000UL);
+  TEST_ASSERT_FALSE(monitor->tripped());
+
+  // 90 W is more than standby can explain
+  kiln.pulseMs = 20000;
+  run(60000);
+  assertTripped(SAFETY_STUCK);
+}
+
+void test_open_element_trips()
+{
+  relay(true);
+  run(SAFETY_OPEN_MS + 1000);
+  assertTripped(SAFETY_OPEN);
+}
+
+void test_stale_samples_trip()
+{
+  kiln.sampling = false;
+  run(SAFETY_STALE_MS + 1000);
+  assertTripped(SAFETY_STALE);
+}
+
+void test_overtemp_trips()
+{
+  // Not firing, so it can't be taken for a runaway first
+  monitor->firing(false);
+  kiln.temp       = SAFETY_TMAX - 2;
+  kiln.setpoint   = -9999;
+  kiln.ratePerMin = 60;
+  run(SAMPLE_MS * (SAFETY_TRIP_SAMPLES + 2));
+  assertTripped(SAFETY_OVERTEMP);
+}
+
+void test_no_rise_with_the_element_on_is_drift()
+{
+  kiln.pulseMs = 500;
+  relay(true);
+  run(SAFETY_DRIFT_MS - 60000);
+  TEST_ASSERT_FALSE(monitor->tripped());
+  run(2 * 60 * 1000UL);
+  assertTripped(SAFETY_TC_DRIFT);
+}
+
+void test_aged_elements_may_stall()
+{
+  // The last final ramp took all the power there was
+  monitor->headroom(0.02);
+  kiln.pulseMs    = 500;
+  kiln.ratePerMin = 0.2;
+  relay(true);
+  run(2 * SAFETY_DRIFT_MS);
+  TEST_ASSERT_FALSE(monitor->tripped());
+
+  // Still, losing heat with the element on isn't a stall
+  kiln.ratePerMin = -1;
+  run(SAFETY_DRIFT_MS);
+  assertTripped(SAFETY_TC_DRIFT);
+}
+
+void test_rise_from_the_low_point_is_a_runaway()
+{
+  // Cools past the point the check arms at, then heats with the relay off
+  kiln.ratePerMin = -2;
+  run(10 * 60 * 1000UL);
+  kiln.ratePerMin = 3;
+  run(4 * 60 * 1000UL);
+  TEST_ASSERT_FALSE(monitor->tripped());
+  run(2 * 60 * 1000UL);
+  assertTripped(SAFETY_RUNAWAY);
+}
+
+void test_no_runaway_outside_a_firing()
+{
+  // Idle kiln in the sun, or a lid opened hot and closed again
+  monitor->firing(false);
+  kiln.temp       = 25;
+  kiln.setpoint   = -9999;
+  kiln.ratePerMin = 2;
+  run(30 * 60 * 1000UL);
+  TEST_ASSERT_FALSE(monitor->tripped());
+
+  // Armed again with the firing, from the temperature it's at
+  monitor->firing(true);
+  run(SAFETY_COAST_MS + 9 * 60 * 1000UL);
+  assertTripped(SAFETY_RUNAWAY);
+}
+
+void test_no_runaway_after_a_firing_ends()
+{
+  kiln.pulseMs    = 500;
+  kiln.ratePerMin = 2;
+  relay(true);
+  run(20 * 60 * 1000UL);
+  relay(false);
+  kiln.pulseMs    = 0;
+  kiln.ratePerMin = -2;
+  run(20 * 60 * 1000UL);
+  // Cooled down, controlEvents() disarms it on KILN_E_DONE
+  monitor->firing(false);
+  TEST_ASSERT_FALSE(monitor->tripped());
+
+  // The cold kiln warms up again in the sun
+  kiln.setpoint   = -9999;
+  kiln.ratePerMin = 1;
+  run(60 * 60 * 1000UL);
+  TEST_ASSERT_FALSE(monitor->tripped());
+}
+
+void test_reset_clears_the_latch()
+{
+  relay(true);
+  run(SAFETY_OPEN_MS + 1000);
+  assertTripped(SAFETY_OPEN);
+  relay(false);
+  monitor->reset();
+  run(60000);
+  TEST_ASSERT_FALSE(monitor->tripped());
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_heating_normally_is_fine);
+  RUN_TEST(test_stuck_contactor_trips);
+  RUN_TEST(test_pulses_while_releasing_dont_trip);
+  RUN_TEST(test_bouncing_contacts_dont_trip);
+  RUN_TEST(test_slow_trickle_doesnt_trip);
+  RUN_TEST(test_open_element_trips);
+  RUN_TEST(test_stale_samples_trip);
+  RUN_TEST(test_overtemp_trips);
+  RUN_TEST(test_no_rise_with_the_element_on_is_drift);
+  RUN_TEST(test_aged_elements_may_stall);
+  RUN_TEST(test_rise_from_the_low_point_is_a_runaway);
+  RUN_TEST(test_no_runaway_outside_a_firing);
+  RUN_TEST(test_no_runaway_after_a_firing_ends);
+  RUN_TEST(test_reset_clears_the_latch);
+  return UNITY_END();
+}
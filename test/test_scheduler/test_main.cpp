@@ -0,0 +1,154 @@
+/*
+ * Scheduler on a virtual clock: ordering of jobs due together, phases,
+ * deadline misses and the wait run() returns.
+ */
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <unity.h>
+
+#include <string>
+#include <vector>
+
+#include "Scheduler.h"
+
+static int64_t clockUs;
+static int64_t virtualClock() { return clockUs; }
+
+static Scheduler *sched;
+static std::string order;
+static std::vector<int64_t> at;
+
+static void sample() { order += "S"; }
+static void filter() { order += "F"; }
+static void control() { order += "C"; }
+static void publish() { order += "P"; }
+static void stamp() { at.push_back(clockUs); }
+// Overruns its period, as a stalled bus read would
+static void slow() { clockUs += 2500 * 1000LL; }
+
+// Steps the clock to each due time, as the control task's wait would
+static void runUntil(int64_t endUs)
+{
+  while (clockUs < endUs) {
+    uint32_t wait = sched->run(clockUs, 1000);
+    clockUs += std::max<uint32_t>(wait, 1) * 1000LL;
+  }
+}
+
+void setUp()
+{
+  clockUs = 1000000;
+  order.clear();
+  at.clear();
+  sched = new Scheduler(virtualClock);
+}
+
+void tearDown() { delete sched; }
+
+void test_same_time_runs_by_stage_then_id()
+{
+  // Added and started in the wrong order on purpose
+  sched->add(5, "publish", SCHED_PUBLISH, 1000, 0, publish);
+  sched->add(3, "control", SCHED_CONTROL, 1000, 0, control);
+  sched->add(4, "filter", SCHED_FILTER, 1000, 0, filter);
+  sched->add(1, "sample", SCHED_SAMPLE, 1000, 0, sample);
+  sched->begin();
+  for (uint8_t id : {5, 3, 4, 1})
+    sched->start(id);
+
+  runUntil(clockUs + 3500 * 1000LL);
+  TEST_ASSERT_EQUAL_STRING("SFCPSFCPSFCP", order.c_str());
+}
+
+void test_phase_offsets_the_grid()
+{
+  sched->add(0, "stamp", SCHED_SAMPLE, 1000, 250, stamp);
+  sched->begin();
+  int64_t epoch = clockUs;
+  sched->start(0);
+
+  runUntil(epoch + 3000 * 1000LL);
+  TEST_ASSERT_EQUAL(3, at.size());
+  for (size_t i = 0; i < at.size(); i++)
+    TEST_ASSERT_EQUAL(epoch + (250 + i * 1000) * 1000LL, at[i]);
+  TEST_ASSERT_EQUAL(0, sched->stats(0).maxLateUs);
+}
+
+void test_start_waits_for_the_next_slot()
+{
+  sched->add(0, "stamp", SCHED_SAMPLE, 1000, 0, stamp);
+  sched->begin();
+  int64_t epoch = clockUs;
+  clockUs += 1400 * 1000LL;
+  sched->start(0);
+  TEST_ASSERT_EQUAL(600, sched->run(clockUs, 5000));
+  runUntil(epoch + 2500 * 1000LL);
+  TEST_ASSERT_EQUAL(1, at.size());
+  TEST_ASSERT_EQUAL(epoch + 2000 * 1000LL, at[0]);
+}
+
+void test_overrun_skips_releases()
+{
+  sched->add(0, "slow", SCHED_CONTROL, 1000, 0, slow);
+  sched->add(1, "stamp", SCHED_PUBLISH, 1000, 0, stamp);
+  sched->begin();
+  int64_t epoch = clockUs;
+  sched->start(0);
+  sched->start(1);
+
+  // Runs at 1 s and takes until 3.5 s, the stamp due at 1 s still runs in
+  // that pass after it
+  runUntil(epoch + 1001 * 1000LL);
+  sched->stop(0);
+  runUntil(epoch + 5500 * 1000LL);
+
+  // The next pass is at 4.5 s: the release at 2 s runs 2.5 s late, 3 and
+  // 4 s are skipped rather than made up, then it's back on the grid
+  SchedStats s = sched->stats(1);
+  TEST_ASSERT_EQUAL(2, s.misses);
+  TEST_ASSERT_EQUAL(2500 * 1000, s.maxLateUs);
+  TEST_ASSERT_EQUAL(3, at.size());
+  TEST_ASSERT_EQUAL(epoch + 3500 * 1000LL, at[0]);
+  TEST_ASSERT_EQUAL(epoch + 4500 * 1000LL, at[1]);
+  TEST_ASSERT_EQUAL(epoch + 5000 * 1000LL, at[2]);
+  TEST_ASSERT_EQUAL(2500 * 1000, sched->stats(0).maxRunUs);
+}
+
+void test_once_runs_one_time()
+{
+  sched->add(0, "stamp", SCHED_SAMPLE, 0, 0, stamp);
+  sched->begin();
+  int64_t from = clockUs;
+  sched->once(0, 300);
+  TEST_ASSERT_TRUE(sched->active(0));
+  // start() ignores a job without a period
+  sched->start(0);
+
+  runUntil(from + 5000 * 1000LL);
+  TEST_ASSERT_EQUAL(1, at.size());
+  TEST_ASSERT_EQUAL(from + 300 * 1000LL, at[0]);
+  TEST_ASSERT_FALSE(sched->active(0));
+}
+
+void test_idle_waits_at_most_max()
+{
+  sched->begin();
+  TEST_ASSERT_EQUAL(1000, sched->run(clockUs, 1000));
+  sched->add(0, "stamp", SCHED_SAMPLE, 10000, 0, stamp);
+  sched->start(0);
+  TEST_ASSERT_EQUAL(1000, sched->run(clockUs, 1000));
+  TEST_ASSERT_EQUAL(10000, sched->run(clockUs, 60000));
+}
+
+int main(int argc, char **argv)
+{
+  UNITY_BEGIN();
+  RUN_TEST(test_same_time_runs_by_stage_then_id);
+  RUN_TEST(test_phase_offsets_the_grid);
+  RUN_TEST(test_start_waits_for_the_next_slot);
+  RUN_TEST(test_overrun_skips_releases);
+  RUN_TEST(test_once_runs_one_time);
+  RUN_TEST(test_idle_waits_at_most_max);
+  return UNITY_END();
+}
@@ -0,0 +1,135 @@
+/*
+ * Replays an input recording through the control logic and checks every
+ * relay decision against what the kiln decided, see KrecReplay.h.
+ *
+ *   curl -o rec.old 'http://kiln.local/api/v1/debug/recording.bin?old'
+ *   curl -o rec.bin  http://kiln.local/api/v1/debug/recording.bin
+ *   ./krec [-c cap] [-w window] [-d] rec.old rec.bin
+ *
+ * The files go in the order they were written, the old one first if it
+ * holds the start of the firing. -c and -w are the kiln's demand cap (W)
+ * and window (s), -d prints every event. Exits 0 when all decisions
+ * matched, 1 at the first one that didn't, 2 if a file can't be read.
+ */
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#include <unistd.h>
+
+#include <vector>
+
+#include "KrecReplay.h"
+
+static const char *NAMES[] = {"start", "job",  "frame", "pulse",
+                              "command", "time", "relay", "gap"};
+
+static void dump(const KrecEvent &e)
+{
+  printf("%8zu %14.6f %-7s ", e.offset, e.us / 1e6, NAMES[e.type]);
+  switch (e.type) {
+  case REC_START:
+  case REC_TIME:
+    printf("epoch %u", e.epoch);
+    if (e.type == REC_TIME)
+      printf(" syncs %u", e.syncs);
+    break;
+  case REC_JOB:
+    printf("%u", e.job);
+    break;
+  case REC_FRAME:
+    printf("%.2f %.2f fault %u", e.temp, e.internal, e.fault);
+    break;
+  case REC_PULSE:
+    printf("%.6f", e.pulseUs / 1e6);
+    break;
+  case REC_COMMAND:
+    printf("%u", e.cmd);
+    for (uint8_t i = 0; i < 4; i++)
+      printf(" {%d,%d,%d}", e.schedule[i][0], e.schedule[i][1],
+             e.schedule[i][2]);
+    break;
+  case REC_RELAY:
+    printf("%s", e.on ? "on" : "off");
+    break;
+  case REC_GAP:
+    printf("%u dropped", e.dropped);
+    break;
+  }
+  printf("\n");
+}
+
+static bool readFile(const char *path, std::vector<uint8_t> &data)
+{
+  FILE *f = fopen(path, "rb");
+  if (f == nullptr)
+    return false;
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    data.insert(data.end(), buf, buf + n);
+  fclose(f);
+  return true;
+}
+
+int main(int argc, char **argv)
+{
+  StaticJsonDocument<64> demand;
+  bool print = false;
+  int opt;
+  while ((opt = getopt(argc, argv, "c:w:d")) != -1) {
+    switch (opt) {
+    case 'c':
+      demand["cap"] = atof(optarg);
+      break;
+    case 'w':
+      demand["win"] = atoi(optarg);
+      break;
+    case 'd':
+      print = true;
+      break;
+    default:
+      fprintf(stderr, "usage: %s [-c cap] [-w window] [-d] file...\n",
+              argv[0]);
+      return 2;
+    }
+  }
+
+  KrecReplay replay;
+  if (!replay.demand(demand.as<JsonVariantConst>())) {
+    fprintf(stderr, "demand settings out of range\n");
+    return 2;
+  }
+
+  bool ok          = true;
+  const char *file = nullptr;
+  for (int i = optind; ok && i < argc; i++) {
+    file = argv[i];
+    std::vector<uint8_t> data;
+    if (!readFile(argv[i], data)) {
+      fprintf(stderr, "%s: can't read\n", argv[i]);
+      return 2;
+    }
+    KrecReader reader(data.data(), data.size());
+    KrecEvent e;
+    while (ok && reader.next(e)) {
+      if (print)
+        dump(e);
+      ok = replay.event(e);
+    }
+    if (reader.error()) {
+      fprintf(stderr, "%s: %s\n", argv[i], reader.error());
+      return 2;
+    }
+  }
+  ok = ok && replay.end();
+
+  printf("%u events, %u firings, %u relay decisions matched\n",
+         replay.events(), replay.firings(), replay.decisions());
+  if (ok)
+    return 0;
+  const KrecEvent &at = replay.mismatchAt();
+  printf("mismatch in %s at offset %zu, %.6f s: %s\n", file, at.offset,
+         at.us / 1e6, replay.mismatch());
+  return 1;
+}